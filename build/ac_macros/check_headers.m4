@@ -5,12 +5,14 @@ AC_CHECK_HEADERS(dlfcn.h)
 AC_CHECK_HEADERS(errno.h)
 AC_CHECK_HEADERS(execinfo.h)
 AC_CHECK_HEADERS(inttypes.h)
+AC_CHECK_HEADERS(linux/futex.h)
 AC_CHECK_HEADERS(netdb.h)
 AC_CHECK_HEADERS(signal.h)
 AC_CHECK_HEADERS(sys/mman.h)
 AC_CHECK_HEADERS(sys/param.h)
 AC_CHECK_HEADERS(sys/resource.h)
 AC_CHECK_HEADERS(sys/socket.h)
+AC_CHECK_HEADERS(sys/syscall.h)
 AC_CHECK_HEADERS(sys/sysctl.h)
 AC_CHECK_HEADERS(sys/time.h)
 AC_CHECK_HEADERS(sys/wait.h)
@@ -125,7 +125,8 @@ typedef enum {
   GRN_COMMAND_ERROR = -74,
   GRN_PLUGIN_ERROR = -75,
   GRN_SCORER_ERROR = -76,
-  GRN_CANCEL = -77
+  GRN_CANCEL = -77,
+  GRN_ZSTD_ERROR = -78
 } grn_rc;
 
 GRN_API grn_rc grn_init(void);
@@ -264,12 +265,20 @@ GRN_API long long int grn_ctx_get_match_escalation_threshold(grn_ctx *ctx);
 GRN_API grn_rc grn_ctx_set_match_escalation_threshold(grn_ctx *ctx, long long int threshold);
 GRN_API long long int grn_get_default_match_escalation_threshold(void);
 GRN_API grn_rc grn_set_default_match_escalation_threshold(long long int threshold);
+GRN_API uint32_t grn_ctx_get_n_workers(grn_ctx *ctx);
+GRN_API grn_rc grn_ctx_set_n_workers(grn_ctx *ctx, uint32_t n_workers);
+GRN_API uint32_t grn_get_default_n_workers(void);
+GRN_API grn_rc grn_set_default_n_workers(uint32_t n_workers);
 
 GRN_API int grn_get_lock_timeout(void);
 GRN_API grn_rc grn_set_lock_timeout(int timeout);
 
 /* cache */
 #define GRN_CACHE_DEFAULT_MAX_N_ENTRIES 100
+/* 0 means that the total size of cache entries isn't limited. */
+#define GRN_CACHE_DEFAULT_MAX_N_BYTES 0
+/* 0 means that filtered result sets aren't cached. */
+#define GRN_CACHE_DEFAULT_MAX_N_RESULT_SET_BYTES 0
 typedef struct _grn_cache grn_cache;
 
 GRN_API grn_cache *grn_cache_open(grn_ctx *ctx);
@@ -283,6 +292,16 @@ GRN_API grn_rc grn_cache_set_max_n_entries(grn_ctx *ctx,
                                            unsigned int n);
 GRN_API unsigned int grn_cache_get_max_n_entries(grn_ctx *ctx,
                                                  grn_cache *cache);
+GRN_API grn_rc grn_cache_set_max_n_bytes(grn_ctx *ctx,
+                                         grn_cache *cache,
+                                         size_t n_bytes);
+GRN_API size_t grn_cache_get_max_n_bytes(grn_ctx *ctx,
+                                         grn_cache *cache);
+GRN_API grn_rc grn_cache_set_max_n_result_set_bytes(grn_ctx *ctx,
+                                                    grn_cache *cache,
+                                                    size_t n_bytes);
+GRN_API size_t grn_cache_get_max_n_result_set_bytes(grn_ctx *ctx,
+                                                    grn_cache *cache);
 
 /* grn_encoding */
 
@@ -324,11 +343,18 @@ typedef uint32_t grn_table_flags;
 #define GRN_OBJ_COMPRESS_LZ4           (0x02<<4)
 /* Just for backward compatibility. We'll remove it at 5.0.0. */
 #define GRN_OBJ_COMPRESS_LZO           GRN_OBJ_COMPRESS_LZ4
+#define GRN_OBJ_COMPRESS_ZSTD          (0x03<<4)
 
 #define GRN_OBJ_WITH_SECTION           (0x01<<7)
 #define GRN_OBJ_WITH_WEIGHT            (0x01<<8)
 #define GRN_OBJ_WITH_POSITION          (0x01<<9)
 #define GRN_OBJ_RING_BUFFER            (0x01<<10)
+/* Only for non index columns. Index columns use it for GRN_OBJ_UNIT_MASK. */
+#define GRN_OBJ_COMPRESS_BLOCK         (0x01<<11)
+
+/* Index columns aren't compressed. So they reuse GRN_OBJ_COMPRESS_MASK bits. */
+#define GRN_OBJ_INDEX_SIMD_PACK        (0x01<<4)
+#define GRN_OBJ_INDEX_BLOCK_MAX        (0x02<<4)
 
 #define GRN_OBJ_UNIT_MASK              (0x0f<<8)
 #define GRN_OBJ_UNIT_DOCUMENT_NONE     (0x00<<8)
@@ -345,6 +371,8 @@ typedef uint32_t grn_table_flags;
 
 #define GRN_OBJ_NO_SUBREC              (0x00<<13)
 #define GRN_OBJ_WITH_SUBREC            (0x01<<13)
+/* Only for fixed size columns. Tables use it for GRN_OBJ_WITH_SUBREC. */
+#define GRN_OBJ_WITH_ZONE_MAP          (0x01<<13)
 
 #define GRN_OBJ_KEY_VAR_SIZE           (0x01<<14)
 
@@ -829,6 +857,7 @@ GRN_API grn_rc grn_column_index_update(grn_ctx *ctx, grn_obj *column,
                                        grn_obj *oldvalue, grn_obj *newvalue);
 GRN_API grn_obj *grn_column_table(grn_ctx *ctx, grn_obj *column);
 GRN_API grn_rc grn_column_truncate(grn_ctx *ctx, grn_obj *column);
+GRN_API grn_rc grn_column_analyze(grn_ctx *ctx, grn_obj *column);
 
 /*-------------------------------------------------------------
  * API for db, table and/or column
@@ -869,7 +898,8 @@ typedef enum {
 /* Just for backward compatibility. We'll remove it at 5.0.0. */
 #define GRN_INFO_SUPPORT_LZO GRN_INFO_SUPPORT_LZ4
   GRN_INFO_NORMALIZER,
-  GRN_INFO_TOKEN_FILTERS
+  GRN_INFO_TOKEN_FILTERS,
+  GRN_INFO_SUPPORT_ZSTD
 } grn_info_type;
 
 GRN_API grn_obj *grn_obj_get_info(grn_ctx *ctx, grn_obj *obj, grn_info_type type, grn_obj *valuebuf);
@@ -34,6 +34,29 @@ typedef void (*grn_thread_set_limit_func)(uint32_t new_limit, void *data);
 GRN_API void grn_thread_set_set_limit_func(grn_thread_set_limit_func func,
                                            void *data);
 
+typedef struct _grn_thread_worker_status grn_thread_worker_status;
+struct _grn_thread_worker_status {
+  uint32_t n_queued_jobs;
+  uint64_t n_processed_jobs;
+  /* In seconds. */
+  double busy_time;
+  /* In seconds. */
+  double elapsed_time;
+  grn_bool parked;
+};
+
+GRN_API uint32_t
+grn_thread_get_worker_statuses(grn_thread_worker_status *statuses,
+                               uint32_t n_statuses);
+
+typedef uint32_t
+(*grn_thread_get_worker_statuses_func)(grn_thread_worker_status *statuses,
+                                       uint32_t n_statuses,
+                                       void *data);
+GRN_API void
+grn_thread_set_get_worker_statuses_func(grn_thread_get_worker_statuses_func func,
+                                        void *data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,300 @@
+/* -*- c-basic-offset: 2 -*- */
+/*
+  Copyright(C) 2016 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "grn_block_cache.h"
+#include "grn_ctx.h"
+#include "grn_hash.h"
+#include "grn_str.h"
+
+#include <string.h>
+
+typedef struct {
+  uint32_t owner_id;
+  grn_id block_id;
+} grn_block_cache_key;
+
+/* Entries are linked from the most recently used one. */
+typedef struct {
+  grn_block_cache_entry *next;
+  grn_block_cache_entry *prev;
+  grn_hash *hash;
+  grn_mutex mutex;
+  uint64_t n_bytes;
+  uint64_t max_n_bytes;
+  uint32_t last_owner_id;
+} grn_block_cache;
+
+#define HEAD(cache) ((grn_block_cache_entry *)(cache))
+
+static grn_ctx grn_block_cache_ctx;
+static grn_block_cache grn_block_cache_default;
+static uint64_t grn_block_cache_max_n_bytes =
+  GRN_BLOCK_CACHE_DEFAULT_MAX_N_BYTES;
+
+void
+grn_block_cache_init_from_env(void)
+{
+  char grn_block_cache_max_n_bytes_env[GRN_ENV_BUFFER_SIZE];
+  grn_getenv("GRN_BLOCK_CACHE_MAX_N_BYTES",
+             grn_block_cache_max_n_bytes_env,
+             GRN_ENV_BUFFER_SIZE);
+  if (grn_block_cache_max_n_bytes_env[0]) {
+    const char *end =
+      grn_block_cache_max_n_bytes_env +
+      strlen(grn_block_cache_max_n_bytes_env);
+    grn_block_cache_max_n_bytes =
+      grn_atoull(grn_block_cache_max_n_bytes_env, end, NULL);
+  }
+}
+
+void
+grn_block_cache_init(void)
+{
+  grn_ctx *ctx = &grn_block_cache_ctx;
+  grn_block_cache *cache = &grn_block_cache_default;
+
+  grn_ctx_init(ctx, 0);
+
+  cache->next = HEAD(cache);
+  cache->prev = HEAD(cache);
+  cache->hash = grn_hash_create(ctx, NULL, sizeof(grn_block_cache_key),
+                                sizeof(grn_block_cache_entry *), 0);
+  MUTEX_INIT(cache->mutex);
+  cache->n_bytes = 0;
+  cache->max_n_bytes = grn_block_cache_max_n_bytes;
+  cache->last_owner_id = 0;
+}
+
+static void
+grn_block_cache_entry_free(grn_block_cache_entry *entry)
+{
+  grn_ctx *ctx = &grn_block_cache_ctx;
+  GRN_FREE(entry);
+}
+
+/* It must be called with cache->mutex locked. */
+static void
+grn_block_cache_remove(grn_block_cache *cache, grn_block_cache_entry *entry)
+{
+  grn_ctx *ctx = &grn_block_cache_ctx;
+  grn_block_cache_key key;
+
+  key.owner_id = entry->owner_id;
+  key.block_id = entry->block_id;
+  grn_hash_delete(ctx, cache->hash, &key, sizeof(key), NULL);
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+  entry->cached = GRN_FALSE;
+  cache->n_bytes -= entry->size;
+  if (entry->nref == 0) {
+    grn_block_cache_entry_free(entry);
+  }
+}
+
+/* It must be called with cache->mutex locked. */
+static void
+grn_block_cache_evict(grn_block_cache *cache)
+{
+  grn_block_cache_entry *entry = cache->prev;
+  while (cache->n_bytes > cache->max_n_bytes && entry != HEAD(cache)) {
+    grn_block_cache_entry *prev = entry->prev;
+    if (entry->nref == 0) {
+      grn_block_cache_remove(cache, entry);
+    }
+    entry = prev;
+  }
+}
+
+void
+grn_block_cache_fin(void)
+{
+  grn_ctx *ctx = &grn_block_cache_ctx;
+  grn_block_cache *cache = &grn_block_cache_default;
+  grn_block_cache_entry *entry;
+
+  for (entry = cache->next; entry != HEAD(cache);) {
+    grn_block_cache_entry *next = entry->next;
+    grn_block_cache_entry_free(entry);
+    entry = next;
+  }
+  cache->next = HEAD(cache);
+  cache->prev = HEAD(cache);
+  cache->n_bytes = 0;
+  if (cache->hash) {
+    grn_hash_close(ctx, cache->hash);
+    cache->hash = NULL;
+  }
+  MUTEX_FIN(cache->mutex);
+
+  grn_ctx_fin(ctx);
+}
+
+uint32_t
+grn_block_cache_generate_owner_id(void)
+{
+  grn_block_cache *cache = &grn_block_cache_default;
+  uint32_t owner_id;
+  GRN_ATOMIC_ADD_EX(&(cache->last_owner_id), 1, owner_id);
+  return owner_id + 1;
+}
+
+grn_block_cache_entry *
+grn_block_cache_fetch(grn_ctx *ctx, uint32_t owner_id, grn_id block_id)
+{
+  grn_block_cache *cache = &grn_block_cache_default;
+  grn_block_cache_key key;
+  grn_block_cache_entry **value;
+  grn_block_cache_entry *entry = NULL;
+
+  if (!cache->hash) {
+    return NULL;
+  }
+
+  key.owner_id = owner_id;
+  key.block_id = block_id;
+  MUTEX_LOCK(cache->mutex);
+  if (grn_hash_get(&grn_block_cache_ctx, cache->hash, &key, sizeof(key),
+                   (void **)&value)) {
+    entry = *value;
+    entry->nref++;
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = cache->next;
+    entry->prev = HEAD(cache);
+    cache->next->prev = entry;
+    cache->next = entry;
+  }
+  MUTEX_UNLOCK(cache->mutex);
+  return entry;
+}
+
+grn_block_cache_entry *
+grn_block_cache_entry_open(grn_ctx *ctx, uint32_t size)
+{
+  grn_block_cache_entry *entry;
+
+  /* Entries are freed by the cache's context because they may be
+     evicted in other threads. */
+  {
+    grn_ctx *ctx = &grn_block_cache_ctx;
+    entry = GRN_MALLOC(sizeof(grn_block_cache_entry) + size);
+  }
+  if (!entry) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[block-cache] failed to allocate an entry: <%u>", size);
+    return NULL;
+  }
+  entry->next = NULL;
+  entry->prev = NULL;
+  entry->owner_id = 0;
+  entry->block_id = GRN_ID_NIL;
+  entry->nref = 0;
+  entry->cached = GRN_FALSE;
+  entry->size = size;
+  entry->data = entry + 1;
+  return entry;
+}
+
+void
+grn_block_cache_entry_close(grn_ctx *ctx, grn_block_cache_entry *entry)
+{
+  grn_block_cache_entry_free(entry);
+}
+
+grn_block_cache_entry *
+grn_block_cache_add(grn_ctx *ctx,
+                    uint32_t owner_id,
+                    grn_id block_id,
+                    grn_block_cache_entry *entry)
+{
+  grn_block_cache *cache = &grn_block_cache_default;
+  grn_block_cache_key key;
+  grn_block_cache_entry **value;
+  int added;
+
+  entry->owner_id = owner_id;
+  entry->block_id = block_id;
+  entry->nref = 1;
+
+  if (!cache->hash || entry->size > cache->max_n_bytes) {
+    /* It's freed by grn_block_cache_unref(). */
+    return entry;
+  }
+
+  key.owner_id = owner_id;
+  key.block_id = block_id;
+  MUTEX_LOCK(cache->mutex);
+  if (!grn_hash_add(&grn_block_cache_ctx, cache->hash, &key, sizeof(key),
+                    (void **)&value, &added)) {
+    MUTEX_UNLOCK(cache->mutex);
+    return entry;
+  }
+  if (!added) {
+    grn_block_cache_entry *cached_entry = *value;
+    cached_entry->nref++;
+    MUTEX_UNLOCK(cache->mutex);
+    grn_block_cache_entry_close(ctx, entry);
+    return cached_entry;
+  }
+  *value = entry;
+  entry->cached = GRN_TRUE;
+  entry->next = cache->next;
+  entry->prev = HEAD(cache);
+  cache->next->prev = entry;
+  cache->next = entry;
+  cache->n_bytes += entry->size;
+  grn_block_cache_evict(cache);
+  MUTEX_UNLOCK(cache->mutex);
+  return entry;
+}
+
+void
+grn_block_cache_unref(grn_ctx *ctx, grn_block_cache_entry *entry)
+{
+  grn_block_cache *cache = &grn_block_cache_default;
+  grn_bool need_free;
+
+  MUTEX_LOCK(cache->mutex);
+  entry->nref--;
+  need_free = (entry->nref == 0 && !entry->cached);
+  MUTEX_UNLOCK(cache->mutex);
+  if (need_free) {
+    grn_block_cache_entry_close(ctx, entry);
+  }
+}
+
+void
+grn_block_cache_expire(grn_ctx *ctx, uint32_t owner_id)
+{
+  grn_block_cache *cache = &grn_block_cache_default;
+  grn_block_cache_entry *entry;
+
+  if (!cache->hash) {
+    return;
+  }
+
+  MUTEX_LOCK(cache->mutex);
+  for (entry = cache->next; entry != HEAD(cache);) {
+    grn_block_cache_entry *next = entry->next;
+    if (entry->owner_id == owner_id) {
+      grn_block_cache_remove(cache, entry);
+    }
+    entry = next;
+  }
+  MUTEX_UNLOCK(cache->mutex);
+}
@@ -21,18 +21,90 @@
 #include "grn_ctx_impl.h"
 #include "grn_hash.h"
 #include "grn_db.h"
+#include "grn_rset.h"
 
 typedef struct _grn_cache_entry grn_cache_entry;
+typedef struct _grn_cache_result_set grn_cache_result_set;
 
-struct _grn_cache {
+typedef struct {
+  grn_id id;
+  int n_subrecs;
+  double score;
+} grn_cache_result_set_record;
+
+/* A result set cache entry keeps records of a filtered table. It's
+   shared by requests that use the same condition but different sort
+   keys, pagination, output columns or drilldowns. */
+struct _grn_cache_result_set {
+  grn_cache_result_set *next;
+  grn_cache_result_set *prev;
+  grn_id id;
+  grn_timeval tv;
+  grn_cache_dependency *dependencies;
+  uint32_t n_dependencies;
+  grn_cache_result_set_record *records;
+  uint32_t n_records;
+  uint32_t n_bytes;
+};
+
+/* Entries are distributed to shards by key hash. Each shard has its own
+   lock so that requests for different keys don't block each other. */
+#define GRN_CACHE_N_SHARDS_BITS 4
+#define GRN_CACHE_N_SHARDS (1 << GRN_CACHE_N_SHARDS_BITS)
+
+/* The number of counters of the frequency sketch in each shard. It must
+   be a power of 2. */
+#define GRN_CACHE_SKETCH_SIZE (1 << 10)
+#define GRN_CACHE_SKETCH_N_HASHES 4
+#define GRN_CACHE_SKETCH_MAX_COUNT 15
+/* The sketch is aged after (GRN_CACHE_SKETCH_SAMPLE_RATIO * max_nentries)
+   accesses. */
+#define GRN_CACHE_SKETCH_SAMPLE_RATIO 10
+#define GRN_CACHE_SKETCH_MIN_SAMPLE_SIZE 1024
+
+/* Entries in a shard are linked as a ring for the CLOCK algorithm. A hit
+   only marks the entry as referenced instead of relinking it. The hand
+   gives a second chance to referenced entries when it looks for a
+   victim.
+
+   A hit takes only the read lock of its shard because it doesn't change
+   the hash table or the ring. Reference counts, hit counts and sketch
+   counters are updated atomically under the read lock. Adding,
+   expiring and moving the hand take the write lock. */
+typedef struct {
   grn_cache_entry *next;
   grn_cache_entry *prev;
-  grn_ctx *ctx;
+  grn_cache_entry *hand;
   grn_hash *hash;
-  grn_mutex mutex;
+  grn_rwlock lock;
+  uint64_t n_bytes;
+  /* TinyLFU: count-min sketch of access frequencies of keys. Counters
+     are updated only by CAS so that concurrent increments and aging
+     don't overwrite each other. Readers may see a slightly stale
+     value. It's OK because it's an estimate. */
+  uint32_t sketch[GRN_CACHE_SKETCH_SIZE];
+  uint32_t n_sketch_samples;
+} grn_cache_shard;
+
+struct _grn_cache {
+  grn_cache_shard shards[GRN_CACHE_N_SHARDS];
+  grn_ctx *ctx;
   uint32_t max_nentries;
+  uint64_t max_n_bytes;
+  /* They are updated atomically. */
   uint32_t nfetches;
   uint32_t nhits;
+  uint32_t n_evictions;
+  uint32_t n_rejections;
+  /* The global CLOCK position. Eviction visits shards in round-robin
+     order from it so that all shards lose entries evenly. */
+  uint32_t eviction_shard_index;
+  /* The second tier: LRU list of filtered result sets. */
+  grn_mutex result_sets_mutex;
+  grn_cache_result_set result_sets_head;
+  grn_hash *result_sets;
+  uint64_t n_result_set_bytes;
+  uint64_t max_n_result_set_bytes;
 };
 
 struct _grn_cache_entry {
@@ -42,16 +114,43 @@ struct _grn_cache_entry {
   grn_timeval tv;
   grn_id id;
   uint32_t nref;
+  grn_cache_dependency *dependencies;
+  uint32_t n_dependencies;
+  uint32_t key_hash;
+  uint32_t n_bytes;
+  uint32_t nhits;
+  grn_bool referenced;
 };
 
 static grn_ctx grn_cache_ctx;
 static grn_cache *grn_cache_current = NULL;
 static grn_cache *grn_cache_default = NULL;
 
+#define SHARD_HEAD(shard) ((grn_cache_entry *)(shard))
+
+static void
+grn_cache_close_shards(grn_cache *cache, int n_shards)
+{
+  grn_ctx *ctx = cache->ctx;
+  int i;
+
+  for (i = 0; i < n_shards; i++) {
+    grn_cache_shard *shard = &(cache->shards[i]);
+    grn_cache_entry *vp;
+    GRN_HASH_EACH(ctx, shard->hash, id, NULL, NULL, &vp, {
+      grn_obj_close(ctx, vp->value);
+      GRN_FREE(vp->dependencies);
+    });
+    grn_hash_close(ctx, shard->hash);
+    RWLOCK_FIN(shard->lock);
+  }
+}
+
 grn_cache *
 grn_cache_open(grn_ctx *ctx)
 {
   grn_cache *cache = NULL;
+  int i;
 
   GRN_API_ENTER;
   cache = GRN_MALLOC(sizeof(grn_cache));
@@ -60,21 +159,50 @@ grn_cache_open(grn_ctx *ctx)
     goto exit;
   }
 
-  cache->next = (grn_cache_entry *)cache;
-  cache->prev = (grn_cache_entry *)cache;
   cache->ctx = ctx;
-  cache->hash = grn_hash_create(cache->ctx, NULL, GRN_CACHE_MAX_KEY_SIZE,
-                                sizeof(grn_cache_entry), GRN_OBJ_KEY_VAR_SIZE);
-  if (!cache->hash) {
-    ERR(GRN_NO_MEMORY_AVAILABLE, "[cache] failed to create hash table");
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard *shard = &(cache->shards[i]);
+    shard->next = SHARD_HEAD(shard);
+    shard->prev = SHARD_HEAD(shard);
+    shard->hand = SHARD_HEAD(shard);
+    shard->hash = grn_hash_create(cache->ctx, NULL, GRN_CACHE_MAX_KEY_SIZE,
+                                  sizeof(grn_cache_entry),
+                                  GRN_OBJ_KEY_VAR_SIZE);
+    if (!shard->hash) {
+      ERR(GRN_NO_MEMORY_AVAILABLE, "[cache] failed to create hash table");
+      grn_cache_close_shards(cache, i);
+      GRN_FREE(cache);
+      cache = NULL;
+      goto exit;
+    }
+    RWLOCK_INIT(shard->lock);
+    shard->n_bytes = 0;
+    memset(shard->sketch, 0, sizeof(shard->sketch));
+    shard->n_sketch_samples = 0;
+  }
+  cache->result_sets = grn_hash_create(cache->ctx, NULL, GRN_CACHE_MAX_KEY_SIZE,
+                                       sizeof(grn_cache_result_set),
+                                       GRN_OBJ_KEY_VAR_SIZE);
+  if (!cache->result_sets) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[cache] failed to create hash table for result sets");
+    grn_cache_close_shards(cache, GRN_CACHE_N_SHARDS);
     GRN_FREE(cache);
     cache = NULL;
     goto exit;
   }
-  MUTEX_INIT(cache->mutex);
+  MUTEX_INIT(cache->result_sets_mutex);
+  cache->result_sets_head.next = &(cache->result_sets_head);
+  cache->result_sets_head.prev = &(cache->result_sets_head);
+  cache->n_result_set_bytes = 0;
+  cache->max_n_result_set_bytes = GRN_CACHE_DEFAULT_MAX_N_RESULT_SET_BYTES;
   cache->max_nentries = GRN_CACHE_DEFAULT_MAX_N_ENTRIES;
   cache->nfetches = 0;
   cache->nhits = 0;
+  cache->max_n_bytes = GRN_CACHE_DEFAULT_MAX_N_BYTES;
+  cache->n_evictions = 0;
+  cache->n_rejections = 0;
+  cache->eviction_shard_index = 0;
 
 exit :
   GRN_API_RETURN(cache);
@@ -84,15 +212,19 @@ grn_rc
 grn_cache_close(grn_ctx *ctx_not_used, grn_cache *cache)
 {
   grn_ctx *ctx = cache->ctx;
-  grn_cache_entry *vp;
 
   GRN_API_ENTER;
 
-  GRN_HASH_EACH(ctx, cache->hash, id, NULL, NULL, &vp, {
-    grn_obj_close(ctx, vp->value);
-  });
-  grn_hash_close(ctx, cache->hash);
-  MUTEX_FIN(cache->mutex);
+  grn_cache_close_shards(cache, GRN_CACHE_N_SHARDS);
+  {
+    grn_cache_result_set *rs;
+    GRN_HASH_EACH(ctx, cache->result_sets, id, NULL, NULL, &rs, {
+      GRN_FREE(rs->records);
+      GRN_FREE(rs->dependencies);
+    });
+  }
+  grn_hash_close(ctx, cache->result_sets);
+  MUTEX_FIN(cache->result_sets_mutex);
   GRN_FREE(cache);
 
   GRN_API_RETURN(ctx->rc);
@@ -122,20 +254,17 @@ grn_cache_init(void)
   grn_cache_current_set(ctx, grn_cache_default);
 }
 
+static void grn_cache_evict(grn_cache *cache);
+
 grn_rc
 grn_cache_set_max_n_entries(grn_ctx *ctx, grn_cache *cache, unsigned int n)
 {
-  uint32_t current_max_n_entries;
-
   if (!cache) {
     return GRN_INVALID_ARGUMENT;
   }
 
-  current_max_n_entries = cache->max_nentries;
   cache->max_nentries = n;
-  if (n < current_max_n_entries) {
-    grn_cache_expire(cache, current_max_n_entries - n);
-  }
+  grn_cache_evict(cache);
 
   return GRN_SUCCESS;
 }
@@ -149,26 +278,456 @@ grn_cache_get_max_n_entries(grn_ctx *ctx, grn_cache *cache)
   return cache->max_nentries;
 }
 
+static uint32_t
+grn_cache_calculate_key_hash(const char *str, uint32_t str_len)
+{
+  /* FNV-1a */
+  uint32_t i;
+  uint32_t hash = 2166136261U;
+  for (i = 0; i < str_len; i++) {
+    hash ^= (uint8_t)str[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static uint32_t
+grn_cache_shard_index(uint32_t key_hash)
+{
+  return key_hash >> (32 - GRN_CACHE_N_SHARDS_BITS);
+}
+
+static uint32_t
+grn_cache_sketch_index(uint32_t hash, int i)
+{
+  uint32_t step = (hash >> 17) | (hash << 15) | 1;
+  return (hash + step * i) & (GRN_CACHE_SKETCH_SIZE - 1);
+}
+
+static uint32_t
+grn_cache_sketch_estimate(grn_cache_shard *shard, uint32_t hash)
+{
+  int i;
+  uint32_t frequency = GRN_CACHE_SKETCH_MAX_COUNT;
+  for (i = 0; i < GRN_CACHE_SKETCH_N_HASHES; i++) {
+    uint32_t count = shard->sketch[grn_cache_sketch_index(hash, i)];
+    if (count < frequency) {
+      frequency = count;
+    }
+  }
+  return frequency;
+}
+
+/* grn_cache_sketch_halve halves a counter with CAS because concurrent
+   hits may increment it under the same read lock. */
+static void
+grn_cache_sketch_halve(uint32_t *count)
+{
+  uint32_t current_count = *count;
+  while (current_count > 0) {
+    uint32_t previous_count;
+    GRN_ATOMIC_CAS_EX(count, current_count, current_count >> 1,
+                      previous_count);
+    if (previous_count == current_count) {
+      break;
+    }
+    current_count = previous_count;
+  }
+}
+
+/* grn_cache_sketch_increment records an access to a key. All counters
+   are halved periodically so that old popularity fades out. It may be
+   called with only the read lock of shard. */
+static void
+grn_cache_sketch_increment(grn_cache *cache, grn_cache_shard *shard,
+                           uint32_t hash)
+{
+  int i;
+  uint32_t sample_size;
+  uint32_t n_samples;
+  uint32_t frequency = grn_cache_sketch_estimate(shard, hash);
+
+  if (frequency < GRN_CACHE_SKETCH_MAX_COUNT) {
+    /* Conservative update: increment only the minimum counters. */
+    for (i = 0; i < GRN_CACHE_SKETCH_N_HASHES; i++) {
+      uint32_t *count = &(shard->sketch[grn_cache_sketch_index(hash, i)]);
+      uint32_t current_count = *count;
+      while (current_count == frequency) {
+        uint32_t previous_count;
+        GRN_ATOMIC_CAS_EX(count, current_count, current_count + 1,
+                          previous_count);
+        if (previous_count == current_count) {
+          break;
+        }
+        current_count = previous_count;
+      }
+    }
+  }
+
+  sample_size = cache->max_nentries * GRN_CACHE_SKETCH_SAMPLE_RATIO;
+  if (sample_size < GRN_CACHE_SKETCH_MIN_SAMPLE_SIZE) {
+    sample_size = GRN_CACHE_SKETCH_MIN_SAMPLE_SIZE;
+  }
+  sample_size /= GRN_CACHE_N_SHARDS;
+  GRN_ATOMIC_ADD_EX(&(shard->n_sketch_samples), 1, n_samples);
+  n_samples++;
+  if (n_samples >= sample_size) {
+    uint32_t current_n_samples;
+    /* Only one of concurrent callers ages the sketch. */
+    GRN_ATOMIC_CAS_EX(&(shard->n_sketch_samples), n_samples, 0,
+                      current_n_samples);
+    if (current_n_samples == n_samples) {
+      uint32_t j;
+      for (j = 0; j < GRN_CACHE_SKETCH_SIZE; j++) {
+        grn_cache_sketch_halve(&(shard->sketch[j]));
+      }
+    }
+  }
+}
+
+/* It must be called with the write lock of shard. */
+static void
+grn_cache_expire_entry(grn_cache *cache, grn_cache_shard *shard,
+                       grn_cache_entry *ce)
+{
+  grn_ctx *ctx = cache->ctx;
+  if (!ce->nref) {
+    if (shard->hand == ce) {
+      shard->hand = ce->next;
+    }
+    ce->prev->next = ce->next;
+    ce->next->prev = ce->prev;
+    shard->n_bytes -= ce->n_bytes;
+    grn_obj_close(ctx, ce->value);
+    GRN_FREE(ce->dependencies);
+    grn_hash_delete_by_id(ctx, shard->hash, ce->id, NULL);
+  }
+}
+
+/* grn_cache_shard_find_victim moves the CLOCK hand to an entry that isn't
+   referenced recently. Referenced entries passed by the hand lose their
+   reference mark. Entries in use are never victims. It must be called
+   with the write lock of shard. */
+static grn_cache_entry *
+grn_cache_shard_find_victim(grn_cache_shard *shard)
+{
+  grn_cache_entry *head = SHARD_HEAD(shard);
+  uint32_t n_entries = GRN_HASH_SIZE(shard->hash);
+  uint32_t i;
+
+  /* Two rounds are enough to clear all reference marks. */
+  for (i = 0; i < (n_entries + 1) * 2; i++) {
+    grn_cache_entry *ce = shard->hand;
+    if (ce == head) {
+      shard->hand = ce->next;
+      continue;
+    }
+    if (!ce->nref) {
+      if (!ce->referenced) {
+        return ce;
+      }
+      ce->referenced = GRN_FALSE;
+    }
+    shard->hand = ce->next;
+  }
+  return NULL;
+}
+
+static void
+grn_cache_get_size(grn_cache *cache,
+                   uint32_t *n_entries,
+                   uint64_t *n_bytes)
+{
+  int i;
+  *n_entries = 0;
+  *n_bytes = 0;
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard *shard = &(cache->shards[i]);
+    *n_entries += GRN_HASH_SIZE(shard->hash);
+    *n_bytes += shard->n_bytes;
+  }
+}
+
+/* grn_cache_is_full reads counters of other shards without locking them.
+   The result may be slightly stale under concurrent updates. */
+static grn_bool
+grn_cache_is_full(grn_cache *cache,
+                  uint32_t n_additional_entries,
+                  uint64_t n_additional_bytes)
+{
+  uint32_t n_entries;
+  uint64_t n_bytes;
+
+  grn_cache_get_size(cache, &n_entries, &n_bytes);
+  if (n_entries + n_additional_entries > cache->max_nentries) {
+    return GRN_TRUE;
+  }
+  if (cache->max_n_bytes > 0 &&
+      n_bytes + n_additional_bytes > cache->max_n_bytes) {
+    return GRN_TRUE;
+  }
+  return GRN_FALSE;
+}
+
+/* grn_cache_evict_one expires one entry. Shards are visited in
+   round-robin order from the global CLOCK position. It locks only one
+   shard at a time. It returns GRN_FALSE when there is no entry that can
+   be expired. */
+static grn_bool
+grn_cache_evict_one(grn_cache *cache)
+{
+  uint32_t i;
+
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    uint32_t shard_index;
+    grn_cache_shard *shard;
+    grn_cache_entry *victim;
+    GRN_ATOMIC_ADD_EX(&(cache->eviction_shard_index), 1, shard_index);
+    shard = &(cache->shards[shard_index % GRN_CACHE_N_SHARDS]);
+    RWLOCK_WRITE_LOCK(shard->lock);
+    victim = grn_cache_shard_find_victim(shard);
+    if (victim) {
+      grn_cache_expire_entry(cache, shard, victim);
+    }
+    RWLOCK_WRITE_UNLOCK(shard->lock);
+    if (victim) {
+      return GRN_TRUE;
+    }
+  }
+  return GRN_FALSE;
+}
+
+/* grn_cache_evict expires entries until the cache fits into both of
+   max_nentries and max_n_bytes. */
+static void
+grn_cache_evict(grn_cache *cache)
+{
+  while (grn_cache_is_full(cache, 0, 0)) {
+    uint32_t n_evictions;
+    if (!grn_cache_evict_one(cache)) {
+      break;
+    }
+    GRN_ATOMIC_ADD_EX(&(cache->n_evictions), 1, n_evictions);
+  }
+}
+
+/* grn_cache_admit is the TinyLFU admission filter. A new entry that
+   needs eviction is admitted only when its key is accessed at least as
+   frequently as the eviction victim. It keeps frequently used entries
+   from being flushed by one-off queries. */
+static grn_bool
+grn_cache_admit(grn_cache *cache, uint32_t key_hash, uint32_t n_bytes)
+{
+  grn_cache_shard *shard = &(cache->shards[grn_cache_shard_index(key_hash)]);
+  uint32_t victim_shard_index = cache->eviction_shard_index;
+  uint32_t frequency;
+  uint32_t i;
+
+  if (cache->max_n_bytes > 0 && n_bytes > cache->max_n_bytes) {
+    return GRN_FALSE;
+  }
+  if (!grn_cache_is_full(cache, 1, n_bytes)) {
+    return GRN_TRUE;
+  }
+
+  RWLOCK_READ_LOCK(shard->lock);
+  frequency = grn_cache_sketch_estimate(shard, key_hash);
+  RWLOCK_READ_UNLOCK(shard->lock);
+
+  /* The candidate competes with the entry that grn_cache_evict() will
+     expire next. */
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard *victim_shard =
+      &(cache->shards[(victim_shard_index + i) % GRN_CACHE_N_SHARDS]);
+    grn_cache_entry *victim;
+    uint32_t victim_frequency = 0;
+    RWLOCK_WRITE_LOCK(victim_shard->lock);
+    victim = grn_cache_shard_find_victim(victim_shard);
+    if (victim) {
+      victim_frequency =
+        grn_cache_sketch_estimate(victim_shard, victim->key_hash);
+    }
+    RWLOCK_WRITE_UNLOCK(victim_shard->lock);
+    if (victim) {
+      return frequency >= victim_frequency;
+    }
+  }
+  return GRN_TRUE;
+}
+
+grn_rc
+grn_cache_set_max_n_bytes(grn_ctx *ctx, grn_cache *cache, size_t n_bytes)
+{
+  if (!cache) {
+    return GRN_INVALID_ARGUMENT;
+  }
+
+  cache->max_n_bytes = n_bytes;
+  grn_cache_evict(cache);
+
+  return GRN_SUCCESS;
+}
+
+size_t
+grn_cache_get_max_n_bytes(grn_ctx *ctx, grn_cache *cache)
+{
+  if (!cache) {
+    return 0;
+  }
+  return cache->max_n_bytes;
+}
+
 void
 grn_cache_get_statistics(grn_ctx *ctx, grn_cache *cache,
                          grn_cache_statistics *statistics)
 {
-  MUTEX_LOCK(cache->mutex);
-  statistics->nentries = GRN_HASH_SIZE(cache->hash);
+  int i;
+
+  statistics->nentries = 0;
+  statistics->n_bytes = 0;
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard *shard = &(cache->shards[i]);
+    RWLOCK_READ_LOCK(shard->lock);
+    statistics->nentries += GRN_HASH_SIZE(shard->hash);
+    statistics->n_bytes += shard->n_bytes;
+    if (statistics->entries) {
+      grn_cache_entry *head = SHARD_HEAD(shard);
+      grn_cache_entry *ce;
+      for (ce = head->next; ce != head; ce = ce->next) {
+        grn_cache_entry_statistics entry_statistics;
+        entry_statistics.n_bytes = ce->n_bytes;
+        entry_statistics.nhits = ce->nhits;
+        entry_statistics.frequency =
+          grn_cache_sketch_estimate(shard, ce->key_hash);
+        grn_bulk_write(ctx, statistics->entries,
+                       (const char *)&entry_statistics,
+                       sizeof(grn_cache_entry_statistics));
+      }
+    }
+    RWLOCK_READ_UNLOCK(shard->lock);
+  }
   statistics->max_nentries = cache->max_nentries;
   statistics->nfetches = cache->nfetches;
   statistics->nhits = cache->nhits;
-  MUTEX_UNLOCK(cache->mutex);
+  statistics->max_n_bytes = cache->max_n_bytes;
+  statistics->n_evictions = cache->n_evictions;
+  statistics->n_rejections = cache->n_rejections;
+  MUTEX_LOCK(cache->result_sets_mutex);
+  statistics->n_result_sets = GRN_HASH_SIZE(cache->result_sets);
+  statistics->n_result_set_bytes = cache->n_result_set_bytes;
+  statistics->max_n_result_set_bytes = cache->max_n_result_set_bytes;
+  MUTEX_UNLOCK(cache->result_sets_mutex);
+}
+
+/* grn_cache_dependencies_are_fresh checks whether the objects that an
+   entry created at tv depends on are not modified since then. */
+static grn_bool
+grn_cache_dependencies_are_fresh(grn_ctx *ctx,
+                                 grn_timeval *tv,
+                                 grn_cache_dependency *dependencies,
+                                 uint32_t n_dependencies)
+{
+  uint32_t i;
+  if (tv->tv_sec <= grn_db_lastmod(ctx->impl->db)) {
+    return GRN_FALSE;
+  }
+  for (i = 0; i < n_dependencies; i++) {
+    grn_cache_dependency *dependency = &(dependencies[i]);
+    if (dependency->id == GRN_ID_NIL) {
+      if (dependency->lastmod != grn_db_n_modifications(ctx->impl->db)) {
+        return GRN_FALSE;
+      }
+    } else {
+      grn_obj *obj = grn_ctx_at(ctx, dependency->id);
+      if (!obj || dependency->lastmod != grn_obj_lastmod(ctx, obj)) {
+        return GRN_FALSE;
+      }
+    }
+  }
+  return GRN_TRUE;
+}
+
+static grn_bool
+grn_cache_entry_is_fresh(grn_ctx *ctx, grn_cache_entry *ce)
+{
+  return grn_cache_dependencies_are_fresh(ctx, &(ce->tv),
+                                          ce->dependencies,
+                                          ce->n_dependencies);
 }
 
 static void
-grn_cache_expire_entry(grn_cache *cache, grn_cache_entry *ce)
+grn_cache_start_recording(grn_ctx *ctx)
 {
-  if (!ce->nref) {
-    ce->prev->next = ce->next;
-    ce->next->prev = ce->prev;
-    grn_obj_close(cache->ctx, ce->value);
-    grn_hash_delete_by_id(cache->ctx, cache->hash, ce->id, NULL);
+  GRN_BULK_REWIND(&(ctx->impl->cache_dependencies.dependencies));
+  ctx->impl->cache_dependencies.recording = GRN_TRUE;
+}
+
+void
+grn_cache_add_dependency(grn_ctx *ctx, grn_obj *obj)
+{
+  grn_obj *dependencies = &(ctx->impl->cache_dependencies.dependencies);
+  grn_cache_dependency *dependency;
+  grn_id id = DB_OBJ(obj)->id;
+  size_t i, n;
+
+  switch (obj->header.type) {
+  case GRN_TABLE_HASH_KEY :
+  case GRN_TABLE_PAT_KEY :
+  case GRN_TABLE_DAT_KEY :
+  case GRN_TABLE_NO_KEY :
+  case GRN_COLUMN_VAR_SIZE :
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_INDEX :
+    break;
+  default :
+    return;
+  }
+
+  n = GRN_BULK_VSIZE(dependencies) / sizeof(grn_cache_dependency);
+  dependency = (grn_cache_dependency *)GRN_BULK_HEAD(dependencies);
+  for (i = 0; i < n; i++) {
+    if (dependency[i].id == id) {
+      return;
+    }
+  }
+  {
+    grn_cache_dependency new_dependency;
+    new_dependency.id = id;
+    new_dependency.lastmod = grn_obj_lastmod(ctx, obj);
+    grn_bulk_write(ctx, dependencies,
+                   (const char *)&new_dependency, sizeof(grn_cache_dependency));
+  }
+}
+
+/* grn_cache_merge_dependencies adds dependencies of a reused cache
+   entry to the current recording. */
+static void
+grn_cache_merge_dependencies(grn_ctx *ctx,
+                             grn_cache_dependency *new_dependencies,
+                             uint32_t n_new_dependencies)
+{
+  grn_obj *dependencies = &(ctx->impl->cache_dependencies.dependencies);
+  uint32_t i;
+
+  if (!ctx->impl->cache_dependencies.recording) {
+    return;
+  }
+
+  for (i = 0; i < n_new_dependencies; i++) {
+    grn_cache_dependency *dependency;
+    size_t j, n;
+    n = GRN_BULK_VSIZE(dependencies) / sizeof(grn_cache_dependency);
+    dependency = (grn_cache_dependency *)GRN_BULK_HEAD(dependencies);
+    for (j = 0; j < n; j++) {
+      if (dependency[j].id == new_dependencies[i].id) {
+        break;
+      }
+    }
+    if (j == n) {
+      grn_bulk_write(ctx, dependencies,
+                     (const char *)&(new_dependencies[i]),
+                     sizeof(grn_cache_dependency));
+    }
   }
 }
 
@@ -178,29 +737,41 @@ grn_cache_fetch(grn_ctx *ctx, grn_cache *cache,
 {
   grn_cache_entry *ce;
   grn_obj *obj = NULL;
+  uint32_t key_hash;
+  grn_cache_shard *shard;
+  uint32_t n_fetches;
+  grn_bool is_stale = GRN_FALSE;
   if (!ctx->impl || !ctx->impl->db) { return obj; }
-  MUTEX_LOCK(cache->mutex);
-  cache->nfetches++;
-  if (grn_hash_get(cache->ctx, cache->hash, str, str_len, (void **)&ce)) {
-    if (ce->tv.tv_sec <= grn_db_lastmod(ctx->impl->db)) {
-      grn_cache_expire_entry(cache, ce);
-      goto exit;
+  GRN_ATOMIC_ADD_EX(&(cache->nfetches), 1, n_fetches);
+  key_hash = grn_cache_calculate_key_hash(str, str_len);
+  shard = &(cache->shards[grn_cache_shard_index(key_hash)]);
+  RWLOCK_READ_LOCK(shard->lock);
+  grn_cache_sketch_increment(cache, shard, key_hash);
+  if (grn_hash_get(cache->ctx, shard->hash, str, str_len, (void **)&ce)) {
+    if (grn_cache_entry_is_fresh(ctx, ce)) {
+      uint32_t n_refs;
+      uint32_t n_hits;
+      GRN_ATOMIC_ADD_EX(&(ce->nref), 1, n_refs);
+      GRN_ATOMIC_ADD_EX(&(ce->nhits), 1, n_hits);
+      ce->referenced = GRN_TRUE;
+      obj = ce->value;
+      GRN_ATOMIC_ADD_EX(&(cache->nhits), 1, n_hits);
+    } else {
+      is_stale = GRN_TRUE;
     }
-    ce->nref++;
-    obj = ce->value;
-    ce->prev->next = ce->next;
-    ce->next->prev = ce->prev;
-    {
-      grn_cache_entry *ce0 = (grn_cache_entry *)cache;
-      ce->next = ce0->next;
-      ce->prev = ce0;
-      ce0->next->prev = ce;
-      ce0->next = ce;
+  }
+  RWLOCK_READ_UNLOCK(shard->lock);
+  if (is_stale) {
+    RWLOCK_WRITE_LOCK(shard->lock);
+    if (grn_hash_get(cache->ctx, shard->hash, str, str_len, (void **)&ce) &&
+        !grn_cache_entry_is_fresh(ctx, ce)) {
+      grn_cache_expire_entry(cache, shard, ce);
     }
-    cache->nhits++;
+    RWLOCK_WRITE_UNLOCK(shard->lock);
+  }
+  if (!obj) {
+    grn_cache_start_recording(ctx);
   }
-exit :
-  MUTEX_UNLOCK(cache->mutex);
   return obj;
 }
 
@@ -209,11 +780,53 @@ grn_cache_unref(grn_ctx *ctx, grn_cache *cache,
                 const char *str, uint32_t str_len)
 {
   grn_cache_entry *ce;
-  MUTEX_LOCK(cache->mutex);
-  if (grn_hash_get(cache->ctx, cache->hash, str, str_len, (void **)&ce)) {
-    if (ce->nref) { ce->nref--; }
+  uint32_t key_hash = grn_cache_calculate_key_hash(str, str_len);
+  grn_cache_shard *shard = &(cache->shards[grn_cache_shard_index(key_hash)]);
+  RWLOCK_READ_LOCK(shard->lock);
+  if (grn_hash_get(cache->ctx, shard->hash, str, str_len, (void **)&ce)) {
+    if (ce->nref) {
+      uint32_t n_refs;
+      GRN_ATOMIC_ADD_EX(&(ce->nref), -1, n_refs);
+    }
   }
-  MUTEX_UNLOCK(cache->mutex);
+  RWLOCK_READ_UNLOCK(shard->lock);
+}
+
+static void
+grn_cache_free_dependencies(grn_cache *cache,
+                            grn_cache_dependency *dependencies)
+{
+  grn_ctx *ctx = cache->ctx;
+  GRN_FREE(dependencies);
+}
+
+/* grn_cache_copy_dependencies returns the dependencies recorded since the
+   last cache miss as a new array owned by cache. */
+static grn_cache_dependency *
+grn_cache_copy_dependencies(grn_ctx *request_ctx, grn_cache *cache,
+                            uint32_t *n_dependencies)
+{
+  grn_ctx *ctx = cache->ctx;
+  grn_cache_dependency *dependencies;
+  if (request_ctx->impl->cache_dependencies.recording) {
+    grn_obj *recorded = &(request_ctx->impl->cache_dependencies.dependencies);
+    *n_dependencies = GRN_BULK_VSIZE(recorded) / sizeof(grn_cache_dependency);
+    dependencies = GRN_MALLOCN(grn_cache_dependency, *n_dependencies + 1);
+    if (dependencies) {
+      grn_memcpy(dependencies, GRN_BULK_HEAD(recorded),
+                 sizeof(grn_cache_dependency) * *n_dependencies);
+    }
+  } else {
+    /* Dependencies are unknown. It depends on the whole DB. */
+    *n_dependencies = 1;
+    dependencies = GRN_MALLOCN(grn_cache_dependency, 1);
+    if (dependencies) {
+      dependencies[0].id = GRN_ID_NIL;
+      dependencies[0].lastmod =
+        grn_db_n_modifications(request_ctx->impl->db);
+    }
+  }
+  return dependencies;
 }
 
 void
@@ -226,58 +839,341 @@ grn_cache_update(grn_ctx *ctx, grn_cache *cache,
   grn_rc rc = GRN_SUCCESS;
   grn_obj *old = NULL;
   grn_obj *obj = NULL;
+  grn_cache_dependency *old_dependencies = NULL;
+  grn_cache_dependency *dependencies = NULL;
+  uint32_t n_dependencies;
+  uint32_t key_hash;
+  uint32_t shard_index;
+  grn_cache_shard *shard;
+  uint32_t n_bytes;
+  grn_bool exist;
 
-  if (!ctx->impl || !cache->max_nentries) { return; }
+  if (!ctx->impl) { return; }
+  if (!cache->max_nentries || !ctx->impl->db) {
+    ctx->impl->cache_dependencies.recording = GRN_FALSE;
+    return;
+  }
+
+  dependencies = grn_cache_copy_dependencies(ctx, cache, &n_dependencies);
+  ctx->impl->cache_dependencies.recording = GRN_FALSE;
+  if (!dependencies) { return; }
+
+  key_hash = grn_cache_calculate_key_hash(str, str_len);
+  shard_index = grn_cache_shard_index(key_hash);
+  shard = &(cache->shards[shard_index]);
+  n_bytes = sizeof(grn_cache_entry) + str_len + GRN_TEXT_LEN(value) +
+    sizeof(grn_cache_dependency) * n_dependencies;
 
-  MUTEX_LOCK(cache->mutex);
   obj = grn_obj_open(cache->ctx, GRN_BULK, 0, GRN_DB_TEXT);
   if (!obj) {
-    goto exit;
+    grn_cache_free_dependencies(cache, dependencies);
+    return;
   }
   GRN_TEXT_PUT(cache->ctx, obj, GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
-  id = grn_hash_add(cache->ctx, cache->hash, str, str_len, (void **)&ce, &added);
+
+  RWLOCK_READ_LOCK(shard->lock);
+  exist = grn_hash_get(cache->ctx, shard->hash, str, str_len, NULL) !=
+    GRN_ID_NIL;
+  RWLOCK_READ_UNLOCK(shard->lock);
+  if (!exist && !grn_cache_admit(cache, key_hash, n_bytes)) {
+    uint32_t n_rejections;
+    GRN_ATOMIC_ADD_EX(&(cache->n_rejections), 1, n_rejections);
+    grn_obj_close(cache->ctx, obj);
+    grn_cache_free_dependencies(cache, dependencies);
+    return;
+  }
+
+  RWLOCK_WRITE_LOCK(shard->lock);
+  id = grn_hash_add(cache->ctx, shard->hash, str, str_len,
+                    (void **)&ce, &added);
   if (id) {
-    if (!added) {
+    if (added) {
+      /* A new entry is placed just behind the hand. It's examined last. */
+      ce->next = shard->hand;
+      ce->prev = shard->hand->prev;
+      shard->hand->prev->next = ce;
+      shard->hand->prev = ce;
+    } else {
       if (ce->nref) {
         rc = GRN_RESOURCE_BUSY;
         goto exit;
       }
       old = ce->value;
-      ce->prev->next = ce->next;
-      ce->next->prev = ce->prev;
+      old_dependencies = ce->dependencies;
+      shard->n_bytes -= ce->n_bytes;
     }
     ce->id = id;
     ce->value = obj;
     ce->tv = ctx->impl->tv;
     ce->nref = 0;
-    {
-      grn_cache_entry *ce0 = (grn_cache_entry *)cache;
-      ce->next = ce0->next;
-      ce->prev = ce0;
-      ce0->next->prev = ce;
-      ce0->next = ce;
-    }
-    if (GRN_HASH_SIZE(cache->hash) > cache->max_nentries) {
-      grn_cache_expire_entry(cache, cache->prev);
-    }
+    ce->dependencies = dependencies;
+    ce->n_dependencies = n_dependencies;
+    ce->key_hash = key_hash;
+    ce->n_bytes = n_bytes;
+    ce->nhits = 0;
+    ce->referenced = GRN_FALSE;
+    dependencies = NULL;
+    shard->n_bytes += n_bytes;
   } else {
     rc = GRN_NO_MEMORY_AVAILABLE;
   }
 exit :
   if (rc) { grn_obj_close(cache->ctx, obj); }
   if (old) { grn_obj_close(cache->ctx, old); }
-  MUTEX_UNLOCK(cache->mutex);
+  if (old_dependencies) { grn_cache_free_dependencies(cache, old_dependencies); }
+  if (dependencies) { grn_cache_free_dependencies(cache, dependencies); }
+  RWLOCK_WRITE_UNLOCK(shard->lock);
+
+  if (rc == GRN_SUCCESS) {
+    grn_cache_evict(cache);
+  }
+}
+
+static void
+grn_cache_expire_result_set(grn_cache *cache, grn_cache_result_set *rs)
+{
+  grn_ctx *ctx = cache->ctx;
+  rs->prev->next = rs->next;
+  rs->next->prev = rs->prev;
+  cache->n_result_set_bytes -= rs->n_bytes;
+  GRN_FREE(rs->records);
+  GRN_FREE(rs->dependencies);
+  grn_hash_delete_by_id(ctx, cache->result_sets, rs->id, NULL);
+}
+
+static void
+grn_cache_evict_result_sets(grn_cache *cache)
+{
+  grn_cache_result_set *head = &(cache->result_sets_head);
+  while (head->prev != head &&
+         cache->n_result_set_bytes > cache->max_n_result_set_bytes) {
+    grn_cache_expire_result_set(cache, head->prev);
+  }
+}
+
+grn_rc
+grn_cache_set_max_n_result_set_bytes(grn_ctx *ctx, grn_cache *cache,
+                                     size_t n_bytes)
+{
+  if (!cache) {
+    return GRN_INVALID_ARGUMENT;
+  }
+
+  MUTEX_LOCK(cache->result_sets_mutex);
+  cache->max_n_result_set_bytes = n_bytes;
+  grn_cache_evict_result_sets(cache);
+  MUTEX_UNLOCK(cache->result_sets_mutex);
+
+  return GRN_SUCCESS;
+}
+
+size_t
+grn_cache_get_max_n_result_set_bytes(grn_ctx *ctx, grn_cache *cache)
+{
+  if (!cache) {
+    return 0;
+  }
+  return cache->max_n_result_set_bytes;
+}
+
+static grn_cache_result_set_record *
+grn_cache_allocate_result_set_records(grn_cache *cache, uint32_t n_records)
+{
+  grn_ctx *ctx = cache->ctx;
+  return GRN_MALLOCN(grn_cache_result_set_record, n_records + 1);
+}
+
+static void
+grn_cache_free_result_set_records(grn_cache *cache,
+                                  grn_cache_result_set_record *records)
+{
+  grn_ctx *ctx = cache->ctx;
+  GRN_FREE(records);
+}
+
+/* grn_cache_fetch_result_set returns a new temporary result set of table
+   that is restored from the cache. It returns NULL on cache miss. */
+grn_obj *
+grn_cache_fetch_result_set(grn_ctx *ctx, grn_cache *cache,
+                           const char *str, uint32_t str_len,
+                           grn_obj *table)
+{
+  grn_cache_result_set *rs;
+  grn_obj *result_set = NULL;
+
+  if (!ctx->impl || !ctx->impl->db) { return NULL; }
+  if (cache->max_n_result_set_bytes == 0) { return NULL; }
+
+  MUTEX_LOCK(cache->result_sets_mutex);
+  if (!grn_hash_get(cache->ctx, cache->result_sets, str, str_len,
+                    (void **)&rs)) {
+    goto exit;
+  }
+  if (!grn_cache_dependencies_are_fresh(ctx, &(rs->tv),
+                                        rs->dependencies,
+                                        rs->n_dependencies)) {
+    grn_cache_expire_result_set(cache, rs);
+    goto exit;
+  }
+
+  result_set = grn_table_create(ctx, NULL, 0, NULL,
+                                GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
+                                table, NULL);
+  if (!result_set) {
+    goto exit;
+  }
+  {
+    uint32_t i;
+    for (i = 0; i < rs->n_records; i++) {
+      grn_cache_result_set_record *record = &(rs->records[i]);
+      grn_rset_recinfo *ri;
+      if (!grn_hash_add(ctx, (grn_hash *)result_set,
+                        &(record->id), sizeof(grn_id),
+                        (void **)&ri, NULL)) {
+        break;
+      }
+      ri->score = record->score;
+      ri->n_subrecs = record->n_subrecs;
+    }
+    if (i < rs->n_records) {
+      grn_obj_close(ctx, result_set);
+      result_set = NULL;
+      goto exit;
+    }
+  }
+
+  rs->prev->next = rs->next;
+  rs->next->prev = rs->prev;
+  rs->next = cache->result_sets_head.next;
+  rs->prev = &(cache->result_sets_head);
+  cache->result_sets_head.next->prev = rs;
+  cache->result_sets_head.next = rs;
+
+  grn_cache_merge_dependencies(ctx, rs->dependencies, rs->n_dependencies);
+
+exit :
+  MUTEX_UNLOCK(cache->result_sets_mutex);
+  return result_set;
+}
+
+void
+grn_cache_update_result_set(grn_ctx *ctx, grn_cache *cache,
+                            const char *str, uint32_t str_len,
+                            grn_obj *result_set)
+{
+  grn_cache_result_set *rs;
+  grn_cache_result_set_record *records;
+  grn_cache_dependency *dependencies;
+  uint32_t n_records;
+  uint32_t n_dependencies;
+  uint64_t n_bytes;
+  grn_id id;
+  int added = 0;
+
+  if (!ctx->impl || !ctx->impl->db) { return; }
+  if (cache->max_n_result_set_bytes == 0) { return; }
+  if (result_set->header.type != GRN_TABLE_HASH_KEY ||
+      !(result_set->header.flags & GRN_OBJ_WITH_SUBREC)) {
+    return;
+  }
+
+  n_records = grn_table_size(ctx, result_set);
+  n_bytes = sizeof(grn_cache_result_set) + str_len +
+    sizeof(grn_cache_result_set_record) * (uint64_t)n_records;
+  if (n_bytes > cache->max_n_result_set_bytes) {
+    return;
+  }
+
+  records = grn_cache_allocate_result_set_records(cache, n_records);
+  if (!records) {
+    return;
+  }
+  {
+    uint32_t i = 0;
+    grn_id *key;
+    grn_rset_recinfo *ri;
+    GRN_HASH_EACH(ctx, (grn_hash *)result_set, record_id, &key, NULL, &ri, {
+      if (i == n_records) {
+        break;
+      }
+      records[i].id = *key;
+      records[i].n_subrecs = ri->n_subrecs;
+      records[i].score = ri->score;
+      i++;
+    });
+    n_records = i;
+  }
+
+  /* Recording continues because the whole response depends on more
+     objects. */
+  dependencies = grn_cache_copy_dependencies(ctx, cache, &n_dependencies);
+  if (!dependencies) {
+    grn_cache_free_result_set_records(cache, records);
+    return;
+  }
+  n_bytes += sizeof(grn_cache_dependency) * n_dependencies;
+
+  MUTEX_LOCK(cache->result_sets_mutex);
+  id = grn_hash_add(cache->ctx, cache->result_sets, str, str_len,
+                    (void **)&rs, &added);
+  if (!id) {
+    grn_cache_free_result_set_records(cache, records);
+    grn_cache_free_dependencies(cache, dependencies);
+    goto exit;
+  }
+  if (!added) {
+    rs->prev->next = rs->next;
+    rs->next->prev = rs->prev;
+    cache->n_result_set_bytes -= rs->n_bytes;
+    grn_cache_free_result_set_records(cache, rs->records);
+    grn_cache_free_dependencies(cache, rs->dependencies);
+  }
+  rs->id = id;
+  rs->tv = ctx->impl->tv;
+  rs->dependencies = dependencies;
+  rs->n_dependencies = n_dependencies;
+  rs->records = records;
+  rs->n_records = n_records;
+  rs->n_bytes = n_bytes;
+  cache->n_result_set_bytes += n_bytes;
+  rs->next = cache->result_sets_head.next;
+  rs->prev = &(cache->result_sets_head);
+  cache->result_sets_head.next->prev = rs;
+  cache->result_sets_head.next = rs;
+  grn_cache_evict_result_sets(cache);
+exit :
+  MUTEX_UNLOCK(cache->result_sets_mutex);
 }
 
 void
 grn_cache_expire(grn_cache *cache, int32_t size)
 {
-  grn_cache_entry *ce0 = (grn_cache_entry *)cache;
-  MUTEX_LOCK(cache->mutex);
-  while (ce0 != ce0->prev && size--) {
-    grn_cache_expire_entry(cache, ce0->prev);
+  if (size < 0) {
+    int i;
+    /* Result sets are meaningless without the current database. */
+    grn_cache_result_set *head = &(cache->result_sets_head);
+    MUTEX_LOCK(cache->result_sets_mutex);
+    while (head->prev != head) {
+      grn_cache_expire_result_set(cache, head->prev);
+    }
+    MUTEX_UNLOCK(cache->result_sets_mutex);
+    for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+      grn_cache_shard *shard = &(cache->shards[i]);
+      grn_cache_entry *shard_head = SHARD_HEAD(shard);
+      grn_cache_entry *ce;
+      RWLOCK_WRITE_LOCK(shard->lock);
+      for (ce = shard_head->next; ce != shard_head;) {
+        grn_cache_entry *next = ce->next;
+        grn_cache_expire_entry(cache, shard, ce);
+        ce = next;
+      }
+      RWLOCK_WRITE_UNLOCK(shard->lock);
+    }
+  } else {
+    while (size > 0 && grn_cache_evict_one(cache)) {
+      size--;
+    }
   }
-  MUTEX_UNLOCK(cache->mutex);
 }
 
 void
@@ -0,0 +1,681 @@
+/* -*- c-basic-offset: 2 -*- */
+/*
+  Copyright(C) 2016 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "grn_column_stats.h"
+#include "grn_db.h"
+#include "grn_store.h"
+#include "grn_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRN_COLUMN_STATS_VERSION 1
+#define GRN_COLUMN_STATS_PATH_SUFFIX ".s"
+#define GRN_COLUMN_STATS_SEGMENT_SIZE 4096
+
+static grn_bool
+grn_column_stats_build_path(grn_ctx *ctx, const char *column_path,
+                            char *path)
+{
+  if (strlen(column_path) + strlen(GRN_COLUMN_STATS_PATH_SUFFIX) >=
+      PATH_MAX) {
+    ERR(GRN_FILENAME_TOO_LONG,
+        "[column][stats] too long path: <%s%s>",
+        column_path, GRN_COLUMN_STATS_PATH_SUFFIX);
+    return GRN_FALSE;
+  }
+  grn_strcpy(path, PATH_MAX, column_path);
+  grn_strcat(path, PATH_MAX, GRN_COLUMN_STATS_PATH_SUFFIX);
+  return GRN_TRUE;
+}
+
+grn_column_stats *
+grn_column_stats_create(grn_ctx *ctx, const char *column_path, grn_id range)
+{
+  grn_column_stats *stats;
+  char path[PATH_MAX];
+  const char *io_path = NULL;
+
+  if (column_path) {
+    if (!grn_column_stats_build_path(ctx, column_path, path)) {
+      return NULL;
+    }
+    io_path = path;
+  }
+
+  stats = GRN_MALLOCN(grn_column_stats, 1);
+  if (!stats) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[column][stats][create] failed to allocate memory");
+    return NULL;
+  }
+  stats->io = grn_io_create(ctx, io_path,
+                            sizeof(struct grn_column_stats_header),
+                            GRN_COLUMN_STATS_SEGMENT_SIZE, 1,
+                            grn_io_auto, 0);
+  if (!stats->io) {
+    GRN_FREE(stats);
+    return NULL;
+  }
+  stats->header = grn_io_header(stats->io);
+  memset(stats->header, 0, sizeof(struct grn_column_stats_header));
+  stats->header->version = GRN_COLUMN_STATS_VERSION;
+  stats->header->range = range;
+  return stats;
+}
+
+grn_column_stats *
+grn_column_stats_open(grn_ctx *ctx, const char *column_path)
+{
+  grn_column_stats *stats;
+  char path[PATH_MAX];
+  grn_io *io;
+  struct grn_column_stats_header *header;
+
+  if (!column_path || !*column_path) {
+    return NULL;
+  }
+  if (!grn_column_stats_build_path(ctx, column_path, path)) {
+    return NULL;
+  }
+  if (!grn_path_exist(path)) {
+    return NULL;
+  }
+
+  io = grn_io_open(ctx, path, grn_io_auto);
+  if (!io) {
+    return NULL;
+  }
+  header = grn_io_header(io);
+  if (header->version != GRN_COLUMN_STATS_VERSION) {
+    ERR(GRN_INVALID_FORMAT,
+        "[column][stats][open] unsupported version: <%u>: <%s>",
+        header->version, path);
+    grn_io_close(ctx, io);
+    return NULL;
+  }
+
+  stats = GRN_MALLOCN(grn_column_stats, 1);
+  if (!stats) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[column][stats][open] failed to allocate memory: <%s>", path);
+    grn_io_close(ctx, io);
+    return NULL;
+  }
+  stats->io = io;
+  stats->header = header;
+  return stats;
+}
+
+grn_rc
+grn_column_stats_close(grn_ctx *ctx, grn_column_stats *stats)
+{
+  grn_rc rc;
+  if (!stats) { return GRN_INVALID_ARGUMENT; }
+  rc = grn_io_close(ctx, stats->io);
+  GRN_FREE(stats);
+  return rc;
+}
+
+grn_rc
+grn_column_stats_remove(grn_ctx *ctx, const char *column_path)
+{
+  char path[PATH_MAX];
+
+  if (!column_path || !*column_path) {
+    return GRN_SUCCESS;
+  }
+  if (!grn_column_stats_build_path(ctx, column_path, path)) {
+    return ctx->rc;
+  }
+  if (!grn_path_exist(path)) {
+    return GRN_SUCCESS;
+  }
+  return grn_io_remove(ctx, path);
+}
+
+grn_column_stats *
+grn_column_stats_get(grn_ctx *ctx, grn_obj *column)
+{
+  if (!column) {
+    return NULL;
+  }
+  switch (column->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+    return ((grn_ra *)column)->stats;
+  case GRN_COLUMN_VAR_SIZE :
+    if ((column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) !=
+        GRN_OBJ_COLUMN_SCALAR) {
+      return NULL;
+    }
+    return ((grn_ja *)column)->stats;
+  default :
+    return NULL;
+  }
+}
+
+static grn_bool
+grn_column_stats_value_to_double(grn_id range,
+                                 const void *value, uint32_t value_size,
+                                 double *number)
+{
+#define CONVERT(type)                           \
+  if (value_size != sizeof(type)) {             \
+    return GRN_FALSE;                           \
+  }                                             \
+  *number = (double)(*((const type *)value));   \
+  return GRN_TRUE
+
+  switch (range) {
+  case GRN_DB_INT8 :
+    CONVERT(int8_t);
+  case GRN_DB_UINT8 :
+    CONVERT(uint8_t);
+  case GRN_DB_INT16 :
+    CONVERT(int16_t);
+  case GRN_DB_UINT16 :
+    CONVERT(uint16_t);
+  case GRN_DB_INT32 :
+    CONVERT(int32_t);
+  case GRN_DB_UINT32 :
+    CONVERT(uint32_t);
+  case GRN_DB_INT64 :
+  case GRN_DB_TIME :
+    CONVERT(int64_t);
+  case GRN_DB_UINT64 :
+    CONVERT(uint64_t);
+  case GRN_DB_FLOAT :
+    CONVERT(double);
+  default :
+    return GRN_FALSE;
+  }
+#undef CONVERT
+}
+
+static grn_bool
+grn_column_stats_have_histogram(grn_id range)
+{
+  switch (range) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_FLOAT :
+  case GRN_DB_TIME :
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+static uint64_t
+grn_column_stats_hash(const void *value, uint32_t value_size)
+{
+  const uint8_t *p = value;
+  uint64_t hash = 14695981039346656037ULL;
+  uint32_t i;
+
+  for (i = 0; i < value_size; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ULL;
+  }
+  /* Finalize to spread bits to the upper bits used by the registers. */
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static void
+grn_column_stats_add_register(struct grn_column_stats_header *header,
+                              const void *value, uint32_t value_size)
+{
+  uint64_t hash;
+  uint32_t index;
+  uint8_t rank = 1;
+  uint64_t rest;
+  const uint8_t max_rank = 64 - GRN_COLUMN_STATS_N_REGISTERS_BITS + 1;
+
+  hash = grn_column_stats_hash(value, value_size);
+  index = (uint32_t)(hash >> (64 - GRN_COLUMN_STATS_N_REGISTERS_BITS));
+  rest = hash << GRN_COLUMN_STATS_N_REGISTERS_BITS;
+  while (rank < max_rank && !(rest & (1ULL << 63))) {
+    rank++;
+    rest <<= 1;
+  }
+  if (header->registers[index] < rank) {
+    header->registers[index] = rank;
+  }
+}
+
+static void
+grn_column_stats_add_histogram(struct grn_column_stats_header *header,
+                               double number)
+{
+  uint32_t n_buckets = header->n_buckets;
+  uint32_t left, right;
+
+  if (n_buckets == 0) {
+    return;
+  }
+
+  if (number < header->bounds[0]) {
+    header->bounds[0] = number;
+  }
+  if (number > header->bounds[n_buckets]) {
+    header->bounds[n_buckets] = number;
+  }
+
+  left = 0;
+  right = n_buckets - 1;
+  while (left < right) {
+    uint32_t middle = left + (right - left + 1) / 2;
+    if (header->bounds[middle] <= number) {
+      left = middle;
+    } else {
+      right = middle - 1;
+    }
+  }
+  header->counts[left]++;
+}
+
+void
+grn_column_stats_add_value(grn_ctx *ctx, grn_column_stats *stats,
+                           const void *value, uint32_t value_size)
+{
+  struct grn_column_stats_header *header = stats->header;
+
+  header->n_modifications++;
+  if (value_size == 0) {
+    header->n_nulls++;
+    return;
+  }
+
+  header->n_values++;
+  grn_column_stats_add_register(header, value, value_size);
+  {
+    double number;
+    if (grn_column_stats_value_to_double(header->range, value, value_size,
+                                         &number)) {
+      grn_column_stats_add_histogram(header, number);
+    }
+  }
+}
+
+/*
+ * Values of a deleted record are cleared by setting a null value. It
+ * cancels the null value because the record doesn't exist anymore.
+ */
+void
+grn_column_stats_delete_null(grn_ctx *ctx, grn_column_stats *stats)
+{
+  struct grn_column_stats_header *header = stats->header;
+
+  if (header->n_nulls > 0) {
+    header->n_nulls--;
+  }
+  if (header->n_modifications > 0) {
+    header->n_modifications--;
+  }
+}
+
+uint64_t
+grn_column_stats_n_distinct_values(grn_ctx *ctx, grn_column_stats *stats)
+{
+  struct grn_column_stats_header *header = stats->header;
+  const double m = GRN_COLUMN_STATS_N_REGISTERS;
+  double alpha;
+  double sum = 0.0;
+  double estimated;
+  uint32_t i, n_zeros = 0;
+
+  if (header->n_values == 0) {
+    return 0;
+  }
+
+  alpha = 0.7213 / (1.0 + 1.079 / m);
+  for (i = 0; i < GRN_COLUMN_STATS_N_REGISTERS; i++) {
+    sum += ldexp(1.0, -((int)header->registers[i]));
+    if (header->registers[i] == 0) {
+      n_zeros++;
+    }
+  }
+  estimated = alpha * m * m / sum;
+  if (estimated <= 2.5 * m && n_zeros > 0) {
+    estimated = m * log(m / n_zeros);
+  }
+  if (estimated < 1.0) {
+    estimated = 1.0;
+  }
+  if (estimated > header->n_values) {
+    estimated = header->n_values;
+  }
+  return (uint64_t)(estimated + 0.5);
+}
+
+static int
+grn_column_stats_compare_double(const void *a, const void *b)
+{
+  double x = *((const double *)a);
+  double y = *((const double *)b);
+  if (x < y) {
+    return -1;
+  } else if (x > y) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+static void
+grn_column_stats_build_histogram(grn_ctx *ctx,
+                                 struct grn_column_stats_header *header,
+                                 grn_obj *numbers)
+{
+  double *values = (double *)GRN_BULK_HEAD(numbers);
+  uint64_t n_values = GRN_BULK_VSIZE(numbers) / sizeof(double);
+  uint32_t i, n_buckets;
+
+  header->n_buckets = 0;
+  if (n_values == 0) {
+    return;
+  }
+
+  qsort(values, n_values, sizeof(double), grn_column_stats_compare_double);
+
+  n_buckets = GRN_COLUMN_STATS_MAX_N_BUCKETS;
+  if (n_values < n_buckets) {
+    n_buckets = n_values;
+  }
+  for (i = 0; i < n_buckets; i++) {
+    uint64_t start = (n_values * i) / n_buckets;
+    uint64_t end = (n_values * (i + 1)) / n_buckets;
+    header->bounds[i] = values[start];
+    header->counts[i] = end - start;
+  }
+  header->bounds[n_buckets] = values[n_values - 1];
+  header->n_buckets = n_buckets;
+}
+
+grn_rc
+grn_column_analyze(grn_ctx *ctx, grn_obj *column)
+{
+  grn_obj *table;
+  grn_id range;
+  const char *column_path;
+  grn_column_stats *stats;
+  grn_table_cursor *cursor;
+  grn_id id;
+  grn_obj value;
+  grn_obj numbers;
+  grn_bool have_histogram;
+
+  GRN_API_ENTER;
+
+  if (!column) {
+    ERR(GRN_INVALID_ARGUMENT, "[column][analyze] column is NULL");
+    GRN_API_RETURN(ctx->rc);
+  }
+
+  switch (column->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+    break;
+  case GRN_COLUMN_VAR_SIZE :
+    if ((column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) ==
+        GRN_OBJ_COLUMN_SCALAR) {
+      break;
+    }
+    /* fallthru */
+  default :
+    {
+      char name[GRN_TABLE_MAX_KEY_SIZE];
+      int name_size;
+      name_size = grn_obj_name(ctx, column, name, GRN_TABLE_MAX_KEY_SIZE);
+      if (name_size == 0) {
+        name_size = grn_column_name(ctx, column, name, GRN_TABLE_MAX_KEY_SIZE);
+      }
+      ERR(GRN_INVALID_ARGUMENT,
+          "[column][analyze] only scalar column is supported: <%.*s>",
+          name_size, name);
+      GRN_API_RETURN(ctx->rc);
+    }
+  }
+
+  table = grn_ctx_at(ctx, column->header.domain);
+  if (!table) {
+    ERR(GRN_INVALID_ARGUMENT,
+        "[column][analyze] table isn't found: <%u>",
+        column->header.domain);
+    GRN_API_RETURN(ctx->rc);
+  }
+
+  range = DB_OBJ(column)->range;
+  column_path = grn_obj_path(ctx, column);
+  if (column->header.type == GRN_COLUMN_FIX_SIZE) {
+    stats = ((grn_ra *)column)->stats;
+    ((grn_ra *)column)->stats = NULL;
+  } else {
+    stats = ((grn_ja *)column)->stats;
+    ((grn_ja *)column)->stats = NULL;
+  }
+  if (stats) {
+    grn_column_stats_close(ctx, stats);
+    grn_column_stats_remove(ctx, column_path);
+    if (ctx->rc != GRN_SUCCESS) {
+      GRN_API_RETURN(ctx->rc);
+    }
+  }
+
+  stats = grn_column_stats_create(ctx, column_path, range);
+  if (!stats) {
+    if (ctx->rc == GRN_SUCCESS) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "[column][analyze] failed to create statistics");
+    }
+    GRN_API_RETURN(ctx->rc);
+  }
+
+  have_histogram = grn_column_stats_have_histogram(range);
+  GRN_VOID_INIT(&value);
+  GRN_FLOAT_INIT(&numbers, GRN_OBJ_VECTOR);
+  cursor = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1,
+                                 GRN_CURSOR_BY_ID);
+  if (cursor) {
+    struct grn_column_stats_header *header = stats->header;
+    while ((id = grn_table_cursor_next(ctx, cursor)) != GRN_ID_NIL) {
+      const char *raw_value;
+      uint32_t raw_value_size;
+
+      GRN_BULK_REWIND(&value);
+      grn_obj_get_value(ctx, column, id, &value);
+      raw_value = GRN_BULK_HEAD(&value);
+      raw_value_size = GRN_BULK_VSIZE(&value);
+      if (raw_value_size == 0) {
+        header->n_nulls++;
+        continue;
+      }
+      header->n_values++;
+      grn_column_stats_add_register(header, raw_value, raw_value_size);
+      if (have_histogram) {
+        double number;
+        if (grn_column_stats_value_to_double(range,
+                                             raw_value, raw_value_size,
+                                             &number)) {
+          GRN_FLOAT_PUT(ctx, &numbers, number);
+        }
+      }
+    }
+    grn_table_cursor_close(ctx, cursor);
+    grn_column_stats_build_histogram(ctx, header, &numbers);
+  }
+  GRN_OBJ_FIN(ctx, &numbers);
+  GRN_OBJ_FIN(ctx, &value);
+
+  if (ctx->rc != GRN_SUCCESS) {
+    grn_column_stats_close(ctx, stats);
+    grn_column_stats_remove(ctx, column_path);
+    GRN_API_RETURN(ctx->rc);
+  }
+
+  if (column->header.type == GRN_COLUMN_FIX_SIZE) {
+    ((grn_ra *)column)->stats = stats;
+  } else {
+    ((grn_ja *)column)->stats = stats;
+  }
+
+  GRN_API_RETURN(ctx->rc);
+}
+
+/* The ratio of values that are less than number in the histogram. */
+static double
+grn_column_stats_histogram_ratio_less(struct grn_column_stats_header *header,
+                                      double number)
+{
+  uint32_t i;
+  uint64_t total = 0;
+  double n_less = 0.0;
+
+  for (i = 0; i < header->n_buckets; i++) {
+    double lower = header->bounds[i];
+    double upper = header->bounds[i + 1];
+    total += header->counts[i];
+    if (number > upper) {
+      n_less += header->counts[i];
+    } else if (number > lower) {
+      n_less += header->counts[i] * ((number - lower) / (upper - lower));
+    }
+  }
+  if (total == 0) {
+    return 0.0;
+  }
+  return n_less / total;
+}
+
+grn_bool
+grn_column_stats_estimate_size(grn_ctx *ctx,
+                               grn_obj *column,
+                               grn_operator op,
+                               grn_obj *value,
+                               unsigned int n_records,
+                               unsigned int *size)
+{
+  grn_column_stats *stats;
+  struct grn_column_stats_header *header;
+  uint64_t n_total;
+  uint64_t n_distinct_values;
+  double value_ratio;
+  double equal_ratio;
+  double ratio;
+  grn_obj casted_value;
+  grn_bool have_number = GRN_FALSE;
+  double number = 0.0;
+
+  stats = grn_column_stats_get(ctx, column);
+  if (!stats) {
+    return GRN_FALSE;
+  }
+  header = stats->header;
+  n_total = header->n_values + header->n_nulls;
+  if (n_total == 0) {
+    return GRN_FALSE;
+  }
+
+  switch (op) {
+  case GRN_OP_EQUAL :
+  case GRN_OP_NOT_EQUAL :
+  case GRN_OP_LESS :
+  case GRN_OP_GREATER :
+  case GRN_OP_LESS_EQUAL :
+  case GRN_OP_GREATER_EQUAL :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+
+  GRN_OBJ_INIT(&casted_value, GRN_BULK, 0, header->range);
+  if (grn_obj_cast(ctx, value, &casted_value, GRN_FALSE) != GRN_SUCCESS) {
+    GRN_OBJ_FIN(ctx, &casted_value);
+    return GRN_FALSE;
+  }
+  if (header->n_buckets > 0) {
+    have_number = grn_column_stats_value_to_double(header->range,
+                                                   GRN_BULK_HEAD(&casted_value),
+                                                   GRN_BULK_VSIZE(&casted_value),
+                                                   &number);
+  }
+
+  value_ratio = (double)(header->n_values) / n_total;
+  n_distinct_values = grn_column_stats_n_distinct_values(ctx, stats);
+  if (GRN_BULK_VSIZE(&casted_value) == 0) {
+    equal_ratio = (double)(header->n_nulls) / n_total;
+  } else if (n_distinct_values == 0 ||
+             (have_number &&
+              (number < header->bounds[0] ||
+               number > header->bounds[header->n_buckets]))) {
+    equal_ratio = 0.0;
+  } else {
+    equal_ratio = value_ratio / n_distinct_values;
+  }
+  GRN_OBJ_FIN(ctx, &casted_value);
+
+  switch (op) {
+  case GRN_OP_EQUAL :
+    ratio = equal_ratio;
+    break;
+  case GRN_OP_NOT_EQUAL :
+    ratio = 1.0 - equal_ratio;
+    break;
+  default :
+    if (!have_number) {
+      return GRN_FALSE;
+    }
+    ratio = grn_column_stats_histogram_ratio_less(header, number);
+    switch (op) {
+    case GRN_OP_LESS :
+      break;
+    case GRN_OP_LESS_EQUAL :
+      ratio += equal_ratio;
+      break;
+    case GRN_OP_GREATER :
+      ratio = 1.0 - ratio - equal_ratio;
+      break;
+    case GRN_OP_GREATER_EQUAL :
+      ratio = 1.0 - ratio;
+      break;
+    default :
+      break;
+    }
+    ratio *= value_ratio;
+    break;
+  }
+
+  if (ratio < 0.0) {
+    ratio = 0.0;
+  } else if (ratio > 1.0) {
+    ratio = 1.0;
+  }
+  *size = (unsigned int)(n_records * ratio + 0.5);
+  return GRN_TRUE;
+}
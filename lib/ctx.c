@@ -22,6 +22,7 @@
 #include "grn_request_timer.h"
 #include "grn_tokenizers.h"
 #include "grn_ctx_impl.h"
+#include "grn_expr.h"
 #include "grn_ii.h"
 #include "grn_pat.h"
 #include "grn_index_column.h"
@@ -34,6 +35,7 @@
 #include "grn_ctx_impl_mrb.h"
 #include "grn_logger.h"
 #include "grn_cache.h"
+#include "grn_block_cache.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
@@ -77,6 +79,9 @@ int grn_uyield_count = 0;
 #endif
 
 static grn_bool grn_ctx_per_db = GRN_FALSE;
+static uint32_t grn_n_workers_default = 0;
+/* GRN_N_WORKERS_DEFAULT out of 1..GRN_N_WORKERS_MAX is ignored. */
+#define GRN_N_WORKERS_MAX 256
 
 static void
 grn_init_from_env(void)
@@ -91,12 +96,27 @@ grn_init_from_env(void)
     }
   }
 
+  {
+    char grn_n_workers_default_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_N_WORKERS_DEFAULT",
+               grn_n_workers_default_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_n_workers_default_env[0]) {
+      int n_workers = atoi(grn_n_workers_default_env);
+      if (n_workers > 0 && n_workers <= GRN_N_WORKERS_MAX) {
+        grn_n_workers_default = n_workers;
+      }
+    }
+  }
+
   grn_alloc_init_from_env();
   grn_mrb_init_from_env();
   grn_ctx_impl_mrb_init_from_env();
   grn_io_init_from_env();
+  grn_block_cache_init_from_env();
   grn_ii_init_from_env();
   grn_db_init_from_env();
+  grn_expr_init_from_env();
   grn_index_column_init_from_env();
   grn_proc_init_from_env();
   grn_plugin_init_from_env();
@@ -408,6 +428,17 @@ grn_ctx_impl_init(grn_ctx *ctx)
       grn_get_default_match_escalation_threshold();
   }
 
+  if (ctx == &grn_gctx) {
+    ctx->impl->n_workers = grn_n_workers_default;
+  } else {
+    ctx->impl->n_workers = grn_get_default_n_workers();
+  }
+
+  ctx->impl->cache_dependencies.recording = GRN_FALSE;
+  GRN_TEXT_INIT(&ctx->impl->cache_dependencies.dependencies, 0);
+
+  GRN_TEXT_INIT(&ctx->impl->compressed_values, 0);
+
   ctx->impl->finalizer = NULL;
 
   ctx->impl->com = NULL;
@@ -569,6 +600,9 @@ grn_ctx_fin(grn_ctx *ctx)
       grn_expr_parser_close(ctx);
     }
     GRN_OBJ_FIN(ctx, &ctx->impl->current_request_id);
+    ctx->impl->cache_dependencies.recording = GRN_FALSE;
+    GRN_OBJ_FIN(ctx, &ctx->impl->cache_dependencies.dependencies);
+    GRN_OBJ_FIN(ctx, &ctx->impl->compressed_values);
     if (ctx->impl->values) {
 #ifndef USE_MEMORY_DEBUG
       grn_db_obj *o;
@@ -739,6 +773,7 @@ grn_init(void)
     goto fail_tokenizer;
   }
   grn_cache_init();
+  grn_block_cache_init();
   if (!grn_request_canceler_init()) {
     rc = ctx->rc;
     GRN_LOG(ctx, GRN_LOG_ALERT,
@@ -758,6 +793,7 @@ grn_init(void)
 fail_request_timer:
   grn_request_canceler_fin();
 fail_request_canceler:
+  grn_block_cache_fin();
   grn_cache_fin();
 fail_tokenizer:
   grn_normalizer_fin();
@@ -830,6 +866,18 @@ grn_set_default_match_escalation_threshold(long long int threshold)
   return grn_ctx_set_match_escalation_threshold(&grn_gctx, threshold);
 }
 
+uint32_t
+grn_get_default_n_workers(void)
+{
+  return grn_ctx_get_n_workers(&grn_gctx);
+}
+
+grn_rc
+grn_set_default_n_workers(uint32_t n_workers)
+{
+  return grn_ctx_set_n_workers(&grn_gctx, n_workers);
+}
+
 int
 grn_get_lock_timeout(void)
 {
@@ -860,6 +908,7 @@ grn_fin(void)
   grn_query_logger_fin(ctx);
   grn_request_timer_fin();
   grn_request_canceler_fin();
+  grn_block_cache_fin();
   grn_cache_fin();
   grn_tokenizers_fin();
   grn_normalizer_fin();
@@ -1000,6 +1049,26 @@ grn_ctx_set_match_escalation_threshold(grn_ctx *ctx, long long int threshold)
   return GRN_SUCCESS;
 }
 
+uint32_t
+grn_ctx_get_n_workers(grn_ctx *ctx)
+{
+  if (ctx->impl) {
+    return ctx->impl->n_workers;
+  } else {
+    return grn_n_workers_default;
+  }
+}
+
+grn_rc
+grn_ctx_set_n_workers(grn_ctx *ctx, uint32_t n_workers)
+{
+  if (!ctx->impl) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  ctx->impl->n_workers = n_workers;
+  return GRN_SUCCESS;
+}
+
 grn_content_type
 grn_get_ctype(grn_obj *var)
 {
@@ -1247,6 +1316,7 @@ grn_ctx_qe_exec_uri(grn_ctx *ctx, const char *path, uint32_t path_len)
         }
       }
       ctx->impl->curr_expr = expr;
+      ctx->impl->cache_dependencies.recording = GRN_FALSE;
       grn_expr_exec(ctx, expr, 0);
     } else {
       ERR(GRN_INVALID_ARGUMENT, "invalid command name: %.*s",
@@ -1259,6 +1329,7 @@ grn_ctx_qe_exec_uri(grn_ctx *ctx, const char *path, uint32_t path_len)
       GRN_TEXT_SET(ctx, val, v, filename_end - v);
     }
     ctx->impl->curr_expr = expr;
+    ctx->impl->cache_dependencies.recording = GRN_FALSE;
     grn_expr_exec(ctx, expr, 0);
   }
 exit :
@@ -1369,6 +1440,7 @@ grn_ctx_qe_exec(grn_ctx *ctx, const char *str, uint32_t str_len)
     }
   }
   ctx->impl->curr_expr = expr;
+  ctx->impl->cache_dependencies.recording = GRN_FALSE;
   if (expr && command_proc_p(expr)) {
     grn_expr_exec(ctx, expr, 0);
   } else {
@@ -23,6 +23,7 @@
 #include "grn_dat.h"
 #include "grn_ii.h"
 #include "grn_index_column.h"
+#include "grn_column_stats.h"
 #include "grn_ctx_impl.h"
 #include "grn_token_cursor.h"
 #include "grn_tokenizers.h"
@@ -91,12 +92,49 @@ grn_obj_get_range_info(grn_ctx *ctx, grn_obj *obj,
 
 static char grn_db_key[GRN_ENV_BUFFER_SIZE];
 
+static int grn_table_sort_radix_sort_threshold = 4096;
+static int grn_table_group_parallel_threshold = 65536;
+static int grn_table_setoperation_merge_threshold = 4096;
+
 void
 grn_db_init_from_env(void)
 {
   grn_getenv("GRN_DB_KEY",
              grn_db_key,
              GRN_ENV_BUFFER_SIZE);
+
+  {
+    char grn_table_sort_radix_sort_threshold_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_SORT_RADIX_SORT_THRESHOLD",
+               grn_table_sort_radix_sort_threshold_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_table_sort_radix_sort_threshold_env[0]) {
+      grn_table_sort_radix_sort_threshold =
+        atoi(grn_table_sort_radix_sort_threshold_env);
+    }
+  }
+
+  {
+    char grn_table_group_parallel_threshold_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_GROUP_PARALLEL_THRESHOLD",
+               grn_table_group_parallel_threshold_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_table_group_parallel_threshold_env[0]) {
+      grn_table_group_parallel_threshold =
+        atoi(grn_table_group_parallel_threshold_env);
+    }
+  }
+
+  {
+    char grn_table_setoperation_merge_threshold_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_SETOPERATION_MERGE_THRESHOLD",
+               grn_table_setoperation_merge_threshold_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_table_setoperation_merge_threshold_env[0]) {
+      grn_table_setoperation_merge_threshold =
+        atoi(grn_table_setoperation_merge_threshold_env);
+    }
+  }
 }
 
 inline static void
@@ -662,17 +700,29 @@ grn_db_touch(grn_ctx *ctx, grn_obj *s)
 
 #define IS_TEMP(obj) (DB_OBJ(obj)->id & GRN_OBJ_TMP_OBJECT)
 
+/*
+ * The lastmod of the specs of a DB is the number of modifications in the DB.
+ * The lastmod of a table or a column is the number of modifications in the
+ * DB at the time it is modified last. So it is unique in the DB and it is
+ * changed even when the table or the column is truncated.
+ */
+uint32_t
+grn_db_n_modifications(grn_obj *s)
+{
+  return ((grn_db *)s)->specs->io->header->lastmod;
+}
+
 void
 grn_obj_touch(grn_ctx *ctx, grn_obj *obj, grn_timeval *tv)
 {
   grn_timeval tv_;
-  if (!tv) {
-    grn_timeval_now(ctx, &tv_);
-    tv = &tv_;
-  }
   if (obj) {
     switch (obj->header.type) {
     case GRN_DB :
+      if (!tv) {
+        grn_timeval_now(ctx, &tv_);
+        tv = &tv_;
+      }
       grn_obj_io(obj)->header->lastmod = tv->tv_sec;
       break;
     case GRN_TABLE_HASH_KEY :
@@ -682,14 +732,35 @@ grn_obj_touch(grn_ctx *ctx, grn_obj *obj, grn_timeval *tv)
     case GRN_COLUMN_VAR_SIZE :
     case GRN_COLUMN_FIX_SIZE :
     case GRN_COLUMN_INDEX :
-      if (!IS_TEMP(obj)) {
-        grn_obj_io(DB_OBJ(obj)->db)->header->lastmod = tv->tv_sec;
+      if (!IS_TEMP(obj) && DB_OBJ(obj)->id != GRN_ID_NIL) {
+        grn_db *s = (grn_db *)(DB_OBJ(obj)->db);
+        uint32_t n_modifications;
+        GRN_ATOMIC_ADD_EX(&(s->specs->io->header->lastmod), 1,
+                          n_modifications);
+        grn_obj_io(obj)->header->lastmod = n_modifications + 1;
       }
       break;
     }
   }
 }
 
+uint32_t
+grn_obj_lastmod(grn_ctx *ctx, grn_obj *obj)
+{
+  switch (obj->header.type) {
+  case GRN_TABLE_HASH_KEY :
+  case GRN_TABLE_PAT_KEY :
+  case GRN_TABLE_DAT_KEY :
+  case GRN_TABLE_NO_KEY :
+  case GRN_COLUMN_VAR_SIZE :
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_INDEX :
+    return grn_obj_io(obj)->header->lastmod;
+  default :
+    return 0;
+  }
+}
+
 grn_rc
 grn_db_check_name(grn_ctx *ctx, const char *name, unsigned int name_size)
 {
@@ -1409,6 +1480,7 @@ grn_table_add(grn_ctx *ctx, grn_obj *table, const void *key, unsigned int key_si
     }
     if (added_) {
       grn_hook *hooks = DB_OBJ(table)->hooks[GRN_HOOK_INSERT];
+      grn_obj_touch(ctx, table, NULL);
       if (hooks) {
         // todo : grn_proc_ctx_open()
         grn_obj id_, flags_, oldvalue_, value_;
@@ -1694,6 +1766,14 @@ grn_obj_clear_value(grn_ctx *ctx, grn_obj *obj, grn_id id)
     GRN_OBJ_INIT(&buf, GRN_BULK, 0, range);
     switch (obj->header.type) {
     case GRN_COLUMN_VAR_SIZE :
+      rc = grn_obj_set_value(ctx, obj, id, &buf, GRN_OBJ_SET);
+      if (rc == GRN_SUCCESS) {
+        grn_column_stats *stats = grn_column_stats_get(ctx, obj);
+        if (stats) {
+          grn_column_stats_delete_null(ctx, stats);
+        }
+      }
+      break;
     case GRN_COLUMN_FIX_SIZE :
       rc = grn_obj_set_value(ctx, obj, id, &buf, GRN_OBJ_SET);
       break;
@@ -2163,7 +2243,7 @@ grn_table_truncate(grn_ctx *ctx, grn_obj *table)
       grn_obj_set_info(ctx, table, GRN_INFO_TOKEN_FILTERS, &token_filters);
       GRN_OBJ_FIN(ctx, &token_filters);
     }
-    if (rc == GRN_SUCCESS) {
+    if (rc == GRN_SUCCESS && table) {
       grn_obj_touch(ctx, table, NULL);
     }
   }
@@ -2661,7 +2741,7 @@ grn_table_cursor_delete(grn_ctx *ctx, grn_table_cursor *tc)
     ERR(GRN_INVALID_ARGUMENT, "%s invalid cursor", tag);
   } else {
     grn_id id;
-    grn_obj *table;
+    grn_obj *table = NULL;
     const void *key = NULL;
     unsigned int key_size = 0;
     switch (tc->header.type) {
@@ -2710,6 +2790,9 @@ grn_table_cursor_delete(grn_ctx *ctx, grn_table_cursor *tc)
       ERR(GRN_INVALID_ARGUMENT, "%s invalid type %d", tag, tc->header.type);
       break;
     }
+    if (rc == GRN_SUCCESS && table) {
+      grn_obj_touch(ctx, table, NULL);
+    }
   }
 exit :
   GRN_API_RETURN(rc);
@@ -3005,6 +3088,30 @@ grn_table_next(grn_ctx *ctx, grn_obj *table, grn_id id)
   GRN_API_RETURN(r);
 }
 
+grn_id
+grn_table_curr_id(grn_ctx *ctx, grn_obj *table)
+{
+  grn_id id = GRN_ID_NIL;
+  GRN_API_ENTER;
+  if (table) {
+    switch (table->header.type) {
+    case GRN_TABLE_PAT_KEY :
+      id = grn_pat_curr_id(ctx, (grn_pat *)table);
+      break;
+    case GRN_TABLE_DAT_KEY :
+      id = grn_dat_curr_id(ctx, (grn_dat *)table);
+      break;
+    case GRN_TABLE_HASH_KEY :
+      id = grn_hash_curr_id(ctx, (grn_hash *)table);
+      break;
+    case GRN_TABLE_NO_KEY :
+      id = grn_array_curr_id(ctx, (grn_array *)table);
+      break;
+    }
+  }
+  GRN_API_RETURN(id);
+}
+
 static grn_rc
 grn_accessor_resolve_one_index_column(grn_ctx *ctx, grn_accessor *accessor,
                                       grn_obj *current_res, grn_obj **next_res,
@@ -3559,109 +3666,253 @@ grn_table_group_add_subrec(grn_ctx *ctx,
   grn_rset_recinfo_update_calc_values(ctx, ri, table, value_buffer);
 }
 
+/*
+ * Returns the column of a key such as "_key.column" that can be grouped
+ * by referring the column directly. range is the range of the key.
+ */
+static grn_obj *
+accelerated_table_group_column(grn_ctx *ctx, grn_obj *key, grn_obj *range)
+{
+  grn_accessor *a;
+  if (key->header.type != GRN_ACCESSOR) {
+    return NULL;
+  }
+  a = (grn_accessor *)key;
+  if (!(a->action == GRN_ACCESSOR_GET_KEY &&
+        a->next && a->next->action == GRN_ACCESSOR_GET_COLUMN_VALUE &&
+        a->next->obj && !a->next->next)) {
+    return NULL;
+  }
+  switch (a->next->obj->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+    return a->next->obj;
+  case GRN_COLUMN_VAR_SIZE :
+    if (GRN_OBJ_TABLEP(range)) { /* todo : support other type */
+      return a->next->obj;
+    }
+    return NULL;
+  default :
+    return NULL;
+  }
+}
+
+/* source_id is the key of the id record. */
+inline static void
+accelerated_table_group_fix_size_record(grn_ctx *ctx,
+                                        grn_ra *ra, grn_ra_cache *cache,
+                                        grn_obj *range, int idp,
+                                        grn_obj *res, grn_obj *calc_target,
+                                        grn_id id, grn_id source_id,
+                                        grn_rset_recinfo *ri,
+                                        grn_obj *value_buffer)
+{
+  void *v, *value;
+  unsigned int element_size = ra->header->element_size;
+  v = grn_ra_ref_cache(ctx, ra, source_id, cache);
+  if (idp && *((grn_id *)v) &&
+      grn_table_at(ctx, range, *((grn_id *)v)) == GRN_ID_NIL) {
+    return;
+  }
+  if ((!idp || *((grn_id *)v)) &&
+      grn_table_add_v_inline(ctx, res, v, element_size, &value, NULL)) {
+    grn_table_group_add_subrec(ctx, res, value,
+                               ri ? ri->score : 0,
+                               (grn_rset_posinfo *)&id, 0,
+                               calc_target,
+                               value_buffer);
+  }
+}
+
+inline static void
+accelerated_table_group_var_size_record(grn_ctx *ctx,
+                                        grn_ja *ja,
+                                        grn_obj *res, grn_obj *calc_target,
+                                        grn_id id, grn_id source_id,
+                                        grn_rset_recinfo *ri,
+                                        grn_obj *value_buffer)
+{
+  grn_io_win jw;
+  unsigned int len = 0;
+  void *value;
+  grn_id *v;
+  if ((v = grn_ja_ref(ctx, ja, source_id, &jw, &len))) {
+    while (len) {
+      if ((*v != GRN_ID_NIL) &&
+          grn_table_add_v_inline(ctx, res, v, sizeof(grn_id), &value, NULL)) {
+        grn_table_group_add_subrec(ctx, res, value,
+                                   ri ? ri->score : 0,
+                                   (grn_rset_posinfo *)&id, 0,
+                                   calc_target,
+                                   value_buffer);
+      }
+      v++;
+      len -= sizeof(grn_id);
+    }
+    grn_ja_unref(ctx, &jw);
+  }
+}
+
 static grn_bool
 accelerated_table_group(grn_ctx *ctx, grn_obj *table, grn_obj *key,
-                        grn_table_group_result *result)
+                        grn_table_group_result *result,
+                        int offset, int limit)
 {
   grn_obj *res = result->table;
   grn_obj *calc_target = result->calc_target;
-  if (key->header.type == GRN_ACCESSOR) {
-    grn_accessor *a = (grn_accessor *)key;
-    if (a->action == GRN_ACCESSOR_GET_KEY &&
-        a->next && a->next->action == GRN_ACCESSOR_GET_COLUMN_VALUE &&
-        a->next->obj && !a->next->next) {
-      grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
-      int idp = GRN_OBJ_TABLEP(range);
-      grn_table_cursor *tc;
-      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
-        grn_bool processed = GRN_TRUE;
-        grn_obj value_buffer;
-        GRN_VOID_INIT(&value_buffer);
-        switch (a->next->obj->header.type) {
-        case GRN_COLUMN_FIX_SIZE :
-          {
-            grn_id id;
-            grn_ra *ra = (grn_ra *)a->next->obj;
-            unsigned int element_size = (ra)->header->element_size;
-            grn_ra_cache cache;
-            GRN_RA_CACHE_INIT(ra, &cache);
-            while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-              void *v, *value;
-              grn_id *id_;
-              uint32_t key_size;
-              grn_rset_recinfo *ri = NULL;
-              if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-                grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
-              }
-              id_ = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
-              v = grn_ra_ref_cache(ctx, ra, *id_, &cache);
-              if (idp && *((grn_id *)v) &&
-                  grn_table_at(ctx, range, *((grn_id *)v)) == GRN_ID_NIL) {
-                continue;
-              }
-              if ((!idp || *((grn_id *)v)) &&
-                  grn_table_add_v_inline(ctx, res, v, element_size, &value, NULL)) {
-                grn_table_group_add_subrec(ctx, res, value,
-                                           ri ? ri->score : 0,
-                                           (grn_rset_posinfo *)&id, 0,
-                                           calc_target,
-                                           &value_buffer);
-              }
-            }
-            GRN_RA_CACHE_FIN(ra, &cache);
-          }
-          break;
-        case GRN_COLUMN_VAR_SIZE :
-          if (idp) { /* todo : support other type */
-            grn_id id;
-            grn_ja *ja = (grn_ja *)a->next->obj;
-            while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-              grn_io_win jw;
-              unsigned int len = 0;
-              void *value;
-              grn_id *v, *id_;
-              uint32_t key_size;
-              grn_rset_recinfo *ri = NULL;
-              if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-                grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
-              }
-              id_ = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
-              if ((v = grn_ja_ref(ctx, ja, *id_, &jw, &len))) {
-                while (len) {
-                  if ((*v != GRN_ID_NIL) &&
-                      grn_table_add_v_inline(ctx, res, v, sizeof(grn_id), &value, NULL)) {
-                    grn_table_group_add_subrec(ctx, res, value,
-                                               ri ? ri->score : 0,
-                                               (grn_rset_posinfo *)&id, 0,
-                                               calc_target,
-                                               &value_buffer);
-                  }
-                  v++;
-                  len -= sizeof(grn_id);
-                }
-                grn_ja_unref(ctx, &jw);
-              }
-            }
-          } else {
-            processed = GRN_FALSE;
+  grn_obj *range;
+  grn_obj *column;
+  int idp;
+  grn_table_cursor *tc;
+  grn_obj value_buffer;
+  grn_id id;
+
+  if (key->header.type != GRN_ACCESSOR) {
+    return GRN_FALSE;
+  }
+  range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
+  column = accelerated_table_group_column(ctx, key, range);
+  if (!column) {
+    return GRN_FALSE;
+  }
+  idp = GRN_OBJ_TABLEP(range);
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, offset, limit, 0);
+  if (!tc) {
+    return GRN_FALSE;
+  }
+  GRN_VOID_INIT(&value_buffer);
+  if (column->header.type == GRN_COLUMN_FIX_SIZE) {
+    grn_ra *ra = (grn_ra *)column;
+    grn_ra_cache cache;
+    GRN_RA_CACHE_INIT(ra, &cache);
+    while ((id = grn_table_cursor_next_inline(ctx, tc))) {
+      grn_id *source_id;
+      uint32_t key_size;
+      grn_rset_recinfo *ri = NULL;
+      if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
+        grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
+      }
+      source_id = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
+      accelerated_table_group_fix_size_record(ctx, ra, &cache,
+                                              range, idp,
+                                              res, calc_target,
+                                              id, *source_id, ri,
+                                              &value_buffer);
+    }
+    GRN_RA_CACHE_FIN(ra, &cache);
+  } else {
+    grn_ja *ja = (grn_ja *)column;
+    while ((id = grn_table_cursor_next_inline(ctx, tc))) {
+      grn_id *source_id;
+      uint32_t key_size;
+      grn_rset_recinfo *ri = NULL;
+      if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
+        grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
+      }
+      source_id = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
+      accelerated_table_group_var_size_record(ctx, ja,
+                                              res, calc_target,
+                                              id, *source_id, ri,
+                                              &value_buffer);
+    }
+  }
+  GRN_OBJ_FIN(ctx, &value_buffer);
+  grn_table_cursor_close(ctx, tc);
+  return GRN_TRUE;
+}
+
+inline static void
+grn_table_group_single_key_record(grn_ctx *ctx,
+                                  grn_obj *res,
+                                  grn_obj *calc_target,
+                                  grn_id id,
+                                  grn_rset_recinfo *ri,
+                                  grn_obj *bulk,
+                                  int idp,
+                                  grn_obj *value_buffer)
+{
+  void *value;
+
+  switch (bulk->header.type) {
+  case GRN_UVECTOR :
+    {
+      grn_bool is_reference;
+      unsigned int element_size;
+      uint8_t *elements;
+      int i, n_elements;
+
+      is_reference = !grn_type_id_is_builtin(ctx, bulk->header.type);
+
+      element_size = grn_uvector_element_size(ctx, bulk);
+      elements = GRN_BULK_HEAD(bulk);
+      n_elements = GRN_BULK_VSIZE(bulk) / element_size;
+      for (i = 0; i < n_elements; i++) {
+        uint8_t *element = elements + (element_size * i);
+
+        if (is_reference) {
+          grn_id id = *((grn_id *)element);
+          if (id == GRN_ID_NIL) {
+            continue;
           }
-          break;
-        default :
-          processed = GRN_FALSE;
-          break;
         }
-        GRN_OBJ_FIN(ctx, &value_buffer);
-        grn_table_cursor_close(ctx, tc);
-        return processed;
+
+        if (!grn_table_add_v_inline(ctx, res, element, element_size,
+                                    &value, NULL)) {
+          continue;
+        }
+
+        grn_table_group_add_subrec(ctx, res, value,
+                                   ri ? ri->score : 0,
+                                   (grn_rset_posinfo *)&id, 0,
+                                   calc_target,
+                                   value_buffer);
+      }
+    }
+    break;
+  case GRN_VECTOR :
+    {
+      unsigned int i, n_elements;
+      n_elements = grn_vector_size(ctx, bulk);
+      for (i = 0; i < n_elements; i++) {
+        const char *content;
+        unsigned int content_length;
+        content_length = grn_vector_get_element(ctx, bulk, i,
+                                                &content, NULL, NULL);
+        if (grn_table_add_v_inline(ctx, res,
+                                   content, content_length,
+                                   &value, NULL)) {
+          grn_table_group_add_subrec(ctx, res, value,
+                                     ri ? ri->score : 0,
+                                     (grn_rset_posinfo *)&id, 0,
+                                     calc_target,
+                                     value_buffer);
+        }
+      }
+    }
+    break;
+  case GRN_BULK :
+    {
+      if ((!idp || *((grn_id *)GRN_BULK_HEAD(bulk))) &&
+          grn_table_add_v_inline(ctx, res,
+                                 GRN_BULK_HEAD(bulk), GRN_BULK_VSIZE(bulk),
+                                 &value, NULL)) {
+        grn_table_group_add_subrec(ctx, res, value,
+                                   ri ? ri->score : 0,
+                                   (grn_rset_posinfo *)&id, 0,
+                                   calc_target,
+                                   value_buffer);
       }
     }
+    break;
+  default :
+    ERR(GRN_INVALID_ARGUMENT, "invalid column");
+    break;
   }
-  return GRN_FALSE;
 }
 
 static void
 grn_table_group_single_key_records(grn_ctx *ctx, grn_obj *table,
-                                   grn_obj *key, grn_table_group_result *result)
+                                   grn_obj *key, grn_table_group_result *result,
+                                   int offset, int limit)
 {
   grn_obj bulk;
   grn_obj value_buffer;
@@ -3671,106 +3922,35 @@ grn_table_group_single_key_records(grn_ctx *ctx, grn_obj *table,
 
   GRN_TEXT_INIT(&bulk, 0);
   GRN_VOID_INIT(&value_buffer);
-  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0,
+                                  offset, limit, 0))) {
     grn_id id;
     grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
     int idp = GRN_OBJ_TABLEP(range);
     while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-      void *value;
       grn_rset_recinfo *ri = NULL;
       GRN_BULK_REWIND(&bulk);
       if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
         grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
       }
       grn_obj_get_value(ctx, key, id, &bulk);
-      switch (bulk.header.type) {
-      case GRN_UVECTOR :
-        {
-          grn_bool is_reference;
-          unsigned int element_size;
-          uint8_t *elements;
-          int i, n_elements;
-
-          is_reference = !grn_type_id_is_builtin(ctx, bulk.header.type);
-
-          element_size = grn_uvector_element_size(ctx, &bulk);
-          elements = GRN_BULK_HEAD(&bulk);
-          n_elements = GRN_BULK_VSIZE(&bulk) / element_size;
-          for (i = 0; i < n_elements; i++) {
-            uint8_t *element = elements + (element_size * i);
-
-            if (is_reference) {
-              grn_id id = *((grn_id *)element);
-              if (id == GRN_ID_NIL) {
-                continue;
-              }
-            }
+      grn_table_group_single_key_record(ctx, res, calc_target,
+                                        id, ri, &bulk, idp,
+                                        &value_buffer);
+    }
+    grn_table_cursor_close(ctx, tc);
+  }
+  GRN_OBJ_FIN(ctx, &value_buffer);
+  GRN_OBJ_FIN(ctx, &bulk);
+}
 
-            if (!grn_table_add_v_inline(ctx, res, element, element_size,
-                                        &value, NULL)) {
-              continue;
-            }
-
-            grn_table_group_add_subrec(ctx, res, value,
-                                       ri ? ri->score : 0,
-                                       (grn_rset_posinfo *)&id, 0,
-                                       calc_target,
-                                       &value_buffer);
-          }
-        }
-        break;
-      case GRN_VECTOR :
-        {
-          unsigned int i, n_elements;
-          n_elements = grn_vector_size(ctx, &bulk);
-          for (i = 0; i < n_elements; i++) {
-            const char *content;
-            unsigned int content_length;
-            content_length = grn_vector_get_element(ctx, &bulk, i,
-                                                    &content, NULL, NULL);
-            if (grn_table_add_v_inline(ctx, res,
-                                       content, content_length,
-                                       &value, NULL)) {
-              grn_table_group_add_subrec(ctx, res, value,
-                                         ri ? ri->score : 0,
-                                         (grn_rset_posinfo *)&id, 0,
-                                         calc_target,
-                                         &value_buffer);
-            }
-          }
-        }
-        break;
-      case GRN_BULK :
-        {
-          if ((!idp || *((grn_id *)GRN_BULK_HEAD(&bulk))) &&
-              grn_table_add_v_inline(ctx, res,
-                                     GRN_BULK_HEAD(&bulk), GRN_BULK_VSIZE(&bulk),
-                                     &value, NULL)) {
-            grn_table_group_add_subrec(ctx, res, value,
-                                       ri ? ri->score : 0,
-                                       (grn_rset_posinfo *)&id, 0,
-                                       calc_target,
-                                       &value_buffer);
-          }
-        }
-        break;
-      default :
-        ERR(GRN_INVALID_ARGUMENT, "invalid column");
-        break;
-      }
-    }
-    grn_table_cursor_close(ctx, tc);
-  }
-  GRN_OBJ_FIN(ctx, &value_buffer);
-  GRN_OBJ_FIN(ctx, &bulk);
-}
-
-#define GRN_TABLE_GROUP_ALL_NAME     "_all"
-#define GRN_TABLE_GROUP_ALL_NAME_LEN (sizeof(GRN_TABLE_GROUP_ALL_NAME) - 1)
+#define GRN_TABLE_GROUP_ALL_NAME     "_all"
+#define GRN_TABLE_GROUP_ALL_NAME_LEN (sizeof(GRN_TABLE_GROUP_ALL_NAME) - 1)
 
 static void
 grn_table_group_all_records(grn_ctx *ctx, grn_obj *table,
-                            grn_table_group_result *result)
+                            grn_table_group_result *result,
+                            int offset, int limit)
 {
   grn_obj value_buffer;
   grn_table_cursor *tc;
@@ -3778,7 +3958,8 @@ grn_table_group_all_records(grn_ctx *ctx, grn_obj *table,
   grn_obj *calc_target = result->calc_target;
 
   GRN_VOID_INIT(&value_buffer);
-  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0,
+                                  offset, limit, 0))) {
     grn_id id;
     void *value;
     if (grn_table_add_v_inline(ctx, res,
@@ -3960,20 +4141,50 @@ grn_table_group_multi_keys_add_record(grn_ctx *ctx,
   }
 }
 
+static inline void
+grn_table_group_multi_keys_scalar_record(grn_ctx *ctx,
+                                         grn_table_sort_key *keys,
+                                         int n_keys,
+                                         grn_table_group_result *results,
+                                         int n_results,
+                                         grn_id id,
+                                         grn_rset_recinfo *ri,
+                                         grn_obj *vector,
+                                         grn_obj *bulk)
+{
+  int k;
+  grn_table_sort_key *kp;
+
+  GRN_BULK_REWIND(vector);
+  for (k = 0, kp = keys; k < n_keys; k++, kp++) {
+    GRN_BULK_REWIND(bulk);
+    grn_obj_get_value(ctx, kp->key, id, bulk);
+    grn_vector_add_element(ctx, vector,
+                           GRN_BULK_HEAD(bulk), GRN_BULK_VSIZE(bulk),
+                           0,
+                           bulk->header.domain);
+  }
+
+  grn_table_group_multi_keys_add_record(ctx, keys, n_keys, results, n_results,
+                                        id, ri, vector, bulk);
+}
+
 static void
 grn_table_group_multi_keys_scalar_records(grn_ctx *ctx,
                                           grn_obj *table,
                                           grn_table_sort_key *keys,
                                           int n_keys,
                                           grn_table_group_result *results,
-                                          int n_results)
+                                          int n_results,
+                                          int offset,
+                                          int limit)
 {
   grn_id id;
   grn_table_cursor *tc;
   grn_obj bulk;
   grn_obj vector;
 
-  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, offset, limit, 0);
   if (!tc) {
     return;
   }
@@ -3981,26 +4192,15 @@ grn_table_group_multi_keys_scalar_records(grn_ctx *ctx,
   GRN_TEXT_INIT(&bulk, 0);
   GRN_OBJ_INIT(&vector, GRN_VECTOR, 0, GRN_DB_VOID);
   while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-    int k;
-    grn_table_sort_key *kp;
     grn_rset_recinfo *ri = NULL;
 
     if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
       grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
     }
 
-    GRN_BULK_REWIND(&vector);
-    for (k = 0, kp = keys; k < n_keys; k++, kp++) {
-      GRN_BULK_REWIND(&bulk);
-      grn_obj_get_value(ctx, kp->key, id, &bulk);
-      grn_vector_add_element(ctx, &vector,
-                             GRN_BULK_HEAD(&bulk), GRN_BULK_VSIZE(&bulk),
-                             0,
-                             bulk.header.domain);
-    }
-
-    grn_table_group_multi_keys_add_record(ctx, keys, n_keys, results, n_results,
-                                          id, ri, &vector, &bulk);
+    grn_table_group_multi_keys_scalar_record(ctx, keys, n_keys,
+                                             results, n_results,
+                                             id, ri, &vector, &bulk);
   }
   GRN_OBJ_FIN(ctx, &vector);
   GRN_OBJ_FIN(ctx, &bulk);
@@ -4108,7 +4308,9 @@ grn_table_group_multi_keys_vector_records(grn_ctx *ctx,
                                           grn_table_sort_key *keys,
                                           int n_keys,
                                           grn_table_group_result *results,
-                                          int n_results)
+                                          int n_results,
+                                          int offset,
+                                          int limit)
 {
   grn_id id;
   grn_table_cursor *tc;
@@ -4117,7 +4319,7 @@ grn_table_group_multi_keys_vector_records(grn_ctx *ctx,
   grn_obj *key_buffers;
   int k;
 
-  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, offset, limit, 0);
   if (!tc) {
     return;
   }
@@ -4162,151 +4364,1135 @@ grn_table_group_multi_keys_vector_records(grn_ctx *ctx,
   grn_table_cursor_close(ctx, tc);
 }
 
-grn_rc
-grn_table_group(grn_ctx *ctx, grn_obj *table,
-                grn_table_sort_key *keys, int n_keys,
-                grn_table_group_result *results, int n_results)
+/* Records are grouped by keys into results. */
+typedef struct {
+  grn_table_sort_key *keys;
+  int n_keys;
+  grn_table_group_result *results;
+  int n_results;
+  grn_bool group_by_all_records;
+  grn_bool have_vector;
+} grn_table_group_target;
+
+static void
+grn_table_group_records(grn_ctx *ctx, grn_obj *table,
+                        grn_table_group_target *target,
+                        int offset, int limit)
+{
+  grn_table_sort_key *keys = target->keys;
+  int n_keys = target->n_keys;
+  grn_table_group_result *results = target->results;
+  int n_results = target->n_results;
+
+  if (target->group_by_all_records) {
+    grn_table_group_all_records(ctx, table, results, offset, limit);
+  } else if (n_keys == 1 && n_results == 1) {
+    if (!accelerated_table_group(ctx, table, keys->key, results,
+                                 offset, limit)) {
+      grn_table_group_single_key_records(ctx, table, keys->key, results,
+                                         offset, limit);
+    }
+  } else if (target->have_vector) {
+    grn_table_group_multi_keys_vector_records(ctx, table,
+                                              keys, n_keys,
+                                              results, n_results,
+                                              offset, limit);
+  } else {
+    grn_table_group_multi_keys_scalar_records(ctx, table,
+                                              keys, n_keys,
+                                              results, n_results,
+                                              offset, limit);
+  }
+}
+
+typedef enum {
+  GRN_TABLE_GROUP_TARGET_FIX_SIZE_REFERENCE,
+  GRN_TABLE_GROUP_TARGET_VAR_SIZE_REFERENCE,
+  GRN_TABLE_GROUP_TARGET_SOURCE_KEY
+} grn_table_group_target_type;
+
+/*
+ * A target grouped by a key such as "_key.column" in a shared scan.
+ * source_key is the accessor after "_key".
+ */
+typedef struct {
+  grn_table_group_target *target;
+  grn_table_group_target_type type;
+  grn_obj *range;
+  int idp;
+  grn_obj *column;
+  grn_ra_cache cache;
+  grn_obj *source_key;
+  grn_obj bulk;
+} grn_table_group_target_state;
+
+static grn_bool
+grn_table_group_target_is_sharable(grn_ctx *ctx, grn_obj *table,
+                                   grn_table_group_target *target)
 {
-  grn_rc rc = GRN_SUCCESS;
-  grn_bool group_by_all_records = GRN_FALSE;
-  if (n_keys == 0 && n_results == 1) {
-    group_by_all_records = GRN_TRUE;
-  } else if (!table || !n_keys || !n_results) {
-    ERR(GRN_INVALID_ARGUMENT, "table or n_keys or n_results is void");
-    return GRN_INVALID_ARGUMENT;
+  grn_accessor *a;
+
+  if (target->group_by_all_records) {
+    return GRN_FALSE;
   }
-  GRN_API_ENTER;
-  {
-    int k, r;
-    grn_table_sort_key *kp;
-    grn_table_group_result *rp;
-    for (k = 0, kp = keys; k < n_keys; k++, kp++) {
-      if ((kp->flags & GRN_TABLE_GROUP_BY_COLUMN_VALUE) && !kp->key) {
-        ERR(GRN_INVALID_ARGUMENT, "column missing in (%d)", k);
-        goto exit;
-      }
+  if (!(target->n_keys == 1 && target->n_results == 1)) {
+    return GRN_FALSE;
+  }
+  if (target->keys->key->header.type != GRN_ACCESSOR) {
+    return GRN_FALSE;
+  }
+  a = (grn_accessor *)(target->keys->key);
+  return (a->action == GRN_ACCESSOR_GET_KEY &&
+          a->obj == table &&
+          a->next);
+}
+
+static void
+grn_table_group_target_state_init(grn_ctx *ctx,
+                                  grn_table_group_target_state *state,
+                                  grn_table_group_target *target)
+{
+  grn_obj *key = target->keys->key;
+
+  state->target = target;
+  state->range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
+  state->idp = GRN_OBJ_TABLEP(state->range);
+  state->column = accelerated_table_group_column(ctx, key, state->range);
+  state->source_key = (grn_obj *)(((grn_accessor *)key)->next);
+  GRN_TEXT_INIT(&(state->bulk), 0);
+  if (!state->column) {
+    state->type = GRN_TABLE_GROUP_TARGET_SOURCE_KEY;
+  } else if (state->column->header.type == GRN_COLUMN_FIX_SIZE) {
+    state->type = GRN_TABLE_GROUP_TARGET_FIX_SIZE_REFERENCE;
+    GRN_RA_CACHE_INIT((grn_ra *)(state->column), &(state->cache));
+  } else {
+    state->type = GRN_TABLE_GROUP_TARGET_VAR_SIZE_REFERENCE;
+  }
+}
+
+static void
+grn_table_group_target_state_fin(grn_ctx *ctx,
+                                 grn_table_group_target_state *state)
+{
+  if (state->type == GRN_TABLE_GROUP_TARGET_FIX_SIZE_REFERENCE) {
+    GRN_RA_CACHE_FIN((grn_ra *)(state->column), &(state->cache));
+  }
+  GRN_OBJ_FIN(ctx, &(state->bulk));
+}
+
+inline static void
+grn_table_group_target_state_add_record(grn_ctx *ctx,
+                                        grn_table_group_target_state *state,
+                                        grn_id id,
+                                        grn_id source_id,
+                                        grn_rset_recinfo *ri,
+                                        grn_obj *value_buffer)
+{
+  grn_table_group_result *result = state->target->results;
+
+  switch (state->type) {
+  case GRN_TABLE_GROUP_TARGET_FIX_SIZE_REFERENCE :
+    accelerated_table_group_fix_size_record(ctx,
+                                            (grn_ra *)(state->column),
+                                            &(state->cache),
+                                            state->range, state->idp,
+                                            result->table,
+                                            result->calc_target,
+                                            id, source_id, ri,
+                                            value_buffer);
+    break;
+  case GRN_TABLE_GROUP_TARGET_VAR_SIZE_REFERENCE :
+    accelerated_table_group_var_size_record(ctx,
+                                            (grn_ja *)(state->column),
+                                            result->table,
+                                            result->calc_target,
+                                            id, source_id, ri,
+                                            value_buffer);
+    break;
+  case GRN_TABLE_GROUP_TARGET_SOURCE_KEY :
+    GRN_BULK_REWIND(&(state->bulk));
+    grn_obj_get_value(ctx, state->source_key, source_id, &(state->bulk));
+    grn_table_group_single_key_record(ctx, result->table, result->calc_target,
+                                      id, ri, &(state->bulk), state->idp,
+                                      value_buffer);
+    break;
+  }
+}
+
+#define GRN_TABLE_GROUP_N_BLOCK_RECORDS 256
+
+/*
+ * Targets grouped by keys such as "_key.column" share one scan of the
+ * table. The key of each record in the table is read only once for
+ * them. Records are passed to each target in the table cursor order by
+ * blocks. So each result is the same as the result grouped separately.
+ *
+ * Other targets are grouped separately. Sharing only a scan doesn't pay
+ * because hash tables of all targets are used at the same time.
+ */
+static void
+grn_table_group_targets_records(grn_ctx *ctx, grn_obj *table,
+                                grn_table_group_target *targets,
+                                int n_targets,
+                                int offset, int limit)
+{
+  int i;
+  int n_states = 0;
+  grn_table_group_target_state *states = NULL;
+  grn_table_cursor *tc;
+  grn_obj value_buffer;
+  grn_id id;
+  grn_id ids[GRN_TABLE_GROUP_N_BLOCK_RECORDS];
+  grn_id source_ids[GRN_TABLE_GROUP_N_BLOCK_RECORDS];
+  grn_rset_recinfo *ris[GRN_TABLE_GROUP_N_BLOCK_RECORDS];
+
+  for (i = 0; i < n_targets; i++) {
+    if (grn_table_group_target_is_sharable(ctx, table, &(targets[i]))) {
+      n_states++;
     }
-    for (r = 0, rp = results; r < n_results; r++, rp++) {
-      if (!rp->table) {
-        grn_table_flags flags;
-        grn_obj *key_type = NULL;
-        uint32_t additional_value_size;
-
-        flags = GRN_TABLE_HASH_KEY|
-          GRN_OBJ_WITH_SUBREC|
-          GRN_OBJ_UNIT_USERDEF_DOCUMENT;
-        if (group_by_all_records) {
-          key_type = grn_ctx_at(ctx, GRN_DB_SHORT_TEXT);
-        } else if (n_keys == 1) {
-          key_type = grn_ctx_at(ctx, grn_obj_get_range(ctx, keys[0].key));
-        } else {
-          flags |= GRN_OBJ_KEY_VAR_SIZE;
-        }
-        additional_value_size = grn_rset_recinfo_calc_values_size(ctx,
-                                                                  rp->flags);
-        rp->table = grn_table_create_with_max_n_subrecs(ctx, NULL, 0, NULL,
-                                                        flags,
-                                                        key_type, table,
-                                                        rp->max_n_subrecs,
-                                                        additional_value_size);
-        if (key_type) {
-          grn_obj_unlink(ctx, key_type);
-        }
-        if (!rp->table) {
-          goto exit;
+  }
+  if (n_states < 2) {
+    for (i = 0; i < n_targets; i++) {
+      grn_table_group_records(ctx, table, &(targets[i]), offset, limit);
+    }
+    return;
+  }
+
+  states = GRN_MALLOCN(grn_table_group_target_state, n_states);
+  if (!states) {
+    return;
+  }
+  n_states = 0;
+  for (i = 0; i < n_targets; i++) {
+    if (grn_table_group_target_is_sharable(ctx, table, &(targets[i]))) {
+      grn_table_group_target_state_init(ctx,
+                                        &(states[n_states]),
+                                        &(targets[i]));
+      n_states++;
+    } else {
+      grn_table_group_records(ctx, table, &(targets[i]), offset, limit);
+    }
+  }
+
+  GRN_VOID_INIT(&value_buffer);
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, offset, limit, 0);
+  if (tc) {
+    for (;;) {
+      int j, n_records = 0;
+      while (n_records < GRN_TABLE_GROUP_N_BLOCK_RECORDS &&
+             (id = grn_table_cursor_next_inline(ctx, tc))) {
+        grn_id *source_id;
+        uint32_t key_size;
+        grn_rset_recinfo *ri = NULL;
+        if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
+          grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
         }
-        DB_OBJ(rp->table)->flags.group = rp->flags;
+        source_id = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
+        ids[n_records] = id;
+        source_ids[n_records] = source_id ? *source_id : GRN_ID_NIL;
+        ris[n_records] = ri;
+        n_records++;
       }
-    }
-    if (group_by_all_records) {
-      grn_table_group_all_records(ctx, table, results);
-    } else if (n_keys == 1 && n_results == 1) {
-      if (!accelerated_table_group(ctx, table, keys->key, results)) {
-        grn_table_group_single_key_records(ctx, table, keys->key, results);
+      if (n_records == 0) {
+        break;
       }
-    } else {
-      grn_bool have_vector = GRN_FALSE;
-      for (k = 0, kp = keys; k < n_keys; k++, kp++) {
-        grn_id range_id;
-        grn_obj_flags range_flags = 0;
-        grn_obj_get_range_info(ctx, kp->key, &range_id, &range_flags);
-        if (range_flags == GRN_OBJ_VECTOR) {
-          have_vector = GRN_TRUE;
+      for (i = 0; i < n_states; i++) {
+        for (j = 0; j < n_records; j++) {
+          grn_table_group_target_state_add_record(ctx, &(states[i]),
+                                                  ids[j], source_ids[j],
+                                                  ris[j], &value_buffer);
+        }
+      }
+    }
+    grn_table_cursor_close(ctx, tc);
+  }
+  GRN_OBJ_FIN(ctx, &value_buffer);
+
+  for (i = 0; i < n_states; i++) {
+    grn_table_group_target_state_fin(ctx, &(states[i]));
+  }
+  GRN_FREE(states);
+}
+
+static grn_bool
+grn_table_group_is_run_safe_key(grn_ctx *ctx, grn_obj *key)
+{
+  grn_id range_id;
+
+  if (!key) {
+    return GRN_TRUE;
+  }
+
+  range_id = grn_obj_get_range(ctx, key);
+  if (range_id & GRN_OBJ_TMP_OBJECT) {
+    return GRN_FALSE;
+  }
+
+  switch (key->header.type) {
+  case GRN_ACCESSOR :
+    {
+      grn_accessor *a;
+      for (a = (grn_accessor *)key; a; a = a->next) {
+        switch (a->action) {
+        case GRN_ACCESSOR_GET_ID :
+        case GRN_ACCESSOR_GET_KEY :
+        case GRN_ACCESSOR_GET_VALUE :
+        case GRN_ACCESSOR_GET_SCORE :
+        case GRN_ACCESSOR_GET_NSUBRECS :
+        case GRN_ACCESSOR_GET_MAX :
+        case GRN_ACCESSOR_GET_MIN :
+        case GRN_ACCESSOR_GET_SUM :
+        case GRN_ACCESSOR_GET_AVG :
           break;
+        case GRN_ACCESSOR_GET_COLUMN_VALUE :
+          if (!grn_table_group_is_run_safe_key(ctx, a->obj)) {
+            return GRN_FALSE;
+          }
+          break;
+        default :
+          return GRN_FALSE;
         }
       }
-      if (have_vector) {
-        grn_table_group_multi_keys_vector_records(ctx, table,
-                                                  keys, n_keys,
-                                                  results, n_results);
-      } else {
-        grn_table_group_multi_keys_scalar_records(ctx, table,
-                                                  keys, n_keys,
-                                                  results, n_results);
+    }
+    return GRN_TRUE;
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_VAR_SIZE :
+    return !IS_TEMP(key);
+  default :
+    return GRN_FALSE;
+  }
+}
+
+static grn_bool
+grn_table_group_can_run_in_parallel(grn_ctx *ctx, grn_obj *table,
+                                    grn_table_group_target *targets,
+                                    int n_targets)
+{
+  int t, k, r;
+
+  for (t = 0; t < n_targets; t++) {
+    grn_table_group_target *target = &(targets[t]);
+    for (k = 0; k < target->n_keys; k++) {
+      if (!grn_table_group_is_run_safe_key(ctx, target->keys[k].key)) {
+        return GRN_FALSE;
       }
     }
-    for (r = 0, rp = results; r < n_results; r++, rp++) {
-      GRN_TABLE_GROUPED_ON(rp->table);
+    for (r = 0; r < target->n_results; r++) {
+      grn_obj *res = target->results[r].table;
+      if (res->header.type != GRN_TABLE_HASH_KEY) {
+        return GRN_FALSE;
+      }
+      if (!(DB_OBJ(res)->header.flags & GRN_OBJ_WITH_SUBREC)) {
+        return GRN_FALSE;
+      }
+      if (!grn_table_group_is_run_safe_key(ctx,
+                                           target->results[r].calc_target)) {
+        return GRN_FALSE;
+      }
     }
   }
-exit :
-  GRN_API_RETURN(rc);
+  return GRN_TRUE;
 }
 
-grn_rc
-grn_table_setoperation(grn_ctx *ctx, grn_obj *table1, grn_obj *table2, grn_obj *res,
-                       grn_operator op)
-{
-  grn_rc rc = GRN_SUCCESS;
-  void *key = NULL, *value1 = NULL, *value2 = NULL;
-  uint32_t value_size = 0;
-  uint32_t key_size = 0;
-  grn_bool have_subrec;
-  if (table1 != res) {
-    if (table2 == res) {
-      grn_obj *t = table1;
-      table1 = table2;
-      table2 = t;
-    } else {
-      return GRN_INVALID_ARGUMENT;
+/*
+ * Creates a table that has the same layout as res in run_ctx. Records
+ * in a run are grouped into it by a thread.
+ */
+static grn_obj *
+grn_table_group_run_table_create(grn_ctx *ctx, grn_ctx *run_ctx,
+                                 grn_obj *table, grn_obj *res)
+{
+  grn_obj *run_table;
+  grn_obj *key_type = NULL;
+  grn_table_flags flags;
+  uint32_t additional_value_size;
+
+  flags = GRN_TABLE_HASH_KEY|
+    GRN_OBJ_WITH_SUBREC|
+    GRN_OBJ_UNIT_USERDEF_DOCUMENT;
+  if (res->header.domain == GRN_ID_NIL) {
+    flags |= GRN_OBJ_KEY_VAR_SIZE;
+  } else {
+    key_type = grn_ctx_at(ctx, res->header.domain);
+    if (!key_type) {
+      return NULL;
     }
   }
-  have_subrec = ((DB_OBJ(table1)->header.flags & GRN_OBJ_WITH_SUBREC) &&
-                 (DB_OBJ(table2)->header.flags & GRN_OBJ_WITH_SUBREC));
-  switch (table1->header.type) {
-  case GRN_TABLE_HASH_KEY :
-    value_size = ((grn_hash *)table1)->value_size;
-    break;
-  case GRN_TABLE_PAT_KEY :
-    value_size = ((grn_pat *)table1)->value_size;
-    break;
-  case GRN_TABLE_DAT_KEY :
-    value_size = 0;
-    break;
-  case GRN_TABLE_NO_KEY :
-    value_size = ((grn_array *)table1)->value_size;
-    break;
+  additional_value_size =
+    grn_rset_recinfo_calc_values_size(ctx, DB_OBJ(res)->flags.group);
+  run_table = grn_table_create_with_max_n_subrecs(run_ctx, NULL, 0, NULL,
+                                                  flags,
+                                                  key_type, table,
+                                                  DB_OBJ(res)->max_n_subrecs,
+                                                  additional_value_size);
+  if (key_type) {
+    grn_obj_unlink(ctx, key_type);
   }
-  switch (table2->header.type) {
-  case GRN_TABLE_HASH_KEY :
-    if (value_size < ((grn_hash *)table2)->value_size) {
-      value_size = ((grn_hash *)table2)->value_size;
+  if (!run_table) {
+    return NULL;
+  }
+  if (((grn_hash *)run_table)->key_size != ((grn_hash *)res)->key_size ||
+      ((grn_hash *)run_table)->value_size != ((grn_hash *)res)->value_size ||
+      DB_OBJ(run_table)->subrec_size != DB_OBJ(res)->subrec_size ||
+      DB_OBJ(run_table)->subrec_offset != DB_OBJ(res)->subrec_offset) {
+    grn_obj_close(run_ctx, run_table);
+    return NULL;
+  }
+  DB_OBJ(run_table)->flags.group = DB_OBJ(res)->flags.group;
+  return run_table;
+}
+
+/*
+ * Merges groups in run_table into res. Groups that aren't in res yet
+ * are added in the run_table order. So groups are ordered by the first
+ * record in the table cursor order like sequential grouping when runs
+ * are merged in the range order.
+ */
+static void
+grn_table_group_run_table_merge(grn_ctx *ctx, grn_obj *res,
+                                grn_obj *run_table)
+{
+  uint32_t value_size = ((grn_hash *)res)->value_size;
+  int limit = DB_OBJ(res)->max_n_subrecs;
+  int subrec_size = DB_OBJ(res)->subrec_size;
+  void *key;
+  uint32_t key_size;
+  void *run_value;
+
+  GRN_HASH_EACH(ctx, (grn_hash *)run_table, id, &key, &key_size, &run_value, {
+    void *value;
+    int added = 0;
+    grn_rset_recinfo *ri;
+    grn_rset_recinfo *run_ri;
+    int n_subrecs;
+    int run_n_subrecs;
+
+    if (!grn_table_add_v_inline(ctx, res, key, key_size, &value, &added)) {
+      continue;
     }
-    break;
-  case GRN_TABLE_PAT_KEY :
-    if (value_size < ((grn_pat *)table2)->value_size) {
-      value_size = ((grn_pat *)table2)->value_size;
+    if (added) {
+      grn_memcpy(value, run_value, value_size);
+      continue;
     }
-    break;
-  case GRN_TABLE_DAT_KEY :
-    value_size = 0;
-    break;
-  case GRN_TABLE_NO_KEY :
-    if (value_size < ((grn_array *)table2)->value_size) {
-      value_size = ((grn_array *)table2)->value_size;
+
+    ri = value;
+    run_ri = run_value;
+    n_subrecs = GRN_RSET_N_SUBRECS(ri);
+    run_n_subrecs = GRN_RSET_N_SUBRECS(run_ri);
+    grn_rset_recinfo_merge_calc_values(ctx, ri, res, run_ri);
+    ri->score += run_ri->score;
+    if (limit) {
+      int i;
+      int n_run_subrecs = run_n_subrecs < limit ? run_n_subrecs : limit;
+      for (i = 0; i < n_run_subrecs; i++) {
+        double *subrec = GRN_RSET_SUBRECS_NTH(run_ri->subrecs, subrec_size, i);
+        byte *body = (byte *)subrec + GRN_RSET_SCORE_SIZE;
+        n_subrecs++;
+        if (limit < n_subrecs) {
+          if (GRN_RSET_SUBRECS_CMP(*subrec, *((double *)(ri->subrecs)), 0) > 0) {
+            subrecs_replace_min((byte *)ri->subrecs, subrec_size, limit,
+                                *subrec, body, 0);
+          }
+        } else {
+          subrecs_push((byte *)ri->subrecs, subrec_size, n_subrecs,
+                       *subrec, body, 0);
+        }
+      }
+    }
+    ri->n_subrecs += run_n_subrecs;
+  });
+}
+
+typedef struct {
+  grn_ctx worker_ctx;
+  grn_thread thread;
+  grn_bool running;
+  grn_obj *table;
+  /* The first run groups into the given results directly. */
+  grn_table_group_target *targets;
+  int n_targets;
+  /* The range of records in the table cursor order. */
+  int offset;
+  int limit;
+} grn_table_group_run;
+
+static void
+grn_table_group_run_process(grn_ctx *ctx, grn_table_group_run *run)
+{
+  grn_table_group_targets_records(ctx, run->table,
+                                  run->targets, run->n_targets,
+                                  run->offset, run->limit);
+}
+
+static grn_thread_func_result CALLBACK
+grn_table_group_run_process_thread(void *arg)
+{
+  grn_table_group_run *run = arg;
+  grn_table_group_run_process(&(run->worker_ctx), run);
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+/*
+ * Returns GRN_FALSE without grouping any records when runs can't be
+ * prepared.
+ *
+ * Records are split into n_runs ranges in the table cursor order. Each
+ * range is grouped into thread local tables by a thread. The first run
+ * is processed in the current thread. Thread local tables are merged
+ * into the results in the range order at the end.
+ */
+static grn_bool
+grn_table_group_parallel(grn_ctx *ctx, grn_obj *table,
+                         grn_table_group_target *targets, int n_targets,
+                         int n_runs)
+{
+  int i, t, r, n;
+  int n_total_results = 0;
+  int n_inited_runs = 0;
+  grn_bool processed = GRN_FALSE;
+  grn_table_group_run *runs = NULL;
+  grn_table_group_target *run_targets = NULL;
+  grn_table_group_result *run_results = NULL;
+
+  n = grn_table_size(ctx, table);
+  if (n_runs > n) {
+    n_runs = n;
+  }
+  if (n_runs < 2) {
+    return GRN_FALSE;
+  }
+  for (t = 0; t < n_targets; t++) {
+    n_total_results += targets[t].n_results;
+  }
+  runs = GRN_MALLOC(sizeof(grn_table_group_run) * n_runs);
+  run_targets = GRN_CALLOC(sizeof(grn_table_group_target) *
+                           n_targets * n_runs);
+  run_results = GRN_CALLOC(sizeof(grn_table_group_result) *
+                           n_total_results * n_runs);
+  if (!runs || !run_targets || !run_results) {
+    goto exit;
+  }
+  for (i = 0; i < n_runs; i++) {
+    grn_table_group_run *run = &(runs[i]);
+    int run_offset = (int)((int64_t)n * i / n_runs);
+    int next_run_offset = (int)((int64_t)n * (i + 1) / n_runs);
+    grn_table_group_result *results;
+    run->running = GRN_FALSE;
+    if (i > 0) {
+      if (grn_ctx_init(&(run->worker_ctx), 0) != GRN_SUCCESS) {
+        break;
+      }
+      grn_ctx_use(&(run->worker_ctx), grn_ctx_db(ctx));
+    }
+    n_inited_runs++;
+    run->table = table;
+    run->n_targets = n_targets;
+    run->offset = run_offset;
+    run->limit = next_run_offset - run_offset;
+    if (i == 0) {
+      run->targets = targets;
+      continue;
+    }
+    run->targets = run_targets + n_targets * i;
+    results = run_results + n_total_results * i;
+    for (t = 0; t < n_targets; t++) {
+      grn_table_group_target *target = &(run->targets[t]);
+      *target = targets[t];
+      target->results = results;
+      results += target->n_results;
+      for (r = 0; r < target->n_results; r++) {
+        target->results[r] = targets[t].results[r];
+        target->results[r].table =
+          grn_table_group_run_table_create(ctx, &(run->worker_ctx),
+                                           table, targets[t].results[r].table);
+        if (!target->results[r].table) {
+          break;
+        }
+      }
+      if (r < target->n_results) {
+        break;
+      }
+    }
+    if (t < n_targets) {
+      break;
+    }
+  }
+  if (i < n_runs) {
+    goto exit;
+  }
+
+  processed = GRN_TRUE;
+  for (i = 1; i < n_runs; i++) {
+    if (THREAD_CREATE(runs[i].thread,
+                      grn_table_group_run_process_thread,
+                      &(runs[i]))) {
+      runs[i].running = GRN_FALSE;
+    } else {
+      runs[i].running = GRN_TRUE;
+    }
+  }
+  grn_table_group_run_process(ctx, &(runs[0]));
+  for (i = 1; i < n_runs; i++) {
+    if (runs[i].running) {
+      THREAD_JOIN(runs[i].thread);
+      runs[i].running = GRN_FALSE;
+    } else {
+      grn_table_group_run_process(&(runs[i].worker_ctx), &(runs[i]));
+    }
+  }
+
+  for (i = 1; i < n_runs; i++) {
+    grn_ctx *run_ctx = &(runs[i].worker_ctx);
+    if (run_ctx->rc != GRN_SUCCESS) {
+      if (ctx->rc == GRN_SUCCESS) {
+        ERR(run_ctx->rc, "[table][group] run failed: %s", run_ctx->errbuf);
+      }
+      break;
+    }
+    for (t = 0; t < n_targets; t++) {
+      for (r = 0; r < targets[t].n_results; r++) {
+        grn_table_group_run_table_merge(ctx,
+                                        targets[t].results[r].table,
+                                        runs[i].targets[t].results[r].table);
+      }
+    }
+  }
+
+exit :
+  if (runs) {
+    for (i = 1; i < n_inited_runs; i++) {
+      for (t = 0; t < n_targets; t++) {
+        grn_table_group_target *target = &(runs[i].targets[t]);
+        for (r = 0; r < target->n_results; r++) {
+          grn_obj *run_table = target->results[r].table;
+          if (run_table) {
+            grn_obj_close(&(runs[i].worker_ctx), run_table);
+          }
+        }
+      }
+      grn_ctx_fin(&(runs[i].worker_ctx));
+    }
+    GRN_FREE(runs);
+  }
+  if (run_targets) {
+    GRN_FREE(run_targets);
+  }
+  if (run_results) {
+    GRN_FREE(run_results);
+  }
+  return processed;
+}
+
+static grn_bool
+grn_table_group_target_prepare(grn_ctx *ctx, grn_obj *table,
+                               grn_table_group_target *target)
+{
+  int k, r;
+  grn_table_sort_key *kp;
+  grn_table_group_result *rp;
+  grn_table_sort_key *keys = target->keys;
+  int n_keys = target->n_keys;
+
+  for (k = 0, kp = keys; k < n_keys; k++, kp++) {
+    if ((kp->flags & GRN_TABLE_GROUP_BY_COLUMN_VALUE) && !kp->key) {
+      ERR(GRN_INVALID_ARGUMENT, "column missing in (%d)", k);
+      return GRN_FALSE;
+    }
+  }
+  for (r = 0, rp = target->results; r < target->n_results; r++, rp++) {
+    if (!rp->table) {
+      grn_table_flags flags;
+      grn_obj *key_type = NULL;
+      uint32_t additional_value_size;
+
+      flags = GRN_TABLE_HASH_KEY|
+        GRN_OBJ_WITH_SUBREC|
+        GRN_OBJ_UNIT_USERDEF_DOCUMENT;
+      if (target->group_by_all_records) {
+        key_type = grn_ctx_at(ctx, GRN_DB_SHORT_TEXT);
+      } else if (n_keys == 1) {
+        key_type = grn_ctx_at(ctx, grn_obj_get_range(ctx, keys[0].key));
+      } else {
+        flags |= GRN_OBJ_KEY_VAR_SIZE;
+      }
+      additional_value_size = grn_rset_recinfo_calc_values_size(ctx,
+                                                                rp->flags);
+      rp->table = grn_table_create_with_max_n_subrecs(ctx, NULL, 0, NULL,
+                                                      flags,
+                                                      key_type, table,
+                                                      rp->max_n_subrecs,
+                                                      additional_value_size);
+      if (key_type) {
+        grn_obj_unlink(ctx, key_type);
+      }
+      if (!rp->table) {
+        return GRN_FALSE;
+      }
+      DB_OBJ(rp->table)->flags.group = rp->flags;
+    }
+  }
+  target->have_vector = GRN_FALSE;
+  if (!target->group_by_all_records &&
+      !(n_keys == 1 && target->n_results == 1)) {
+    for (k = 0, kp = keys; k < n_keys; k++, kp++) {
+      grn_id range_id;
+      grn_obj_flags range_flags = 0;
+      grn_obj_get_range_info(ctx, kp->key, &range_id, &range_flags);
+      if (range_flags == GRN_OBJ_VECTOR) {
+        target->have_vector = GRN_TRUE;
+        break;
+      }
+    }
+  }
+  return GRN_TRUE;
+}
+
+static void
+grn_table_group_targets(grn_ctx *ctx, grn_obj *table,
+                        grn_table_group_target *targets, int n_targets)
+{
+  int t, r;
+  /*
+   * Each run has at least grn_table_group_parallel_threshold
+   * records. Runs are processed by threads with their own contexts
+   * only when keys don't refer temporary objects.
+   */
+  int n_runs = 1;
+  int n_workers = grn_ctx_get_n_workers(ctx);
+  if (n_workers > 1 &&
+      grn_table_group_can_run_in_parallel(ctx, table, targets, n_targets)) {
+    int n = grn_table_size(ctx, table);
+    if (grn_table_group_parallel_threshold > 0) {
+      n_runs = n / grn_table_group_parallel_threshold;
+    } else {
+      n_runs = n;
+    }
+    if (n_runs > n_workers) {
+      n_runs = n_workers;
+    }
+  }
+  if (n_runs < 2 ||
+      !grn_table_group_parallel(ctx, table, targets, n_targets, n_runs)) {
+    grn_table_group_targets_records(ctx, table, targets, n_targets, 0, -1);
+  }
+  for (t = 0; t < n_targets; t++) {
+    for (r = 0; r < targets[t].n_results; r++) {
+      GRN_TABLE_GROUPED_ON(targets[t].results[r].table);
+    }
+  }
+}
+
+grn_rc
+grn_table_group(grn_ctx *ctx, grn_obj *table,
+                grn_table_sort_key *keys, int n_keys,
+                grn_table_group_result *results, int n_results)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_bool group_by_all_records = GRN_FALSE;
+  if (n_keys == 0 && n_results == 1) {
+    group_by_all_records = GRN_TRUE;
+  } else if (!table || !n_keys || !n_results) {
+    ERR(GRN_INVALID_ARGUMENT, "table or n_keys or n_results is void");
+    return GRN_INVALID_ARGUMENT;
+  }
+  GRN_API_ENTER;
+  {
+    grn_table_group_target target;
+    target.keys = keys;
+    target.n_keys = n_keys;
+    target.results = results;
+    target.n_results = n_results;
+    target.group_by_all_records = group_by_all_records;
+    if (!grn_table_group_target_prepare(ctx, table, &target)) {
+      goto exit;
+    }
+    grn_table_group_targets(ctx, table, &target, 1);
+  }
+exit :
+  GRN_API_RETURN(rc);
+}
+
+grn_rc
+grn_table_group_multi(grn_ctx *ctx, grn_obj *table,
+                      grn_table_group_spec *specs, int n_specs)
+{
+  int i;
+  grn_table_group_target *targets;
+
+  if (!table || n_specs <= 0) {
+    ERR(GRN_INVALID_ARGUMENT, "[table][group][multi] table or n_specs is void");
+    return GRN_INVALID_ARGUMENT;
+  }
+  GRN_API_ENTER;
+  targets = GRN_MALLOCN(grn_table_group_target, n_specs);
+  if (!targets) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[table][group][multi] failed to allocate targets: <%d>", n_specs);
+    GRN_API_RETURN(ctx->rc);
+  }
+  for (i = 0; i < n_specs; i++) {
+    grn_table_group_spec *spec = &(specs[i]);
+    grn_table_group_target *target = &(targets[i]);
+    target->keys = spec->keys;
+    target->n_keys = spec->n_keys;
+    target->results = spec->results;
+    target->n_results = spec->n_results;
+    target->group_by_all_records = GRN_FALSE;
+    if (spec->n_keys == 0 && spec->n_results == 1) {
+      target->group_by_all_records = GRN_TRUE;
+    } else if (!spec->n_keys || !spec->n_results) {
+      ERR(GRN_INVALID_ARGUMENT,
+          "[table][group][multi][%d] n_keys or n_results is void", i);
+      goto exit;
+    }
+    if (!grn_table_group_target_prepare(ctx, table, target)) {
+      goto exit;
+    }
+  }
+  grn_table_group_targets(ctx, table, targets, n_specs);
+exit :
+  GRN_FREE(targets);
+  GRN_API_RETURN(ctx->rc);
+}
+
+typedef struct {
+  grn_id key;
+  grn_id id;
+  void *value;
+} grn_table_setoperation_entry;
+
+#define GRN_TABLE_SETOPERATION_RADIX_BITS 11
+#define GRN_TABLE_SETOPERATION_RADIX_SIZE (1 << GRN_TABLE_SETOPERATION_RADIX_BITS)
+#define GRN_TABLE_SETOPERATION_MAX_SIZE_RATIO 4
+
+static grn_bool
+grn_table_setoperation_can_merge(grn_ctx *ctx,
+                                 grn_obj *table1,
+                                 grn_obj *table2)
+{
+  uint32_t size1, size2;
+
+  if (grn_table_setoperation_merge_threshold <= 0) {
+    return GRN_FALSE;
+  }
+  if (table1->header.type != GRN_TABLE_HASH_KEY ||
+      table2->header.type != GRN_TABLE_HASH_KEY) {
+    return GRN_FALSE;
+  }
+  if (table1->header.domain != table2->header.domain) {
+    return GRN_FALSE;
+  }
+  if (((grn_hash *)table1)->key_size != sizeof(grn_id) ||
+      ((grn_hash *)table2)->key_size != sizeof(grn_id)) {
+    return GRN_FALSE;
+  }
+  size1 = GRN_HASH_SIZE((grn_hash *)table1);
+  size2 = GRN_HASH_SIZE((grn_hash *)table2);
+  if (size1 < grn_table_setoperation_merge_threshold ||
+      size2 < grn_table_setoperation_merge_threshold) {
+    return GRN_FALSE;
+  }
+  /* Probing the larger table is cheaper than listing all of its records. */
+  if (size1 > size2 * GRN_TABLE_SETOPERATION_MAX_SIZE_RATIO ||
+      size2 > size1 * GRN_TABLE_SETOPERATION_MAX_SIZE_RATIO) {
+    return GRN_FALSE;
+  }
+  return GRN_TRUE;
+}
+
+/* LSD radix sort by key. entries are sorted into buffer and swapped. */
+static void
+grn_table_setoperation_entries_sort(grn_ctx *ctx,
+                                    grn_table_setoperation_entry **entries,
+                                    grn_table_setoperation_entry **buffer,
+                                    uint32_t n_entries)
+{
+  uint32_t shift;
+  uint32_t counts[GRN_TABLE_SETOPERATION_RADIX_SIZE];
+
+  for (shift = 0;
+       shift < sizeof(grn_id) * 8;
+       shift += GRN_TABLE_SETOPERATION_RADIX_BITS) {
+    uint32_t i;
+    uint32_t offset = 0;
+    grn_table_setoperation_entry *source = *entries;
+    grn_table_setoperation_entry *destination = *buffer;
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n_entries; i++) {
+      counts[(source[i].key >> shift) &
+             (GRN_TABLE_SETOPERATION_RADIX_SIZE - 1)]++;
+    }
+    if (counts[(source[0].key >> shift) &
+               (GRN_TABLE_SETOPERATION_RADIX_SIZE - 1)] == n_entries) {
+      continue;
+    }
+    for (i = 0; i < GRN_TABLE_SETOPERATION_RADIX_SIZE; i++) {
+      uint32_t count = counts[i];
+      counts[i] = offset;
+      offset += count;
+    }
+    for (i = 0; i < n_entries; i++) {
+      uint32_t digit = (source[i].key >> shift) &
+        (GRN_TABLE_SETOPERATION_RADIX_SIZE - 1);
+      destination[counts[digit]++] = source[i];
+    }
+    *entries = destination;
+    *buffer = source;
+  }
+}
+
+/*
+ * Lists records in hash as entries sorted by key. Result sets are
+ * usually sorted already because records are added in ID order.
+ */
+static grn_table_setoperation_entry *
+grn_table_setoperation_entries_open(grn_ctx *ctx,
+                                    grn_hash *hash,
+                                    uint32_t *n_entries)
+{
+  grn_table_setoperation_entry *entries;
+  uint32_t n = 0;
+  grn_bool sorted = GRN_TRUE;
+  grn_id *key;
+  void *value;
+
+  entries = GRN_MALLOCN(grn_table_setoperation_entry, GRN_HASH_SIZE(hash));
+  if (!entries) {
+    return NULL;
+  }
+  GRN_HASH_EACH(ctx, hash, id, &key, NULL, &value, {
+    if (n > 0 && entries[n - 1].key > *key) {
+      sorted = GRN_FALSE;
+    }
+    entries[n].key = *key;
+    entries[n].id = id;
+    entries[n].value = value;
+    n++;
+  });
+  if (!sorted) {
+    grn_table_setoperation_entry *buffer;
+    grn_table_setoperation_entry *allocated = entries;
+    buffer = GRN_MALLOCN(grn_table_setoperation_entry, n);
+    if (!buffer) {
+      GRN_FREE(entries);
+      return NULL;
+    }
+    grn_table_setoperation_entries_sort(ctx, &entries, &buffer, n);
+    if (entries == allocated) {
+      GRN_FREE(buffer);
+    } else {
+      GRN_FREE(allocated);
+    }
+  }
+  *n_entries = n;
+  return entries;
+}
+
+/*
+ * Result sets usually have no columns and no delete hooks. Records in
+ * them can be deleted without grn_table_delete_prepare() that lists
+ * columns for each record.
+ */
+static grn_bool
+grn_table_setoperation_need_delete_prepare(grn_ctx *ctx, grn_obj *table)
+{
+  grn_hash *columns;
+  int n_columns;
+
+  if (DB_OBJ(table)->hooks[GRN_HOOK_DELETE]) {
+    return GRN_TRUE;
+  }
+  columns = grn_hash_create(ctx, NULL, sizeof(grn_id), 0,
+                            GRN_OBJ_TABLE_HASH_KEY|GRN_HASH_TINY);
+  if (!columns) {
+    return GRN_TRUE;
+  }
+  n_columns = grn_table_columns(ctx, table, "", 0, (grn_obj *)columns);
+  grn_hash_close(ctx, columns);
+  return n_columns > 0;
+}
+
+/*
+ * Deletes entries[i].id from table in the order of entries[i].key. It is
+ * the order that hash probing deletes records in. Reused IDs of deleted
+ * records depend on it.
+ */
+static void
+grn_table_setoperation_delete_entries(grn_ctx *ctx, grn_obj *table,
+                                      grn_table_setoperation_entry *entries,
+                                      uint32_t n_entries)
+{
+  uint32_t i;
+  grn_bool need_delete_prepare;
+  grn_table_setoperation_entry *allocated = NULL;
+
+  for (i = 1; i < n_entries; i++) {
+    if (entries[i - 1].key > entries[i].key) {
+      break;
+    }
+  }
+  if (i < n_entries) {
+    allocated = GRN_MALLOCN(grn_table_setoperation_entry, n_entries);
+    if (allocated) {
+      grn_table_setoperation_entry *buffer = allocated;
+      grn_table_setoperation_entries_sort(ctx, &entries, &buffer, n_entries);
+    }
+  }
+
+  need_delete_prepare =
+    grn_table_setoperation_need_delete_prepare(ctx, table);
+  for (i = 0; i < n_entries; i++) {
+    if (need_delete_prepare) {
+      _grn_table_delete_by_id(ctx, table, entries[i].id, NULL);
+    } else {
+      grn_hash_delete_by_id(ctx, (grn_hash *)table, entries[i].id, NULL);
+    }
+  }
+
+  if (allocated) {
+    GRN_FREE(allocated);
+  }
+}
+
+/*
+ * Intersects table1 with table2 by walking both of them in key order
+ * instead of probing table2 for each record. OR and ADJUST don't use
+ * it because they probe only for records in table2 anyway.
+ */
+static grn_bool
+grn_table_setoperation_merge(grn_ctx *ctx, grn_obj *table1, grn_obj *table2,
+                             grn_operator op, grn_bool have_subrec)
+{
+  grn_table_setoperation_entry *entries1;
+  grn_table_setoperation_entry *entries2;
+  grn_table_setoperation_entry *deleted_entries;
+  uint32_t n_entries1 = 0, n_entries2 = 0, n_deleted_entries = 0;
+  uint32_t i = 0, j = 0;
+
+  if (!(op == GRN_OP_AND || op == GRN_OP_AND_NOT)) {
+    return GRN_FALSE;
+  }
+
+  entries1 = grn_table_setoperation_entries_open(ctx, (grn_hash *)table1,
+                                                 &n_entries1);
+  if (!entries1) {
+    return GRN_FALSE;
+  }
+  entries2 = grn_table_setoperation_entries_open(ctx, (grn_hash *)table2,
+                                                 &n_entries2);
+  if (!entries2) {
+    GRN_FREE(entries1);
+    return GRN_FALSE;
+  }
+
+  /*
+   * Deleted records are stored into the walked part of entries1 for AND
+   * and entries2 for AND_NOT with the order of hash probing as key.
+   */
+  deleted_entries = (op == GRN_OP_AND) ? entries1 : entries2;
+  while (i < n_entries1 && j < n_entries2) {
+    grn_table_setoperation_entry entry1 = entries1[i];
+    grn_table_setoperation_entry entry2 = entries2[j];
+    if (entry1.key < entry2.key) {
+      if (op == GRN_OP_AND) {
+        deleted_entries[n_deleted_entries].key = entry1.id;
+        deleted_entries[n_deleted_entries].id = entry1.id;
+        n_deleted_entries++;
+      }
+      i++;
+    } else if (entry1.key > entry2.key) {
+      j++;
+    } else {
+      if (op == GRN_OP_AND) {
+        if (have_subrec) {
+          grn_rset_recinfo *ri1 = entry1.value;
+          grn_rset_recinfo *ri2 = entry2.value;
+          ri1->score += ri2->score;
+        }
+      } else {
+        deleted_entries[n_deleted_entries].key = entry2.id;
+        deleted_entries[n_deleted_entries].id = entry1.id;
+        n_deleted_entries++;
+      }
+      i++;
+      j++;
+    }
+  }
+  if (op == GRN_OP_AND) {
+    for (; i < n_entries1; i++) {
+      grn_id id = entries1[i].id;
+      deleted_entries[n_deleted_entries].key = id;
+      deleted_entries[n_deleted_entries].id = id;
+      n_deleted_entries++;
+    }
+  }
+  grn_table_setoperation_delete_entries(ctx, table1,
+                                        deleted_entries, n_deleted_entries);
+  GRN_FREE(entries1);
+  GRN_FREE(entries2);
+
+  return GRN_TRUE;
+}
+
+grn_rc
+grn_table_setoperation(grn_ctx *ctx, grn_obj *table1, grn_obj *table2, grn_obj *res,
+                       grn_operator op)
+{
+  grn_rc rc = GRN_SUCCESS;
+  void *key = NULL, *value1 = NULL, *value2 = NULL;
+  uint32_t value_size = 0;
+  uint32_t key_size = 0;
+  grn_bool have_subrec;
+  if (table1 != res) {
+    if (table2 == res) {
+      grn_obj *t = table1;
+      table1 = table2;
+      table2 = t;
+    } else {
+      return GRN_INVALID_ARGUMENT;
+    }
+  }
+  have_subrec = ((DB_OBJ(table1)->header.flags & GRN_OBJ_WITH_SUBREC) &&
+                 (DB_OBJ(table2)->header.flags & GRN_OBJ_WITH_SUBREC));
+  switch (table1->header.type) {
+  case GRN_TABLE_HASH_KEY :
+    value_size = ((grn_hash *)table1)->value_size;
+    break;
+  case GRN_TABLE_PAT_KEY :
+    value_size = ((grn_pat *)table1)->value_size;
+    break;
+  case GRN_TABLE_DAT_KEY :
+    value_size = 0;
+    break;
+  case GRN_TABLE_NO_KEY :
+    value_size = ((grn_array *)table1)->value_size;
+    break;
+  }
+  switch (table2->header.type) {
+  case GRN_TABLE_HASH_KEY :
+    if (value_size < ((grn_hash *)table2)->value_size) {
+      value_size = ((grn_hash *)table2)->value_size;
+    }
+    break;
+  case GRN_TABLE_PAT_KEY :
+    if (value_size < ((grn_pat *)table2)->value_size) {
+      value_size = ((grn_pat *)table2)->value_size;
+    }
+    break;
+  case GRN_TABLE_DAT_KEY :
+    value_size = 0;
+    break;
+  case GRN_TABLE_NO_KEY :
+    if (value_size < ((grn_array *)table2)->value_size) {
+      value_size = ((grn_array *)table2)->value_size;
     }
     break;
   }
+  if (grn_table_setoperation_can_merge(ctx, table1, table2) &&
+      grn_table_setoperation_merge(ctx, table1, table2, op, have_subrec)) {
+    return rc;
+  }
   switch (op) {
   case GRN_OP_OR :
     if (have_subrec) {
@@ -4367,6 +5553,55 @@ grn_table_setoperation(grn_ctx *ctx, grn_obj *table1, grn_obj *table2, grn_obj *
   return rc;
 }
 
+static grn_bool
+grn_table_difference_merge(grn_ctx *ctx, grn_obj *table1, grn_obj *table2)
+{
+  grn_table_setoperation_entry *entries1;
+  grn_table_setoperation_entry *entries2;
+  uint32_t n_entries1 = 0, n_entries2 = 0, n_deleted_entries = 0;
+  uint32_t i = 0, j = 0;
+  grn_bool walk_table2;
+
+  entries1 = grn_table_setoperation_entries_open(ctx, (grn_hash *)table1,
+                                                 &n_entries1);
+  if (!entries1) {
+    return GRN_FALSE;
+  }
+  entries2 = grn_table_setoperation_entries_open(ctx, (grn_hash *)table2,
+                                                 &n_entries2);
+  if (!entries2) {
+    GRN_FREE(entries1);
+    return GRN_FALSE;
+  }
+  /* Hash probing walks the smaller table. */
+  walk_table2 = (n_entries1 > n_entries2);
+  while (i < n_entries1 && j < n_entries2) {
+    grn_table_setoperation_entry entry1 = entries1[i];
+    grn_table_setoperation_entry entry2 = entries2[j];
+    if (entry1.key < entry2.key) {
+      i++;
+    } else if (entry1.key > entry2.key) {
+      j++;
+    } else {
+      grn_id order = walk_table2 ? entry2.id : entry1.id;
+      entries1[n_deleted_entries].key = order;
+      entries1[n_deleted_entries].id = entry1.id;
+      entries2[n_deleted_entries].key = order;
+      entries2[n_deleted_entries].id = entry2.id;
+      n_deleted_entries++;
+      i++;
+      j++;
+    }
+  }
+  grn_table_setoperation_delete_entries(ctx, table1,
+                                        entries1, n_deleted_entries);
+  grn_table_setoperation_delete_entries(ctx, table2,
+                                        entries2, n_deleted_entries);
+  GRN_FREE(entries1);
+  GRN_FREE(entries2);
+  return GRN_TRUE;
+}
+
 grn_rc
 grn_table_difference(grn_ctx *ctx, grn_obj *table1, grn_obj *table2,
                      grn_obj *res1, grn_obj *res2)
@@ -4374,6 +5609,10 @@ grn_table_difference(grn_ctx *ctx, grn_obj *table1, grn_obj *table2,
   void *key = NULL;
   uint32_t key_size = 0;
   if (table1 != res1 || table2 != res2) { return GRN_INVALID_ARGUMENT; }
+  if (grn_table_setoperation_can_merge(ctx, table1, table2) &&
+      grn_table_difference_merge(ctx, table1, table2)) {
+    return GRN_SUCCESS;
+  }
   if (grn_table_size(ctx, table1) > grn_table_size(ctx, table2)) {
     GRN_TABLE_EACH(ctx, table2, 0, 0, id, &key, &key_size, NULL, {
       grn_id id1;
@@ -4698,12 +5937,48 @@ grn_column_create(grn_ctx *ctx, grn_obj *table,
       goto exit;
     }
   }
+  if ((flags & GRN_OBJ_COLUMN_TYPE_MASK) != GRN_OBJ_COLUMN_INDEX &&
+      (flags & GRN_OBJ_WITH_ZONE_MAP) &&
+      ((flags & GRN_OBJ_COLUMN_TYPE_MASK) != GRN_OBJ_COLUMN_SCALAR ||
+       (flags & GRN_OBJ_KEY_VAR_SIZE) || value_size > sizeof(int64_t))) {
+    ERR(GRN_INVALID_ARGUMENT,
+        "[column][create] WITH_ZONE_MAP requires fixed size scalar column: "
+        "<%.*s>",
+        name_size, fullname);
+    goto exit;
+  }
   switch (flags & GRN_OBJ_COLUMN_TYPE_MASK) {
   case GRN_OBJ_COLUMN_SCALAR :
     if ((flags & GRN_OBJ_KEY_VAR_SIZE) || value_size > sizeof(int64_t)) {
       res = (grn_obj *)grn_ja_create(ctx, path, value_size, flags);
+    } else if (flags & (GRN_OBJ_COMPRESS_BLOCK | GRN_OBJ_WITH_ZONE_MAP)) {
+      uint32_t ra_flags =
+        flags & (GRN_OBJ_COMPRESS_BLOCK | GRN_OBJ_WITH_ZONE_MAP);
+      if (type->header.type == GRN_TYPE) {
+        switch (type->header.flags & GRN_OBJ_KEY_MASK) {
+        case GRN_OBJ_KEY_INT :
+          ra_flags |= GRN_OBJ_KEY_INT;
+          break;
+        case GRN_OBJ_KEY_UINT :
+          ra_flags |= GRN_OBJ_KEY_UINT;
+          break;
+        default :
+          ra_flags = 0;
+          break;
+        }
+      }
+      if (!ra_flags) {
+        ERR(GRN_INVALID_ARGUMENT,
+            "[column][create] %s for fixed size value "
+            "requires integer, time or reference type: <%.*s>",
+            (flags & GRN_OBJ_COMPRESS_BLOCK) ?
+            "COMPRESS_BLOCK" : "WITH_ZONE_MAP",
+            name_size, fullname);
+        goto exit;
+      }
+      res = (grn_obj *)grn_ra_create(ctx, path, value_size, ra_flags);
     } else {
-      res = (grn_obj *)grn_ra_create(ctx, path, value_size);
+      res = (grn_obj *)grn_ra_create(ctx, path, value_size, 0);
     }
     break;
   case GRN_OBJ_COLUMN_VECTOR :
@@ -4820,6 +6095,10 @@ default_column_set_value(grn_ctx *ctx, grn_proc_ctx *pctx, grn_obj *in, grn_obj
       if (((grn_ra *)pctx->obj)->header->element_size < value_size) {
         ERR(GRN_INVALID_ARGUMENT, "too long value (%d)", value_size);
         return GRN_INVALID_ARGUMENT;
+      } else if (GRN_RA_HAS_BLOCK_SUMMARY((grn_ra *)pctx->obj)) {
+        int64_t v = 0;
+        grn_memcpy(&v, in->u.p.ptr, value_size);
+        return grn_ra_put(ctx, (grn_ra *)pctx->obj, arg->id, &v);
       } else {
         void *v = grn_ra_ref(ctx, (grn_ra *)pctx->obj, arg->id);
         if (!v) {
@@ -6983,6 +8262,15 @@ grn_obj_set_value_column_var_size_scalar(grn_ctx *ctx, grn_obj *obj, grn_id id,
   }
 
   rc = grn_ja_put(ctx, (grn_ja *)obj, id, v, s, flags, NULL);
+  if (rc == GRN_SUCCESS && ((grn_ja *)obj)->stats) {
+    switch (flags & GRN_OBJ_SET_MASK) {
+    case GRN_OBJ_SET :
+      grn_column_stats_add_value(ctx, ((grn_ja *)obj)->stats, v, s);
+      break;
+    default :
+      break;
+    }
+  }
 
   if (buf_domain != GRN_DB_VOID) {
     grn_obj_close(ctx, &buf);
@@ -7202,11 +8490,24 @@ grn_obj_set_value_column_fix_size(grn_ctx *ctx, grn_obj *obj, grn_id id,
   } else if (element_size < s) {
     ERR(GRN_INVALID_ARGUMENT, "too long value (%d)", s);
   } else {
-    void *p = grn_ra_ref(ctx, (grn_ra *)obj, id);
-    if (!p) {
-      ERR(GRN_NO_MEMORY_AVAILABLE, "ra get failed");
-      rc = GRN_NO_MEMORY_AVAILABLE;
-      return rc;
+    /* Values of a compressed column can't be referred. They are
+       updated in a copy and stored by grn_ra_put(). Values of a column
+       with a zone map are also stored by it to update the zone map. */
+    int64_t compressed_value = 0;
+    void *p;
+    if (GRN_RA_HAS_BLOCK_SUMMARY((grn_ra *)obj)) {
+      rc = grn_ra_get_value(ctx, (grn_ra *)obj, id, &compressed_value);
+      if (rc != GRN_SUCCESS) {
+        return rc;
+      }
+      p = &compressed_value;
+    } else {
+      p = grn_ra_ref(ctx, (grn_ra *)obj, id);
+      if (!p) {
+        ERR(GRN_NO_MEMORY_AVAILABLE, "ra get failed");
+        rc = GRN_NO_MEMORY_AVAILABLE;
+        return rc;
+      }
     }
     switch (flags & GRN_OBJ_SET_MASK) {
     case GRN_OBJ_SET :
@@ -7215,7 +8516,9 @@ grn_obj_set_value_column_fix_size(grn_ctx *ctx, grn_obj *obj, grn_id id,
           rc = ctx->rc;
         }
         GRN_OBJ_FIN(ctx, &buf);
-        grn_ra_unref(ctx, (grn_ra *)obj, id);
+        if (p != &compressed_value) {
+          grn_ra_unref(ctx, (grn_ra *)obj, id);
+        }
         return rc;
       }
       if (element_size != s) {
@@ -7232,6 +8535,9 @@ grn_obj_set_value_column_fix_size(grn_ctx *ctx, grn_obj *obj, grn_id id,
       } else {
         grn_memcpy(p, v, s);
       }
+      if (s > 0 && ((grn_ra *)obj)->stats) {
+        grn_column_stats_add_value(ctx, ((grn_ra *)obj)->stats, v, s);
+      }
       rc = GRN_SUCCESS;
       break;
     case GRN_OBJ_INCR :
@@ -7246,7 +8552,13 @@ grn_obj_set_value_column_fix_size(grn_ctx *ctx, grn_obj *obj, grn_id id,
       rc = GRN_OPERATION_NOT_SUPPORTED;
       break;
     }
-    grn_ra_unref(ctx, (grn_ra *)obj, id);
+    if (p == &compressed_value) {
+      if (rc == GRN_SUCCESS) {
+        rc = grn_ra_put(ctx, (grn_ra *)obj, id, p);
+      }
+    } else {
+      grn_ra_unref(ctx, (grn_ra *)obj, id);
+    }
   }
   GRN_OBJ_FIN(ctx, &buf);
   return rc;
@@ -7314,10 +8626,46 @@ grn_obj_set_value(grn_ctx *ctx, grn_obj *obj, grn_id id,
       rc = grn_obj_set_value_column_index(ctx, obj, id, value, flags);
       break;
     }
+    if (rc == GRN_SUCCESS) {
+      grn_obj_touch(ctx, obj, NULL);
+    }
   }
   GRN_API_RETURN(rc);
 }
 
+/*
+ * Values of a compressed fixed size column are copied into a buffer of
+ * ctx because their decoded blocks may be evicted from the shared block
+ * cache. The copy is valid until the next copy in the same context.
+ */
+static void *
+grn_obj_get_compressed_values(grn_ctx *ctx, grn_ra *ra, grn_id id,
+                              int n_values)
+{
+  grn_obj *buffer = &(ctx->impl->compressed_values);
+  uint32_t element_size = ra->header->element_size;
+  grn_ra_cache cache;
+  int i;
+
+  GRN_BULK_REWIND(buffer);
+  if (grn_bulk_space(ctx, buffer, element_size * n_values) != GRN_SUCCESS) {
+    return NULL;
+  }
+  GRN_RA_CACHE_INIT(ra, &cache);
+  for (i = 0; i < n_values; i++) {
+    void *p = grn_ra_ref_cache(ctx, ra, id + i, &cache);
+    if (!p) {
+      break;
+    }
+    grn_memcpy(GRN_BULK_HEAD(buffer) + element_size * i, p, element_size);
+  }
+  GRN_RA_CACHE_FIN(ra, &cache);
+  if (i < n_values) {
+    return NULL;
+  }
+  return GRN_BULK_HEAD(buffer);
+}
+
 const char *
 grn_obj_get_value_(grn_ctx *ctx, grn_obj *obj, grn_id id, uint32_t *size)
 {
@@ -7350,7 +8698,11 @@ grn_obj_get_value_(grn_ctx *ctx, grn_obj *obj, grn_id id, uint32_t *size)
     }
     break;
   case GRN_COLUMN_FIX_SIZE :
-    if ((value = grn_ra_ref(ctx, (grn_ra *)obj, id))) {
+    if (GRN_RA_IS_COMPRESSED((grn_ra *)obj)) {
+      if ((value = grn_obj_get_compressed_values(ctx, (grn_ra *)obj, id, 1))) {
+        *size = ((grn_ra *)obj)->header->element_size;
+      }
+    } else if ((value = grn_ra_ref(ctx, (grn_ra *)obj, id))) {
       grn_ra_unref(ctx, (grn_ra *)obj, id);
       *size = ((grn_ra *)obj)->header->element_size;
     }
@@ -7570,11 +8922,18 @@ grn_obj_get_value(grn_ctx *ctx, grn_obj *obj, grn_id id, grn_obj *value)
     value->header.domain = grn_obj_get_range(ctx, obj);
     if (id) {
       unsigned int element_size;
-      void *v = grn_ra_ref(ctx, (grn_ra *)obj, id);
-      if (v) {
-        element_size = ((grn_ra *)obj)->header->element_size;
-        grn_bulk_write(ctx, value, v, element_size);
-        grn_ra_unref(ctx, (grn_ra *)obj, id);
+      element_size = ((grn_ra *)obj)->header->element_size;
+      if (GRN_RA_IS_COMPRESSED((grn_ra *)obj)) {
+        int64_t v = 0;
+        if (grn_ra_get_value(ctx, (grn_ra *)obj, id, &v) == GRN_SUCCESS) {
+          grn_bulk_write(ctx, value, (const char *)&v, element_size);
+        }
+      } else {
+        void *v = grn_ra_ref(ctx, (grn_ra *)obj, id);
+        if (v) {
+          grn_bulk_write(ctx, value, v, element_size);
+          grn_ra_unref(ctx, (grn_ra *)obj, id);
+        }
       }
     }
     break;
@@ -7597,15 +8956,21 @@ grn_obj_get_values(grn_ctx *ctx, grn_obj *obj, grn_id offset, void **values)
       int table_size = (int)grn_table_size(ctx, domain);
       if (0 < offset && offset <= table_size) {
         grn_ra *ra = (grn_ra *)obj;
-        void *p = grn_ra_ref(ctx, ra, offset);
+        int n;
+        void *p;
+        if ((offset >> ra->element_width) == (table_size >> ra->element_width)) {
+          n = (table_size & ra->element_mask) + 1 - (offset & ra->element_mask);
+        } else {
+          n = ra->element_mask + 1 - (offset & ra->element_mask);
+        }
+        if (GRN_RA_IS_COMPRESSED(ra)) {
+          p = grn_obj_get_compressed_values(ctx, ra, offset, n);
+        } else if ((p = grn_ra_ref(ctx, ra, offset))) {
+          grn_ra_unref(ctx, ra, offset);
+        }
         if (p) {
-          if ((offset >> ra->element_width) == (table_size >> ra->element_width)) {
-            nrecords = (table_size & ra->element_mask) + 1 - (offset & ra->element_mask);
-          } else {
-            nrecords = ra->element_mask + 1 - (offset & ra->element_mask);
-          }
+          nrecords = n;
           if (values) { *values = p; }
-          grn_ra_unref(ctx, ra, offset);
         } else {
           ERR(GRN_NO_MEMORY_AVAILABLE, "ra get failed");
         }
@@ -7665,17 +9030,29 @@ grn_obj_get_info(grn_ctx *ctx, grn_obj *obj, grn_info_type type, grn_obj *valueb
     GRN_BOOL_PUT(ctx, valuebuf, GRN_FALSE);
 #endif
     break;
-  case GRN_INFO_SUPPORT_LZ4 :
+  case GRN_INFO_SUPPORT_LZ4 :
+    if (!valuebuf && !(valuebuf = grn_obj_open(ctx, GRN_BULK, 0, GRN_DB_BOOL))) {
+      ERR(GRN_INVALID_ARGUMENT,
+          "failed to open value buffer for GRN_INFO_LZ4_SUPPORT");
+      goto exit;
+    }
+#ifdef GRN_WITH_LZ4
+    GRN_BOOL_PUT(ctx, valuebuf, GRN_TRUE);
+#else /* GRN_WITH_LZ4 */
+    GRN_BOOL_PUT(ctx, valuebuf, GRN_FALSE);
+#endif /* GRN_WITH_LZ4 */
+    break;
+  case GRN_INFO_SUPPORT_ZSTD :
     if (!valuebuf && !(valuebuf = grn_obj_open(ctx, GRN_BULK, 0, GRN_DB_BOOL))) {
       ERR(GRN_INVALID_ARGUMENT,
-          "failed to open value buffer for GRN_INFO_LZ4_SUPPORT");
+          "failed to open value buffer for GRN_INFO_ZSTD_SUPPORT");
       goto exit;
     }
-#ifdef GRN_WITH_LZ4
+#ifdef GRN_WITH_ZSTD
     GRN_BOOL_PUT(ctx, valuebuf, GRN_TRUE);
-#else /* GRN_WITH_LZ4 */
+#else /* GRN_WITH_ZSTD */
     GRN_BOOL_PUT(ctx, valuebuf, GRN_FALSE);
-#endif /* GRN_WITH_LZ4 */
+#endif /* GRN_WITH_ZSTD */
     break;
   default :
     if (!obj) {
@@ -9336,6 +10713,9 @@ grn_table_update_by_id(grn_ctx *ctx, grn_obj *table, grn_id id,
     } else {
       rc = grn_dat_update_by_id(ctx, dat, id, dest_key, dest_key_size);
     }
+    if (rc == GRN_SUCCESS) {
+      grn_obj_touch(ctx, table, NULL);
+    }
   }
   GRN_API_RETURN(rc);
 }
@@ -9351,6 +10731,9 @@ grn_table_update(grn_ctx *ctx, grn_obj *table,
     rc = grn_dat_update(ctx, (grn_dat *)table,
                         src_key, src_key_size,
                         dest_key, dest_key_size);
+    if (rc == GRN_SUCCESS) {
+      grn_obj_touch(ctx, table, NULL);
+    }
   }
   GRN_API_RETURN(rc);
 }
@@ -9859,6 +11242,9 @@ grn_ctx_at(grn_ctx *ctx, grn_id id)
       if (res && res->header.type == GRN_PROC) {
         grn_plugin_ensure_registered(ctx, res);
       }
+      if (res && ctx->impl->cache_dependencies.recording) {
+        grn_cache_add_dependency(ctx, res);
+      }
     }
   }
 exit :
@@ -10616,6 +12002,18 @@ grn_obj_is_locked(grn_ctx *ctx, grn_obj *obj)
   GRN_API_RETURN(res);
 }
 
+const grn_io_lock_stats *
+grn_obj_get_lock_stats(grn_ctx *ctx, grn_obj *obj)
+{
+  grn_io *io;
+
+  io = grn_obj_io(obj);
+  if (!io) {
+    return NULL;
+  }
+  return &(io->lock_stats);
+}
+
 grn_rc
 grn_obj_flush(grn_ctx *ctx, grn_obj *obj)
 {
@@ -10640,6 +12038,12 @@ grn_obj_flush(grn_ctx *ctx, grn_obj *obj)
   case GRN_COLUMN_INDEX :
     rc = grn_ii_flush(ctx, (grn_ii *)obj);
     break;
+  case GRN_COLUMN_FIX_SIZE :
+    rc = grn_ra_flush(ctx, (grn_ra *)obj);
+    break;
+  case GRN_COLUMN_VAR_SIZE :
+    rc = grn_ja_flush(ctx, (grn_ja *)obj);
+    break;
   default :
     rc = grn_io_flush(ctx, grn_obj_io(obj));
     break;
@@ -10963,70 +12367,313 @@ part_reference(grn_ctx *ctx,
                sort_reference_entry *b, sort_reference_entry *e,
                grn_table_sort_key *keys, int n_keys)
 {
-  sort_reference_entry *c;
+  sort_reference_entry *c;
+  intptr_t d = e - b;
+  if (compare_reference(ctx, b, e, keys, n_keys)) {
+    swap_reference(b, e);
+  }
+  if (d < 2) { return NULL; }
+  c = b + (d >> 1);
+  if (compare_reference(ctx, b, c, keys, n_keys)) {
+    swap_reference(b, c);
+  } else {
+    if (compare_reference(ctx, c, e, keys, n_keys)) {
+      swap_reference(c, e);
+    }
+  }
+  if (d < 3) { return NULL; }
+  b++;
+  swap_reference(b, c);
+  c = b;
+  for (;;) {
+    do {
+      b++;
+    } while (compare_reference(ctx, c, b, keys, n_keys));
+    do {
+      e--;
+    } while (compare_reference(ctx, e, c, keys, n_keys));
+    if (b >= e) { break; }
+    swap_reference(b, e);
+  }
+  swap_reference(c, e);
+  return e;
+}
+
+static void
+sort_reference(grn_ctx *ctx,
+               sort_reference_entry *head, sort_reference_entry *tail,
+               int from, int to,
+               grn_table_sort_key *keys, int n_keys)
+{
+  sort_reference_entry *c;
+  if (head < tail && (c = part_reference(ctx, head, tail, keys, n_keys))) {
+    intptr_t m = c - head + 1;
+    if (from < m - 1) {
+      sort_reference(ctx, head, c - 1, from, to, keys, n_keys);
+    }
+    if (m < to) {
+      sort_reference(ctx, c + 1, tail, from - m, to - m, keys, n_keys);
+    }
+  }
+}
+
+static sort_reference_entry *
+pack_reference(grn_ctx *ctx, grn_obj *table,
+               sort_reference_entry *head, sort_reference_entry *tail,
+               grn_table_sort_key *keys, int n_keys)
+{
+  int i = 0;
+  sort_reference_entry e, c;
+  grn_table_cursor *tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  if (!tc) { return NULL; }
+  if ((c.id = grn_table_cursor_next_inline(ctx, tc))) {
+    c.value = grn_obj_get_value_(ctx, keys->key, c.id, &c.size);
+    while ((e.id = grn_table_cursor_next_inline(ctx, tc))) {
+      e.value = grn_obj_get_value_(ctx, keys->key, e.id, &e.size);
+      if (compare_reference(ctx, &c, &e, keys, n_keys)) {
+        *head++ = e;
+      } else {
+        *tail-- = e;
+      }
+      i++;
+    }
+    *head = c;
+    i++;
+  }
+  grn_table_cursor_close(ctx, tc);
+  return i > 2 ? head : NULL;
+}
+
+static int
+grn_table_sort_reference(grn_ctx *ctx, grn_obj *table,
+                         int offset, int limit,
+                         grn_obj *result,
+                         grn_table_sort_key *keys, int n_keys)
+{
+  int e, n;
+  sort_reference_entry *array, *ep;
+  e = offset + limit;
+  n = grn_table_size(ctx, table);
+  if (!(array = GRN_MALLOC(sizeof(sort_reference_entry) * n))) {
+    return 0;
+  }
+  if ((ep = pack_reference(ctx, table, array, array + n - 1, keys, n_keys))) {
+    intptr_t m = ep - array + 1;
+    if (offset < m - 1) {
+      sort_reference(ctx, array, ep - 1, offset, e, keys, n_keys);
+    }
+    if (m < e) {
+      sort_reference(ctx, ep + 1, array + n - 1, offset - m, e - m, keys, n_keys);
+    }
+  }
+  {
+    int i;
+    grn_id *v;
+    for (i = 0, ep = array + offset; i < limit && ep < array + n; i++, ep++) {
+      if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
+      *v = ep->id;
+    }
+    GRN_FREE(array);
+    return i;
+  }
+}
+
+
+typedef struct {
+  grn_id id;
+  grn_obj value;
+} sort_value_entry;
+
+inline static int
+compare_value(grn_ctx *ctx,
+              sort_value_entry *a, sort_value_entry *b,
+              grn_table_sort_key *keys, int n_keys,
+              grn_obj *a_buffer, grn_obj *b_buffer)
+{
+  int i;
+  uint8_t type;
+  uint32_t as, bs;
+  const unsigned char *ap, *bp;
+  for (i = 0; i < n_keys; i++, keys++) {
+    if (i) {
+      GRN_BULK_REWIND(a_buffer);
+      GRN_BULK_REWIND(b_buffer);
+      if (keys->flags & GRN_TABLE_SORT_DESC) {
+        grn_obj_get_value(ctx, keys->key, b->id, a_buffer);
+        grn_obj_get_value(ctx, keys->key, a->id, b_buffer);
+      } else {
+        grn_obj_get_value(ctx, keys->key, a->id, a_buffer);
+        grn_obj_get_value(ctx, keys->key, b->id, b_buffer);
+      }
+      ap = (const unsigned char *)GRN_BULK_HEAD(a_buffer);
+      as = GRN_BULK_VSIZE(a_buffer);
+      bp = (const unsigned char *)GRN_BULK_HEAD(b_buffer);
+      bs = GRN_BULK_VSIZE(b_buffer);
+    } else {
+      if (keys->flags & GRN_TABLE_SORT_DESC) {
+        ap = (const unsigned char *)GRN_BULK_HEAD(&b->value);
+        as = GRN_BULK_VSIZE(&b->value);
+        bp = (const unsigned char *)GRN_BULK_HEAD(&a->value);
+        bs = GRN_BULK_VSIZE(&a->value);
+      } else {
+        ap = (const unsigned char *)GRN_BULK_HEAD(&a->value);
+        as = GRN_BULK_VSIZE(&a->value);
+        bp = (const unsigned char *)GRN_BULK_HEAD(&b->value);
+        bs = GRN_BULK_VSIZE(&b->value);
+      }
+    }
+    type = keys->offset;
+    switch (type) {
+    case KEY_ID :
+      if (ap != bp) { return ap > bp; }
+      break;
+    case KEY_BULK :
+      for (;; ap++, bp++, as--, bs--) {
+        if (!as) { if (bs) { return 0; } else { break; } }
+        if (!bs) { return 1; }
+        if (*ap < *bp) { return 0; }
+        if (*ap > *bp) { return 1; }
+      }
+      break;
+    case KEY_INT8 :
+      CMPNUM(int8_t);
+      break;
+    case KEY_INT16 :
+      CMPNUM(int16_t);
+      break;
+    case KEY_INT32 :
+      CMPNUM(int32_t);
+      break;
+    case KEY_INT64 :
+      CMPNUM(int64_t);
+      break;
+    case KEY_UINT8 :
+      CMPNUM(uint8_t);
+      break;
+    case KEY_UINT16 :
+      CMPNUM(uint16_t);
+      break;
+    case KEY_UINT32 :
+      CMPNUM(uint32_t);
+      break;
+    case KEY_UINT64 :
+      CMPNUM(uint64_t);
+      break;
+    case KEY_FLOAT32 :
+      if (as) {
+        if (bs) {
+          float va = *((float *)(ap));
+          float vb = *((float *)(bp));
+          if (va < vb || va > vb) { return va > vb; }
+        } else {
+          return 1;
+        }
+      } else {
+        if (bs) { return 0; }
+      }
+      break;
+    case KEY_FLOAT64 :
+      if (as) {
+        if (bs) {
+          double va = *((double *)(ap));
+          double vb = *((double *)(bp));
+          if (va < vb || va > vb) { return va > vb; }
+        } else {
+          return 1;
+        }
+      } else {
+        if (bs) { return 0; }
+      }
+      break;
+    }
+  }
+  return 0;
+}
+
+inline static void
+swap_value(sort_value_entry *a, sort_value_entry *b)
+{
+  sort_value_entry c_ = *a;
+  *a = *b;
+  *b = c_;
+}
+
+inline static sort_value_entry *
+part_value(grn_ctx *ctx,
+           sort_value_entry *b, sort_value_entry *e,
+           grn_table_sort_key *keys, int n_keys,
+           grn_obj *a_buffer, grn_obj *b_buffer)
+{
+  sort_value_entry *c;
   intptr_t d = e - b;
-  if (compare_reference(ctx, b, e, keys, n_keys)) {
-    swap_reference(b, e);
+  if (compare_value(ctx, b, e, keys, n_keys, a_buffer, b_buffer)) {
+    swap_value(b, e);
   }
   if (d < 2) { return NULL; }
   c = b + (d >> 1);
-  if (compare_reference(ctx, b, c, keys, n_keys)) {
-    swap_reference(b, c);
+  if (compare_value(ctx, b, c, keys, n_keys, a_buffer, b_buffer)) {
+    swap_value(b, c);
   } else {
-    if (compare_reference(ctx, c, e, keys, n_keys)) {
-      swap_reference(c, e);
+    if (compare_value(ctx, c, e, keys, n_keys, a_buffer, b_buffer)) {
+      swap_value(c, e);
     }
   }
   if (d < 3) { return NULL; }
   b++;
-  swap_reference(b, c);
+  swap_value(b, c);
   c = b;
   for (;;) {
     do {
       b++;
-    } while (compare_reference(ctx, c, b, keys, n_keys));
+    } while (compare_value(ctx, c, b, keys, n_keys, a_buffer, b_buffer));
     do {
       e--;
-    } while (compare_reference(ctx, e, c, keys, n_keys));
+    } while (compare_value(ctx, e, c, keys, n_keys, a_buffer, b_buffer));
     if (b >= e) { break; }
-    swap_reference(b, e);
+    swap_value(b, e);
   }
-  swap_reference(c, e);
+  swap_value(c, e);
   return e;
 }
 
 static void
-sort_reference(grn_ctx *ctx,
-               sort_reference_entry *head, sort_reference_entry *tail,
-               int from, int to,
-               grn_table_sort_key *keys, int n_keys)
+sort_value(grn_ctx *ctx,
+           sort_value_entry *head, sort_value_entry *tail,
+           int from, int to,
+           grn_table_sort_key *keys, int n_keys,
+           grn_obj *a_buffer, grn_obj *b_buffer)
 {
-  sort_reference_entry *c;
-  if (head < tail && (c = part_reference(ctx, head, tail, keys, n_keys))) {
+  sort_value_entry *c;
+  if (head < tail && (c = part_value(ctx, head, tail, keys, n_keys,
+                                     a_buffer, b_buffer))) {
     intptr_t m = c - head + 1;
     if (from < m - 1) {
-      sort_reference(ctx, head, c - 1, from, to, keys, n_keys);
+      sort_value(ctx, head, c - 1, from, to, keys, n_keys, a_buffer, b_buffer);
     }
     if (m < to) {
-      sort_reference(ctx, c + 1, tail, from - m, to - m, keys, n_keys);
+      sort_value(ctx, c + 1, tail, from - m, to - m, keys, n_keys,
+                 a_buffer, b_buffer);
     }
   }
 }
 
-static sort_reference_entry *
-pack_reference(grn_ctx *ctx, grn_obj *table,
-               sort_reference_entry *head, sort_reference_entry *tail,
-               grn_table_sort_key *keys, int n_keys)
+static sort_value_entry *
+pack_value(grn_ctx *ctx, grn_obj *table,
+           sort_value_entry *head, sort_value_entry *tail,
+           grn_table_sort_key *keys, int n_keys,
+           grn_obj *a_buffer, grn_obj *b_buffer)
 {
   int i = 0;
-  sort_reference_entry e, c;
+  sort_value_entry e, c;
   grn_table_cursor *tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
   if (!tc) { return NULL; }
   if ((c.id = grn_table_cursor_next_inline(ctx, tc))) {
-    c.value = grn_obj_get_value_(ctx, keys->key, c.id, &c.size);
+    GRN_TEXT_INIT(&c.value, 0);
+    grn_obj_get_value(ctx, keys->key, c.id, &c.value);
     while ((e.id = grn_table_cursor_next_inline(ctx, tc))) {
-      e.value = grn_obj_get_value_(ctx, keys->key, e.id, &e.size);
-      if (compare_reference(ctx, &c, &e, keys, n_keys)) {
+      GRN_TEXT_INIT(&e.value, 0);
+      grn_obj_get_value(ctx, keys->key, e.id, &e.value);
+      if (compare_value(ctx, &c, &e, keys, n_keys, a_buffer, b_buffer)) {
         *head++ = e;
       } else {
         *tail-- = e;
@@ -11041,26 +12688,37 @@ pack_reference(grn_ctx *ctx, grn_obj *table,
 }
 
 static int
-grn_table_sort_reference(grn_ctx *ctx, grn_obj *table,
-                         int offset, int limit,
-                         grn_obj *result,
-                         grn_table_sort_key *keys, int n_keys)
+grn_table_sort_value(grn_ctx *ctx, grn_obj *table,
+                     int offset, int limit,
+                     grn_obj *result,
+                     grn_table_sort_key *keys, int n_keys)
 {
   int e, n;
-  sort_reference_entry *array, *ep;
+  sort_value_entry *array, *ep;
   e = offset + limit;
   n = grn_table_size(ctx, table);
-  if (!(array = GRN_MALLOC(sizeof(sort_reference_entry) * n))) {
+  if (!(array = GRN_MALLOC(sizeof(sort_value_entry) * n))) {
     return 0;
   }
-  if ((ep = pack_reference(ctx, table, array, array + n - 1, keys, n_keys))) {
-    intptr_t m = ep - array + 1;
-    if (offset < m - 1) {
-      sort_reference(ctx, array, ep - 1, offset, e, keys, n_keys);
-    }
-    if (m < e) {
-      sort_reference(ctx, ep + 1, array + n - 1, offset - m, e - m, keys, n_keys);
+  {
+    grn_obj a_buffer;
+    grn_obj b_buffer;
+    GRN_TEXT_INIT(&a_buffer, 0);
+    GRN_TEXT_INIT(&b_buffer, 0);
+    if ((ep = pack_value(ctx, table, array, array + n - 1, keys, n_keys,
+                         &a_buffer, &b_buffer))) {
+      intptr_t m = ep - array + 1;
+      if (offset < m - 1) {
+        sort_value(ctx, array, ep - 1, offset, e, keys, n_keys,
+                   &a_buffer, &b_buffer);
+      }
+      if (m < e) {
+        sort_value(ctx, ep + 1, array + n - 1, offset - m, e - m, keys, n_keys,
+                   &a_buffer, &b_buffer);
+      }
     }
+    GRN_OBJ_FIN(ctx, &a_buffer);
+    GRN_OBJ_FIN(ctx, &b_buffer);
   }
   {
     int i;
@@ -11074,258 +12732,619 @@ grn_table_sort_reference(grn_ctx *ctx, grn_obj *table,
   }
 }
 
+/*
+ * Radix sort: All sort keys of a record are encoded into one binary
+ * key whose memcmp() order is the sort order. So records are sorted
+ * without calling compare_*() and fetching values for each
+ * comparison.
+ *
+ * Each key is encoded as the followings. All bytes of a key are
+ * inverted for GRN_TABLE_SORT_DESC.
+ *
+ *   * Number: A presence byte and the big endian value. The sign bit
+ *     is flipped for signed integers. All bits are flipped for
+ *     negative floats and the sign bit is flipped for others.
+ *   * Text: The value padded with 0 to the max value size in the
+ *     table and the big endian value size. The size is needed to sort
+ *     "a" before "a\0".
+ */
+
+#define SORT_RADIX_MAX_KEY_SIZE 256
+#define SORT_RADIX_INSERTION_SORT_THRESHOLD 32
 
 typedef struct {
-  grn_id id;
-  grn_obj value;
-} sort_value_entry;
+  uint8_t type;
+  grn_bool descending;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t max_value_size;
+} sort_radix_key;
 
-inline static int
-compare_value(grn_ctx *ctx,
-              sort_value_entry *a, sort_value_entry *b,
-              grn_table_sort_key *keys, int n_keys,
-              grn_obj *a_buffer, grn_obj *b_buffer)
+static void
+sort_radix_encode_uint(uint8_t *key, uint64_t value, uint32_t size)
 {
-  int i;
-  uint8_t type;
-  uint32_t as, bs;
-  const unsigned char *ap, *bp;
-  for (i = 0; i < n_keys; i++, keys++) {
-    if (i) {
-      GRN_BULK_REWIND(a_buffer);
-      GRN_BULK_REWIND(b_buffer);
-      if (keys->flags & GRN_TABLE_SORT_DESC) {
-        grn_obj_get_value(ctx, keys->key, b->id, a_buffer);
-        grn_obj_get_value(ctx, keys->key, a->id, b_buffer);
-      } else {
-        grn_obj_get_value(ctx, keys->key, a->id, a_buffer);
-        grn_obj_get_value(ctx, keys->key, b->id, b_buffer);
-      }
-      ap = (const unsigned char *)GRN_BULK_HEAD(a_buffer);
-      as = GRN_BULK_VSIZE(a_buffer);
-      bp = (const unsigned char *)GRN_BULK_HEAD(b_buffer);
-      bs = GRN_BULK_VSIZE(b_buffer);
-    } else {
-      if (keys->flags & GRN_TABLE_SORT_DESC) {
-        ap = (const unsigned char *)GRN_BULK_HEAD(&b->value);
-        as = GRN_BULK_VSIZE(&b->value);
-        bp = (const unsigned char *)GRN_BULK_HEAD(&a->value);
-        bs = GRN_BULK_VSIZE(&a->value);
-      } else {
-        ap = (const unsigned char *)GRN_BULK_HEAD(&a->value);
-        as = GRN_BULK_VSIZE(&a->value);
-        bp = (const unsigned char *)GRN_BULK_HEAD(&b->value);
-        bs = GRN_BULK_VSIZE(&b->value);
-      }
+  uint32_t i;
+  for (i = 0; i < size; i++) {
+    key[size - i - 1] = (uint8_t)(value & 0xff);
+    value >>= 8;
+  }
+}
+
+static grn_bool
+sort_radix_encode(grn_ctx *ctx, sort_radix_key *radix_key,
+                  const uint8_t *value, uint32_t value_size,
+                  uint8_t *key)
+{
+  uint8_t *current = key + radix_key->offset;
+  uint32_t value_type_size = radix_key->size - 1;
+
+  if (radix_key->type == KEY_BULK) {
+    if (value_size > radix_key->max_value_size) {
+      return GRN_FALSE;
     }
-    type = keys->offset;
-    switch (type) {
+    grn_memcpy(current, value, value_size);
+    memset(current + value_size, 0, radix_key->max_value_size - value_size);
+    sort_radix_encode_uint(current + radix_key->max_value_size,
+                           value_size,
+                           radix_key->size - radix_key->max_value_size);
+  } else if (value_size < value_type_size) {
+    memset(current, 0, radix_key->size);
+  } else {
+    uint64_t encoded = 0;
+    current[0] = 1;
+    switch (radix_key->type) {
     case KEY_ID :
-      if (ap != bp) { return ap > bp; }
+    case KEY_UINT32 :
+      encoded = *((uint32_t *)value);
       break;
-    case KEY_BULK :
-      for (;; ap++, bp++, as--, bs--) {
-        if (!as) { if (bs) { return 0; } else { break; } }
-        if (!bs) { return 1; }
-        if (*ap < *bp) { return 0; }
-        if (*ap > *bp) { return 1; }
-      }
+    case KEY_UINT8 :
+      encoded = *((uint8_t *)value);
+      break;
+    case KEY_UINT16 :
+      encoded = *((uint16_t *)value);
+      break;
+    case KEY_UINT64 :
+      encoded = *((uint64_t *)value);
       break;
     case KEY_INT8 :
-      CMPNUM(int8_t);
+      encoded = (uint8_t)(*((int8_t *)value)) ^ 0x80;
       break;
     case KEY_INT16 :
-      CMPNUM(int16_t);
+      encoded = (uint16_t)(*((int16_t *)value)) ^ 0x8000;
       break;
     case KEY_INT32 :
-      CMPNUM(int32_t);
+      encoded = (uint32_t)(*((int32_t *)value)) ^ 0x80000000;
       break;
     case KEY_INT64 :
-      CMPNUM(int64_t);
-      break;
-    case KEY_UINT8 :
-      CMPNUM(uint8_t);
-      break;
-    case KEY_UINT16 :
-      CMPNUM(uint16_t);
-      break;
-    case KEY_UINT32 :
-      CMPNUM(uint32_t);
-      break;
-    case KEY_UINT64 :
-      CMPNUM(uint64_t);
+      encoded = (uint64_t)(*((int64_t *)value)) ^ (((uint64_t)1) << 63);
       break;
     case KEY_FLOAT32 :
-      if (as) {
-        if (bs) {
-          float va = *((float *)(ap));
-          float vb = *((float *)(bp));
-          if (va < vb || va > vb) { return va > vb; }
+      {
+        float float_value = *((float *)value);
+        uint32_t bits = 0;
+        /* -0.0 == 0.0 */
+        if (!(float_value <= 0.0 && float_value >= 0.0)) {
+          grn_memcpy(&bits, &float_value, sizeof(uint32_t));
+        }
+        if (bits & 0x80000000) {
+          encoded = ~bits;
         } else {
-          return 1;
+          encoded = bits ^ 0x80000000;
+        }
+      }
+      break;
+    case KEY_FLOAT64 :
+      {
+        double float_value = *((double *)value);
+        uint64_t bits = 0;
+        if (!(float_value <= 0.0 && float_value >= 0.0)) {
+          grn_memcpy(&bits, &float_value, sizeof(uint64_t));
+        }
+        if (bits & (((uint64_t)1) << 63)) {
+          encoded = ~bits;
+        } else {
+          encoded = bits ^ (((uint64_t)1) << 63);
         }
+      }
+      break;
+    default :
+      return GRN_FALSE;
+    }
+    sort_radix_encode_uint(current + 1, encoded, value_type_size);
+  }
+
+  if (radix_key->descending) {
+    uint32_t i;
+    for (i = 0; i < radix_key->size; i++) {
+      current[i] = ~current[i];
+    }
+  }
+
+  return GRN_TRUE;
+}
+
+static void
+sort_radix_insertion_sort(uint8_t **entries, size_t n_entries,
+                          size_t depth, size_t key_size)
+{
+  size_t i;
+  for (i = 1; i < n_entries; i++) {
+    uint8_t *entry = entries[i];
+    size_t j = i;
+    while (j > 0 &&
+           memcmp(entries[j - 1] + depth, entry + depth, key_size - depth) > 0) {
+      entries[j] = entries[j - 1];
+      j--;
+    }
+    entries[j] = entry;
+  }
+}
+
+/* Sorts only entries in [from, to) completely. */
+static void
+sort_radix(uint8_t **entries, uint8_t **buffer, size_t n_entries,
+           size_t depth, size_t key_size, size_t from, size_t to)
+{
+  size_t counts[256];
+  size_t i;
+
+  while (n_entries > SORT_RADIX_INSERTION_SORT_THRESHOLD &&
+         depth < key_size) {
+    uint8_t first_byte = entries[0][depth];
+    grn_bool same = GRN_TRUE;
+    for (i = 1; i < n_entries; i++) {
+      if (entries[i][depth] != first_byte) {
+        same = GRN_FALSE;
+        break;
+      }
+    }
+    if (!same) {
+      break;
+    }
+    depth++;
+  }
+  if (depth >= key_size) {
+    return;
+  }
+  if (n_entries <= SORT_RADIX_INSERTION_SORT_THRESHOLD) {
+    sort_radix_insertion_sort(entries, n_entries, depth, key_size);
+    return;
+  }
+
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < n_entries; i++) {
+    counts[entries[i][depth]]++;
+  }
+  {
+    size_t offsets[256];
+    size_t offset = 0;
+    for (i = 0; i < 256; i++) {
+      offsets[i] = offset;
+      offset += counts[i];
+    }
+    for (i = 0; i < n_entries; i++) {
+      buffer[offsets[entries[i][depth]]++] = entries[i];
+    }
+  }
+  grn_memcpy(entries, buffer, sizeof(uint8_t *) * n_entries);
+
+  {
+    size_t start = 0;
+    for (i = 0; i < 256 && start < to; i++) {
+      size_t end = start + counts[i];
+      if (counts[i] > 1 && end > from) {
+        sort_radix(entries + start, buffer, counts[i],
+                   depth + 1, key_size,
+                   from > start ? from - start : 0,
+                   (to < end ? to : end) - start);
+      }
+      start = end;
+    }
+  }
+}
+
+typedef struct {
+  grn_ctx worker_ctx;
+  grn_thread thread;
+  grn_bool running;
+  grn_obj *table;
+  grn_table_sort_key *keys;
+  int n_keys;
+  sort_radix_key *radix_keys;
+  grn_bool use_reference;
+  /* The range of records in the table cursor order. */
+  int offset;
+  int limit;
+  /* Only for KEY_BULK keys. */
+  uint32_t *max_value_sizes;
+  size_t key_size;
+  uint8_t *records;
+  uint8_t **entries;
+  uint8_t **buffer;
+  /* -1 means that a value can't be encoded. */
+  int n_entries;
+  /* The number of entries to be sorted from the head. */
+  int n_sorted_entries;
+} sort_radix_run;
+
+typedef void (*sort_radix_run_func)(grn_ctx *ctx, sort_radix_run *run);
+
+static void
+sort_radix_run_measure(grn_ctx *ctx, sort_radix_run *run)
+{
+  int i;
+  grn_table_cursor *tc;
+  grn_id id;
+  grn_obj value;
+
+  GRN_TEXT_INIT(&value, 0);
+  tc = grn_table_cursor_open(ctx, run->table, NULL, 0, NULL, 0,
+                             run->offset, run->limit, 0);
+  if (!tc) {
+    run->n_entries = -1;
+    goto exit;
+  }
+  while ((id = grn_table_cursor_next_inline(ctx, tc))) {
+    for (i = 0; i < run->n_keys; i++) {
+      uint32_t value_size;
+      if (run->radix_keys[i].type != KEY_BULK) {
+        continue;
+      }
+      if (run->use_reference) {
+        grn_obj_get_value_(ctx, run->keys[i].key, id, &value_size);
       } else {
-        if (bs) { return 0; }
+        GRN_BULK_REWIND(&value);
+        grn_obj_get_value(ctx, run->keys[i].key, id, &value);
+        if (value.header.type != GRN_BULK) {
+          run->n_entries = -1;
+          break;
+        }
+        value_size = GRN_BULK_VSIZE(&value);
+      }
+      if (value_size > run->max_value_sizes[i]) {
+        run->max_value_sizes[i] = value_size;
       }
+      if (run->max_value_sizes[i] > SORT_RADIX_MAX_KEY_SIZE) {
+        run->n_entries = -1;
+        break;
+      }
+    }
+    if (run->n_entries == -1) {
       break;
-    case KEY_FLOAT64 :
-      if (as) {
-        if (bs) {
-          double va = *((double *)(ap));
-          double vb = *((double *)(bp));
-          if (va < vb || va > vb) { return va > vb; }
-        } else {
-          return 1;
+    }
+  }
+  grn_table_cursor_close(ctx, tc);
+exit :
+  GRN_OBJ_FIN(ctx, &value);
+}
+
+static void
+sort_radix_run_sort(grn_ctx *ctx, sort_radix_run *run)
+{
+  int i;
+  int n_entries = 0;
+  size_t entry_size = run->key_size + sizeof(grn_id);
+  grn_table_cursor *tc;
+  grn_id id;
+  grn_obj value;
+
+  GRN_TEXT_INIT(&value, 0);
+  tc = grn_table_cursor_open(ctx, run->table, NULL, 0, NULL, 0,
+                             run->offset, run->limit, 0);
+  if (!tc) {
+    run->n_entries = -1;
+    goto exit;
+  }
+  while (n_entries < run->limit &&
+         (id = grn_table_cursor_next_inline(ctx, tc))) {
+    uint8_t *record = run->records + entry_size * n_entries;
+    for (i = 0; i < run->n_keys; i++) {
+      const uint8_t *raw_value;
+      uint32_t raw_value_size;
+      if (run->use_reference) {
+        raw_value = (const uint8_t *)grn_obj_get_value_(ctx, run->keys[i].key,
+                                                       id, &raw_value_size);
+        if (run->radix_keys[i].type == KEY_ID) {
+          grn_id value_id = (grn_id)(uintptr_t)raw_value;
+          GRN_BULK_REWIND(&value);
+          GRN_UINT32_PUT(ctx, &value, value_id);
+          raw_value = (const uint8_t *)GRN_BULK_HEAD(&value);
+          raw_value_size = GRN_BULK_VSIZE(&value);
         }
       } else {
-        if (bs) { return 0; }
+        GRN_BULK_REWIND(&value);
+        grn_obj_get_value(ctx, run->keys[i].key, id, &value);
+        if (value.header.type != GRN_BULK) {
+          break;
+        }
+        raw_value = (const uint8_t *)GRN_BULK_HEAD(&value);
+        raw_value_size = GRN_BULK_VSIZE(&value);
+      }
+      if (!sort_radix_encode(ctx, run->radix_keys + i,
+                             raw_value, raw_value_size,
+                             record)) {
+        break;
       }
+    }
+    if (i < run->n_keys) {
+      n_entries = -1;
       break;
     }
+    grn_memcpy(record + run->key_size, &id, sizeof(grn_id));
+    run->entries[n_entries++] = record;
   }
-  return 0;
+  grn_table_cursor_close(ctx, tc);
+  run->n_entries = n_entries;
+  if (run->n_sorted_entries > n_entries) {
+    run->n_sorted_entries = n_entries;
+  }
+  if (n_entries > 0) {
+    sort_radix(run->entries, run->buffer, n_entries, 0, run->key_size,
+               0, run->n_sorted_entries);
+  }
+exit :
+  GRN_OBJ_FIN(ctx, &value);
 }
 
-inline static void
-swap_value(sort_value_entry *a, sort_value_entry *b)
+static grn_thread_func_result CALLBACK
+sort_radix_run_measure_thread(void *arg)
 {
-  sort_value_entry c_ = *a;
-  *a = *b;
-  *b = c_;
+  sort_radix_run *run = arg;
+  sort_radix_run_measure(&(run->worker_ctx), run);
+  return GRN_THREAD_FUNC_RETURN_VALUE;
 }
 
-inline static sort_value_entry *
-part_value(grn_ctx *ctx,
-           sort_value_entry *b, sort_value_entry *e,
-           grn_table_sort_key *keys, int n_keys,
-           grn_obj *a_buffer, grn_obj *b_buffer)
+static grn_thread_func_result CALLBACK
+sort_radix_run_sort_thread(void *arg)
 {
-  sort_value_entry *c;
-  intptr_t d = e - b;
-  if (compare_value(ctx, b, e, keys, n_keys, a_buffer, b_buffer)) {
-    swap_value(b, e);
-  }
-  if (d < 2) { return NULL; }
-  c = b + (d >> 1);
-  if (compare_value(ctx, b, c, keys, n_keys, a_buffer, b_buffer)) {
-    swap_value(b, c);
-  } else {
-    if (compare_value(ctx, c, e, keys, n_keys, a_buffer, b_buffer)) {
-      swap_value(c, e);
-    }
-  }
-  if (d < 3) { return NULL; }
-  b++;
-  swap_value(b, c);
-  c = b;
-  for (;;) {
-    do {
-      b++;
-    } while (compare_value(ctx, c, b, keys, n_keys, a_buffer, b_buffer));
-    do {
-      e--;
-    } while (compare_value(ctx, e, c, keys, n_keys, a_buffer, b_buffer));
-    if (b >= e) { break; }
-    swap_value(b, e);
-  }
-  swap_value(c, e);
-  return e;
+  sort_radix_run *run = arg;
+  sort_radix_run_sort(&(run->worker_ctx), run);
+  return GRN_THREAD_FUNC_RETURN_VALUE;
 }
 
+/*
+ * Processes runs in threads. The first run is processed in the current
+ * thread. It's processed sequentially when a thread can't be created.
+ */
 static void
-sort_value(grn_ctx *ctx,
-           sort_value_entry *head, sort_value_entry *tail,
-           int from, int to,
-           grn_table_sort_key *keys, int n_keys,
-           grn_obj *a_buffer, grn_obj *b_buffer)
+sort_radix_process_runs(grn_ctx *ctx, sort_radix_run *runs, int n_runs,
+                        sort_radix_run_func func,
+                        grn_thread_func_result (CALLBACK *thread_func)(void *))
 {
-  sort_value_entry *c;
-  if (head < tail && (c = part_value(ctx, head, tail, keys, n_keys,
-                                     a_buffer, b_buffer))) {
-    intptr_t m = c - head + 1;
-    if (from < m - 1) {
-      sort_value(ctx, head, c - 1, from, to, keys, n_keys, a_buffer, b_buffer);
-    }
-    if (m < to) {
-      sort_value(ctx, c + 1, tail, from - m, to - m, keys, n_keys,
-                 a_buffer, b_buffer);
+  int i;
+  for (i = 1; i < n_runs; i++) {
+    if (THREAD_CREATE(runs[i].thread, thread_func, &(runs[i]))) {
+      runs[i].running = GRN_FALSE;
+    } else {
+      runs[i].running = GRN_TRUE;
     }
   }
-}
-
-static sort_value_entry *
-pack_value(grn_ctx *ctx, grn_obj *table,
-           sort_value_entry *head, sort_value_entry *tail,
-           grn_table_sort_key *keys, int n_keys,
-           grn_obj *a_buffer, grn_obj *b_buffer)
-{
-  int i = 0;
-  sort_value_entry e, c;
-  grn_table_cursor *tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
-  if (!tc) { return NULL; }
-  if ((c.id = grn_table_cursor_next_inline(ctx, tc))) {
-    GRN_TEXT_INIT(&c.value, 0);
-    grn_obj_get_value(ctx, keys->key, c.id, &c.value);
-    while ((e.id = grn_table_cursor_next_inline(ctx, tc))) {
-      GRN_TEXT_INIT(&e.value, 0);
-      grn_obj_get_value(ctx, keys->key, e.id, &e.value);
-      if (compare_value(ctx, &c, &e, keys, n_keys, a_buffer, b_buffer)) {
-        *head++ = e;
-      } else {
-        *tail-- = e;
-      }
-      i++;
+  func(ctx, &(runs[0]));
+  for (i = 1; i < n_runs; i++) {
+    if (runs[i].running) {
+      THREAD_JOIN(runs[i].thread);
+      runs[i].running = GRN_FALSE;
+    } else {
+      func(ctx, &(runs[i]));
     }
-    *head = c;
-    i++;
   }
-  grn_table_cursor_close(ctx, tc);
-  return i > 2 ? head : NULL;
 }
 
+/*
+ * Returns -1 when keys can't be sorted by radix sort.
+ *
+ * Records are split into n_runs ranges in the table cursor order. Each
+ * range is encoded and sorted by a thread. It's enough to sort only
+ * offset + limit entries in each range. Sorted ranges are merged at the
+ * end. Equal keys are merged in the range order to keep the table
+ * cursor order.
+ */
 static int
-grn_table_sort_value(grn_ctx *ctx, grn_obj *table,
+grn_table_sort_radix(grn_ctx *ctx, grn_obj *table,
                      int offset, int limit,
                      grn_obj *result,
-                     grn_table_sort_key *keys, int n_keys)
-{
-  int e, n;
-  sort_value_entry *array, *ep;
-  e = offset + limit;
+                     grn_table_sort_key *keys, int n_keys,
+                     grn_bool use_reference,
+                     int n_runs)
+{
+  int i, j, n;
+  int n_sorted = -1;
+  int n_inited_runs = 0;
+  size_t key_size = 0;
+  size_t entry_size;
+  grn_bool have_bulk_key = GRN_FALSE;
+  sort_radix_key *radix_keys = NULL;
+  sort_radix_run *runs = NULL;
+  uint32_t *max_value_sizes = NULL;
+  uint8_t *records = NULL;
+  uint8_t **entries = NULL;
+  uint8_t **buffer = NULL;
+
   n = grn_table_size(ctx, table);
-  if (!(array = GRN_MALLOC(sizeof(sort_value_entry) * n))) {
-    return 0;
+  if (n <= 0) {
+    return -1;
   }
-  {
-    grn_obj a_buffer;
-    grn_obj b_buffer;
-    GRN_TEXT_INIT(&a_buffer, 0);
-    GRN_TEXT_INIT(&b_buffer, 0);
-    if ((ep = pack_value(ctx, table, array, array + n - 1, keys, n_keys,
-                         &a_buffer, &b_buffer))) {
-      intptr_t m = ep - array + 1;
-      if (offset < m - 1) {
-        sort_value(ctx, array, ep - 1, offset, e, keys, n_keys,
-                   &a_buffer, &b_buffer);
+  if (n_runs > n) {
+    n_runs = n;
+  }
+  if (n_runs < 1) {
+    n_runs = 1;
+  }
+  radix_keys = GRN_MALLOC(sizeof(sort_radix_key) * n_keys);
+  runs = GRN_MALLOC(sizeof(sort_radix_run) * n_runs);
+  max_value_sizes = GRN_CALLOC(sizeof(uint32_t) * n_keys * n_runs);
+  if (!radix_keys || !runs || !max_value_sizes) {
+    goto exit;
+  }
+  for (i = 0; i < n_keys; i++) {
+    radix_keys[i].type = keys[i].offset;
+    radix_keys[i].descending = (keys[i].flags & GRN_TABLE_SORT_DESC);
+    radix_keys[i].max_value_size = 0;
+    if (radix_keys[i].type == KEY_BULK) {
+      have_bulk_key = GRN_TRUE;
+    }
+  }
+  for (i = 0; i < n_runs; i++) {
+    sort_radix_run *run = &(runs[i]);
+    int run_offset = (int)((int64_t)n * i / n_runs);
+    int next_run_offset = (int)((int64_t)n * (i + 1) / n_runs);
+    run->running = GRN_FALSE;
+    if (i > 0) {
+      if (grn_ctx_init(&(run->worker_ctx), 0) != GRN_SUCCESS) {
+        break;
       }
-      if (m < e) {
-        sort_value(ctx, ep + 1, array + n - 1, offset - m, e - m, keys, n_keys,
-                   &a_buffer, &b_buffer);
+      grn_ctx_use(&(run->worker_ctx), grn_ctx_db(ctx));
+    }
+    n_inited_runs++;
+    run->table = table;
+    run->keys = keys;
+    run->n_keys = n_keys;
+    run->radix_keys = radix_keys;
+    run->use_reference = use_reference;
+    run->offset = run_offset;
+    run->limit = next_run_offset - run_offset;
+    run->max_value_sizes = max_value_sizes + n_keys * i;
+    run->n_entries = 0;
+    run->n_sorted_entries = offset + limit;
+  }
+  if (n_inited_runs < n_runs) {
+    goto exit;
+  }
+
+  if (have_bulk_key) {
+    sort_radix_process_runs(ctx, runs, n_runs,
+                            sort_radix_run_measure,
+                            sort_radix_run_measure_thread);
+    for (i = 0; i < n_runs; i++) {
+      if (runs[i].n_entries == -1) {
+        goto exit;
+      }
+      for (j = 0; j < n_keys; j++) {
+        if (runs[i].max_value_sizes[j] > radix_keys[j].max_value_size) {
+          radix_keys[j].max_value_size = runs[i].max_value_sizes[j];
+        }
       }
     }
-    GRN_OBJ_FIN(ctx, &a_buffer);
-    GRN_OBJ_FIN(ctx, &b_buffer);
   }
+
+  for (i = 0; i < n_keys; i++) {
+    sort_radix_key *radix_key = radix_keys + i;
+    radix_key->offset = key_size;
+    switch (radix_key->type) {
+    case KEY_BULK :
+      radix_key->size = radix_key->max_value_size + sizeof(uint16_t);
+      break;
+    case KEY_ID :
+    case KEY_INT32 :
+    case KEY_UINT32 :
+    case KEY_FLOAT32 :
+      radix_key->size = 1 + sizeof(uint32_t);
+      break;
+    case KEY_INT8 :
+    case KEY_UINT8 :
+      radix_key->size = 1 + sizeof(uint8_t);
+      break;
+    case KEY_INT16 :
+    case KEY_UINT16 :
+      radix_key->size = 1 + sizeof(uint16_t);
+      break;
+    case KEY_INT64 :
+    case KEY_UINT64 :
+    case KEY_FLOAT64 :
+      radix_key->size = 1 + sizeof(uint64_t);
+      break;
+    default :
+      goto exit;
+    }
+    key_size += radix_key->size;
+    if (key_size > SORT_RADIX_MAX_KEY_SIZE) {
+      goto exit;
+    }
+  }
+
+  entry_size = key_size + sizeof(grn_id);
+  records = GRN_MALLOC(entry_size * n);
+  entries = GRN_MALLOC(sizeof(uint8_t *) * n);
+  buffer = GRN_MALLOC(sizeof(uint8_t *) * n);
+  if (!records || !entries || !buffer) {
+    goto exit;
+  }
+  for (i = 0; i < n_runs; i++) {
+    sort_radix_run *run = &(runs[i]);
+    run->key_size = key_size;
+    run->records = records + entry_size * run->offset;
+    run->entries = entries + run->offset;
+    run->buffer = buffer + run->offset;
+  }
+  sort_radix_process_runs(ctx, runs, n_runs,
+                          sort_radix_run_sort,
+                          sort_radix_run_sort_thread);
+  for (i = 0; i < n_runs; i++) {
+    if (runs[i].n_entries == -1) {
+      goto exit;
+    }
+  }
+
   {
-    int i;
+    int e = offset + limit;
+    int *heads;
     grn_id *v;
-    for (i = 0, ep = array + offset; i < limit && ep < array + n; i++, ep++) {
+
+    heads = GRN_CALLOC(sizeof(int) * n_runs);
+    if (!heads) {
+      goto exit;
+    }
+    for (n_sorted = 0, i = 0; i < e; i++) {
+      sort_radix_run *min_run = NULL;
+      uint8_t *min_entry = NULL;
+      for (j = 0; j < n_runs; j++) {
+        uint8_t *entry;
+        if (heads[j] >= runs[j].n_sorted_entries) {
+          continue;
+        }
+        entry = runs[j].entries[heads[j]];
+        if (!min_entry || memcmp(entry, min_entry, key_size) < 0) {
+          min_run = &(runs[j]);
+          min_entry = entry;
+        }
+      }
+      if (!min_run) {
+        break;
+      }
+      heads[min_run - runs]++;
+      if (i < offset) {
+        continue;
+      }
       if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
-      *v = ep->id;
+      grn_memcpy(v, min_entry + key_size, sizeof(grn_id));
+      n_sorted++;
     }
-    GRN_FREE(array);
-    return i;
+    GRN_FREE(heads);
+  }
+
+exit :
+  if (buffer) {
+    GRN_FREE(buffer);
+  }
+  if (entries) {
+    GRN_FREE(entries);
   }
+  if (records) {
+    GRN_FREE(records);
+  }
+  if (runs) {
+    for (i = 1; i < n_inited_runs; i++) {
+      grn_ctx_fin(&(runs[i].worker_ctx));
+    }
+    GRN_FREE(runs);
+  }
+  if (max_value_sizes) {
+    GRN_FREE(max_value_sizes);
+  }
+  if (radix_keys) {
+    GRN_FREE(radix_keys);
+  }
+  return n_sorted;
 }
 
 static grn_bool
@@ -11335,11 +13354,26 @@ is_compressed_column(grn_ctx *ctx, grn_obj *obj)
     return GRN_FALSE;
   }
 
+  if (obj->header.type == GRN_COLUMN_FIX_SIZE) {
+    return GRN_RA_IS_COMPRESSED((grn_ra *)obj) ? GRN_TRUE : GRN_FALSE;
+  }
+
   if (obj->header.type != GRN_COLUMN_VAR_SIZE) {
     return GRN_FALSE;
   }
 
-  return (obj->header.flags & (GRN_OBJ_COMPRESS_ZLIB | GRN_OBJ_COMPRESS_LZ4));
+  if (obj->header.flags & GRN_OBJ_COMPRESS_BLOCK) {
+    return GRN_TRUE;
+  }
+
+  switch (obj->header.flags & GRN_OBJ_COMPRESS_MASK) {
+  case GRN_OBJ_COMPRESS_ZLIB :
+  case GRN_OBJ_COMPRESS_LZ4 :
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
 }
 
 static grn_bool
@@ -11477,6 +13511,7 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
     grn_bool have_sub_record_accessor = GRN_FALSE;
     grn_bool have_encoded_pat_key_accessor = GRN_FALSE;
     grn_bool have_index_value_get = GRN_FALSE;
+    grn_bool use_reference;
     grn_table_sort_key *kp;
     for (kp = keys, j = n_keys; j; kp++, j--) {
       if (is_compressed_column(ctx, kp->key)) {
@@ -11560,10 +13595,38 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
         }
       }
     }
-    if (have_compressed_column ||
-        have_sub_record_accessor ||
-        have_encoded_pat_key_accessor ||
-        have_index_value_get) {
+    use_reference = !(have_compressed_column ||
+                      have_sub_record_accessor ||
+                      have_encoded_pat_key_accessor ||
+                      have_index_value_get);
+    i = -1;
+    {
+      /*
+       * Each run has at least grn_table_sort_radix_sort_threshold
+       * records. Runs are processed by threads with their own contexts
+       * only when values are referred without temporary objects.
+       */
+      int n_runs = 1;
+      int n_workers = grn_ctx_get_n_workers(ctx);
+      if (n_workers > 1 && use_reference) {
+        if (grn_table_sort_radix_sort_threshold > 0) {
+          n_runs = n / grn_table_sort_radix_sort_threshold;
+        } else {
+          n_runs = n;
+        }
+        if (n_runs > n_workers) {
+          n_runs = n_workers;
+        }
+      }
+      /* Partial quick sort is enough to sort a few top records by a thread. */
+      if (n_runs > 1 || e >= grn_table_sort_radix_sort_threshold) {
+        i = grn_table_sort_radix(ctx, table, offset, limit, result,
+                                 keys, n_keys, use_reference, n_runs);
+      }
+    }
+    if (i >= 0) {
+      /* Sorted by radix sort. */
+    } else if (!use_reference) {
       i = grn_table_sort_value(ctx, table, offset, limit, result,
                                keys, n_keys);
     } else {
@@ -13852,6 +15915,8 @@ grn_load(grn_ctx *ctx, grn_content_type input_type,
 static void
 grn_db_recover_database(grn_ctx *ctx, grn_obj *db)
 {
+  grn_io_clear_waiters(grn_obj_io(db));
+
   if (!grn_obj_is_locked(ctx, db)) {
     return;
   }
@@ -13961,6 +16026,8 @@ grn_db_recover(grn_ctx *ctx, grn_obj *db)
     grn_obj *object;
 
     if ((object = grn_ctx_at(ctx, id))) {
+      /* Processes killed while waiting for a lock leave their counts. */
+      grn_io_clear_waiters(grn_obj_io(object));
       switch (object->header.type) {
       case GRN_TABLE_NO_KEY :
       case GRN_TABLE_HASH_KEY :
@@ -83,17 +83,34 @@ grn_dump_column_create_flags(grn_ctx *ctx,
     if (flags & GRN_OBJ_WITH_POSITION) {
       GRN_TEXT_PUTS(ctx, buffer, "|WITH_POSITION");
     }
+    if (flags & GRN_OBJ_INDEX_SIMD_PACK) {
+      GRN_TEXT_PUTS(ctx, buffer, "|INDEX_SIMD_PACK");
+    }
+    if (flags & GRN_OBJ_INDEX_BLOCK_MAX) {
+      GRN_TEXT_PUTS(ctx, buffer, "|INDEX_BLOCK_MAX");
+    }
     break;
   }
-  switch (flags & GRN_OBJ_COMPRESS_MASK) {
-  case GRN_OBJ_COMPRESS_NONE:
-    break;
-  case GRN_OBJ_COMPRESS_ZLIB:
-    GRN_TEXT_PUTS(ctx, buffer, "|COMPRESS_ZLIB");
-    break;
-  case GRN_OBJ_COMPRESS_LZ4:
-    GRN_TEXT_PUTS(ctx, buffer, "|COMPRESS_LZ4");
-    break;
+  if ((flags & GRN_OBJ_COLUMN_TYPE_MASK) != GRN_OBJ_COLUMN_INDEX) {
+    switch (flags & GRN_OBJ_COMPRESS_MASK) {
+    case GRN_OBJ_COMPRESS_NONE:
+      break;
+    case GRN_OBJ_COMPRESS_ZLIB:
+      GRN_TEXT_PUTS(ctx, buffer, "|COMPRESS_ZLIB");
+      break;
+    case GRN_OBJ_COMPRESS_LZ4:
+      GRN_TEXT_PUTS(ctx, buffer, "|COMPRESS_LZ4");
+      break;
+    case GRN_OBJ_COMPRESS_ZSTD:
+      GRN_TEXT_PUTS(ctx, buffer, "|COMPRESS_ZSTD");
+      break;
+    }
+    if (flags & GRN_OBJ_COMPRESS_BLOCK) {
+      GRN_TEXT_PUTS(ctx, buffer, "|COMPRESS_BLOCK");
+    }
+    if (flags & GRN_OBJ_WITH_ZONE_MAP) {
+      GRN_TEXT_PUTS(ctx, buffer, "|WITH_ZONE_MAP");
+    }
   }
   if (flags & GRN_OBJ_PERSISTENT) {
     GRN_TEXT_PUTS(ctx, buffer, "|PERSISTENT");
@@ -17,6 +17,7 @@
 */
 #include "grn.h"
 #include "grn_db.h"
+#include "grn_column_stats.h"
 #include "grn_ctx_impl.h"
 #include "grn_ctx_impl_mrb.h"
 #include <string.h>
@@ -39,6 +40,58 @@
 # include <oniguruma.h>
 #endif
 
+static int grn_table_select_sequential_parallel_threshold = 65536;
+
+typedef enum {
+  GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_NO,
+  GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_AUTO,
+  GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_YES
+} grn_table_select_order_by_estimated_size_mode;
+
+static grn_table_select_order_by_estimated_size_mode
+grn_table_select_order_by_estimated_size =
+  GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_AUTO;
+
+void
+grn_expr_init_from_env(void)
+{
+  {
+    char grn_table_select_sequential_parallel_threshold_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_SELECT_SEQUENTIAL_PARALLEL_THRESHOLD",
+               grn_table_select_sequential_parallel_threshold_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_table_select_sequential_parallel_threshold_env[0]) {
+      grn_table_select_sequential_parallel_threshold =
+        atoi(grn_table_select_sequential_parallel_threshold_env);
+    }
+  }
+
+  {
+    /*
+     * "no": conditions are processed in the given order.
+     * "auto": conditions combined by AND are reordered when the order
+     *         of the selected records isn't changed.
+     * "yes": the first condition is also reordered. The order of records
+     *        in a scored result set may be changed.
+     */
+    char grn_table_select_order_by_estimated_size_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE",
+               grn_table_select_order_by_estimated_size_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (strcmp(grn_table_select_order_by_estimated_size_env, "no") == 0) {
+      grn_table_select_order_by_estimated_size =
+        GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_NO;
+    } else if (strcmp(grn_table_select_order_by_estimated_size_env,
+                      "yes") == 0) {
+      grn_table_select_order_by_estimated_size =
+        GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_YES;
+    } else {
+      grn_table_select_order_by_estimated_size =
+        GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_AUTO;
+    }
+  }
+}
+
 grn_obj *
 grn_expr_alloc(grn_ctx *ctx, grn_obj *expr, grn_id domain, grn_obj_flags flags)
 {
@@ -5118,6 +5171,21 @@ typedef union {
     grn_obj constant_buffer;
     int32_t score;
     grn_bool (*exec)(grn_ctx *ctx, grn_obj *x, grn_obj *y);
+    grn_ra *column;
+    grn_ra_cache cache;
+    grn_obj values_buffer;
+    void (*kernel)(const void *values, const void *constant,
+                   int n_values, int32_t *scores);
+    grn_operator op;
+    grn_bool use_block_summary;
+    grn_id max_id;
+    grn_ra_block_summary block_summary;
+    grn_bool block_may_match;
+    /* The condition that is ANDed just after this condition. It's only
+       used to skip blocks. */
+    grn_bool use_sibling;
+    grn_operator sibling_op;
+    grn_obj sibling_constant_buffer;
   } simple_condition;
 } grn_table_select_sequential_data;
 
@@ -5128,6 +5196,13 @@ typedef int32_t (*grn_table_select_sequential_exec_func)(grn_ctx *ctx,
                                                          grn_table_select_sequential_data *data);
 typedef void (*grn_table_select_sequential_fin_func)(grn_ctx *ctx,
                                                      grn_table_select_sequential_data *data);
+typedef void (*grn_table_select_sequential_exec_batch_func)(grn_ctx *ctx,
+                                                            const grn_id *ids,
+                                                            int n_ids,
+                                                            int32_t *scores,
+                                                            grn_table_select_sequential_data *data);
+
+#define GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS 1024
 
 static void
 grn_table_select_sequential_init_general(grn_ctx *ctx,
@@ -5525,6 +5600,181 @@ grn_table_select_sequential_is_simple_condition(grn_ctx *ctx, grn_obj *expr)
   return GRN_TRUE;
 }
 
+/*
+ * Kernels compare values of a fix size column with a constant for a
+ * batch of records. They are simple loops over typed arrays so that
+ * compilers can vectorize them.
+ */
+#define GRN_TABLE_SELECT_SEQUENTIAL_EQUAL(x, y) ((x) == (y))
+#define GRN_TABLE_SELECT_SEQUENTIAL_NOT_EQUAL(x, y) ((x) != (y))
+#define GRN_TABLE_SELECT_SEQUENTIAL_FLOAT_EQUAL(x, y) \
+  (((x) <= (y)) && ((x) >= (y)))
+#define GRN_TABLE_SELECT_SEQUENTIAL_FLOAT_NOT_EQUAL(x, y) \
+  (!GRN_TABLE_SELECT_SEQUENTIAL_FLOAT_EQUAL(x, y))
+#define GRN_TABLE_SELECT_SEQUENTIAL_LESS(x, y) ((x) < (y))
+#define GRN_TABLE_SELECT_SEQUENTIAL_GREATER(x, y) ((x) > (y))
+#define GRN_TABLE_SELECT_SEQUENTIAL_LESS_EQUAL(x, y) ((x) <= (y))
+#define GRN_TABLE_SELECT_SEQUENTIAL_GREATER_EQUAL(x, y) ((x) >= (y))
+
+#define GRN_TABLE_SELECT_SEQUENTIAL_KERNEL(type_name, type, op_name, compare) \
+  static void                                                           \
+  grn_table_select_sequential_kernel_ ## op_name ## _ ## type_name(     \
+    const void *values,                                                 \
+    const void *constant,                                               \
+    int n_values,                                                       \
+    int32_t *scores)                                                    \
+  {                                                                     \
+    const type *typed_values = values;                                  \
+    const type typed_constant = *((const type *)constant);              \
+    int i;                                                              \
+    for (i = 0; i < n_values; i++) {                                    \
+      scores[i] = compare(typed_values[i], typed_constant) ? 1 : -1;    \
+    }                                                                   \
+  }
+
+/* Float values aren't compared by == to not warn by -Wfloat-equal. */
+#define GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(type_name, type, prefix)      \
+  GRN_TABLE_SELECT_SEQUENTIAL_KERNEL(type_name, type, equal,              \
+                                     prefix ## EQUAL)                     \
+  GRN_TABLE_SELECT_SEQUENTIAL_KERNEL(type_name, type, not_equal,          \
+                                     prefix ## NOT_EQUAL)                 \
+  GRN_TABLE_SELECT_SEQUENTIAL_KERNEL(type_name, type, less,               \
+                                     GRN_TABLE_SELECT_SEQUENTIAL_LESS)    \
+  GRN_TABLE_SELECT_SEQUENTIAL_KERNEL(type_name, type, greater,            \
+                                     GRN_TABLE_SELECT_SEQUENTIAL_GREATER) \
+  GRN_TABLE_SELECT_SEQUENTIAL_KERNEL(type_name, type, less_equal,         \
+                                     GRN_TABLE_SELECT_SEQUENTIAL_LESS_EQUAL) \
+  GRN_TABLE_SELECT_SEQUENTIAL_KERNEL(type_name, type, greater_equal,      \
+                                     GRN_TABLE_SELECT_SEQUENTIAL_GREATER_EQUAL)
+
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(int8, int8_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(uint8, uint8_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(int16, int16_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(uint16, uint16_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(int32, int32_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(uint32, uint32_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(int64, int64_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(uint64, uint64_t,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_)
+GRN_TABLE_SELECT_SEQUENTIAL_KERNELS(float, double,
+                                    GRN_TABLE_SELECT_SEQUENTIAL_FLOAT_)
+
+#undef GRN_TABLE_SELECT_SEQUENTIAL_KERNELS
+#undef GRN_TABLE_SELECT_SEQUENTIAL_KERNEL
+#undef GRN_TABLE_SELECT_SEQUENTIAL_GREATER_EQUAL
+#undef GRN_TABLE_SELECT_SEQUENTIAL_LESS_EQUAL
+#undef GRN_TABLE_SELECT_SEQUENTIAL_GREATER
+#undef GRN_TABLE_SELECT_SEQUENTIAL_LESS
+#undef GRN_TABLE_SELECT_SEQUENTIAL_FLOAT_NOT_EQUAL
+#undef GRN_TABLE_SELECT_SEQUENTIAL_FLOAT_EQUAL
+#undef GRN_TABLE_SELECT_SEQUENTIAL_NOT_EQUAL
+#undef GRN_TABLE_SELECT_SEQUENTIAL_EQUAL
+
+#define GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(type_name) do {      \
+    switch (op) {                                                   \
+    case GRN_OP_EQUAL :                                             \
+      kernel = grn_table_select_sequential_kernel_equal_ ## type_name; \
+      break;                                                        \
+    case GRN_OP_NOT_EQUAL :                                         \
+      kernel =                                                      \
+        grn_table_select_sequential_kernel_not_equal_ ## type_name; \
+      break;                                                        \
+    case GRN_OP_LESS :                                              \
+      kernel = grn_table_select_sequential_kernel_less_ ## type_name; \
+      break;                                                        \
+    case GRN_OP_GREATER :                                           \
+      kernel = grn_table_select_sequential_kernel_greater_ ## type_name; \
+      break;                                                        \
+    case GRN_OP_LESS_EQUAL :                                        \
+      kernel =                                                      \
+        grn_table_select_sequential_kernel_less_equal_ ## type_name; \
+      break;                                                        \
+    case GRN_OP_GREATER_EQUAL :                                     \
+      kernel =                                                      \
+        grn_table_select_sequential_kernel_greater_equal_ ## type_name; \
+      break;                                                        \
+    default :                                                       \
+      break;                                                        \
+    }                                                               \
+  } while (0)
+
+static void
+grn_table_select_sequential_init_simple_condition_kernel(
+  grn_ctx *ctx,
+  grn_table_select_sequential_data *data,
+  grn_obj *target,
+  grn_operator op)
+{
+  void (*kernel)(const void *values, const void *constant,
+                 int n_values, int32_t *scores) = NULL;
+
+  if (target->header.type != GRN_COLUMN_FIX_SIZE) {
+    return;
+  }
+  /* Values are read by IDs of records in the table of the variable. */
+  if (target->header.domain != data->simple_condition.variable->header.domain) {
+    return;
+  }
+
+  switch (DB_OBJ(target)->range) {
+  case GRN_DB_INT8 :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(int8);
+    break;
+  case GRN_DB_UINT8 :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(uint8);
+    break;
+  case GRN_DB_INT16 :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(int16);
+    break;
+  case GRN_DB_UINT16 :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(uint16);
+    break;
+  case GRN_DB_INT32 :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(int32);
+    break;
+  case GRN_DB_UINT32 :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(uint32);
+    break;
+  case GRN_DB_INT64 :
+  case GRN_DB_TIME :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(int64);
+    break;
+  case GRN_DB_UINT64 :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(uint64);
+    break;
+  case GRN_DB_FLOAT :
+    GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND(float);
+    break;
+  default :
+    break;
+  }
+  if (!kernel) {
+    return;
+  }
+
+  data->simple_condition.column = (grn_ra *)target;
+  GRN_RA_CACHE_INIT(data->simple_condition.column,
+                    &(data->simple_condition.cache));
+  data->simple_condition.kernel = kernel;
+
+  if (GRN_RA_HAS_BLOCK_SUMMARY(data->simple_condition.column)) {
+    grn_obj *table = grn_ctx_at(ctx, target->header.domain);
+    if (table) {
+      data->simple_condition.use_block_summary = GRN_TRUE;
+      data->simple_condition.max_id = grn_table_curr_id(ctx, table);
+    }
+  }
+}
+
+#undef GRN_TABLE_SELECT_SEQUENTIAL_KERNEL_FIND
+
 static void
 grn_table_select_sequential_init_simple_condition(
   grn_ctx *ctx,
@@ -5543,6 +5793,18 @@ grn_table_select_sequential_init_simple_condition(
   op = e->codes[2].op;
 
   data->simple_condition.score = 0;
+  data->simple_condition.column = NULL;
+  data->simple_condition.kernel = NULL;
+  data->simple_condition.op = op;
+  data->simple_condition.use_block_summary = GRN_FALSE;
+  data->simple_condition.max_id = GRN_ID_NIL;
+  data->simple_condition.block_summary.min_id = GRN_ID_NIL + 1;
+  data->simple_condition.block_summary.max_id = GRN_ID_NIL;
+  data->simple_condition.block_may_match = GRN_TRUE;
+  data->simple_condition.use_sibling = GRN_FALSE;
+  data->simple_condition.sibling_op = GRN_OP_NOP;
+  GRN_VOID_INIT(&(data->simple_condition.sibling_constant_buffer));
+  GRN_TEXT_INIT(&(data->simple_condition.values_buffer), 0);
 
   value_buffer = &(data->simple_condition.value_buffer);
   GRN_VOID_INIT(value_buffer);
@@ -5602,6 +5864,9 @@ grn_table_select_sequential_init_simple_condition(
     }
     return;
   }
+
+  grn_table_select_sequential_init_simple_condition_kernel(ctx, data,
+                                                           target, op);
 }
 
 static int32_t
@@ -5641,143 +5906,1317 @@ grn_table_select_sequential_fin_simple_condition(
 {
   GRN_OBJ_FIN(ctx, &(data->simple_condition.value_buffer));
   GRN_OBJ_FIN(ctx, &(data->simple_condition.constant_buffer));
+  if (data->simple_condition.column) {
+    GRN_RA_CACHE_FIN(data->simple_condition.column,
+                     &(data->simple_condition.cache));
+  }
+  GRN_OBJ_FIN(ctx, &(data->simple_condition.values_buffer));
+  GRN_OBJ_FIN(ctx, &(data->simple_condition.sibling_constant_buffer));
 }
 
+/*
+ * Uses the condition that is ANDed just after the condition to skip
+ * blocks too. Records in the skipped blocks are removed by the sibling
+ * condition anyway. So "column >= X && column < Y" reads only blocks
+ * in the range by the first condition. sibling is codes of the
+ * condition or NULL.
+ */
 static void
-grn_table_select_sequential(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
-                            grn_obj *v, grn_obj *res, grn_operator op)
+grn_table_select_sequential_init_simple_condition_sibling(
+  grn_ctx *ctx,
+  grn_table_select_sequential_data *data,
+  grn_expr_code *sibling)
+{
+  grn_expr *e = (grn_expr *)(data->simple_condition.expr);
+  grn_obj *sibling_constant_buffer =
+    &(data->simple_condition.sibling_constant_buffer);
+
+  if (!sibling) {
+    return;
+  }
+  if (!data->simple_condition.use_block_summary) {
+    return;
+  }
+
+  switch (sibling[2].op) {
+  case GRN_OP_EQUAL :
+  case GRN_OP_LESS :
+  case GRN_OP_GREATER :
+  case GRN_OP_LESS_EQUAL :
+  case GRN_OP_GREATER_EQUAL :
+    break;
+  default :
+    return;
+  }
+  if (sibling[2].nargs != 2) {
+    return;
+  }
+  if (sibling[0].op != GRN_OP_GET_VALUE ||
+      sibling[0].nargs != 1 ||
+      sibling[0].value != e->codes[0].value) {
+    return;
+  }
+  if (sibling[1].op != GRN_OP_PUSH ||
+      sibling[1].nargs != 1 ||
+      !sibling[1].value ||
+      sibling[1].value->header.type != GRN_BULK) {
+    return;
+  }
+
+  grn_obj_reinit_for(ctx, sibling_constant_buffer, e->codes[0].value);
+  if (grn_obj_cast(ctx, sibling[1].value, sibling_constant_buffer,
+                   GRN_FALSE) != GRN_SUCCESS) {
+    /* The sibling condition reports the error. */
+    return;
+  }
+  data->simple_condition.use_sibling = GRN_TRUE;
+  data->simple_condition.sibling_op = sibling[2].op;
+}
+
+/*
+ * Returns GRN_FALSE when the block of the record can't have matched
+ * records by the block summary of the column. The summary is kept in
+ * data while records in the block are processed.
+ */
+static grn_bool
+grn_table_select_sequential_simple_condition_may_match(
+  grn_ctx *ctx,
+  grn_id id,
+  grn_table_select_sequential_data *data)
+{
+  grn_ra_block_summary *summary = &(data->simple_condition.block_summary);
+  grn_rc rc;
+
+  if (!data->simple_condition.use_block_summary) {
+    return GRN_TRUE;
+  }
+  if (summary->min_id <= id && id <= summary->max_id) {
+    return data->simple_condition.block_may_match;
+  }
+  rc = grn_ra_get_block_summary(ctx, data->simple_condition.column,
+                                id, data->simple_condition.max_id, summary);
+  if (rc != GRN_SUCCESS) {
+    data->simple_condition.use_block_summary = GRN_FALSE;
+    return GRN_TRUE;
+  }
+  data->simple_condition.block_may_match =
+    grn_ra_block_summary_may_match(
+      ctx,
+      data->simple_condition.column,
+      summary,
+      data->simple_condition.op,
+      GRN_BULK_HEAD(&(data->simple_condition.constant_buffer)));
+  if (data->simple_condition.block_may_match &&
+      data->simple_condition.use_sibling) {
+    data->simple_condition.block_may_match =
+      grn_ra_block_summary_may_match(
+        ctx,
+        data->simple_condition.column,
+        summary,
+        data->simple_condition.sibling_op,
+        GRN_BULK_HEAD(&(data->simple_condition.sibling_constant_buffer)));
+  }
+  return data->simple_condition.block_may_match;
+}
+
+static void
+grn_table_select_sequential_exec_batch_simple_condition(
+  grn_ctx *ctx,
+  const grn_id *ids,
+  int n_ids,
+  int32_t *scores,
+  grn_table_select_sequential_data *data)
+{
+  grn_ra *column = data->simple_condition.column;
+  grn_ra_cache *cache = &(data->simple_condition.cache);
+  grn_obj *values_buffer = &(data->simple_condition.values_buffer);
+  grn_obj *constant_buffer = &(data->simple_condition.constant_buffer);
+  uint32_t element_size = column->header->element_size;
+  int i;
+  int n_missing_ids = 0;
+  int missing_ids[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  int n_skipped_ids = 0;
+  int skipped_ids[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  byte *values;
+
+  if (ctx->rc) {
+    return;
+  }
+
+  GRN_BULK_REWIND(values_buffer);
+  if (grn_bulk_space(ctx, values_buffer, element_size * n_ids) !=
+      GRN_SUCCESS) {
+    return;
+  }
+  values = (byte *)GRN_BULK_HEAD(values_buffer);
+  for (i = 0; i < n_ids; i++) {
+    void *value;
+    if (!grn_table_select_sequential_simple_condition_may_match(ctx, ids[i],
+                                                                data)) {
+      memset(values + element_size * i, 0, element_size);
+      skipped_ids[n_skipped_ids++] = i;
+      continue;
+    }
+    value = grn_ra_ref_cache(ctx, column, ids[i], cache);
+    if (!value) {
+      memset(values + element_size * i, 0, element_size);
+      missing_ids[n_missing_ids++] = i;
+      continue;
+    }
+    switch (element_size) {
+    case 1 :
+      ((uint8_t *)values)[i] = *((uint8_t *)value);
+      break;
+    case 2 :
+      ((uint16_t *)values)[i] = *((uint16_t *)value);
+      break;
+    case 4 :
+      ((uint32_t *)values)[i] = *((uint32_t *)value);
+      break;
+    default :
+      ((uint64_t *)values)[i] = *((uint64_t *)value);
+      break;
+    }
+  }
+
+  data->simple_condition.kernel(values,
+                                GRN_BULK_HEAD(constant_buffer),
+                                n_ids,
+                                scores);
+
+  for (i = 0; i < n_skipped_ids; i++) {
+    scores[skipped_ids[i]] = -1;
+  }
+
+  for (i = 0; i < n_missing_ids; i++) {
+    int index = missing_ids[i];
+    scores[index] =
+      grn_table_select_sequential_exec_simple_condition(ctx, ids[index], data);
+  }
+}
+
+/*
+ * Returns whether records can be collected by
+ * grn_table_select_sequential_collect_ids() instead of a table cursor.
+ */
+static grn_bool
+grn_table_select_sequential_can_skip_blocks(
+  grn_ctx *ctx,
+  grn_table_select_sequential_exec_batch_func exec_batch,
+  grn_table_select_sequential_data *data)
+{
+  return
+    exec_batch == grn_table_select_sequential_exec_batch_simple_condition &&
+    data->simple_condition.use_block_summary;
+}
+
+/*
+ * Collects IDs of the next batch in the ID order. Blocks of the column
+ * that can't have matched records are skipped without reading their
+ * values. next_id is the ID to start and it's updated for the next
+ * batch.
+ */
+static int
+grn_table_select_sequential_collect_ids(grn_ctx *ctx,
+                                        grn_obj *table,
+                                        grn_table_select_sequential_data *data,
+                                        grn_id *next_id,
+                                        grn_id *ids)
+{
+  grn_id id = *next_id;
+  grn_id max_id = data->simple_condition.max_id;
+  int n_ids = 0;
+
+  while (n_ids < GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS) {
+    id = grn_table_next(ctx, table, id);
+    if (id == GRN_ID_NIL || id > max_id) {
+      id = max_id;
+      break;
+    }
+    if (!grn_table_select_sequential_simple_condition_may_match(ctx, id,
+                                                                data)) {
+      id = data->simple_condition.block_summary.max_id;
+      continue;
+    }
+    ids[n_ids++] = id;
+  }
+  *next_id = id;
+  return n_ids;
+}
+
+static void
+grn_table_select_sequential_init(grn_ctx *ctx, grn_obj *expr, grn_obj *v,
+                                 grn_expr_code *sibling,
+                                 grn_table_select_sequential_data *data,
+                                 grn_table_select_sequential_exec_func *exec,
+                                 grn_table_select_sequential_exec_batch_func *exec_batch,
+                                 grn_table_select_sequential_fin_func *fin)
 {
-  int32_t score;
-  grn_id id, *idp;
-  grn_table_cursor *tc;
-  grn_hash_cursor *hc;
-  grn_hash *s = (grn_hash *)res;
-  grn_table_select_sequential_data data;
   grn_table_select_sequential_init_func init;
-  grn_table_select_sequential_exec_func exec;
-  grn_table_select_sequential_fin_func fin;
 
-  data.common.expr = expr;
-  data.common.variable = v;
+  data->common.expr = expr;
+  data->common.variable = v;
   init = grn_table_select_sequential_init_general;
-  exec = grn_table_select_sequential_exec_general;
-  fin = grn_table_select_sequential_fin_general;
+  *exec = grn_table_select_sequential_exec_general;
+  *fin = grn_table_select_sequential_fin_general;
   if (grn_table_select_sequential_is_constant(ctx, expr)) {
     init = grn_table_select_sequential_init_constant;
-    exec = grn_table_select_sequential_exec_constant;
-    fin = grn_table_select_sequential_fin_constant;
+    *exec = grn_table_select_sequential_exec_constant;
+    *fin = grn_table_select_sequential_fin_constant;
   } else if (grn_table_select_sequential_is_value(ctx, expr)) {
     init = grn_table_select_sequential_init_value;
-    exec = grn_table_select_sequential_exec_value;
-    fin = grn_table_select_sequential_fin_value;
+    *exec = grn_table_select_sequential_exec_value;
+    *fin = grn_table_select_sequential_fin_value;
 #ifdef GRN_SUPPORT_REGEXP
   } else if (grn_table_select_sequential_is_simple_regexp(ctx, expr)) {
     init = grn_table_select_sequential_init_simple_regexp;
-    exec = grn_table_select_sequential_exec_simple_regexp;
-    fin = grn_table_select_sequential_fin_simple_regexp;
+    *exec = grn_table_select_sequential_exec_simple_regexp;
+    *fin = grn_table_select_sequential_fin_simple_regexp;
 #endif /* GRN_SUPPORT_REGEXP */
   } else if (grn_table_select_sequential_is_simple_condition(ctx, expr)) {
     init = grn_table_select_sequential_init_simple_condition;
-    exec = grn_table_select_sequential_exec_simple_condition;
-    fin = grn_table_select_sequential_fin_simple_condition;
+    *exec = grn_table_select_sequential_exec_simple_condition;
+    *fin = grn_table_select_sequential_fin_simple_condition;
+  }
+
+  init(ctx, data);
+
+  *exec_batch = NULL;
+  if (*exec == grn_table_select_sequential_exec_simple_condition &&
+      data->simple_condition.score == 0 &&
+      data->simple_condition.kernel) {
+    *exec_batch = grn_table_select_sequential_exec_batch_simple_condition;
+    grn_table_select_sequential_init_simple_condition_sibling(ctx, data,
+                                                              sibling);
   }
+}
+
+/*
+ * Evaluates expr for a batch of records at once by exec_batch. It
+ * returns GRN_FALSE for op that isn't supported.
+ */
+static grn_bool
+grn_table_select_sequential_batch(
+  grn_ctx *ctx,
+  grn_obj *table,
+  grn_table_select_sequential_exec_batch_func exec_batch,
+  grn_table_select_sequential_data *data,
+  grn_obj *res,
+  grn_operator op)
+{
+  int i, n_records;
+  grn_id id;
+  grn_id ids[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  grn_id record_ids[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  grn_rset_recinfo *ris[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  int32_t scores[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  grn_hash *s = (grn_hash *)res;
 
-  init(ctx, &data);
   switch (op) {
   case GRN_OP_OR :
-    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while ((id = grn_table_cursor_next(ctx, tc))) {
-        score = exec(ctx, id, &data);
-        if (ctx->rc) {
+    {
+      grn_table_cursor *tc = NULL;
+      grn_id next_id = GRN_ID_NIL;
+      /* Records are added in the table cursor order. It's the ID order
+         only for hash tables and arrays. */
+      grn_bool skip_blocks =
+        (table->header.type == GRN_TABLE_HASH_KEY ||
+         table->header.type == GRN_TABLE_NO_KEY) &&
+        grn_table_select_sequential_can_skip_blocks(ctx, exec_batch, data);
+      if (!skip_blocks) {
+        tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+        if (!tc) {
           break;
         }
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
-            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
+      }
+      for (;;) {
+        n_records = 0;
+        if (skip_blocks) {
+          n_records = grn_table_select_sequential_collect_ids(ctx, table, data,
+                                                              &next_id, ids);
+        } else {
+          while (n_records < GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS &&
+                 (id = grn_table_cursor_next(ctx, tc))) {
+            ids[n_records++] = id;
           }
         }
-      }
-      grn_table_cursor_close(ctx, tc);
-    }
-    break;
-  case GRN_OP_AND :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        score = exec(ctx, *idp, &data);
+        if (n_records == 0) {
+          break;
+        }
+        exec_batch(ctx, ids, n_records, scores, data);
         if (ctx->rc) {
           break;
         }
-        if (score > 0) {
+        for (i = 0; i < n_records; i++) {
           grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
-        } else {
-          grn_hash_cursor_delete(ctx, hc, NULL);
+          if (scores[i] <= 0) {
+            continue;
+          }
+          if (grn_hash_add(ctx, s, &(ids[i]), s->key_size, (void **)&ri,
+                           NULL)) {
+            grn_table_add_subrec(res, ri, scores[i],
+                                 (grn_rset_posinfo *)&(ids[i]), 1);
+          }
         }
       }
-      grn_hash_cursor_close(ctx, hc);
+      if (tc) {
+        grn_table_cursor_close(ctx, tc);
+      }
     }
     break;
+  case GRN_OP_AND :
   case GRN_OP_AND_NOT :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        score = exec(ctx, *idp, &data);
-        if (ctx->rc) {
+  case GRN_OP_ADJUST :
+    {
+      grn_hash_cursor *hc;
+      hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0);
+      if (!hc) {
+        break;
+      }
+      for (;;) {
+        n_records = 0;
+        while (n_records < GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS &&
+               (id = grn_hash_cursor_next(ctx, hc))) {
+          grn_id *idp;
+          void *value;
+          grn_hash_cursor_get_key_value(ctx, hc, (void **)&idp, NULL, &value);
+          record_ids[n_records] = id;
+          ids[n_records] = *idp;
+          ris[n_records] = value;
+          n_records++;
+        }
+        if (n_records == 0) {
           break;
         }
-        if (score > 0) {
-          grn_hash_cursor_delete(ctx, hc, NULL);
-        }
-      }
-      grn_hash_cursor_close(ctx, hc);
-    }
-    break;
-  case GRN_OP_ADJUST :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        score = exec(ctx, *idp, &data);
+        exec_batch(ctx, ids, n_records, scores, data);
         if (ctx->rc) {
           break;
         }
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        for (i = 0; i < n_records; i++) {
+          if (scores[i] > 0) {
+            if (op == GRN_OP_AND_NOT) {
+              grn_hash_delete_by_id(ctx, s, record_ids[i], NULL);
+            } else {
+              grn_table_add_subrec(res, ris[i], scores[i],
+                                   (grn_rset_posinfo *)&(ids[i]), 1);
+            }
+          } else {
+            if (op == GRN_OP_AND) {
+              grn_hash_delete_by_id(ctx, s, record_ids[i], NULL);
+            }
+          }
         }
       }
       grn_hash_cursor_close(ctx, hc);
     }
     break;
   default :
-    break;
+    return GRN_FALSE;
   }
-  fin(ctx, &data);
-}
-
-static inline void
-grn_table_select_index_report(grn_ctx *ctx, const char *tag, grn_obj *index)
-{
-  grn_report_index(ctx, "[table][select]", tag, index);
+  return GRN_TRUE;
 }
 
-static inline grn_bool
-grn_table_select_index_equal(grn_ctx *ctx,
-                             grn_obj *table,
-                             grn_obj *index,
-                             scan_info *si,
-                             grn_obj *res)
+static grn_bool
+grn_table_select_sequential_bitmap_batch(
+  grn_ctx *ctx,
+  grn_obj *table,
+  grn_table_select_sequential_exec_batch_func exec_batch,
+  grn_table_select_sequential_data *data,
+  grn_rset_bitmap *bitmap,
+  grn_operator op)
 {
-  grn_bool processed = GRN_FALSE;
-
-  if (GRN_BULK_VSIZE(si->query) == 0) {
-    /* We can't use index for empty value. */
-    return GRN_FALSE;
-  }
+  int i, n_records;
+  grn_id id;
+  grn_id ids[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  int32_t scores[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+
+  switch (op) {
+  case GRN_OP_OR :
+    {
+      grn_table_cursor *tc = NULL;
+      grn_id next_id = GRN_ID_NIL;
+      /* The order of records in bitmap doesn't matter. */
+      grn_bool skip_blocks =
+        grn_table_select_sequential_can_skip_blocks(ctx, exec_batch, data);
+      if (!skip_blocks) {
+        tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+        if (!tc) {
+          break;
+        }
+      }
+      for (;;) {
+        n_records = 0;
+        if (skip_blocks) {
+          n_records = grn_table_select_sequential_collect_ids(ctx, table, data,
+                                                              &next_id, ids);
+        } else {
+          while (n_records < GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS &&
+                 (id = grn_table_cursor_next(ctx, tc))) {
+            ids[n_records++] = id;
+          }
+        }
+        if (n_records == 0) {
+          break;
+        }
+        exec_batch(ctx, ids, n_records, scores, data);
+        if (ctx->rc) {
+          break;
+        }
+        for (i = 0; i < n_records; i++) {
+          if (scores[i] > 0) {
+            if (grn_rset_bitmap_set(ctx, bitmap, ids[i]) != GRN_SUCCESS) {
+              break;
+            }
+          }
+        }
+        if (ctx->rc) {
+          break;
+        }
+      }
+      if (tc) {
+        grn_table_cursor_close(ctx, tc);
+      }
+    }
+    break;
+  case GRN_OP_AND :
+  case GRN_OP_AND_NOT :
+    id = GRN_ID_NIL;
+    for (;;) {
+      n_records = 0;
+      while (n_records < GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS &&
+             (id = grn_rset_bitmap_next(ctx, bitmap, id))) {
+        ids[n_records++] = id;
+      }
+      if (n_records == 0) {
+        break;
+      }
+      exec_batch(ctx, ids, n_records, scores, data);
+      if (ctx->rc) {
+        break;
+      }
+      for (i = 0; i < n_records; i++) {
+        if ((scores[i] > 0) == (op == GRN_OP_AND_NOT)) {
+          GRN_RSET_BITMAP_UNSET(bitmap, ids[i]);
+        }
+      }
+      if (id == GRN_ID_NIL) {
+        break;
+      }
+    }
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  return GRN_TRUE;
+}
+
+/*
+ * Records are split into morsels by ID range. Threads take the next
+ * morsel one by one and collect matched records in it. So each thread
+ * gets similar amount of works even if matched records are skewed.
+ *
+ * It must be a multiple of the number of bits in a grn_rset_bitmap
+ * word.
+ */
+#define GRN_TABLE_SELECT_SEQUENTIAL_MORSEL_SIZE 16384
+
+typedef struct {
+  /* The context that collects matched records in the morsel. */
+  grn_ctx *ctx;
+  grn_obj ids;
+  grn_obj scores;
+} grn_table_select_sequential_morsel;
+
+typedef struct {
+  grn_obj *table;
+  grn_expr_code *sibling;
+  grn_id max_id;
+  uint32_t n_morsels;
+  uint32_t next_morsel;
+  grn_table_select_sequential_morsel *morsels;
+} grn_table_select_sequential_morsels;
+
+typedef struct {
+  grn_ctx worker_ctx;
+  grn_thread thread;
+  grn_bool running;
+  /* The first run evaluates the given expression directly. */
+  grn_obj *expr;
+  grn_obj *variable;
+  grn_table_select_sequential_morsels *morsels;
+} grn_table_select_sequential_run;
+
+static grn_bool
+grn_table_select_sequential_is_run_safe_value(grn_ctx *ctx, grn_obj *value)
+{
+  grn_id range_id;
+
+  if (value->header.impl_flags & GRN_OBJ_EXPRCONST) {
+    switch (value->header.type) {
+    case GRN_VOID :
+    case GRN_BULK :
+    case GRN_UVECTOR :
+      return GRN_TRUE;
+    default :
+      return GRN_FALSE;
+    }
+  }
+
+  range_id = grn_obj_get_range(ctx, value);
+  if (range_id & GRN_OBJ_TMP_OBJECT) {
+    return GRN_FALSE;
+  }
+
+  switch (value->header.type) {
+  case GRN_ACCESSOR :
+    {
+      grn_accessor *a;
+      for (a = (grn_accessor *)value; a; a = a->next) {
+        switch (a->action) {
+        case GRN_ACCESSOR_GET_ID :
+        case GRN_ACCESSOR_GET_KEY :
+        case GRN_ACCESSOR_GET_VALUE :
+        case GRN_ACCESSOR_GET_SCORE :
+        case GRN_ACCESSOR_GET_NSUBRECS :
+        case GRN_ACCESSOR_GET_MAX :
+        case GRN_ACCESSOR_GET_MIN :
+        case GRN_ACCESSOR_GET_SUM :
+        case GRN_ACCESSOR_GET_AVG :
+          break;
+        case GRN_ACCESSOR_GET_COLUMN_VALUE :
+          if (!grn_table_select_sequential_is_run_safe_value(ctx, a->obj)) {
+            return GRN_FALSE;
+          }
+          break;
+        default :
+          return GRN_FALSE;
+        }
+      }
+    }
+    return GRN_TRUE;
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_VAR_SIZE :
+  case GRN_TABLE_HASH_KEY :
+  case GRN_TABLE_PAT_KEY :
+  case GRN_TABLE_DAT_KEY :
+  case GRN_TABLE_NO_KEY :
+    return !(DB_OBJ(value)->id & GRN_OBJ_TMP_OBJECT);
+  default :
+    return GRN_FALSE;
+  }
+}
+
+/*
+ * Expressions that call functions or assign values aren't evaluated
+ * in parallel. Functions may not be thread safe and assignments must
+ * be done in the table cursor order.
+ */
+static grn_bool
+grn_table_select_sequential_can_run_in_parallel(grn_ctx *ctx, grn_obj *expr,
+                                                grn_obj *v)
+{
+  uint32_t i;
+  grn_expr *e = (grn_expr *)expr;
+
+  for (i = 0; i < e->codes_curr; i++) {
+    grn_expr_code *code = &(e->codes[i]);
+    switch (code->op) {
+    case GRN_OP_CALL :
+    case GRN_OP_ASSIGN :
+    case GRN_OP_STAR_ASSIGN :
+    case GRN_OP_SLASH_ASSIGN :
+    case GRN_OP_MOD_ASSIGN :
+    case GRN_OP_PLUS_ASSIGN :
+    case GRN_OP_MINUS_ASSIGN :
+    case GRN_OP_SHIFTL_ASSIGN :
+    case GRN_OP_SHIFTR_ASSIGN :
+    case GRN_OP_SHIFTRR_ASSIGN :
+    case GRN_OP_AND_ASSIGN :
+    case GRN_OP_XOR_ASSIGN :
+    case GRN_OP_OR_ASSIGN :
+    case GRN_OP_INCR :
+    case GRN_OP_DECR :
+    case GRN_OP_INCR_POST :
+    case GRN_OP_DECR_POST :
+    case GRN_OP_DELETE :
+    case GRN_OP_TABLE_CREATE :
+    case GRN_OP_TABLE_SELECT :
+    case GRN_OP_TABLE_SORT :
+    case GRN_OP_TABLE_GROUP :
+    case GRN_OP_JSON_PUT :
+      return GRN_FALSE;
+    default :
+      break;
+    }
+    if (!code->value || code->value == v) {
+      continue;
+    }
+    if (!grn_table_select_sequential_is_run_safe_value(ctx, code->value)) {
+          return GRN_FALSE;
+    }
+  }
+
+  return GRN_TRUE;
+}
+
+/*
+ * Copies expr to run_ctx. Columns and accessors are shared because
+ * they aren't changed by evaluation. Constants are copied.
+ */
+static grn_obj *
+grn_table_select_sequential_run_expr_create(grn_ctx *ctx, grn_ctx *run_ctx,
+                                            grn_obj *table,
+                                            grn_obj *expr, grn_obj *v,
+                                            grn_obj **run_v)
+{
+  uint32_t i;
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr *run_e;
+  grn_obj *run_expr;
+
+  GRN_EXPR_CREATE_FOR_QUERY(run_ctx, table, run_expr, *run_v);
+  if (!run_expr) {
+    return NULL;
+  }
+  run_e = (grn_expr *)run_expr;
+  if (e->codes_curr > run_e->codes_size) {
+    grn_obj_close(run_ctx, run_expr);
+    return NULL;
+  }
+
+  for (i = 0; i < e->codes_curr; i++) {
+    grn_expr_code *code = &(e->codes[i]);
+    grn_expr_code *run_code = &(run_e->codes[i]);
+    *run_code = *code;
+    if (!code->value) {
+      continue;
+    }
+    if (code->value == v) {
+      run_code->value = *run_v;
+    } else if (code->value->header.impl_flags & GRN_OBJ_EXPRCONST) {
+      grn_obj *run_const = grn_expr_alloc_const(run_ctx, run_expr);
+      if (!run_const) {
+        grn_obj_close(run_ctx, run_expr);
+        return NULL;
+      }
+      GRN_OBJ_INIT(run_const,
+                   code->value->header.type,
+                   GRN_OBJ_EXPRCONST,
+                   code->value->header.domain);
+      grn_bulk_write(run_ctx, run_const,
+                     GRN_BULK_HEAD(code->value),
+                     GRN_BULK_VSIZE(code->value));
+      run_code->value = run_const;
+    }
+  }
+  run_e->codes_curr = e->codes_curr;
+
+  return run_expr;
+}
+
+static void
+grn_table_select_sequential_morsel_flush(
+  grn_ctx *ctx,
+  const grn_id *ids,
+  int n_ids,
+  int32_t *scores,
+  grn_table_select_sequential_exec_func exec,
+  grn_table_select_sequential_exec_batch_func exec_batch,
+  grn_table_select_sequential_data *data,
+  grn_table_select_sequential_morsel *morsel)
+{
+  int i;
+
+  if (exec_batch) {
+    exec_batch(ctx, ids, n_ids, scores, data);
+  } else {
+    for (i = 0; i < n_ids; i++) {
+      scores[i] = exec(ctx, ids[i], data);
+      if (ctx->rc != GRN_SUCCESS) {
+        return;
+      }
+    }
+  }
+  if (ctx->rc != GRN_SUCCESS) {
+    return;
+  }
+  for (i = 0; i < n_ids; i++) {
+    if (scores[i] > 0) {
+      GRN_RECORD_PUT(ctx, &(morsel->ids), ids[i]);
+      GRN_INT32_PUT(ctx, &(morsel->scores), scores[i]);
+    }
+  }
+}
+
+static void
+grn_table_select_sequential_run_process(grn_ctx *ctx,
+                                        grn_table_select_sequential_run *run)
+{
+  grn_table_select_sequential_morsels *morsels = run->morsels;
+  grn_obj *table = morsels->table;
+  grn_table_select_sequential_data data;
+  grn_table_select_sequential_exec_func exec;
+  grn_table_select_sequential_exec_batch_func exec_batch;
+  grn_table_select_sequential_fin_func fin;
+  grn_bool skip_blocks;
+  grn_id ids[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+  int32_t scores[GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS];
+
+  grn_table_select_sequential_init(ctx, run->expr, run->variable,
+                                   morsels->sibling,
+                                   &data, &exec, &exec_batch, &fin);
+  skip_blocks =
+    grn_table_select_sequential_can_skip_blocks(ctx, exec_batch, &data);
+  while (ctx->rc == GRN_SUCCESS) {
+    uint32_t i;
+    grn_table_select_sequential_morsel *morsel;
+    grn_id id;
+    grn_id max_id;
+    int n_ids = 0;
+
+    GRN_ATOMIC_ADD_EX(&(morsels->next_morsel), 1, i);
+    if (i >= morsels->n_morsels) {
+      break;
+    }
+    morsel = &(morsels->morsels[i]);
+    morsel->ctx = ctx;
+    id = i * GRN_TABLE_SELECT_SEQUENTIAL_MORSEL_SIZE;
+    max_id = id + GRN_TABLE_SELECT_SEQUENTIAL_MORSEL_SIZE;
+    if (max_id > morsels->max_id) {
+      max_id = morsels->max_id;
+    }
+    while ((id = grn_table_next(ctx, table, id)) != GRN_ID_NIL &&
+           id <= max_id) {
+      if (skip_blocks &&
+          !grn_table_select_sequential_simple_condition_may_match(ctx, id,
+                                                                  &data)) {
+        id = data.simple_condition.block_summary.max_id;
+        continue;
+      }
+      ids[n_ids++] = id;
+      if (n_ids == GRN_TABLE_SELECT_SEQUENTIAL_N_BATCH_RECORDS) {
+        grn_table_select_sequential_morsel_flush(ctx, ids, n_ids, scores,
+                                                 exec, exec_batch, &data,
+                                                 morsel);
+        n_ids = 0;
+        if (ctx->rc != GRN_SUCCESS) {
+          break;
+        }
+      }
+    }
+    if (n_ids > 0 && ctx->rc == GRN_SUCCESS) {
+      grn_table_select_sequential_morsel_flush(ctx, ids, n_ids, scores,
+                                               exec, exec_batch, &data,
+                                               morsel);
+    }
+  }
+  fin(ctx, &data);
+}
+
+static grn_thread_func_result CALLBACK
+grn_table_select_sequential_run_process_thread(void *arg)
+{
+  grn_table_select_sequential_run *run = arg;
+  grn_ctx *ctx = &(run->worker_ctx);
+  grn_thread_func_result result = GRN_THREAD_FUNC_RETURN_VALUE;
+  /* Keeps an error in ctx until the run is finished. */
+  GRN_API_ENTER;
+  grn_table_select_sequential_run_process(ctx, run);
+  GRN_API_RETURN(result);
+}
+
+/*
+ * Adds matched records to res in the table cursor order. Morsels are
+ * in the ID order. It's the table cursor order of hash tables and
+ * arrays. Patricia trie and double array trie are iterated in the key
+ * order. So matched records in them are found by ID while iterating the
+ * table cursor.
+ */
+static void
+grn_table_select_sequential_morsels_merge(
+  grn_ctx *ctx,
+  grn_table_select_sequential_morsels *morsels,
+  grn_obj *res)
+{
+  uint32_t i;
+  grn_hash *s = (grn_hash *)res;
+  grn_obj *table = morsels->table;
+
+  if (table->header.type == GRN_TABLE_HASH_KEY ||
+      table->header.type == GRN_TABLE_NO_KEY) {
+    for (i = 0; i < morsels->n_morsels; i++) {
+      grn_table_select_sequential_morsel *morsel = &(morsels->morsels[i]);
+      size_t j, n = GRN_BULK_VSIZE(&(morsel->ids)) / sizeof(grn_id);
+      for (j = 0; j < n; j++) {
+        grn_id id = GRN_RECORD_VALUE_AT(&(morsel->ids), j);
+        int32_t score = GRN_INT32_VALUE_AT(&(morsel->scores), j);
+        grn_rset_recinfo *ri;
+        if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
+        }
+      }
+    }
+  } else {
+    grn_rset_bitmap bitmap;
+    grn_table_cursor *tc;
+    grn_id id;
+
+    grn_rset_bitmap_init(ctx, &bitmap);
+    for (i = 0; i < morsels->n_morsels; i++) {
+      grn_table_select_sequential_morsel *morsel = &(morsels->morsels[i]);
+      size_t j, n = GRN_BULK_VSIZE(&(morsel->ids)) / sizeof(grn_id);
+      for (j = 0; j < n; j++) {
+        id = GRN_RECORD_VALUE_AT(&(morsel->ids), j);
+        if (grn_rset_bitmap_set(ctx, &bitmap, id) != GRN_SUCCESS) {
+          break;
+        }
+      }
+    }
+    tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+    if (tc && ctx->rc == GRN_SUCCESS) {
+      while ((id = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
+        grn_table_select_sequential_morsel *morsel;
+        const grn_id *ids;
+        size_t min, max;
+        grn_rset_recinfo *ri;
+        if (!GRN_RSET_BITMAP_TEST(&bitmap, id)) {
+          continue;
+        }
+        morsel = &(morsels->morsels[(id - 1) /
+                                    GRN_TABLE_SELECT_SEQUENTIAL_MORSEL_SIZE]);
+        ids = (const grn_id *)GRN_BULK_HEAD(&(morsel->ids));
+        min = 0;
+        max = GRN_BULK_VSIZE(&(morsel->ids)) / sizeof(grn_id);
+        while (min < max) {
+          size_t mid = min + (max - min) / 2;
+          if (ids[mid] < id) {
+            min = mid + 1;
+          } else {
+            max = mid;
+          }
+        }
+        if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
+          grn_table_add_subrec(res, ri,
+                               GRN_INT32_VALUE_AT(&(morsel->scores), min),
+                               (grn_rset_posinfo *)&id, 1);
+        }
+      }
+    }
+    if (tc) {
+      grn_table_cursor_close(ctx, tc);
+    }
+    grn_rset_bitmap_fin(ctx, &bitmap);
+  }
+}
+
+static void
+grn_table_select_sequential_morsels_merge_bitmap(
+  grn_ctx *ctx,
+  grn_table_select_sequential_morsels *morsels,
+  grn_rset_bitmap *bitmap)
+{
+  uint32_t i;
+
+  for (i = 0; i < morsels->n_morsels; i++) {
+    grn_table_select_sequential_morsel *morsel = &(morsels->morsels[i]);
+    size_t j, n = GRN_BULK_VSIZE(&(morsel->ids)) / sizeof(grn_id);
+    for (j = 0; j < n; j++) {
+      grn_id id = GRN_RECORD_VALUE_AT(&(morsel->ids), j);
+      if (grn_rset_bitmap_set(ctx, bitmap, id) != GRN_SUCCESS) {
+        return;
+      }
+    }
+  }
+}
+
+/*
+ * Returns GRN_FALSE without evaluating expr when runs can't be
+ * prepared. Only GRN_OP_OR is processed in parallel because it scans
+ * all records in table.
+ *
+ * Matched records are added to res or bitmap. One of them must be
+ * NULL.
+ */
+static grn_bool
+grn_table_select_sequential_parallel(grn_ctx *ctx, grn_obj *table,
+                                     grn_obj *expr, grn_obj *v,
+                                     grn_expr_code *sibling,
+                                     grn_obj *res, grn_rset_bitmap *bitmap)
+{
+  int i, n, n_runs;
+  int n_workers;
+  int n_inited_runs = 0;
+  uint32_t m;
+  grn_bool processed = GRN_FALSE;
+  grn_table_select_sequential_morsels morsels;
+  grn_table_select_sequential_run *runs = NULL;
+
+  n_workers = grn_ctx_get_n_workers(ctx);
+  if (n_workers <= 1) {
+    return GRN_FALSE;
+  }
+  n = grn_table_size(ctx, table);
+  if (grn_table_select_sequential_parallel_threshold > 0) {
+    n_runs = n / grn_table_select_sequential_parallel_threshold;
+  } else {
+    n_runs = n;
+  }
+  if (n_runs > n_workers) {
+    n_runs = n_workers;
+  }
+  if (n_runs < 2) {
+    return GRN_FALSE;
+  }
+  if (!grn_table_select_sequential_can_run_in_parallel(ctx, expr, v)) {
+      return GRN_FALSE;
+  }
+
+  morsels.table = table;
+  morsels.sibling = sibling;
+  morsels.max_id = grn_table_curr_id(ctx, table);
+  morsels.n_morsels =
+    (morsels.max_id + GRN_TABLE_SELECT_SEQUENTIAL_MORSEL_SIZE - 1) /
+    GRN_TABLE_SELECT_SEQUENTIAL_MORSEL_SIZE;
+  morsels.next_morsel = 0;
+  morsels.morsels =
+    GRN_MALLOC(sizeof(grn_table_select_sequential_morsel) * morsels.n_morsels);
+  if (!morsels.morsels) {
+    return GRN_FALSE;
+  }
+  for (m = 0; m < morsels.n_morsels; m++) {
+    morsels.morsels[m].ctx = ctx;
+    GRN_RECORD_INIT(&(morsels.morsels[m].ids), GRN_OBJ_VECTOR, GRN_ID_NIL);
+    GRN_INT32_INIT(&(morsels.morsels[m].scores), GRN_OBJ_VECTOR);
+  }
+
+  runs = GRN_MALLOC(sizeof(grn_table_select_sequential_run) * n_runs);
+  if (!runs) {
+    goto exit;
+  }
+  for (i = 0; i < n_runs; i++) {
+    grn_table_select_sequential_run *run = &(runs[i]);
+    run->running = GRN_FALSE;
+    run->morsels = &morsels;
+    if (i == 0) {
+      run->expr = expr;
+      run->variable = v;
+      n_inited_runs++;
+      continue;
+    }
+    if (grn_ctx_init(&(run->worker_ctx), 0) != GRN_SUCCESS) {
+      break;
+    }
+    n_inited_runs++;
+    grn_ctx_use(&(run->worker_ctx), grn_ctx_db(ctx));
+    run->expr =
+      grn_table_select_sequential_run_expr_create(ctx, &(run->worker_ctx),
+                                                  table, expr, v,
+                                                  &(run->variable));
+    if (!run->expr) {
+      break;
+    }
+  }
+  if (i < n_runs) {
+    goto exit;
+  }
+
+  processed = GRN_TRUE;
+  for (i = 1; i < n_runs; i++) {
+    if (THREAD_CREATE(runs[i].thread,
+                      grn_table_select_sequential_run_process_thread,
+                      &(runs[i]))) {
+      runs[i].running = GRN_FALSE;
+    } else {
+      runs[i].running = GRN_TRUE;
+    }
+  }
+  /* Morsels that aren't taken by threads are processed by the first run. */
+  grn_table_select_sequential_run_process(ctx, &(runs[0]));
+  for (i = 1; i < n_runs; i++) {
+    if (runs[i].running) {
+      THREAD_JOIN(runs[i].thread);
+      runs[i].running = GRN_FALSE;
+    }
+  }
+
+  if (ctx->rc != GRN_SUCCESS) {
+    goto exit;
+  }
+  for (i = 1; i < n_runs; i++) {
+    grn_ctx *run_ctx = &(runs[i].worker_ctx);
+    if (run_ctx->rc != GRN_SUCCESS) {
+      /* Reports the error as is because it's raised by expr. */
+      ERR(run_ctx->rc, "%s", run_ctx->errbuf);
+      goto exit;
+    }
+  }
+  if (bitmap) {
+    grn_table_select_sequential_morsels_merge_bitmap(ctx, &morsels, bitmap);
+  } else {
+    grn_table_select_sequential_morsels_merge(ctx, &morsels, res);
+  }
+
+exit :
+  for (m = 0; m < morsels.n_morsels; m++) {
+    grn_table_select_sequential_morsel *morsel = &(morsels.morsels[m]);
+    GRN_OBJ_FIN(morsel->ctx, &(morsel->ids));
+    GRN_OBJ_FIN(morsel->ctx, &(morsel->scores));
+  }
+  GRN_FREE(morsels.morsels);
+  if (runs) {
+    for (i = 1; i < n_inited_runs; i++) {
+      if (runs[i].expr) {
+        grn_obj_close(&(runs[i].worker_ctx), runs[i].expr);
+      }
+      grn_ctx_fin(&(runs[i].worker_ctx));
+    }
+    GRN_FREE(runs);
+  }
+  return processed;
+}
+
+static void
+grn_table_select_sequential(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
+                            grn_obj *v, grn_expr_code *sibling,
+                            grn_obj *res, grn_operator op)
+{
+  int32_t score;
+  grn_id id, *idp;
+  grn_table_cursor *tc;
+  grn_hash_cursor *hc;
+  grn_hash *s = (grn_hash *)res;
+  grn_table_select_sequential_data data;
+  grn_table_select_sequential_exec_func exec;
+  grn_table_select_sequential_exec_batch_func exec_batch;
+  grn_table_select_sequential_fin_func fin;
+
+  if (op == GRN_OP_OR &&
+      grn_table_select_sequential_parallel(ctx, table, expr, v, sibling,
+                                           res, NULL)) {
+    return;
+  }
+  grn_table_select_sequential_init(ctx, expr, v, sibling,
+                                   &data, &exec, &exec_batch, &fin);
+  if (exec_batch &&
+      grn_table_select_sequential_batch(ctx, table, exec_batch, &data,
+                                        res, op)) {
+    fin(ctx, &data);
+    return;
+  }
+  switch (op) {
+  case GRN_OP_OR :
+    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        score = exec(ctx, id, &data);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
+            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
+          }
+        }
+      }
+      grn_table_cursor_close(ctx, tc);
+    }
+    break;
+  case GRN_OP_AND :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        score = exec(ctx, *idp, &data);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        } else {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_AND_NOT :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        GRN_RECORD_SET(ctx, v, *idp);
+        score = exec(ctx, *idp, &data);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_ADJUST :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        score = exec(ctx, *idp, &data);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  default :
+    break;
+  }
+  fin(ctx, &data);
+}
+
+static void
+grn_table_select_sequential_bitmap(grn_ctx *ctx, grn_obj *table,
+                                   grn_obj *expr, grn_obj *v,
+                                   grn_expr_code *sibling,
+                                   grn_rset_bitmap *bitmap, grn_operator op)
+{
+  int32_t score;
+  grn_id id;
+  grn_table_cursor *tc;
+  grn_table_select_sequential_data data;
+  grn_table_select_sequential_exec_func exec;
+  grn_table_select_sequential_exec_batch_func exec_batch;
+  grn_table_select_sequential_fin_func fin;
+
+  if (op == GRN_OP_OR &&
+      grn_table_select_sequential_parallel(ctx, table, expr, v, sibling,
+                                           NULL, bitmap)) {
+    return;
+  }
+  grn_table_select_sequential_init(ctx, expr, v, sibling,
+                                   &data, &exec, &exec_batch, &fin);
+  if (exec_batch &&
+      grn_table_select_sequential_bitmap_batch(ctx, table, exec_batch, &data,
+                                               bitmap, op)) {
+    fin(ctx, &data);
+    return;
+  }
+  switch (op) {
+  case GRN_OP_OR :
+    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        score = exec(ctx, id, &data);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          if (grn_rset_bitmap_set(ctx, bitmap, id) != GRN_SUCCESS) {
+            break;
+          }
+        }
+      }
+      grn_table_cursor_close(ctx, tc);
+    }
+    break;
+  case GRN_OP_AND :
+    for (id = grn_rset_bitmap_next(ctx, bitmap, GRN_ID_NIL);
+         id != GRN_ID_NIL;
+         id = grn_rset_bitmap_next(ctx, bitmap, id)) {
+      score = exec(ctx, id, &data);
+      if (ctx->rc) {
+        break;
+      }
+      if (score <= 0) {
+        GRN_RSET_BITMAP_UNSET(bitmap, id);
+      }
+    }
+    break;
+  case GRN_OP_AND_NOT :
+    for (id = grn_rset_bitmap_next(ctx, bitmap, GRN_ID_NIL);
+         id != GRN_ID_NIL;
+         id = grn_rset_bitmap_next(ctx, bitmap, id)) {
+      GRN_RECORD_SET(ctx, v, id);
+      score = exec(ctx, id, &data);
+      if (ctx->rc) {
+        break;
+      }
+      if (score > 0) {
+        GRN_RSET_BITMAP_UNSET(bitmap, id);
+      }
+    }
+    break;
+  default :
+    /* GRN_OP_ADJUST only changes scores. Records in bitmap don't have it. */
+    break;
+  }
+  fin(ctx, &data);
+}
+
+static void
+grn_table_select_bitmap_flush(grn_ctx *ctx, grn_rset_bitmap *bitmap,
+                              grn_obj *res)
+{
+  grn_id id;
+  grn_hash *s = (grn_hash *)res;
+
+  for (id = grn_rset_bitmap_next(ctx, bitmap, GRN_ID_NIL);
+       id != GRN_ID_NIL;
+       id = grn_rset_bitmap_next(ctx, bitmap, id)) {
+    if (!grn_hash_add(ctx, s, &id, s->key_size, NULL, NULL)) {
+      break;
+    }
+  }
+}
+
+static grn_rset_bitmap *
+grn_table_select_bitmap_open(grn_ctx *ctx)
+{
+  grn_rset_bitmap *bitmap;
+
+  bitmap = GRN_MALLOC(sizeof(grn_rset_bitmap));
+  if (!bitmap) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[table][select][bitmap] failed to allocate");
+    return NULL;
+  }
+  grn_rset_bitmap_init(ctx, bitmap);
+  return bitmap;
+}
+
+static void
+grn_table_select_bitmap_close(grn_ctx *ctx, grn_rset_bitmap *bitmap)
+{
+  if (!bitmap) {
+    return;
+  }
+  grn_rset_bitmap_fin(ctx, bitmap);
+  GRN_FREE(bitmap);
+}
+
+static inline void
+grn_table_select_index_report(grn_ctx *ctx, const char *tag, grn_obj *index)
+{
+  grn_report_index(ctx, "[table][select]", tag, index);
+}
+
+static inline grn_bool
+grn_table_select_index_equal(grn_ctx *ctx,
+                             grn_obj *table,
+                             grn_obj *index,
+                             scan_info *si,
+                             grn_obj *res)
+{
+  grn_bool processed = GRN_FALSE;
+
+  if (GRN_BULK_VSIZE(si->query) == 0) {
+    /* We can't use index for empty value. */
+    return GRN_FALSE;
+  }
 
   if (si->flags & SCAN_ACCESSOR) {
     if (index->header.type == GRN_ACCESSOR && !((grn_accessor *)index)->next) {
@@ -6476,95 +7915,601 @@ grn_table_select_index(grn_ctx *ctx, grn_obj *table, scan_info *si,
         }
         GRN_OBJ_FIN(ctx, &wv);
       }
-      processed = GRN_TRUE;
-      break;
-    case GRN_OP_TERM_EXTRACT :
-      if (si->flags & SCAN_ACCESSOR) {
-        if (index->header.type == GRN_ACCESSOR &&
-            !((grn_accessor *)index)->next) {
-          grn_accessor *a = (grn_accessor *)index;
-          switch (a->action) {
-          case GRN_ACCESSOR_GET_KEY :
-            grn_table_select_index_report(ctx, "[term-extract][accessor][key]",
-                                          table);
-            grn_table_search(ctx, table,
-                             GRN_TEXT_VALUE(si->query), GRN_TEXT_LEN(si->query),
-                             GRN_OP_TERM_EXTRACT, res, si->logical_op);
-            processed = GRN_TRUE;
-            break;
-          }
-        }
+      processed = GRN_TRUE;
+      break;
+    case GRN_OP_TERM_EXTRACT :
+      if (si->flags & SCAN_ACCESSOR) {
+        if (index->header.type == GRN_ACCESSOR &&
+            !((grn_accessor *)index)->next) {
+          grn_accessor *a = (grn_accessor *)index;
+          switch (a->action) {
+          case GRN_ACCESSOR_GET_KEY :
+            grn_table_select_index_report(ctx, "[term-extract][accessor][key]",
+                                          table);
+            grn_table_search(ctx, table,
+                             GRN_TEXT_VALUE(si->query), GRN_TEXT_LEN(si->query),
+                             GRN_OP_TERM_EXTRACT, res, si->logical_op);
+            processed = GRN_TRUE;
+            break;
+          }
+        }
+      }
+      break;
+    case GRN_OP_CALL :
+      if (grn_obj_is_selector_proc(ctx, si->args[0])) {
+        grn_rc rc;
+        grn_proc *proc = (grn_proc *)(si->args[0]);
+        if (grn_logger_pass(ctx, GRN_REPORT_INDEX_LOG_LEVEL)) {
+          char proc_name[GRN_TABLE_MAX_KEY_SIZE];
+          int proc_name_size;
+          char tag[GRN_TABLE_MAX_KEY_SIZE];
+          proc_name_size = grn_obj_name(ctx, (grn_obj *)proc,
+                                        proc_name, GRN_TABLE_MAX_KEY_SIZE);
+          proc_name[proc_name_size] = '\0';
+          grn_snprintf(tag, GRN_TABLE_MAX_KEY_SIZE, GRN_TABLE_MAX_KEY_SIZE,
+                       "[selector][%s]", proc_name);
+          grn_table_select_index_report(ctx, tag, index);
+        }
+        rc = proc->selector(ctx, table, index, si->nargs, si->args,
+                            res, si->logical_op);
+        if (rc) {
+          /* TODO: report error */
+        } else {
+          processed = GRN_TRUE;
+        }
+      }
+      break;
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      processed = grn_table_select_index_range(ctx, table, index, si, res);
+      break;
+    default :
+      /* todo : implement */
+      /* todo : handle SCAN_PRE_CONST */
+      break;
+    }
+  } else {
+    switch (si->op) {
+    case GRN_OP_CALL :
+      if (grn_obj_is_selector_proc(ctx, si->args[0])) {
+        grn_rc rc;
+        grn_proc *proc = (grn_proc *)(si->args[0]);
+        if (grn_logger_pass(ctx, GRN_REPORT_INDEX_LOG_LEVEL)) {
+          char proc_name[GRN_TABLE_MAX_KEY_SIZE];
+          int proc_name_size;
+          char tag[GRN_TABLE_MAX_KEY_SIZE];
+          proc_name_size = grn_obj_name(ctx, (grn_obj *)proc,
+                                        proc_name, GRN_TABLE_MAX_KEY_SIZE);
+          proc_name[proc_name_size] = '\0';
+          grn_snprintf(tag, GRN_TABLE_MAX_KEY_SIZE, GRN_TABLE_MAX_KEY_SIZE,
+                       "[selector][no-index][%s]", proc_name);
+          grn_table_select_index_report(ctx, tag, table);
+        }
+        rc = proc->selector(ctx, table, NULL, si->nargs, si->args,
+                            res, si->logical_op);
+        if (rc) {
+          if (rc == GRN_FUNCTION_NOT_IMPLEMENTED) {
+            ERRCLR(ctx);
+          } else {
+            /* TODO: report error */
+          }
+        } else {
+          processed = GRN_TRUE;
+        }
+      }
+    default :
+      break;
+    }
+  }
+  return processed;
+}
+
+/*
+ * Index search needs a result set with subrecs for AND. So records are
+ * selected by OR into a temporary result set and combined with bitmap.
+ */
+static grn_bool
+grn_table_select_index_bitmap(grn_ctx *ctx, grn_obj *table, scan_info *si,
+                              grn_rset_bitmap *bitmap)
+{
+  grn_bool processed;
+  grn_obj *res;
+  grn_operator logical_op = si->logical_op;
+
+  if (logical_op == GRN_OP_ADJUST) {
+    return GRN_TRUE;
+  }
+
+  res = grn_table_create(ctx, NULL, 0, NULL,
+                         GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, table, NULL);
+  if (!res) {
+    return GRN_FALSE;
+  }
+  si->logical_op = GRN_OP_OR;
+  processed = grn_table_select_index(ctx, table, si, res);
+  si->logical_op = logical_op;
+  if (processed && ctx->rc == GRN_SUCCESS) {
+    grn_rset_bitmap selected;
+    grn_id *key;
+    grn_rset_bitmap_init(ctx, &selected);
+    GRN_HASH_EACH(ctx, (grn_hash *)res, id, &key, NULL, NULL, {
+      if (grn_rset_bitmap_set(ctx, &selected, *key) != GRN_SUCCESS) {
+        break;
+      }
+    });
+    grn_rset_bitmap_setoperation(ctx, bitmap, &selected, logical_op);
+    grn_rset_bitmap_fin(ctx, &selected);
+  }
+  grn_obj_close(ctx, res);
+  return processed;
+}
+
+/*
+ * Conditions combined by AND are reordered by their estimated sizes so
+ * that the most selective indexed condition is processed first and the
+ * following conditions work on a small result set. Sizes are estimated
+ * by index statistics in the same way as ExpressionSizeEstimator.
+ */
+static unsigned int
+grn_scan_info_estimate_size_index(grn_ctx *ctx, scan_info *si,
+                                  grn_obj *index, unsigned int table_size)
+{
+  grn_ii *ii = (grn_ii *)index;
+  grn_obj *lexicon;
+  unsigned int size = table_size;
+
+  if (index->header.type != GRN_COLUMN_INDEX || !si->query) {
+    return table_size;
+  }
+
+  lexicon = grn_ctx_at(ctx, index->header.domain);
+  if (!lexicon) {
+    return table_size;
+  }
+
+  switch (si->op) {
+  case GRN_OP_MATCH :
+    if (si->query->header.type == GRN_BULK &&
+        grn_type_id_is_text_family(ctx, si->query->header.domain)) {
+      size = grn_ii_estimate_size_for_query(ctx, ii,
+                                            GRN_TEXT_VALUE(si->query),
+                                            GRN_TEXT_LEN(si->query),
+                                            NULL);
+    }
+    break;
+  case GRN_OP_EQUAL :
+    if (GRN_BULK_VSIZE(si->query) > 0) {
+      grn_id tid;
+      if (GRN_OBJ_GET_DOMAIN(si->query) == DB_OBJ(lexicon)->id) {
+        tid = GRN_RECORD_VALUE(si->query);
+      } else {
+        tid = grn_table_get(ctx, lexicon,
+                            GRN_BULK_HEAD(si->query),
+                            GRN_BULK_VSIZE(si->query));
+      }
+      if (tid == GRN_ID_NIL) {
+        size = 0;
+      } else {
+        size = grn_ii_estimate_size(ctx, ii, tid);
+      }
+    }
+    break;
+  case GRN_OP_PREFIX :
+  case GRN_OP_LESS :
+  case GRN_OP_GREATER :
+  case GRN_OP_LESS_EQUAL :
+  case GRN_OP_GREATER_EQUAL :
+    if (lexicon->header.type == GRN_TABLE_PAT_KEY ||
+        lexicon->header.type == GRN_TABLE_DAT_KEY) {
+      grn_obj key;
+      GRN_OBJ_INIT(&key, GRN_BULK, 0, lexicon->header.domain);
+      if (grn_obj_cast(ctx, si->query, &key, GRN_FALSE) == GRN_SUCCESS) {
+        grn_table_cursor *cursor;
+        const void *min = NULL, *max = NULL;
+        unsigned int min_size = 0, max_size = 0;
+        int flags = GRN_CURSOR_ASCENDING;
+
+        switch (si->op) {
+        case GRN_OP_PREFIX :
+          flags |= GRN_CURSOR_PREFIX;
+          min = GRN_BULK_HEAD(&key);
+          min_size = GRN_BULK_VSIZE(&key);
+          break;
+        case GRN_OP_LESS :
+          flags |= GRN_CURSOR_LT;
+          max = GRN_BULK_HEAD(&key);
+          max_size = GRN_BULK_VSIZE(&key);
+          break;
+        case GRN_OP_GREATER :
+          flags |= GRN_CURSOR_GT;
+          min = GRN_BULK_HEAD(&key);
+          min_size = GRN_BULK_VSIZE(&key);
+          break;
+        case GRN_OP_LESS_EQUAL :
+          flags |= GRN_CURSOR_LE;
+          max = GRN_BULK_HEAD(&key);
+          max_size = GRN_BULK_VSIZE(&key);
+          break;
+        case GRN_OP_GREATER_EQUAL :
+          flags |= GRN_CURSOR_GE;
+          min = GRN_BULK_HEAD(&key);
+          min_size = GRN_BULK_VSIZE(&key);
+          break;
+        default :
+          break;
+        }
+        cursor = grn_table_cursor_open(ctx, lexicon,
+                                       min, min_size, max, max_size,
+                                       0, -1, flags);
+        if (cursor) {
+          size = grn_ii_estimate_size_for_lexicon_cursor(ctx, ii, cursor);
+          grn_table_cursor_close(ctx, cursor);
+        }
+      }
+      GRN_OBJ_FIN(ctx, &key);
+    }
+    break;
+  default :
+    break;
+  }
+
+  return size;
+}
+
+static grn_bool
+grn_scan_info_estimate_size(grn_ctx *ctx, scan_info *si,
+                            unsigned int table_size, unsigned int *size)
+{
+  int i, n_indexes;
+
+  n_indexes = GRN_BULK_VSIZE(&(si->index)) / sizeof(grn_obj *);
+  if (n_indexes == 0) {
+    return GRN_FALSE;
+  }
+
+  *size = 0;
+  for (i = 0; i < n_indexes; i++) {
+    grn_obj *index = GRN_PTR_VALUE_AT(&(si->index), i);
+    *size += grn_scan_info_estimate_size_index(ctx, si, index, table_size);
+    if (*size >= table_size) {
+      *size = table_size;
+      break;
+    }
+  }
+  return GRN_TRUE;
+}
+
+/*
+ * A condition without index is estimated by statistics of its column
+ * created by column_analyze.
+ */
+static grn_bool
+grn_scan_info_estimate_size_sequential(grn_ctx *ctx, scan_info *si,
+                                       unsigned int table_size,
+                                       unsigned int *size)
+{
+  grn_obj *column;
+
+  if (GRN_BULK_VSIZE(&(si->index)) > 0) {
+    return GRN_FALSE;
+  }
+  if (si->flags & SCAN_ACCESSOR) {
+    return GRN_FALSE;
+  }
+  if (si->nargs != 2 || !si->query || si->args[1] != si->query) {
+    return GRN_FALSE;
+  }
+
+  column = si->args[0];
+  if (!grn_obj_is_column(ctx, column)) {
+    return GRN_FALSE;
+  }
+  return grn_column_stats_estimate_size(ctx, column, si->op, si->query,
+                                        table_size, size);
+}
+
+static grn_bool
+grn_scan_info_refer_score(grn_ctx *ctx, grn_obj *expr, scan_info *si)
+{
+  grn_expr *e = (grn_expr *)expr;
+  uint32_t i;
+
+  for (i = si->start; i <= si->end && i < e->codes_curr; i++) {
+    grn_obj *value = e->codes[i].value;
+    grn_accessor *a;
+    if (!value || value->header.type != GRN_ACCESSOR) {
+      continue;
+    }
+    for (a = (grn_accessor *)value; a; a = a->next) {
+      if (a->action == GRN_ACCESSOR_GET_SCORE) {
+        return GRN_TRUE;
+      }
+    }
+  }
+  return GRN_FALSE;
+}
+
+typedef enum {
+  GRN_SCAN_INFO_ORDER_RANK_INDEX,
+  GRN_SCAN_INFO_ORDER_RANK_SEQUENTIAL,
+  GRN_SCAN_INFO_ORDER_RANK_UNKNOWN
+} grn_scan_info_order_rank;
+
+typedef struct {
+  scan_info *si;
+  grn_scan_info_order_rank rank;
+  unsigned int size;
+} grn_scan_info_order_entry;
+
+/* Stable insertion sort: runs are short. */
+static grn_bool
+grn_scan_info_order_entries(grn_scan_info_order_entry *entries,
+                            int n_entries)
+{
+  int i, j;
+  grn_bool changed = GRN_FALSE;
+
+  for (i = 1; i < n_entries; i++) {
+    grn_scan_info_order_entry entry = entries[i];
+    for (j = i; j > 0; j--) {
+      grn_scan_info_order_entry *previous = &(entries[j - 1]);
+      if (previous->rank < entry.rank) {
+        break;
+      }
+      if (previous->rank == entry.rank && previous->size <= entry.size) {
+        break;
       }
-      break;
-    case GRN_OP_CALL :
-      if (grn_obj_is_selector_proc(ctx, si->args[0])) {
-        grn_rc rc;
-        grn_proc *proc = (grn_proc *)(si->args[0]);
-        if (grn_logger_pass(ctx, GRN_REPORT_INDEX_LOG_LEVEL)) {
-          char proc_name[GRN_TABLE_MAX_KEY_SIZE];
-          int proc_name_size;
-          char tag[GRN_TABLE_MAX_KEY_SIZE];
-          proc_name_size = grn_obj_name(ctx, (grn_obj *)proc,
-                                        proc_name, GRN_TABLE_MAX_KEY_SIZE);
-          proc_name[proc_name_size] = '\0';
-          grn_snprintf(tag, GRN_TABLE_MAX_KEY_SIZE, GRN_TABLE_MAX_KEY_SIZE,
-                       "[selector][%s]", proc_name);
-          grn_table_select_index_report(ctx, tag, index);
-        }
-        rc = proc->selector(ctx, table, index, si->nargs, si->args,
-                            res, si->logical_op);
-        if (rc) {
-          /* TODO: report error */
-        } else {
-          processed = GRN_TRUE;
-        }
+      entries[j] = *previous;
+    }
+    if (j != i) {
+      entries[j] = entry;
+      changed = GRN_TRUE;
+    }
+  }
+  return changed;
+}
+
+/*
+ * Reorders sis[start..end) that are ANDed to the result of the
+ * condition just before start. Indexed conditions are ordered by their
+ * estimated sizes and processed before sequential conditions that are
+ * estimated by column statistics. Function calls such as selectors and
+ * conditions that can't be estimated aren't moved and conditions aren't
+ * moved across them. Selectors may not be able to process AND.
+ */
+static void
+grn_scan_info_order_run(grn_ctx *ctx, grn_obj *expr,
+                        scan_info **sis, int start, int end,
+                        unsigned int table_size)
+{
+  grn_scan_info_order_entry *entries;
+  int i, n_entries, segment_start;
+  grn_bool changed = GRN_FALSE;
+
+  n_entries = end - start;
+  if (n_entries < 2) {
+    return;
+  }
+
+  for (i = start; i < end; i++) {
+    if (grn_scan_info_refer_score(ctx, expr, sis[i])) {
+      return;
+    }
+  }
+
+  entries = GRN_MALLOCN(grn_scan_info_order_entry, n_entries);
+  if (!entries) {
+    return;
+  }
+
+  for (i = 0; i < n_entries; i++) {
+    grn_scan_info_order_entry *entry = &(entries[i]);
+    entry->si = sis[start + i];
+    entry->size = table_size;
+    if (entry->si->op == GRN_OP_CALL) {
+      entry->rank = GRN_SCAN_INFO_ORDER_RANK_UNKNOWN;
+    } else if (grn_scan_info_estimate_size(ctx, entry->si,
+                                           table_size, &(entry->size))) {
+      entry->rank = GRN_SCAN_INFO_ORDER_RANK_INDEX;
+    } else if (grn_scan_info_estimate_size_sequential(ctx, entry->si,
+                                                      table_size,
+                                                      &(entry->size))) {
+      entry->rank = GRN_SCAN_INFO_ORDER_RANK_SEQUENTIAL;
+    } else {
+      entry->rank = GRN_SCAN_INFO_ORDER_RANK_UNKNOWN;
+    }
+    if (ctx->rc != GRN_SUCCESS) {
+      GRN_FREE(entries);
+      return;
+    }
+  }
+
+  segment_start = 0;
+  for (i = 0; i <= n_entries; i++) {
+    if (i < n_entries &&
+        entries[i].rank != GRN_SCAN_INFO_ORDER_RANK_UNKNOWN) {
+      continue;
+    }
+    if (grn_scan_info_order_entries(entries + segment_start,
+                                    i - segment_start)) {
+      changed = GRN_TRUE;
+    }
+    segment_start = i + 1;
+  }
+
+  if (changed) {
+    for (i = 0; i < n_entries; i++) {
+      sis[start + i] = entries[i].si;
+    }
+  }
+
+  GRN_FREE(entries);
+}
+
+/*
+ * The order of records in a scored result set depends on the order of
+ * insertions and deletions. When keep_order is true, conditions are
+ * reordered only when no more records are inserted after them.
+ */
+static void
+grn_scan_info_order_by_estimated_size(grn_ctx *ctx, grn_obj *table,
+                                      grn_obj *expr,
+                                      scan_info **sis, int n,
+                                      grn_bool keep_order)
+{
+  unsigned int table_size;
+  int i;
+  int last_insert = -1;
+
+  if (grn_table_select_order_by_estimated_size ==
+      GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_NO) {
+    return;
+  }
+  if (n < 2) {
+    return;
+  }
+
+  if (keep_order) {
+    for (i = n - 1; i >= 0; i--) {
+      if (sis[i]->logical_op == GRN_OP_OR) {
+        last_insert = i;
+        break;
       }
-      break;
-    case GRN_OP_LESS :
-    case GRN_OP_GREATER :
-    case GRN_OP_LESS_EQUAL :
-    case GRN_OP_GREATER_EQUAL :
-      processed = grn_table_select_index_range(ctx, table, index, si, res);
-      break;
-    default :
-      /* todo : implement */
-      /* todo : handle SCAN_PRE_CONST */
-      break;
     }
-  } else {
-    switch (si->op) {
-    case GRN_OP_CALL :
-      if (grn_obj_is_selector_proc(ctx, si->args[0])) {
-        grn_rc rc;
-        grn_proc *proc = (grn_proc *)(si->args[0]);
-        if (grn_logger_pass(ctx, GRN_REPORT_INDEX_LOG_LEVEL)) {
-          char proc_name[GRN_TABLE_MAX_KEY_SIZE];
-          int proc_name_size;
-          char tag[GRN_TABLE_MAX_KEY_SIZE];
-          proc_name_size = grn_obj_name(ctx, (grn_obj *)proc,
-                                        proc_name, GRN_TABLE_MAX_KEY_SIZE);
-          proc_name[proc_name_size] = '\0';
-          grn_snprintf(tag, GRN_TABLE_MAX_KEY_SIZE, GRN_TABLE_MAX_KEY_SIZE,
-                       "[selector][no-index][%s]", proc_name);
-          grn_table_select_index_report(ctx, tag, table);
-        }
-        rc = proc->selector(ctx, table, NULL, si->nargs, si->args,
-                            res, si->logical_op);
-        if (rc) {
-          if (rc == GRN_FUNCTION_NOT_IMPLEMENTED) {
-            ERRCLR(ctx);
-          } else {
-            /* TODO: report error */
-          }
-        } else {
-          processed = GRN_TRUE;
-        }
+  }
+
+  table_size = grn_table_size(ctx, table);
+  i = 0;
+  while (i < n) {
+    /* The first condition of a run creates the result that the
+       following conditions are ANDed to. It isn't moved. */
+    int start = i + 1;
+
+    for (i++; i < n; i++) {
+      scan_info *si = sis[i];
+      if ((si->flags & (SCAN_PUSH | SCAN_POP)) ||
+          si->logical_op != GRN_OP_AND) {
+        break;
       }
-    default :
-      break;
+    }
+    if (last_insert >= i) {
+      continue;
+    }
+    grn_scan_info_order_run(ctx, expr, sis, start, i, table_size);
+    if (ctx->rc != GRN_SUCCESS) {
+      return;
     }
   }
-  return processed;
+}
+
+/*
+ * An index search for AND reads all postings of the condition even when
+ * the current result set is small. Records in the current result set are
+ * checked sequentially instead when the condition is estimated to match
+ * many more records. This is used only for conditions that are evaluated
+ * to the same records and scores by both of index and sequential search.
+ */
+#define GRN_TABLE_SELECT_INDEX_SEQUENTIAL_RATIO 10
+
+static grn_bool
+grn_table_select_index_use_sequential(grn_ctx *ctx, grn_obj *table,
+                                      scan_info *si, unsigned int n_records)
+{
+  grn_obj *index;
+  grn_obj *column;
+  grn_obj *lexicon;
+  grn_obj *tokenizer = NULL;
+  grn_obj *normalizer = NULL;
+  unsigned int size;
+
+  if (grn_table_select_order_by_estimated_size ==
+      GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_NO) {
+    return GRN_FALSE;
+  }
+  if (si->logical_op != GRN_OP_AND) {
+    return GRN_FALSE;
+  }
+  if (si->flags & (SCAN_PUSH | SCAN_POP | SCAN_ACCESSOR)) {
+    return GRN_FALSE;
+  }
+  switch (si->op) {
+  case GRN_OP_EQUAL :
+  case GRN_OP_LESS :
+  case GRN_OP_GREATER :
+  case GRN_OP_LESS_EQUAL :
+  case GRN_OP_GREATER_EQUAL :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  if (GRN_BULK_VSIZE(&(si->index)) != sizeof(grn_obj *) ||
+      GRN_PTR_VALUE_AT(&(si->scorers), 0) ||
+      si->position.specified ||
+      si->nargs < 1) {
+    return GRN_FALSE;
+  }
+
+  index = GRN_PTR_VALUE(&(si->index));
+  if (index->header.type != GRN_COLUMN_INDEX ||
+      (index->header.flags & GRN_OBJ_WITH_WEIGHT) ||
+      DB_OBJ(index)->source_size != sizeof(grn_id)) {
+    return GRN_FALSE;
+  }
+  column = si->args[0];
+  if (!grn_obj_is_column(ctx, column)) {
+    return GRN_FALSE;
+  }
+  if ((column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) !=
+      GRN_OBJ_COLUMN_SCALAR ||
+      !grn_type_id_is_builtin(ctx, DB_OBJ(column)->range) ||
+      DB_OBJ(column)->id != *((grn_id *)(DB_OBJ(index)->source))) {
+    return GRN_FALSE;
+  }
+  lexicon = grn_ctx_at(ctx, index->header.domain);
+  if (!lexicon) {
+    return GRN_FALSE;
+  }
+  grn_table_get_info(ctx, lexicon, NULL, NULL, &tokenizer, &normalizer, NULL);
+  if (tokenizer || normalizer) {
+    return GRN_FALSE;
+  }
+
+  if (!grn_scan_info_estimate_size(ctx, si, grn_table_size(ctx, table),
+                                   &size)) {
+    return GRN_FALSE;
+  }
+  return (n_records * GRN_TABLE_SELECT_INDEX_SEQUENTIAL_RATIO) < size;
+}
+
+/*
+ * Returns codes of the condition that is ANDed to the result just
+ * after the i-th condition or NULL. Records that don't match it are
+ * removed from the result anyway.
+ */
+static grn_expr_code *
+grn_table_select_sequential_find_sibling(grn_ctx *ctx,
+                                         grn_scanner *scanner,
+                                         grn_expr_code *codes,
+                                         unsigned int i)
+{
+  scan_info *next_si;
+
+  if (i + 1 >= scanner->n_sis) {
+    return NULL;
+  }
+  next_si = scanner->sis[i + 1];
+  if (next_si->flags & (SCAN_PUSH | SCAN_POP)) {
+    return NULL;
+  }
+  if (next_si->logical_op != GRN_OP_AND) {
+    return NULL;
+  }
+  if (next_si->end - next_si->start + 1 != 3) {
+    return NULL;
+  }
+  return codes + next_si->start;
 }
 
 grn_obj *
@@ -6599,41 +8544,111 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
     scanner = grn_scanner_open(ctx, expr, op, res_size > 0);
     if (scanner) {
       grn_obj res_stack;
+      grn_obj bitmap_stack;
+      grn_rset_bitmap *bitmap = NULL;
+      grn_bool use_bitmap;
       grn_expr *e = (grn_expr *)scanner->expr;
       grn_expr_code *codes = e->codes;
       uint32_t codes_curr = e->codes_curr;
       GRN_PTR_INIT(&res_stack, GRN_OBJ_VECTOR, GRN_ID_NIL);
+      GRN_PTR_INIT(&bitmap_stack, GRN_OBJ_VECTOR, GRN_ID_NIL);
+      /*
+       * Records are collected into a bitmap instead of res when res
+       * doesn't have score. The bitmap is flushed into res after all
+       * conditions are processed.
+       */
+      use_bitmap = (res_size == 0 &&
+                    !(DB_OBJ(res)->header.flags & GRN_OBJ_WITH_SUBREC));
+      if (use_bitmap) {
+        bitmap = grn_table_select_bitmap_open(ctx);
+      }
+      grn_scan_info_order_by_estimated_size(
+        ctx, table, scanner->expr, scanner->sis, scanner->n_sis,
+        !(use_bitmap ||
+          grn_table_select_order_by_estimated_size ==
+          GRN_TABLE_SELECT_ORDER_BY_ESTIMATED_SIZE_YES));
       for (i = 0; i < scanner->n_sis; i++) {
         scan_info *si = scanner->sis[i];
         if (si->flags & SCAN_POP) {
           grn_obj *res_;
+          grn_obj *stacked_bitmap;
+          grn_rset_bitmap *bitmap_;
           GRN_PTR_POP(&res_stack, res_);
-          grn_table_setoperation(ctx, res_, res, res_, si->logical_op);
+          GRN_PTR_POP(&bitmap_stack, stacked_bitmap);
+          bitmap_ = (grn_rset_bitmap *)stacked_bitmap;
+          if (bitmap_ && bitmap) {
+            grn_rset_bitmap_setoperation(ctx, bitmap_, bitmap,
+                                         si->logical_op);
+          } else {
+            if (bitmap_) {
+              grn_table_select_bitmap_flush(ctx, bitmap_, res_);
+              grn_table_select_bitmap_close(ctx, bitmap_);
+              bitmap_ = NULL;
+            }
+            if (bitmap) {
+              grn_table_select_bitmap_flush(ctx, bitmap, res);
+            }
+            grn_table_setoperation(ctx, res_, res, res_, si->logical_op);
+          }
+          grn_table_select_bitmap_close(ctx, bitmap);
+          bitmap = bitmap_;
           grn_obj_close(ctx, res);
           res = res_;
         } else {
           grn_bool processed = GRN_FALSE;
           if (si->flags & SCAN_PUSH) {
             grn_obj *res_ = NULL;
-            res_ = grn_table_create(ctx, NULL, 0, NULL,
-                                    GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, table, NULL);
+            grn_table_flags flags = GRN_TABLE_HASH_KEY;
+            if (!use_bitmap) {
+              flags |= GRN_OBJ_WITH_SUBREC;
+            }
+            res_ = grn_table_create(ctx, NULL, 0, NULL, flags, table, NULL);
             if (!res_) {
               break;
             }
             GRN_PTR_PUT(ctx, &res_stack, res);
+            GRN_PTR_PUT(ctx, &bitmap_stack, bitmap);
             res = res_;
+            bitmap = NULL;
+            if (use_bitmap) {
+              bitmap = grn_table_select_bitmap_open(ctx);
+            }
+          }
+          if (grn_table_select_index_use_sequential(
+                ctx, table, si,
+                bitmap ?
+                grn_rset_bitmap_size(ctx, bitmap) :
+                grn_table_size(ctx, res))) {
+            processed = GRN_FALSE;
+          } else if (bitmap) {
+            processed = grn_table_select_index_bitmap(ctx, table, si, bitmap);
+          } else {
+            processed = grn_table_select_index(ctx, table, si, res);
           }
-          processed = grn_table_select_index(ctx, table, si, res);
           if (!processed) {
+            grn_expr_code *sibling;
             if (ctx->rc) { break; }
+            sibling = grn_table_select_sequential_find_sibling(ctx,
+                                                               scanner,
+                                                               codes,
+                                                               i);
             e->codes = codes + si->start;
             e->codes_curr = si->end - si->start + 1;
-            grn_table_select_sequential(ctx, table, expr, v,
-                                        res, si->logical_op);
+            if (bitmap) {
+              grn_table_select_sequential_bitmap(ctx, table, expr, v,
+                                                 sibling,
+                                                 bitmap, si->logical_op);
+            } else {
+              grn_table_select_sequential(ctx, table, expr, v, sibling,
+                                          res, si->logical_op);
+            }
           }
         }
         GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
-                      ":", "filter(%d)", grn_table_size(ctx, res));
+                      ":", "filter(%d)",
+                      bitmap ?
+                      grn_rset_bitmap_size(ctx, bitmap) :
+                      grn_table_size(ctx, res));
         if (ctx->rc) {
           if (res_created) {
             grn_obj_close(ctx, res);
@@ -6642,6 +8657,12 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
           break;
         }
       }
+      if (bitmap) {
+        if (res) {
+          grn_table_select_bitmap_flush(ctx, bitmap, res);
+        }
+        grn_table_select_bitmap_close(ctx, bitmap);
+      }
 
       i = 0;
       if (!res_created) { i++; }
@@ -6651,13 +8672,20 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
         grn_obj_close(ctx, stacked_res);
       }
       GRN_OBJ_FIN(ctx, &res_stack);
+      for (i = 0; i < GRN_BULK_VSIZE(&bitmap_stack) / sizeof(grn_obj *); i++) {
+        grn_rset_bitmap *stacked_bitmap;
+        stacked_bitmap =
+          *((grn_rset_bitmap **)GRN_BULK_HEAD(&bitmap_stack) + i);
+        grn_table_select_bitmap_close(ctx, stacked_bitmap);
+      }
+      GRN_OBJ_FIN(ctx, &bitmap_stack);
       e->codes = codes;
       e->codes_curr = codes_curr;
 
       grn_scanner_close(ctx, scanner);
     } else {
       if (!ctx->rc) {
-        grn_table_select_sequential(ctx, table, expr, v, res, op);
+        grn_table_select_sequential(ctx, table, expr, v, NULL, res, op);
         if (ctx->rc) {
           if (res_created) {
             grn_obj_close(ctx, res);
@@ -6670,6 +8698,106 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
   GRN_API_RETURN(res);
 }
 
+/*
+ * grn_table_select_top_k selects only the top k records by score when expr
+ * is full text search queries joined by OR against one index column that
+ * has GRN_OBJ_INDEX_BLOCK_MAX. n_hits is set to the estimated number of
+ * all matched records. It's the exact number when count_n_hits is true.
+ * It returns NULL when expr can't be processed by grn_ii_select_top_k().
+ * The caller should use grn_table_select() for the case.
+ */
+grn_obj *
+grn_table_select_top_k(grn_ctx *ctx, grn_obj *table, grn_obj *expr, int k,
+                       grn_bool count_n_hits, uint32_t *n_hits)
+{
+  grn_obj *res = NULL;
+  grn_obj *index = NULL;
+  grn_obj queries;
+  grn_obj weights;
+  grn_scanner *scanner;
+  unsigned int i;
+
+  if (k <= 0) {
+    return NULL;
+  }
+  if (!grn_expr_get_var_by_offset(ctx, expr, 0)) {
+    return NULL;
+  }
+
+  GRN_API_ENTER;
+  scanner = grn_scanner_open(ctx, expr, GRN_OP_OR, GRN_FALSE);
+  if (!scanner) {
+    GRN_API_RETURN(NULL);
+  }
+
+  GRN_PTR_INIT(&queries, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  GRN_INT32_INIT(&weights, GRN_OBJ_VECTOR);
+  for (i = 0; i < scanner->n_sis; i++) {
+    scan_info *si = scanner->sis[i];
+    int32_t *wp;
+    if (si->flags & (SCAN_PUSH | SCAN_POP | SCAN_ACCESSOR)) {
+      break;
+    }
+    if (si->op != GRN_OP_MATCH) {
+      break;
+    }
+    if (i > 0 && si->logical_op != GRN_OP_OR) {
+      break;
+    }
+    if (GRN_BULK_VSIZE(&(si->index)) != sizeof(grn_obj *)) {
+      break;
+    }
+    if (GRN_PTR_VALUE_AT(&(si->scorers), 0)) {
+      break;
+    }
+    if (!index) {
+      index = GRN_PTR_VALUE(&(si->index));
+      if (index->header.type != GRN_COLUMN_INDEX ||
+          !(index->header.flags & GRN_OBJ_INDEX_BLOCK_MAX)) {
+        break;
+      }
+    } else if (GRN_PTR_VALUE(&(si->index)) != index) {
+      break;
+    }
+    wp = &GRN_INT32_VALUE(&(si->wv));
+    if (wp[0] != 0 || wp[1] <= 0) {
+      break;
+    }
+    if (!si->query ||
+        !grn_type_id_is_text_family(ctx, si->query->header.domain)) {
+      break;
+    }
+    GRN_PTR_PUT(ctx, &queries, si->query);
+    GRN_INT32_PUT(ctx, &weights, wp[1]);
+  }
+
+  if (i == scanner->n_sis && index) {
+    res = grn_table_create(ctx, NULL, 0, NULL,
+                           GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, table, NULL);
+    if (res) {
+      grn_bool processed;
+      grn_table_select_index_report(ctx, "[top-k]", index);
+      processed = grn_ii_select_top_k(ctx, (grn_ii *)index,
+                                      (grn_obj **)GRN_BULK_HEAD(&queries),
+                                      (int *)GRN_BULK_HEAD(&weights),
+                                      scanner->n_sis, k, (grn_hash *)res,
+                                      count_n_hits, n_hits);
+      if (processed) {
+        GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
+                      ":", "filter(%d)", *n_hits);
+      } else {
+        grn_obj_close(ctx, res);
+        res = NULL;
+      }
+    }
+  }
+
+  GRN_OBJ_FIN(ctx, &queries);
+  GRN_OBJ_FIN(ctx, &weights);
+  grn_scanner_close(ctx, scanner);
+  GRN_API_RETURN(res);
+}
+
 /* grn_expr_parse */
 
 grn_obj *
@@ -238,6 +238,14 @@ typedef pthread_mutex_t grn_critical_section;
 # define CRITICAL_SECTION_LEAVE(cs) pthread_mutex_unlock(&(cs))
 # define CRITICAL_SECTION_FIN(cs)
 
+typedef pthread_rwlock_t grn_rwlock;
+# define RWLOCK_INIT(l)         pthread_rwlock_init(&(l), NULL)
+# define RWLOCK_READ_LOCK(l)    pthread_rwlock_rdlock(&(l))
+# define RWLOCK_READ_UNLOCK(l)  pthread_rwlock_unlock(&(l))
+# define RWLOCK_WRITE_LOCK(l)   pthread_rwlock_wrlock(&(l))
+# define RWLOCK_WRITE_UNLOCK(l) pthread_rwlock_unlock(&(l))
+# define RWLOCK_FIN(l)          pthread_rwlock_destroy(&(l))
+
 typedef pthread_cond_t grn_cond;
 # define COND_INIT(c)   pthread_cond_init(&c, NULL)
 # define COND_SIGNAL(c) pthread_cond_signal(&c)
@@ -322,6 +330,14 @@ typedef CRITICAL_SECTION grn_critical_section;
 #  define CRITICAL_SECTION_LEAVE(cs) LeaveCriticalSection(&(cs))
 #  define CRITICAL_SECTION_FIN(cs)   DeleteCriticalSection(&(cs))
 
+typedef SRWLOCK grn_rwlock;
+#  define RWLOCK_INIT(l)         InitializeSRWLock(&(l))
+#  define RWLOCK_READ_LOCK(l)    AcquireSRWLockShared(&(l))
+#  define RWLOCK_READ_UNLOCK(l)  ReleaseSRWLockShared(&(l))
+#  define RWLOCK_WRITE_LOCK(l)   AcquireSRWLockExclusive(&(l))
+#  define RWLOCK_WRITE_UNLOCK(l) ReleaseSRWLockExclusive(&(l))
+#  define RWLOCK_FIN(l)
+
 typedef struct
 {
   int waiters_count_;
@@ -407,6 +423,14 @@ typedef int grn_cond;
 #  define COND_FIN(c)
 /* todo : must be enhanced! */
 
+typedef int grn_rwlock;
+#  define RWLOCK_INIT(l)         ((l) = 0)
+#  define RWLOCK_READ_LOCK(l)
+#  define RWLOCK_READ_UNLOCK(l)
+#  define RWLOCK_WRITE_LOCK(l)
+#  define RWLOCK_WRITE_UNLOCK(l)
+#  define RWLOCK_FIN(l)
+
 # endif /* WIN32 */
 
 # define MUTEX_INIT_SHARED MUTEX_INIT
@@ -521,6 +545,13 @@ typedef int grn_cond;
 #  define GRN_BIT_SCAN_REV0(v,r) GRN_BIT_SCAN_REV(v,r)
 # endif /* ATOMIC ADD */
 
+/*
+ * GRN_ATOMIC_CAS_EX() performs { r = *p; if (r == o) { *p = n; } }
+ * atomically.
+ */
+# define GRN_ATOMIC_CAS_EX(p, o, n, r) \
+  ((r) = __sync_val_compare_and_swap((p), (o), (n)))
+
 # ifdef __i386__ /* ATOMIC 64BIT SET */
 #  define GRN_SET_64BIT(p,v) \
   __asm__ __volatile__ ("\txchgl %%esi, %%ebx\n1:\n\tmovl (%0), %%eax\n\tmovl 4(%0), %%edx\n\tlock; cmpxchg8b (%0)\n\tjnz 1b\n\txchgl %%ebx, %%esi" : : "D"(p), "S"(*(((uint32_t *)&(v))+0)), "c"(*(((uint32_t *)&(v))+1)) : "ax", "dx", "memory")
@@ -544,6 +575,9 @@ typedef int grn_cond;
 
 # define GRN_ATOMIC_ADD_EX(p,i,r) \
   ((r) = (uint32_t)InterlockedExchangeAdd((int32_t *)(p), (int32_t)(i)))
+# define GRN_ATOMIC_CAS_EX(p,o,n,r) \
+  ((r) = (uint32_t)InterlockedCompareExchange((LONG volatile *)(p), \
+                                               (LONG)(n), (LONG)(o)))
 # if defined(_WIN64) /* ATOMIC 64BIT SET */
 #  define GRN_SET_64BIT(p,v) \
   (*(p) = (v))
@@ -576,6 +610,8 @@ typedef int grn_cond;
 #  include <atomic.h>
 #  define GRN_ATOMIC_ADD_EX(p,i,r) \
   (r = atomic_add_32_nv(p, i) - i)
+#  define GRN_ATOMIC_CAS_EX(p,o,n,r) \
+  (r = atomic_cas_32(p, o, n))
 /* todo */
 #  define GRN_SET_64BIT(p,v) \
   (void)atomic_swap_64(p, v)
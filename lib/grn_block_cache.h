@@ -0,0 +1,86 @@
+/* -*- c-basic-offset: 2 -*- */
+/*
+  Copyright(C) 2016 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "grn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * grn_block_cache is a process wide cache of decompressed blocks. An
+ * entry is identified by an owner ID, that is unique in the process,
+ * and a block ID in the owner. The total size of cached blocks is
+ * bounded by GRN_BLOCK_CACHE_MAX_N_BYTES environment variable. Least
+ * recently used entries that aren't referenced are evicted first.
+ */
+
+#define GRN_BLOCK_CACHE_DEFAULT_MAX_N_BYTES (64 * 1024 * 1024)
+
+typedef struct _grn_block_cache_entry grn_block_cache_entry;
+
+struct _grn_block_cache_entry {
+  grn_block_cache_entry *next;
+  grn_block_cache_entry *prev;
+  uint32_t owner_id;
+  grn_id block_id;
+  uint32_t nref;
+  grn_bool cached; /* The entry is registered in the cache or not. */
+  uint32_t size;
+  void *data;
+};
+
+void grn_block_cache_init_from_env(void);
+void grn_block_cache_init(void);
+void grn_block_cache_fin(void);
+
+uint32_t grn_block_cache_generate_owner_id(void);
+
+/*
+ * grn_block_cache_fetch() returns a referenced entry or NULL. A returned
+ * entry must be released by grn_block_cache_unref().
+ */
+grn_block_cache_entry *grn_block_cache_fetch(grn_ctx *ctx,
+                                             uint32_t owner_id,
+                                             grn_id block_id);
+/*
+ * grn_block_cache_entry_open() creates an entry that isn't registered
+ * yet. The caller fills entry->data and registers it by
+ * grn_block_cache_add() or closes it by grn_block_cache_entry_close().
+ */
+grn_block_cache_entry *grn_block_cache_entry_open(grn_ctx *ctx,
+                                                  uint32_t size);
+void grn_block_cache_entry_close(grn_ctx *ctx, grn_block_cache_entry *entry);
+/*
+ * grn_block_cache_add() registers a filled entry and returns a
+ * referenced entry. If the block is already cached, the given entry is
+ * closed and the cached entry is returned.
+ */
+grn_block_cache_entry *grn_block_cache_add(grn_ctx *ctx,
+                                           uint32_t owner_id,
+                                           grn_id block_id,
+                                           grn_block_cache_entry *entry);
+void grn_block_cache_unref(grn_ctx *ctx, grn_block_cache_entry *entry);
+/* grn_block_cache_expire() removes all blocks of the owner. */
+void grn_block_cache_expire(grn_ctx *ctx, uint32_t owner_id);
+
+#ifdef __cplusplus
+}
+#endif
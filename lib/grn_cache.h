@@ -26,13 +26,34 @@ extern "C" {
 
 #define GRN_CACHE_MAX_KEY_SIZE GRN_HASH_MAX_KEY_SIZE_LARGE
 
+typedef struct {
+  uint32_t n_bytes;
+  uint32_t nhits;
+  uint32_t frequency;
+} grn_cache_entry_statistics;
+
 typedef struct {
   uint32_t nentries;
   uint32_t max_nentries;
   uint32_t nfetches;
   uint32_t nhits;
+  uint64_t n_bytes;
+  uint64_t max_n_bytes;
+  uint32_t n_evictions;
+  uint32_t n_rejections;
+  uint32_t n_result_sets;
+  uint64_t n_result_set_bytes;
+  uint64_t max_n_result_set_bytes;
+  /* If not NULL, grn_cache_entry_statistics of each entry are
+     appended. */
+  grn_obj *entries;
 } grn_cache_statistics;
 
+typedef struct {
+  grn_id id;        /* GRN_ID_NIL means the whole DB */
+  uint32_t lastmod; /* See grn_obj_lastmod() and grn_db_n_modifications() */
+} grn_cache_dependency;
+
 void grn_cache_init(void);
 grn_obj *grn_cache_fetch(grn_ctx *ctx, grn_cache *cache,
                          const char *str, uint32_t str_size);
@@ -41,6 +62,13 @@ void grn_cache_unref(grn_ctx *ctx, grn_cache *cache,
 void grn_cache_update(grn_ctx *ctx, grn_cache *cache,
                       const char *str, uint32_t str_size, grn_obj *value);
 void grn_cache_expire(grn_cache *cache, int32_t size);
+grn_obj *grn_cache_fetch_result_set(grn_ctx *ctx, grn_cache *cache,
+                                    const char *str, uint32_t str_size,
+                                    grn_obj *table);
+void grn_cache_update_result_set(grn_ctx *ctx, grn_cache *cache,
+                                 const char *str, uint32_t str_size,
+                                 grn_obj *result_set);
+void grn_cache_add_dependency(grn_ctx *ctx, grn_obj *obj);
 void grn_cache_fin(void);
 void grn_cache_get_statistics(grn_ctx *ctx, grn_cache *cache,
                               grn_cache_statistics *statistics);
@@ -0,0 +1,82 @@
+/* -*- c-basic-offset: 2 -*- */
+/*
+  Copyright(C) 2016 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "grn.h"
+#include "grn_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Statistics of values in a scalar column. They are created by
+ * grn_column_analyze() and stored in "${COLUMN_PATH}.s". Values set by
+ * grn_obj_set_value() after that are added incrementally.
+ */
+
+#define GRN_COLUMN_STATS_MAX_N_BUCKETS 32
+#define GRN_COLUMN_STATS_N_REGISTERS_BITS 10
+#define GRN_COLUMN_STATS_N_REGISTERS (1 << GRN_COLUMN_STATS_N_REGISTERS_BITS)
+
+struct grn_column_stats_header {
+  uint32_t version;
+  grn_id range;
+  uint32_t n_buckets;
+  uint32_t reserved;
+  uint64_t n_values;
+  uint64_t n_nulls;
+  uint64_t n_modifications;
+  /* Equi-depth histogram. It's available only for number and time. */
+  double bounds[GRN_COLUMN_STATS_MAX_N_BUCKETS + 1];
+  uint64_t counts[GRN_COLUMN_STATS_MAX_N_BUCKETS];
+  /* HyperLogLog registers to estimate the number of distinct values. */
+  uint8_t registers[GRN_COLUMN_STATS_N_REGISTERS];
+};
+
+typedef struct _grn_column_stats {
+  grn_io *io;
+  struct grn_column_stats_header *header;
+} grn_column_stats;
+
+grn_column_stats *grn_column_stats_create(grn_ctx *ctx,
+                                          const char *column_path,
+                                          grn_id range);
+grn_column_stats *grn_column_stats_open(grn_ctx *ctx,
+                                        const char *column_path);
+grn_rc grn_column_stats_close(grn_ctx *ctx, grn_column_stats *stats);
+grn_rc grn_column_stats_remove(grn_ctx *ctx, const char *column_path);
+
+grn_column_stats *grn_column_stats_get(grn_ctx *ctx, grn_obj *column);
+void grn_column_stats_add_value(grn_ctx *ctx, grn_column_stats *stats,
+                                const void *value, uint32_t value_size);
+void grn_column_stats_delete_null(grn_ctx *ctx, grn_column_stats *stats);
+
+uint64_t grn_column_stats_n_distinct_values(grn_ctx *ctx,
+                                            grn_column_stats *stats);
+grn_bool grn_column_stats_estimate_size(grn_ctx *ctx,
+                                        grn_obj *column,
+                                        grn_operator op,
+                                        grn_obj *value,
+                                        unsigned int n_records,
+                                        unsigned int *size);
+
+#ifdef __cplusplus
+}
+#endif
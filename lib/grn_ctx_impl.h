@@ -199,6 +199,18 @@ struct _grn_ctx_impl {
   /* match escalation portion */
   int64_t match_escalation_threshold;
 
+  /* workers portion */
+  uint32_t n_workers;
+
+  /* cache portion */
+  struct {
+    grn_bool recording;
+    grn_obj dependencies; /* grn_cache_dependency array */
+  } cache_dependencies;
+
+  /* column portion */
+  grn_obj compressed_values; /* Copied values of a compressed column. */
+
   /* lifetime portion */
   grn_proc_func *finalizer;
 
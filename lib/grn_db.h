@@ -65,6 +65,7 @@ GRN_API grn_rc grn_db_close(grn_ctx *ctx, grn_obj *db);
 grn_obj *grn_db_keys(grn_obj *s);
 
 uint32_t grn_db_lastmod(grn_obj *s);
+uint32_t grn_db_n_modifications(grn_obj *s);
 
 grn_rc _grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id,
                                grn_table_delete_optarg *optarg);
@@ -88,6 +89,7 @@ grn_rc grn_table_fuzzy_search(grn_ctx *ctx, grn_obj *table,
                               grn_fuzzy_search_optarg *args, grn_obj *res, grn_operator op);
 
 grn_id grn_table_next(grn_ctx *ctx, grn_obj *table, grn_id id);
+grn_id grn_table_curr_id(grn_ctx *ctx, grn_obj *table);
 
 int grn_table_get_key2(grn_ctx *ctx, grn_obj *table, grn_id id, grn_obj *bulk);
 
@@ -427,6 +429,20 @@ GRN_API grn_rc grn_table_group_with_range_gap(grn_ctx *ctx, grn_obj *table,
                                               grn_obj *result_set,
                                               uint32_t range_gap);
 
+typedef struct {
+  grn_table_sort_key *keys;
+  int n_keys;
+  grn_table_group_result *results;
+  int n_results;
+} grn_table_group_spec;
+
+/*
+ * Groups records in table by each spec like grn_table_group() but scans
+ * table only once for all specs.
+ */
+grn_rc grn_table_group_multi(grn_ctx *ctx, grn_obj *table,
+                             grn_table_group_spec *specs, int n_specs);
+
 GRN_API grn_rc grn_column_filter(grn_ctx *ctx, grn_obj *column,
                                  grn_operator op,
                                  grn_obj *value, grn_obj *result_set,
@@ -447,6 +463,8 @@ grn_obj *grn_obj_default_set_value_hook(grn_ctx *ctx,
                                         grn_user_data *user_data);
 
 void grn_obj_touch(grn_ctx *ctx, grn_obj *obj, grn_timeval *tv);
+uint32_t grn_obj_lastmod(grn_ctx *ctx, grn_obj *obj);
+const grn_io_lock_stats *grn_obj_get_lock_stats(grn_ctx *ctx, grn_obj *obj);
 
 grn_rc grn_pvector_fin(grn_ctx *ctx, grn_obj *obj);
 
@@ -37,6 +37,8 @@ typedef enum {
   SCAN_CONST
 } scan_stat;
 
+void grn_expr_init_from_env(void);
+
 typedef struct _grn_scan_info scan_info;
 typedef grn_bool (*grn_scan_info_each_arg_callback)(grn_ctx *ctx, grn_obj *obj, void *user_data);
 
@@ -79,6 +81,10 @@ void grn_p_expr_code(grn_ctx *ctx, grn_expr_code *code);
 
 grn_obj *grn_expr_alloc_const(grn_ctx *ctx, grn_obj *expr);
 
+grn_obj *grn_table_select_top_k(grn_ctx *ctx, grn_obj *table,
+                                grn_obj *expr, int k, grn_bool count_n_hits,
+                                uint32_t *n_hits);
+
 #ifdef __cplusplus
 }
 #endif
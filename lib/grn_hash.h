@@ -365,6 +365,8 @@ grn_rc grn_array_remove(grn_ctx *ctx, const char *path);
 
 grn_id grn_hash_at(grn_ctx *ctx, grn_hash *hash, grn_id id);
 grn_id grn_array_at(grn_ctx *ctx, grn_array *array, grn_id id);
+grn_id grn_hash_curr_id(grn_ctx *ctx, grn_hash *hash);
+grn_id grn_array_curr_id(grn_ctx *ctx, grn_array *array);
 
 void grn_hash_check(grn_ctx *ctx, grn_hash *hash);
 
@@ -29,6 +29,8 @@
 extern "C" {
 #endif
 
+typedef struct _grn_ii_merger grn_ii_merger;
+
 struct _grn_ii {
   grn_db_obj obj;
   grn_io *seg;           /* I/O for a variety of segments */
@@ -40,6 +42,7 @@ struct _grn_ii {
   uint32_t n_elements;   /* Number of elements in postings */
                          /* rid, [sid], tf, [weight] and [pos] */
   struct grn_ii_header *header;
+  grn_ii_merger *merger; /* Background buffer merger (lazily started) */
 };
 
 #define GRN_II_BGQSIZE 16
@@ -160,6 +163,11 @@ GRN_API grn_rc grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsig
                              grn_hash *s, grn_operator op, grn_select_optarg *optarg);
 grn_rc grn_ii_sel(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
                   grn_hash *s, grn_operator op, grn_search_optarg *optarg);
+grn_bool grn_ii_select_top_k(grn_ctx *ctx, grn_ii *ii,
+                             grn_obj **queries, int *weights,
+                             unsigned int n_queries, unsigned int k,
+                             grn_hash *s, grn_bool count_n_hits,
+                             uint32_t *n_hits);
 
 void grn_ii_resolve_sel_and(grn_ctx *ctx, grn_hash *s, grn_operator op);
 
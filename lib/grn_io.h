@@ -89,9 +89,19 @@ struct _grn_io_header {
   uint32_t lock;
   uint64_t curr_size;
   uint32_t segment_tail;
-  uint32_t lastmod;
+  uint32_t lastmod;    /* See grn_obj_touch() */
 };
 
+/*
+ * Contention statistics of grn_io_lock() in the process. They are
+ * updated while the lock is acquired.
+ */
+typedef struct {
+  uint64_t n_acquisitions;
+  uint64_t n_waits;
+  uint64_t total_wait_time; /* nanoseconds */
+} grn_io_lock_stats;
+
 struct _grn_io {
   char path[PATH_MAX];
   struct _grn_io_header *header;
@@ -108,6 +118,7 @@ struct _grn_io {
   uint32_t count;
   uint8_t flags;
   uint32_t *lock;
+  grn_io_lock_stats lock_stats;
 };
 
 GRN_API grn_io *grn_io_create(grn_ctx *ctx, const char *path,
@@ -311,6 +322,7 @@ void grn_io_segment_alloc(grn_ctx *ctx, grn_io *io, grn_io_array_info *ai,
 GRN_API grn_rc grn_io_lock(grn_ctx *ctx, grn_io *io, int timeout);
 GRN_API void grn_io_unlock(grn_io *io);
 void grn_io_clear_lock(grn_io *io);
+void grn_io_clear_waiters(grn_io *io);
 uint32_t grn_io_is_locked(grn_io *io);
 
 #define GRN_IO_ARRAY_AT(io,array,offset,flags,res) do {\
@@ -30,6 +30,7 @@ extern "C" {
 #define GRN_SELECT_INTERNAL_VAR_CONDITION     "$condition"
 
 void grn_proc_init_from_env(void);
+void grn_proc_select_init_from_env(void);
 
 GRN_VAR const char *grn_document_root;
 void grn_db_init_builtin_query(grn_ctx *ctx);
@@ -40,6 +41,7 @@ void grn_proc_init_column_create(grn_ctx *ctx);
 void grn_proc_init_column_list(grn_ctx *ctx);
 void grn_proc_init_column_remove(grn_ctx *ctx);
 void grn_proc_init_column_rename(grn_ctx *ctx);
+void grn_proc_init_column_analyze(grn_ctx *ctx);
 void grn_proc_init_config_get(grn_ctx *ctx);
 void grn_proc_init_config_set(grn_ctx *ctx);
 void grn_proc_init_config_delete(grn_ctx *ctx);
@@ -64,6 +64,10 @@ void grn_rset_recinfo_update_calc_values(grn_ctx *ctx,
                                          grn_rset_recinfo *ri,
                                          grn_obj *table,
                                          grn_obj *value);
+void grn_rset_recinfo_merge_calc_values(grn_ctx *ctx,
+                                        grn_rset_recinfo *ri,
+                                        grn_obj *table,
+                                        grn_rset_recinfo *other_ri);
 
 int64_t *grn_rset_recinfo_get_max_(grn_ctx *ctx,
                                    grn_rset_recinfo *ri,
@@ -109,6 +113,38 @@ void grn_rset_recinfo_set_avg(grn_ctx *ctx,
                               grn_obj *table,
                               double avg);
 
+/*
+ * grn_rset_bitmap is a compact set of record IDs. It is used instead of a
+ * result set while the score of each record isn't needed.
+ */
+typedef struct {
+  uint64_t *words;
+  uint32_t n_words;
+} grn_rset_bitmap;
+
+#define GRN_RSET_BITMAP_WORD_BITS 64
+
+#define GRN_RSET_BITMAP_TEST(bitmap,id) \
+  (((id) / GRN_RSET_BITMAP_WORD_BITS) < (bitmap)->n_words && \
+   ((bitmap)->words[(id) / GRN_RSET_BITMAP_WORD_BITS] & \
+    (((uint64_t)1) << ((id) % GRN_RSET_BITMAP_WORD_BITS))))
+#define GRN_RSET_BITMAP_UNSET(bitmap,id) do { \
+  if (((id) / GRN_RSET_BITMAP_WORD_BITS) < (bitmap)->n_words) { \
+    (bitmap)->words[(id) / GRN_RSET_BITMAP_WORD_BITS] &= \
+      ~(((uint64_t)1) << ((id) % GRN_RSET_BITMAP_WORD_BITS)); \
+  } \
+} while (0)
+
+void grn_rset_bitmap_init(grn_ctx *ctx, grn_rset_bitmap *bitmap);
+void grn_rset_bitmap_fin(grn_ctx *ctx, grn_rset_bitmap *bitmap);
+grn_rc grn_rset_bitmap_set(grn_ctx *ctx, grn_rset_bitmap *bitmap, grn_id id);
+grn_id grn_rset_bitmap_next(grn_ctx *ctx, grn_rset_bitmap *bitmap, grn_id id);
+uint32_t grn_rset_bitmap_size(grn_ctx *ctx, grn_rset_bitmap *bitmap);
+void grn_rset_bitmap_setoperation(grn_ctx *ctx,
+                                  grn_rset_bitmap *bitmap1,
+                                  grn_rset_bitmap *bitmap2,
+                                  grn_operator op);
+
 #ifdef __cplusplus
 }
 #endif
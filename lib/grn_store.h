@@ -31,53 +31,165 @@ extern "C" {
 
 typedef struct _grn_ra grn_ra;
 
+/*
+ * Values of a fixed size column with GRN_OBJ_COMPRESS_BLOCK are
+ * packed by GRN_RA_BLOCK_N_VALUES records. GRN_OBJ_WITH_ZONE_MAP keeps
+ * the range of values for each block of the same size.
+ */
+#define GRN_RA_BLOCK_W_N_VALUES 9
+#define GRN_RA_BLOCK_N_VALUES   (1U << GRN_RA_BLOCK_W_N_VALUES)
+
 struct _grn_ra {
   grn_db_obj obj;
   grn_io *io;
   int element_width;
   int element_mask;
   struct grn_ra_header *header;
+  struct _grn_column_stats *stats;
+  struct {
+    struct _grn_ja *store;    /* Packed blocks. */
+    grn_critical_section lock;
+    void *tail;               /* Unpacked tail blocks in the first segment. */
+    uint32_t cache_owner_id;  /* Owner ID of the blocks in grn_block_cache. */
+    uint32_t generation;      /* header->generation of the cached blocks. */
+  } block;
+  struct _grn_ra *zone_map;   /* Ranges of blocks. */
 };
 
 struct grn_ra_header {
   uint32_t element_size;
   uint32_t nrecords; /* nrecords is not maintained by default */
-  uint32_t reserved[10];
+  uint32_t flags;
+  uint32_t tail_block; /* ID of the unpacked tail block + 1 */
+  uint32_t generation; /* It's incremented when a packed block is updated */
+  uint32_t reserved[7];
 };
 
-grn_ra *grn_ra_create(grn_ctx *ctx, const char *path, unsigned int element_size);
+#define GRN_RA_IS_COMPRESSED(ra) \
+  ((ra)->header->flags & GRN_OBJ_COMPRESS_BLOCK)
+#define GRN_RA_HAS_ZONE_MAP(ra) \
+  ((ra)->zone_map != NULL)
+/* Compressed blocks have their ranges in their headers. */
+#define GRN_RA_HAS_BLOCK_SUMMARY(ra) \
+  (GRN_RA_IS_COMPRESSED(ra) || GRN_RA_HAS_ZONE_MAP(ra))
+
+/*
+ * grn_ra_block_summary is the range of values in a block of
+ * GRN_RA_BLOCK_N_VALUES records. min and max are signed values when
+ * is_signed is true.
+ */
+typedef struct {
+  grn_id min_id;
+  grn_id max_id;
+  grn_bool is_signed;
+  union {
+    int64_t i;
+    uint64_t u;
+  } min;
+  union {
+    int64_t i;
+    uint64_t u;
+  } max;
+} grn_ra_block_summary;
+
+/*
+ * flags accepts GRN_OBJ_COMPRESS_BLOCK and GRN_OBJ_WITH_ZONE_MAP.
+ * GRN_OBJ_KEY_INT in flags means that values are signed integers.
+ */
+grn_ra *grn_ra_create(grn_ctx *ctx, const char *path,
+                      unsigned int element_size, uint32_t flags);
 grn_ra *grn_ra_open(grn_ctx *ctx, const char *path);
 grn_rc grn_ra_info(grn_ctx *ctx, grn_ra *ra, unsigned int *element_size);
 grn_rc grn_ra_close(grn_ctx *ctx, grn_ra *ra);
 grn_rc grn_ra_remove(grn_ctx *ctx, const char *path);
 void *grn_ra_ref(grn_ctx *ctx, grn_ra *ra, grn_id id);
 grn_rc grn_ra_unref(grn_ctx *ctx, grn_ra *ra, grn_id id);
+/*
+ * grn_ra_get_value() copies the value of element_size bytes to value.
+ * grn_ra_ref() can't be used for a compressed fixed size column
+ * because its values are in shared block cache entries. Use it or
+ * grn_ra_ref_cache() for them.
+ */
+grn_rc grn_ra_get_value(grn_ctx *ctx, grn_ra *ra, grn_id id, void *value);
+/*
+ * grn_ra_put() stores a value of element_size bytes. Values of a
+ * compressed fixed size column must be stored by it. Values of a column
+ * with a zone map must be stored by it to update the zone map.
+ */
+grn_rc grn_ra_put(grn_ctx *ctx, grn_ra *ra, grn_id id, const void *value);
+grn_rc grn_ra_flush(grn_ctx *ctx, grn_ra *ra);
+/*
+ * grn_ra_get_block_summary() returns the summary of the block that has
+ * the record. Records after max_id aren't summarized if possible. It
+ * returns GRN_OPERATION_NOT_SUPPORTED for a column that isn't
+ * compressed and doesn't have a zone map.
+ */
+grn_rc grn_ra_get_block_summary(grn_ctx *ctx, grn_ra *ra,
+                                grn_id id, grn_id max_id,
+                                grn_ra_block_summary *summary);
+/*
+ * grn_ra_block_summary_may_match() returns whether a value in the
+ * block may satisfy `value op operand`. operand is a value of
+ * element_size bytes. It returns GRN_TRUE for unsupported operators.
+ */
+grn_bool grn_ra_block_summary_may_match(grn_ctx *ctx, grn_ra *ra,
+                                        grn_ra_block_summary *summary,
+                                        grn_operator op,
+                                        const void *operand);
 
 typedef struct _grn_ra_cache grn_ra_cache;
 
 struct _grn_ra_cache {
   void *p;
   int32_t seg;
+  void *block; /* Referred block cache entry of a compressed column. */
 };
 
 #define GRN_RA_CACHE_INIT(ra,c) do {\
-  (c)->p = NULL; (c)->seg = -1;\
+  (c)->p = NULL; (c)->seg = -1; (c)->block = NULL;\
 } while (0)
 
 #define GRN_RA_CACHE_FIN(ra,c) do {\
   if ((c)->seg != -1) { GRN_IO_SEG_UNREF((ra)->io, (c)->seg); }\
+  if ((c)->block) { grn_ra_cache_fin_block(ctx, (ra), (c)); }\
 } while (0);
 
+void grn_ra_cache_fin_block(grn_ctx *ctx, grn_ra *ra, grn_ra_cache *cache);
+
 void *grn_ra_ref_cache(grn_ctx *ctx, grn_ra *ra, grn_id id, grn_ra_cache *cache);
 
 /**** variable sized elements ****/
 
 typedef struct _grn_ja grn_ja;
 
+/* Zstandard contexts kept for reuse by each column. */
+#define GRN_JA_ZSTD_N_CACHED_CONTEXTS 8
+
 struct _grn_ja {
   grn_db_obj obj;
   grn_io *io;
   struct grn_ja_header *header;
+  struct _grn_column_stats *stats;
+#ifdef GRN_WITH_ZSTD
+  struct {
+    grn_critical_section lock;
+    grn_bool loaded;  /* The stored dictionary is loaded or not. */
+    grn_bool trained; /* Dictionary training is tried or not. */
+    void *cctxs[GRN_JA_ZSTD_N_CACHED_CONTEXTS]; /* Unused contexts. */
+    uint32_t n_cctxs;
+    void *dctxs[GRN_JA_ZSTD_N_CACHED_CONTEXTS]; /* Unused contexts. */
+    uint32_t n_dctxs;
+    void *cdict;
+    void *ddict;
+  } zstd;
+#endif /* GRN_WITH_ZSTD */
+  struct {
+    struct _grn_ja *store;    /* Compressed blocks of packed values. */
+    grn_critical_section lock;
+    uint32_t cache_owner_id;  /* Owner ID of the blocks in grn_block_cache. */
+    grn_id next_pack_id;      /* The first ID that isn't packed yet. */
+    uint32_t n_pending_bytes; /* Size of values that aren't packed yet. */
+  } block;
 };
 
 GRN_API grn_ja *grn_ja_create(grn_ctx *ctx, const char *path,
@@ -100,6 +212,7 @@ int grn_ja_defrag(grn_ctx *ctx, grn_ja *ja, int threshold);
 GRN_API grn_rc grn_ja_putv(grn_ctx *ctx, grn_ja *ja, grn_id id,
                            grn_obj *vector, int flags);
 GRN_API uint32_t grn_ja_size(grn_ctx *ctx, grn_ja *ja, grn_id id);
+grn_rc grn_ja_flush(grn_ctx *ctx, grn_ja *ja);
 
 void grn_ja_check(grn_ctx *ctx, grn_ja *ja);
 
@@ -127,6 +240,8 @@ typedef struct {
   void *packed_buf;          /* Buffer for decompression. */
   uint32_t packed_buf_size;  /* Size of the buffer for decompression. */
   void *stream;              /* Stream of a compression library. */
+  void *block;               /* Block cache entry of the current value. */
+  const void *block_value;   /* Address of the current value in the block. */
 } grn_ja_reader;
 
 /*
@@ -1039,6 +1039,15 @@ grn_array_next(grn_ctx *ctx, grn_array *array, grn_id id)
   return GRN_ID_NIL;
 }
 
+grn_id
+grn_array_curr_id(grn_ctx *ctx, grn_array *array)
+{
+  if (grn_array_error_if_truncated(ctx, array) != GRN_SUCCESS) {
+    return GRN_ID_NIL;
+  }
+  return grn_array_get_max_id(array);
+}
+
 int
 grn_array_cursor_get_value(grn_ctx *ctx, grn_array_cursor *cursor, void **value)
 {
@@ -2997,6 +3006,15 @@ grn_hash_next(grn_ctx *ctx, grn_hash *hash, grn_id id)
   return GRN_ID_NIL;
 }
 
+grn_id
+grn_hash_curr_id(grn_ctx *ctx, grn_hash *hash)
+{
+  if (grn_hash_error_if_truncated(ctx, hash) != GRN_SUCCESS) {
+    return GRN_ID_NIL;
+  }
+  return HASH_CURR_MAX(hash);
+}
+
 grn_id
 grn_hash_at(grn_ctx *ctx, grn_hash *hash, grn_id id)
 {
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <math.h>
 #include <sys/stat.h>
 
 #ifdef WIN32
@@ -43,6 +44,11 @@
 # include <oniguruma.h>
 #endif
 
+#ifdef __SSE2__
+# define II_WITH_SSE2
+# include <emmintrin.h>
+#endif
+
 #define MAX_PSEG                 0x20000
 #define S_CHUNK                  (1 << GRN_II_W_CHUNK)
 #define W_SEGMENT                18
@@ -74,6 +80,8 @@
 static grn_bool grn_ii_cursor_set_min_enable = GRN_FALSE;
 static double grn_ii_select_too_many_index_match_ratio = -1;
 static double grn_ii_estimate_size_for_query_reduce_ratio = 0.9;
+static grn_bool grn_ii_async_merge_enable = GRN_FALSE;
+static uint32_t grn_ii_async_merge_threshold = S_SEGMENT / 8;
 
 void
 grn_ii_init_from_env(void)
@@ -111,6 +119,31 @@ grn_ii_init_from_env(void)
         atof(grn_ii_estimate_size_for_query_reduce_ratio_env);
     }
   }
+
+  {
+    char grn_ii_async_merge_enable_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_ASYNC_MERGE_ENABLE",
+               grn_ii_async_merge_enable_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ii_async_merge_enable_env[0]) {
+      grn_ii_async_merge_enable = GRN_TRUE;
+    } else {
+      grn_ii_async_merge_enable = GRN_FALSE;
+    }
+  }
+
+  {
+    char grn_ii_async_merge_threshold_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_ASYNC_MERGE_THRESHOLD",
+               grn_ii_async_merge_threshold_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ii_async_merge_threshold_env[0]) {
+      int threshold = atoi(grn_ii_async_merge_threshold_env);
+      if (threshold > 0 && threshold < S_SEGMENT) {
+        grn_ii_async_merge_threshold = threshold;
+      }
+    }
+  }
 }
 
 /* segment */
@@ -1540,6 +1573,79 @@ pack(uint32_t *p, uint32_t i, uint8_t *freq, uint8_t *rp)
   return rp + (ep - ebuf);
 }
 
+/*
+ * SIMD-BP128: UNIT_SIZE values are packed with a single bit width into 4
+ * interleaved 32-bit lanes, so that a block is packed/unpacked by 128-bit
+ * shifts and ors. A block consists of a bit width byte and (4 * w) 32-bit
+ * words. Lane l holds values l, l + 4, l + 8, ... of the block.
+ */
+#define BP128_N_LANES 4
+
+#ifdef II_WITH_SSE2
+static void
+bp128_pack_words(const uint32_t *p, uint32_t w, uint8_t *rp)
+{
+  __m128i acc = _mm_setzero_si128();
+  uint32_t i, shift = 0;
+  for (i = 0; i < UNIT_SIZE; i += BP128_N_LANES) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    acc = _mm_or_si128(acc, _mm_sll_epi32(v, _mm_cvtsi32_si128(shift)));
+    shift += w;
+    if (shift >= 32) {
+      _mm_storeu_si128((__m128i *)rp, acc);
+      rp += sizeof(__m128i);
+      shift -= 32;
+      if (shift) {
+        acc = _mm_srl_epi32(v, _mm_cvtsi32_si128(w - shift));
+      } else {
+        acc = _mm_setzero_si128();
+      }
+    }
+  }
+}
+#else /* II_WITH_SSE2 */
+static void
+bp128_pack_words(const uint32_t *p, uint32_t w, uint8_t *rp)
+{
+  uint32_t lane;
+  uint32_t words[UNIT_SIZE];
+  for (lane = 0; lane < BP128_N_LANES; lane++) {
+    uint32_t i, j = 0, shift = 0, acc = 0;
+    for (i = lane; i < UNIT_SIZE; i += BP128_N_LANES) {
+      uint32_t v = p[i];
+      acc |= v << shift;
+      shift += w;
+      if (shift >= 32) {
+        words[j * BP128_N_LANES + lane] = acc;
+        j++;
+        shift -= 32;
+        acc = shift ? v >> (w - shift) : 0;
+      }
+    }
+  }
+  grn_memcpy(rp, words, sizeof(uint32_t) * BP128_N_LANES * w);
+}
+#endif /* II_WITH_SSE2 */
+
+static uint8_t *
+pack_bp128(uint32_t *p, uint8_t *rp)
+{
+  uint32_t i, w = 0, any = 0;
+  for (i = 0; i < UNIT_SIZE; i++) {
+    any |= p[i];
+  }
+  if (any) {
+    GRN_BIT_SCAN_REV(any, w);
+    w++;
+  }
+  *rp++ = w;
+  if (w) {
+    bp128_pack_words(p, w, rp);
+    rp += sizeof(uint32_t) * BP128_N_LANES * w;
+  }
+  return rp;
+}
+
 int
 grn_p_enc(grn_ctx *ctx, uint32_t *data, uint32_t data_size, uint8_t **res)
 {
@@ -1569,6 +1675,13 @@ grn_p_enc(grn_ctx *ctx, uint32_t *data, uint32_t data_size, uint8_t **res)
 #define CUT_OFF   (1<<1) /* Deprecated */
 #define ODD       (1<<2) /* Variable size data */
 
+/*
+ * This bit in the header of a chunk means that full UNIT_SIZE blocks of
+ * USE_P_ENC data are packed by pack_bp128() instead of pack().
+ */
+#define P_ENC_BP128 (1 << (MAX_N_ELEMENTS + 1))
+#define P_ENC_USEP_MASK ((1 << MAX_N_ELEMENTS) - 1)
+
 typedef struct {
   uint32_t *data;
   uint32_t data_size;
@@ -1618,8 +1731,9 @@ datavec_fin(grn_ctx *ctx, datavec *dv)
   if (dv[0].data) { GRN_FREE(dv[0].data); }
 }
 
-size_t
-grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
+static size_t
+grn_p_encv_internal(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res,
+                    grn_bool use_bp128)
 {
   uint8_t *rp = res, freq[33];
   uint32_t pgap, usep, l, df, data_size, *dp, *dpe;
@@ -1643,7 +1757,7 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
     }
   } else {
     uint32_t buf[UNIT_SIZE];
-    GRN_B_ENC((usep << 1), rp);
+    GRN_B_ENC((usep << 1) | (use_bp128 ? P_ENC_BP128 : 0), rp);
     GRN_B_ENC(df, rp);
     if (dv[dvlen - 1].flags & ODD) {
       GRN_B_ENC(pgap, rp);
@@ -1655,6 +1769,11 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
       dpe = dp + dv[l].data_size;
       if ((dv[l].flags & USE_P_ENC)) {
         uint32_t j = 0, d;
+        if (use_bp128) {
+          for (; dp + UNIT_SIZE <= dpe; dp += UNIT_SIZE) {
+            rp = pack_bp128(dp, rp);
+          }
+        }
         memset(freq, 0, 33);
         while (dp < dpe) {
           if (j == UNIT_SIZE) {
@@ -1679,6 +1798,20 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
   return rp - res;
 }
 
+size_t
+grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
+{
+  return grn_p_encv_internal(ctx, dv, dvlen, res, GRN_FALSE);
+}
+
+static size_t
+grn_ii_p_encv(grn_ctx *ctx, grn_ii *ii, datavec *dv, uint32_t dvlen,
+              uint8_t *res)
+{
+  grn_bool use_bp128 = (ii->header->flags & GRN_OBJ_INDEX_SIMD_PACK) != 0;
+  return grn_p_encv_internal(ctx, dv, dvlen, res, use_bp128);
+}
+
 #define GRN_B_DEC_CHECK(v,p,pe) do { \
   uint8_t *_p = (uint8_t *)p; \
   uint32_t _v; \
@@ -1811,6 +1944,74 @@ unpack(uint8_t *dp, uint8_t *dpe, int i, uint32_t *rp)
   return dp;
 }
 
+#ifdef II_WITH_SSE2
+static void
+bp128_unpack_words(const uint8_t *dp, uint32_t w, uint32_t *p)
+{
+  const __m128i mask = _mm_set1_epi32(w < 32 ? (1U << w) - 1 : 0xffffffff);
+  __m128i word = _mm_loadu_si128((const __m128i *)dp);
+  uint32_t i, shift = 0;
+  for (i = 0; i < UNIT_SIZE; i += BP128_N_LANES) {
+    __m128i v = _mm_srl_epi32(word, _mm_cvtsi32_si128(shift));
+    shift += w;
+    if (shift >= 32) {
+      shift -= 32;
+      if (i + BP128_N_LANES < UNIT_SIZE) {
+        dp += sizeof(__m128i);
+        word = _mm_loadu_si128((const __m128i *)dp);
+        if (shift) {
+          v = _mm_or_si128(v, _mm_sll_epi32(word,
+                                            _mm_cvtsi32_si128(w - shift)));
+        }
+      }
+    }
+    _mm_storeu_si128((__m128i *)(p + i), _mm_and_si128(v, mask));
+  }
+}
+#else /* II_WITH_SSE2 */
+static void
+bp128_unpack_words(const uint8_t *dp, uint32_t w, uint32_t *p)
+{
+  uint32_t lane;
+  uint32_t words[UNIT_SIZE];
+  const uint32_t mask = w < 32 ? (1U << w) - 1 : 0xffffffff;
+  grn_memcpy(words, dp, sizeof(uint32_t) * BP128_N_LANES * w);
+  for (lane = 0; lane < BP128_N_LANES; lane++) {
+    uint32_t i, j = 0, shift = 0, word = words[lane];
+    for (i = lane; i < UNIT_SIZE; i += BP128_N_LANES) {
+      uint32_t v = word >> shift;
+      shift += w;
+      if (shift >= 32) {
+        shift -= 32;
+        if (i + BP128_N_LANES < UNIT_SIZE) {
+          word = words[++j * BP128_N_LANES + lane];
+          if (shift) { v |= word << (w - shift); }
+        }
+      }
+      p[i] = v & mask;
+    }
+  }
+}
+#endif /* II_WITH_SSE2 */
+
+static uint8_t *
+unpack_bp128(uint8_t *dp, uint8_t *dpe, uint32_t *rp)
+{
+  uint32_t w;
+  if (dp >= dpe) { return NULL; }
+  w = *dp++;
+  if (w > 32) { return NULL; }
+  if (w) {
+    size_t size = sizeof(uint32_t) * BP128_N_LANES * w;
+    if (dp + size > dpe) { return NULL; }
+    bp128_unpack_words(dp, w, rp);
+    dp += size;
+  } else {
+    memset(rp, 0, sizeof(uint32_t) * UNIT_SIZE);
+  }
+  return dp;
+}
+
 int
 grn_p_dec(grn_ctx *ctx, uint8_t *data, uint32_t data_size, uint32_t nreq, uint32_t **res)
 {
@@ -1876,7 +2077,8 @@ grn_p_decv(grn_ctx *ctx, uint8_t *data, uint32_t data_size, datavec *dv, uint32_
       dv[l].data_size = i;
     }
   } else {
-    uint32_t n, rest, usep = df >> 1;
+    uint32_t n, rest, usep = (df >> 1) & P_ENC_USEP_MASK;
+    grn_bool use_bp128 = (df & P_ENC_BP128) != 0;
     GRN_B_DEC_CHECK(df, dp, dpe);
     if (dv[dvlen -1].flags & ODD) {
       GRN_B_DEC_CHECK(rest, dp, dpe);
@@ -1897,7 +2099,11 @@ grn_p_decv(grn_ctx *ctx, uint8_t *data, uint32_t data_size, datavec *dv, uint32_
       dv[l].data_size = n = (l < dvlen - 1) ? df : df + rest;
       if (usep & (1 << l)) {
         for (; n >= UNIT_SIZE; n -= UNIT_SIZE) {
-          if (!(dp = unpack(dp, dpe, UNIT_SIZE, rp))) { return 0; }
+          if (use_bp128) {
+            if (!(dp = unpack_bp128(dp, dpe, rp))) { return 0; }
+          } else {
+            if (!(dp = unpack(dp, dpe, UNIT_SIZE, rp))) { return 0; }
+          }
           rp += UNIT_SIZE;
         }
         if (n) {
@@ -2656,8 +2862,63 @@ typedef struct {
   uint32_t segno;
   uint32_t size;
   uint32_t dgap;
+  uint32_t max_score; /* Only with GRN_OBJ_INDEX_BLOCK_MAX */
 } chunk_info;
 
+#define CHUNK_INFO_ENC(cinfo,flags,p) do {\
+  GRN_B_ENC((cinfo)->segno, (p));\
+  GRN_B_ENC((cinfo)->size, (p));\
+  GRN_B_ENC((cinfo)->dgap, (p));\
+  if (((flags) & GRN_OBJ_INDEX_BLOCK_MAX)) {\
+    GRN_B_ENC((cinfo)->max_score, (p));\
+  }\
+} while (0)
+
+#define CHUNK_INFO_DEC(cinfo,flags,p) do {\
+  GRN_B_DEC((cinfo)->segno, (p));\
+  GRN_B_DEC((cinfo)->size, (p));\
+  GRN_B_DEC((cinfo)->dgap, (p));\
+  if (((flags) & GRN_OBJ_INDEX_BLOCK_MAX)) {\
+    GRN_B_DEC((cinfo)->max_score, (p));\
+  } else {\
+    (cinfo)->max_score = 0;\
+  }\
+} while (0)
+
+/*
+ * chunk_max_score returns the max of the sum of (tf + weight) in a record.
+ * It's the upper bound of the score that a record in the chunk gets from the
+ * term. rids are record ID gaps, tfs are (tf - 1) and weights may be NULL.
+ */
+static uint32_t
+chunk_max_score(const uint32_t *rids, const uint32_t *tfs,
+                const uint32_t *weights, uint32_t n)
+{
+  uint32_t i;
+  uint64_t score = 0, max_score = 0;
+  for (i = 0; i < n; i++) {
+    if (i > 0 && rids[i]) {
+      if (score > max_score) { max_score = score; }
+      score = 0;
+    }
+    score += tfs[i] + 1;
+    if (weights) { score += weights[i]; }
+  }
+  if (score > max_score) { max_score = score; }
+  return max_score > UINT32_MAX ? UINT32_MAX : (uint32_t)max_score;
+}
+
+static uint32_t
+datavec_max_score(grn_ii *ii, datavec *dv)
+{
+  int j = 1;
+  uint32_t *tfs, *weights = NULL;
+  if ((ii->header->flags & GRN_OBJ_WITH_SECTION)) { j++; }
+  tfs = dv[j++].data;
+  if ((ii->header->flags & GRN_OBJ_WITH_WEIGHT)) { weights = dv[j].data; }
+  return chunk_max_score(dv[0].data, tfs, weights, dv[0].data_size);
+}
+
 static grn_rc
 chunk_flush(grn_ctx *ctx, grn_ii *ii, chunk_info *cinfo, uint8_t *enc, uint32_t encsize)
 {
@@ -2761,8 +3022,11 @@ chunk_merge(grn_ctx *ctx, grn_ii *ii, buffer *sb, buffer_term *bt,
       uint32_t f_p = ((np < 32) || (np <= (spos >> 13))) ? 0 : USE_P_ENC;
       dv[j].data_size = np; dv[j].flags = f_p|ODD;
     }
+    if ((ii->header->flags & GRN_OBJ_INDEX_BLOCK_MAX)) {
+      cinfo->max_score = datavec_max_score(ii, dv);
+    }
     if ((enc = GRN_MALLOC((ndf * 4 + np) * 2))) {
-      encsize = grn_p_encv(ctx, dv, ii->n_elements, enc);
+      encsize = grn_ii_p_encv(ctx, ii, dv, ii->n_elements, enc);
       if (!(rc = chunk_flush(ctx, ii, cinfo, enc, encsize))) {
         chunk_free(ctx, ii, segno, 0, size);
       }
@@ -2883,9 +3147,7 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
           return GRN_NO_MEMORY_AVAILABLE;
         }
         for (i = 0; i < nchunks; i++) {
-          GRN_B_DEC(cinfo[i].segno, scp);
-          GRN_B_DEC(cinfo[i].size, scp);
-          GRN_B_DEC(cinfo[i].dgap, scp);
+          CHUNK_INFO_DEC(&cinfo[i], ii->header->flags, scp);
           crid += cinfo[i].dgap;
           if (bid.rid <= crid) {
             rc = chunk_merge(ctx, ii, sb, bt, &cinfo[i], crid, dv,
@@ -3027,13 +3289,11 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
             GRN_B_ENC(nvchunks, dcp);
             for (i = 0; i < nchunks; i++) {
               if (cinfo[i].size) {
-                GRN_B_ENC(cinfo[i].segno, dcp);
-                GRN_B_ENC(cinfo[i].size, dcp);
-                GRN_B_ENC(cinfo[i].dgap, dcp);
+                CHUNK_INFO_ENC(&cinfo[i], ii->header->flags, dcp);
               }
             }
           }
-          encsize = grn_p_encv(ctx, dv, ii->n_elements, dcp);
+          encsize = grn_ii_p_encv(ctx, ii, dv, ii->n_elements, dcp);
 
           if (grn_logger_pass(ctx, GRN_LOG_DEBUG)) {
             if (sb->header.chunk_size + S_SEGMENT <= (dcp - dc) + encsize) {
@@ -3056,14 +3316,15 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
               !chunk_flush(ctx, ii, &cinfo[nchunks], dcp, encsize)) {
             int i;
             cinfo[nchunks].dgap = lid.rid - crid;
+            if ((ii->header->flags & GRN_OBJ_INDEX_BLOCK_MAX)) {
+              cinfo[nchunks].max_score = datavec_max_score(ii, dv);
+            }
             nvchunks++;
             dcp = dcp0;
             GRN_B_ENC(nvchunks, dcp);
             for (i = 0; i <= nchunks; i++) {
               if (cinfo[i].size) {
-                GRN_B_ENC(cinfo[i].segno, dcp);
-                GRN_B_ENC(cinfo[i].size, dcp);
-                GRN_B_ENC(cinfo[i].dgap, dcp);
+                CHUNK_INFO_ENC(&cinfo[i], ii->header->flags, dcp);
               }
             }
             GRN_LOG(ctx, GRN_LOG_DEBUG, "split (%d) encsize=%d", tid, encsize);
@@ -3277,9 +3538,7 @@ grn_ii_buffer_check(grn_ctx *ctx, grn_ii *ii, uint32_t seg)
           return;
         }
         for (i = 0; i < nchunks; i++) {
-          GRN_B_DEC(cinfo[i].segno, scp);
-          GRN_B_DEC(cinfo[i].size, scp);
-          GRN_B_DEC(cinfo[i].dgap, scp);
+          CHUNK_INFO_DEC(&cinfo[i], ii->header->flags, scp);
           crid += cinfo[i].dgap;
         }
       }
@@ -3674,6 +3933,179 @@ buffer_new(grn_ctx *ctx, grn_ii *ii, int size, uint32_t *pos,
   return pseg;
 }
 
+/* async merge */
+
+/*
+ * grn_ii_merger merges full enough buffers into chunks in a background
+ * thread so that grn_ii_update_one() rarely needs to merge them
+ * synchronously. The merge itself is the same as the synchronous one:
+ * buffer_flush() and buffer_split() build new segments and chunks and
+ * switch binfo to them, and the replaced segments are reused only after
+ * passing through the bgq. So readers keep using the buffers they have
+ * opened without any lock.
+ */
+struct _grn_ii_merger {
+  grn_ctx ctx;
+  grn_thread thread;
+  grn_mutex mutex;
+  grn_cond cond;
+  grn_bool running;
+  grn_bool stopping;
+  uint32_t n_requests;
+  uint32_t next_lseg;
+  uint8_t requests[GRN_II_MAX_LSEG >> 3];
+};
+
+#define MERGER_REQUEST_AT(merger,lseg) \
+  (((merger)->requests[(lseg) >> 3] >> ((lseg) & 7)) & 1)
+#define MERGER_REQUEST_ON(merger,lseg) \
+  ((merger)->requests[(lseg) >> 3] |= (1 << ((lseg) & 7)))
+#define MERGER_REQUEST_OFF(merger,lseg) \
+  ((merger)->requests[(lseg) >> 3] &= ~(1 << ((lseg) & 7)))
+
+/* grn_ii_merger_merge merges a requested buffer if it is still full enough. */
+static void
+grn_ii_merger_merge(grn_ctx *ctx, grn_ii *ii, uint32_t lseg)
+{
+  grn_rc rc = GRN_SUCCESS;
+  buffer *b;
+  uint32_t pseg;
+  if (grn_io_lock(ctx, ii->seg, grn_lock_timeout)) {
+    ERRCLR(ctx);
+    return;
+  }
+  if (ii->header->binfo[lseg] != NOT_ASSIGNED) {
+    pseg = buffer_open(ctx, ii, SEG2POS(lseg, 0), NULL, &b);
+    if (pseg != NOT_ASSIGNED) {
+      grn_bool need_merge =
+        b->header.buffer_free < grn_ii_async_merge_threshold;
+      grn_bool need_split = need_merge && SPLIT_COND;
+      buffer_close(ctx, ii, pseg);
+      if (need_split) {
+        GRN_LOG(ctx, GRN_LOG_DEBUG,
+                "[ii][merger] splitting seg=%u", lseg);
+        rc = buffer_split(ctx, ii, lseg, NULL);
+      } else if (need_merge) {
+        GRN_LOG(ctx, GRN_LOG_DEBUG,
+                "[ii][merger] flushing seg=%u", lseg);
+        rc = buffer_flush(ctx, ii, lseg, NULL);
+      }
+    }
+  }
+  grn_io_unlock(ii->seg);
+  if (rc != GRN_SUCCESS) {
+    GRN_LOG(ctx, GRN_LOG_WARNING,
+            "[ii][merger] failed to merge seg=%u: %d", lseg, rc);
+  }
+  ERRCLR(ctx);
+}
+
+/* grn_ii_merger_next takes the next requested lseg. It blocks until a
+   request comes and returns GRN_II_MAX_LSEG when the merger is stopping. */
+static uint32_t
+grn_ii_merger_next(grn_ii_merger *merger)
+{
+  uint32_t lseg = GRN_II_MAX_LSEG;
+  MUTEX_LOCK(merger->mutex);
+  while (!merger->stopping && !merger->n_requests) {
+    COND_WAIT(merger->cond, merger->mutex);
+  }
+  if (!merger->stopping) {
+    uint32_t i;
+    for (i = 0; i < GRN_II_MAX_LSEG; i++) {
+      uint32_t candidate = (merger->next_lseg + i) & (GRN_II_MAX_LSEG - 1);
+      if (MERGER_REQUEST_AT(merger, candidate)) {
+        MERGER_REQUEST_OFF(merger, candidate);
+        merger->n_requests--;
+        merger->next_lseg = candidate + 1;
+        lseg = candidate;
+        break;
+      }
+    }
+  }
+  MUTEX_UNLOCK(merger->mutex);
+  return lseg;
+}
+
+static grn_thread_func_result CALLBACK
+grn_ii_merger_main(void *arg)
+{
+  grn_ii *ii = (grn_ii *)arg;
+  grn_ii_merger *merger = ii->merger;
+  for (;;) {
+    uint32_t lseg = grn_ii_merger_next(merger);
+    if (lseg == GRN_II_MAX_LSEG) { break; }
+    grn_ii_merger_merge(&merger->ctx, ii, lseg);
+  }
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+/* grn_ii_merger_start starts a merger thread for ii. */
+static grn_ii_merger *
+grn_ii_merger_start(grn_ctx *ctx, grn_ii *ii)
+{
+  grn_ii_merger *merger = GRN_CALLOC(sizeof(grn_ii_merger));
+  if (!merger) {
+    return NULL;
+  }
+  if (grn_ctx_init(&merger->ctx, 0)) {
+    GRN_FREE(merger);
+    return NULL;
+  }
+  grn_ctx_use(&merger->ctx, grn_ctx_db(ctx));
+  MUTEX_INIT(merger->mutex);
+  COND_INIT(merger->cond);
+  ii->merger = merger;
+  if (THREAD_CREATE(merger->thread, grn_ii_merger_main, ii)) {
+    GRN_LOG(ctx, GRN_LOG_WARNING,
+            "[ii][merger] failed to create a thread: <%s>",
+            grn_io_path(ii->seg));
+  } else {
+    merger->running = GRN_TRUE;
+  }
+  return merger;
+}
+
+/* grn_ii_merger_stop stops the merger thread of ii. Pending requests are
+   discarded because full buffers are merged synchronously anyway. */
+static void
+grn_ii_merger_stop(grn_ctx *ctx, grn_ii *ii)
+{
+  grn_ii_merger *merger = ii->merger;
+  if (!merger) { return; }
+  if (merger->running) {
+    MUTEX_LOCK(merger->mutex);
+    merger->stopping = GRN_TRUE;
+    COND_SIGNAL(merger->cond);
+    MUTEX_UNLOCK(merger->mutex);
+    THREAD_JOIN(merger->thread);
+  }
+  COND_FIN(merger->cond);
+  MUTEX_FIN(merger->mutex);
+  grn_ctx_fin(&merger->ctx);
+  GRN_FREE(merger);
+  ii->merger = NULL;
+}
+
+/* grn_ii_merger_request requests merging a buffer in the background. The
+   caller must lock ii->seg. */
+static void
+grn_ii_merger_request(grn_ctx *ctx, grn_ii *ii, uint32_t lseg)
+{
+  grn_ii_merger *merger = ii->merger;
+  if (!merger) {
+    if (!(merger = grn_ii_merger_start(ctx, ii))) { return; }
+  }
+  if (!merger->running) { return; }
+  MUTEX_LOCK(merger->mutex);
+  if (!MERGER_REQUEST_AT(merger, lseg)) {
+    MERGER_REQUEST_ON(merger, lseg);
+    merger->n_requests++;
+    COND_SIGNAL(merger->cond);
+  }
+  MUTEX_UNLOCK(merger->mutex);
+}
+
 /* ii */
 
 static grn_ii *
@@ -3730,6 +4162,7 @@ _grn_ii_create(grn_ctx *ctx, grn_ii *ii, const char *path, grn_obj *lexicon, uin
   ii->lflags = lflags;
   ii->encoding = encoding;
   ii->header = header;
+  ii->merger = NULL;
   ii->n_elements = 2;
   if ((flags & GRN_OBJ_WITH_SECTION)) { ii->n_elements++; }
   if ((flags & GRN_OBJ_WITH_WEIGHT)) { ii->n_elements++; }
@@ -3792,6 +4225,7 @@ grn_ii_truncate(grn_ctx *ctx, grn_ii *ii)
   }
   lexicon = ii->lexicon;
   flags = ii->header->flags;
+  grn_ii_merger_stop(ctx, ii);
   if ((rc = grn_io_close(ctx, ii->seg))) { goto exit; }
   if ((rc = grn_io_close(ctx, ii->chunk))) { goto exit; }
   ii->seg = NULL;
@@ -3854,6 +4288,7 @@ grn_ii_open(grn_ctx *ctx, const char *path, grn_obj *lexicon)
   ii->lflags = lflags;
   ii->encoding = encoding;
   ii->header = header;
+  ii->merger = NULL;
   ii->n_elements = 2;
   if ((header->flags & GRN_OBJ_WITH_SECTION)) { ii->n_elements++; }
   if ((header->flags & GRN_OBJ_WITH_WEIGHT)) { ii->n_elements++; }
@@ -3866,6 +4301,7 @@ grn_ii_close(grn_ctx *ctx, grn_ii *ii)
 {
   grn_rc rc;
   if (!ii) { return GRN_INVALID_ARGUMENT; }
+  grn_ii_merger_stop(ctx, ii);
   if ((rc = grn_io_close(ctx, ii->seg))) { return rc; }
   if ((rc = grn_io_close(ctx, ii->chunk))) { return rc; }
   GRN_FREE(ii);
@@ -4065,6 +4501,10 @@ grn_ii_update_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_h
     bt->pos_in_buffer = 0;
   }
   rc = buffer_put(ctx, ii, b, bt, br, bs, u, size);
+  if (!rc && grn_ii_async_merge_enable &&
+      b->header.buffer_free < grn_ii_async_merge_threshold) {
+    grn_ii_merger_request(ctx, ii, LSEG(pos));
+  }
   buffer_close(ctx, ii, pseg);
   if (!a[0] || (a[0] & 1)) { a[0] = pos; }
 exit :
@@ -4153,6 +4593,10 @@ grn_ii_delete_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_h
     b->header.buffer_free -= size;
     br = (buffer_rec *)(((byte *)&b->terms[b->header.nterms]) + b->header.buffer_free);
     rc = buffer_put(ctx, ii, b, bt, br, bs, u, size);
+    if (!rc && grn_ii_async_merge_enable &&
+        b->header.buffer_free < grn_ii_async_merge_threshold) {
+      grn_ii_merger_request(ctx, ii, LSEG(a[0]));
+    }
     buffer_close(ctx, ii, pseg);
     break;
   }
@@ -4193,6 +4637,7 @@ struct _grn_ii_cursor {
   uint32_t nchunks;
   uint32_t curr_chunk;
   chunk_info *cinfo;
+  grn_id *chunk_last_rids; /* The last record ID of each chunk in cinfo */
   grn_io_win iw;
   uint8_t *cp;
   uint8_t *cpe;
@@ -4206,8 +4651,6 @@ struct _grn_ii_cursor {
   uint32_t *ppseg;
 
   int weight;
-
-  uint32_t prev_chunk_rid;
 };
 
 static int
@@ -4327,7 +4770,11 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
             grn_ii_cursor_close(ctx, c);
             continue;
           }
-          if (!(c->cinfo = GRN_MALLOCN(chunk_info, c->nchunks))) {
+          c->cinfo = GRN_MALLOCN(chunk_info, c->nchunks);
+          c->chunk_last_rids = GRN_MALLOCN(grn_id, c->nchunks);
+          if (!c->cinfo || !c->chunk_last_rids) {
+            if (c->cinfo) { GRN_FREE(c->cinfo); }
+            if (c->chunk_last_rids) { GRN_FREE(c->chunk_last_rids); }
             buffer_close(ctx, ii, c->buffer_pseg);
             grn_io_win_unmap(&c->iw);
             GRN_FREE(c);
@@ -4335,10 +4782,9 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
             goto exit;
           }
           for (i = 0, crid = GRN_ID_NIL; i < c->nchunks; i++) {
-            GRN_B_DEC(c->cinfo[i].segno, c->cp);
-            GRN_B_DEC(c->cinfo[i].size, c->cp);
-            GRN_B_DEC(c->cinfo[i].dgap, c->cp);
+            CHUNK_INFO_DEC(&c->cinfo[i], ii->header->flags, c->cp);
             crid += c->cinfo[i].dgap;
+            c->chunk_last_rids[i] = crid;
             if (crid < min) { c->curr_chunk = i + 1; }
           }
           if (chunk_is_reused(ctx, ii, c, chunk, c->buf->header.chunk_size)) {
@@ -4361,6 +4807,29 @@ exit :
   return c;
 }
 
+/*
+ * grn_ii_cursor_find_chunk returns the first chunk that may have records
+ * that aren't less than min. It returns c->nchunks when only the last
+ * chunk, that isn't in c->cinfo, may have them. Chunks are sorted by
+ * record ID and don't overlap each other, so the last record IDs are
+ * enough to find the chunk.
+ */
+static inline uint32_t
+grn_ii_cursor_find_chunk(grn_ii_cursor *c, grn_id min)
+{
+  uint32_t low = c->curr_chunk;
+  uint32_t high = c->nchunks;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (c->chunk_last_rids[middle] < min) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
 static inline void
 grn_ii_cursor_set_min(grn_ctx *ctx, grn_ii_cursor *c, grn_id min)
 {
@@ -4369,35 +4838,23 @@ grn_ii_cursor_set_min(grn_ctx *ctx, grn_ii_cursor *c, grn_id min)
   }
 
   if (grn_ii_cursor_set_min_enable) {
+    uint32_t skip_chunk;
     c->min = min;
-    if (c->buf &&
-        c->pc.rid < c->min &&
-        c->prev_chunk_rid < c->min &&
-        c->curr_chunk < c->nchunks) {
-      uint32_t i;
-      uint32_t skip_chunk = 0;
-      grn_id rid = c->prev_chunk_rid;
-
-      if (c->curr_chunk > 0) {
-        i = c->curr_chunk - 1;
-      } else {
-        i = 0;
-      }
-      for (; i < c->nchunks; i++) {
-        rid += c->cinfo[i].dgap;
-        if (rid < c->min) {
-          skip_chunk = i + 1;
-        } else {
-          rid -= c->cinfo[i].dgap;
-          break;
-        }
-      }
-      if (skip_chunk > c->curr_chunk) {
-        c->pc.rid = rid;
-        c->prev_chunk_rid = rid - c->cinfo[skip_chunk - 1].dgap;
-        c->curr_chunk = skip_chunk;
-        c->crp = c->cdp + c->cdf;
-      }
+    if (!c->buf || !(c->stat & CHUNK_USED) || c->pc.rid >= c->min) {
+      return;
+    }
+    /* The current chunk still has records that aren't less than min. */
+    if (c->curr_chunk > 0 &&
+        c->curr_chunk <= c->nchunks &&
+        c->chunk_last_rids[c->curr_chunk - 1] >= c->min &&
+        c->crp < c->cdp + c->cdf) {
+      return;
+    }
+    skip_chunk = grn_ii_cursor_find_chunk(c, c->min);
+    if (skip_chunk > c->curr_chunk) {
+      c->pc.rid = c->chunk_last_rids[skip_chunk - 1];
+      c->curr_chunk = skip_chunk;
+      c->crp = c->cdp + c->cdf;
     }
   }
 }
@@ -4500,7 +4957,6 @@ grn_ii_cursor_next_internal(grn_ctx *ctx, grn_ii_cursor *c,
                 }
                 c->cpp = c->rdv[j].data;
               }
-              c->prev_chunk_rid = c->pc.rid;
               c->pc.rid = 0;
               c->pc.sid = 0;
               c->pc.rest = 0;
@@ -4702,6 +5158,7 @@ grn_ii_cursor_close(grn_ctx *ctx, grn_ii_cursor *c)
   if (!c) { return GRN_INVALID_ARGUMENT; }
   datavec_fin(ctx, c->rdv);
   if (c->cinfo) { GRN_FREE(c->cinfo); }
+  if (c->chunk_last_rids) { GRN_FREE(c->chunk_last_rids); }
   if (c->buf) { buffer_close(ctx, c->ii, c->buffer_pseg); }
   if (c->cp) { grn_io_win_unmap(&c->iw); }
   GRN_FREE(c);
@@ -5656,6 +6113,7 @@ grn_ii_column_update(grn_ctx *ctx, grn_ii *ii, grn_id rid, unsigned int section,
     }
   }
 exit :
+  grn_obj_touch(ctx, (grn_obj *)ii, NULL);
   grn_io_unlock(ii->seg);
   if (old && old != oldvalue) { grn_obj_close(ctx, old); }
   if (new && new != newvalue) { grn_obj_close(ctx, new); }
@@ -6765,6 +7223,40 @@ grn_ii_select_sequential_search(grn_ctx *ctx,
 }
 #endif
 
+static int
+grn_ii_select_compare_rid(const void *a, const void *b)
+{
+  grn_id rid1 = *((const grn_id *)a), rid2 = *((const grn_id *)b);
+  if (rid1 < rid2) { return -1; }
+  if (rid1 > rid2) { return 1; }
+  return 0;
+}
+
+/*
+ * grn_ii_select_sorted_rids returns the sorted record IDs in s. It's used
+ * to skip postings that can't be matched for GRN_OP_AND. The returned
+ * array must be freed by GRN_FREE().
+ */
+static grn_id *
+grn_ii_select_sorted_rids(grn_ctx *ctx, grn_hash *s, uint32_t *n_rids)
+{
+  grn_id *rids;
+  grn_id *key;
+  uint32_t i = 0;
+
+  *n_rids = 0;
+  rids = GRN_MALLOCN(grn_id, GRN_HASH_SIZE(s) + 1);
+  if (!rids) {
+    return NULL;
+  }
+  GRN_HASH_EACH(ctx, s, id, &key, NULL, NULL, {
+    rids[i++] = *key;
+  });
+  qsort(rids, i, sizeof(grn_id), grn_ii_select_compare_rid);
+  *n_rids = i;
+  return rids;
+}
+
 grn_rc
 grn_ii_select(grn_ctx *ctx, grn_ii *ii,
               const char *string, unsigned int string_len,
@@ -6781,6 +7273,8 @@ grn_ii_select(grn_ctx *ctx, grn_ii *ii,
   grn_obj *lexicon = ii->lexicon;
   grn_scorer_score_func *score_func = NULL;
   grn_scorer_matched_record record;
+  grn_id *and_rids = NULL;
+  uint32_t n_and_rids = 0, and_rids_offset = 0;
 
   if (!lexicon || !ii || !s) { return GRN_INVALID_ARGUMENT; }
   if (optarg) {
@@ -6889,7 +7383,27 @@ grn_ii_select(grn_ctx *ctx, grn_ii *ii,
     record.args_expr_offset = optarg->scorer_args_expr_offset;
   }
 
+  if (op == GRN_OP_AND &&
+      s->key_size == sizeof(grn_id) &&
+      GRN_HASH_SIZE(s) < (uint32_t)((*tis)->size)) {
+    and_rids = grn_ii_select_sorted_rids(ctx, s, &n_and_rids);
+  }
+
   for (;;) {
+    if (and_rids) {
+      /* Only records in s can be matched. Jump to the next one. */
+      while (and_rids_offset < n_and_rids &&
+             and_rids[and_rids_offset] < (*tis)->p->rid) {
+        and_rids_offset++;
+      }
+      if (and_rids_offset == n_and_rids) { goto exit; }
+      if (and_rids[and_rids_offset] > (*tis)->p->rid) {
+        if (token_info_skip(ctx, *tis, and_rids[and_rids_offset], 0)) {
+          goto exit;
+        }
+        continue;
+      }
+    }
     rid = (*tis)->p->rid;
     sid = (*tis)->p->sid;
     for (tip = tis + 1, nrid = rid, nsid = sid + 1; tip < tie; tip++) {
@@ -7030,6 +7544,7 @@ exit :
     GRN_OBJ_FIN(ctx, &(record.terms));
     GRN_OBJ_FIN(ctx, &(record.term_weights));
   }
+  if (and_rids) { GRN_FREE(and_rids); }
   for (tip = tis; tip < tis + n; tip++) {
     if (*tip) { token_info_close(ctx, *tip); }
   }
@@ -7050,46 +7565,724 @@ exit :
   return rc;
 }
 
-static uint32_t
-grn_ii_estimate_size_for_query_regexp(grn_ctx *ctx, grn_ii *ii,
-                                      const char *query, unsigned int query_len,
-                                      grn_search_optarg *optarg)
-{
-  grn_rc rc;
-  grn_obj parsed_query;
-  uint32_t size;
+/* top-k */
 
-  GRN_TEXT_INIT(&parsed_query, 0);
-  rc = grn_ii_parse_regexp_query(ctx, "[ii][estimate-size][query][regexp]",
-                                 query, query_len, &parsed_query);
-  if (rc != GRN_SUCCESS) {
-    GRN_OBJ_FIN(ctx, &parsed_query);
-    return 0;
-  }
+/*
+ * block_max is the per-chunk upper bound of the scores of a term. It's
+ * available only for index columns that have GRN_OBJ_INDEX_BLOCK_MAX.
+ * Postings in the buffer and in the chunk after the last split chunk don't
+ * have per-chunk upper bounds.
+ */
+typedef struct {
+  grn_id *last_rids;
+  uint32_t *max_scores;
+  uint32_t n_blocks;
+  uint32_t current;
+  uint32_t buffer_max_score;
+  double max_score;
+  grn_bool available;
+  grn_bool with_tail;
+} block_max;
 
-  if (optarg) {
-    optarg->mode = GRN_OP_MATCH;
+static uint32_t
+block_max_buffer_max_score(grn_ctx *ctx, grn_ii *ii, grn_ii_cursor *c)
+{
+  uint64_t score = 0, max_score = 0;
+  grn_id rid = GRN_ID_NIL;
+  uint16_t nextb = c->nextb;
+  if (c->pb.rid) {
+    rid = c->pb.rid;
+    score = c->pb.tf + c->pb.weight;
+  }
+  while (nextb) {
+    buffer_rec *br = BUFFER_REC_AT(c->buf, nextb);
+    uint8_t *bp = GRN_NEXT_ADDR(br);
+    uint32_t brid, bsid, tf, weight = 0;
+    GRN_B_DEC(brid, bp);
+    if ((ii->header->flags & GRN_OBJ_WITH_SECTION)) {
+      GRN_B_DEC(bsid, bp);
+    }
+    GRN_B_DEC(tf, bp);
+    if ((ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
+      GRN_B_DEC(weight, bp);
+    }
+    if (brid != rid) {
+      if (score > max_score) { max_score = score; }
+      score = 0;
+      rid = brid;
+    }
+    score += tf + weight;
+    nextb = br->step;
   }
+  if (score > max_score) { max_score = score; }
+  return max_score > UINT32_MAX ? UINT32_MAX : (uint32_t)max_score;
+}
 
-  size = grn_ii_estimate_size_for_query(ctx, ii,
-                                        GRN_TEXT_VALUE(&parsed_query),
-                                        GRN_TEXT_LEN(&parsed_query),
-                                        optarg);
-  GRN_OBJ_FIN(ctx, &parsed_query);
+static grn_rc
+block_max_open(grn_ctx *ctx, grn_ii *ii, token_info *ti, block_max *bm)
+{
+  grn_ii_cursor *c;
+  uint32_t i;
 
-  if (optarg) {
-    optarg->mode = GRN_OP_REGEXP;
+  memset(bm, 0, sizeof(block_max));
+  bm->max_score = HUGE_VAL;
+  if (!(ii->header->flags & GRN_OBJ_INDEX_BLOCK_MAX)) { return GRN_SUCCESS; }
+  /* Prefix expanded tokens are read from many cursors. */
+  if (ti->cursors->n_entries != 1) { return GRN_SUCCESS; }
+  c = ti->cursors->bins[0];
+  if (!c->buf) { return GRN_SUCCESS; }
+
+  if (c->nchunks) {
+    bm->last_rids = GRN_MALLOCN(grn_id, c->nchunks);
+    bm->max_scores = GRN_MALLOCN(uint32_t, c->nchunks);
+    if (!bm->last_rids || !bm->max_scores) {
+      if (bm->last_rids) { GRN_FREE(bm->last_rids); }
+      if (bm->max_scores) { GRN_FREE(bm->max_scores); }
+      bm->last_rids = NULL;
+      bm->max_scores = NULL;
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "[ii][select][top-k] failed to allocate block max: <%u>",
+          c->nchunks);
+      return ctx->rc;
+    }
   }
-
-  return size;
+  bm->max_score = 0;
+  for (i = 0; i < c->nchunks; i++) {
+    bm->last_rids[i] = c->chunk_last_rids[i];
+    bm->max_scores[i] = c->cinfo[i].max_score;
+    if (c->cinfo[i].max_score > bm->max_score) {
+      bm->max_score = c->cinfo[i].max_score;
+    }
+  }
+  bm->n_blocks = c->nchunks;
+  bm->with_tail = c->cp < c->cpe;
+  bm->buffer_max_score = block_max_buffer_max_score(ctx, ii, c);
+  if (bm->with_tail) {
+    bm->max_score = HUGE_VAL;
+  } else {
+    bm->max_score += bm->buffer_max_score;
+  }
+  bm->available = GRN_TRUE;
+  return GRN_SUCCESS;
 }
 
-uint32_t
-grn_ii_estimate_size_for_query(grn_ctx *ctx, grn_ii *ii,
-                               const char *query, unsigned int query_len,
-                               grn_search_optarg *optarg)
+static void
+block_max_close(grn_ctx *ctx, block_max *bm)
 {
-  grn_rc rc;
+  if (bm->last_rids) { GRN_FREE(bm->last_rids); }
+  if (bm->max_scores) { GRN_FREE(bm->max_scores); }
+}
+
+/*
+ * block_max_bound returns the upper bound of the score of rid. The bound is
+ * valid until *last_rid. rid must not be less than the previous rid.
+ */
+static double
+block_max_bound(block_max *bm, grn_id rid, grn_id *last_rid)
+{
+  if (!bm->available) {
+    *last_rid = GRN_ID_MAX;
+    return HUGE_VAL;
+  }
+  while (bm->current < bm->n_blocks && bm->last_rids[bm->current] < rid) {
+    bm->current++;
+  }
+  if (bm->current < bm->n_blocks) {
+    *last_rid = bm->last_rids[bm->current];
+    return (double)bm->max_scores[bm->current] + bm->buffer_max_score;
+  }
+  *last_rid = GRN_ID_MAX;
+  if (bm->with_tail) {
+    return HUGE_VAL;
+  }
+  return bm->buffer_max_score;
+}
+
+/*
+ * top_k_term is a query term. A record matches the term when all tokens of
+ * the term appear as a phrase in a section of the record. Scores are
+ * computed in the same way as grn_ii_select().
+ */
+typedef struct {
+  token_info **tis;
+  block_max *block_maxes;
+  double *bounds;
+  uint32_t n_tis;
+  int weight;
+  double max_score;
+  grn_id rid;
+} top_k_term;
+
+/*
+ * top_k_term_bound_scores computes the upper bound of the score of a record
+ * from the upper bounds of the tokens. noccur of a section is not larger than
+ * tf of any token.
+ */
+static double
+top_k_term_bound_scores(grn_ii *ii, top_k_term *term, double *bounds)
+{
+  uint32_t i;
+  double min_bound = bounds[0], total_bound = bounds[0];
+  if (term->n_tis == 1) {
+    return bounds[0] * term->weight;
+  }
+  for (i = 1; i < term->n_tis; i++) {
+    if (bounds[i] < min_bound) { min_bound = bounds[i]; }
+    total_bound += bounds[i];
+  }
+  if ((ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
+    return min_bound * (1 + total_bound) * term->weight;
+  } else {
+    return min_bound * term->weight;
+  }
+}
+
+static double
+top_k_term_bound(grn_ctx *ctx, grn_ii *ii, top_k_term *term, grn_id rid,
+                 grn_id *last_rid)
+{
+  uint32_t i;
+  *last_rid = GRN_ID_MAX;
+  for (i = 0; i < term->n_tis; i++) {
+    grn_id block_last_rid;
+    term->bounds[i] = block_max_bound(&(term->block_maxes[i]), rid,
+                                      &block_last_rid);
+    if (block_last_rid < *last_rid) { *last_rid = block_last_rid; }
+  }
+  return top_k_term_bound_scores(ii, term, term->bounds);
+}
+
+/*
+ * top_k_term_seek moves term->rid to the first record that isn't less than
+ * min_rid and has all tokens. term->rid is GRN_ID_NIL when there are no more
+ * records.
+ */
+static void
+top_k_term_seek(grn_ctx *ctx, top_k_term *term, grn_id min_rid)
+{
+  grn_id rid = min_rid;
+  uint32_t i = 0, n_aligned = 0;
+  for (;;) {
+    token_info *ti = term->tis[i];
+    if (token_info_skip(ctx, ti, rid, 0)) {
+      term->rid = GRN_ID_NIL;
+      return;
+    }
+    if (ti->p->rid != rid) {
+      rid = ti->p->rid;
+      n_aligned = 0;
+    }
+    if (++n_aligned == term->n_tis) { break; }
+    i = (i + 1) % term->n_tis;
+  }
+  term->rid = rid;
+}
+
+/*
+ * top_k_term_score returns the score of term->rid. *n_subrecs is the number
+ * of matched sections. Tokens are moved to the next record.
+ */
+static double
+top_k_term_score(grn_ctx *ctx, top_k_term *term, uint32_t *n_subrecs)
+{
+  grn_id rid = term->rid;
+  uint32_t sid = 0, n = term->n_tis;
+  double score = 0;
+
+  *n_subrecs = 0;
+  for (;;) {
+    int noccur = 0, tscore = 0;
+    uint32_t i, n_aligned = 0;
+
+    for (i = 0; n_aligned < n; i = (i + 1) % n) {
+      token_info *ti = term->tis[i];
+      if (token_info_skip(ctx, ti, rid, sid)) { return score; }
+      if (ti->p->rid != rid) { return score; }
+      if (ti->p->sid != sid) {
+        sid = ti->p->sid;
+        n_aligned = 0;
+      }
+      n_aligned++;
+    }
+
+    if (n == 1) {
+      token_info *ti = term->tis[0];
+      noccur = ti->p->tf;
+      tscore = ti->p->weight + ti->cursors->bins[0]->weight;
+    } else {
+      int count = 0, pos = 0, pscore = 0;
+      token_info **tip, **tie = term->tis + n;
+      for (tip = term->tis; ; tip++) {
+        token_info *ti;
+        if (tip == tie) { tip = term->tis; }
+        ti = *tip;
+        if (token_info_skip_pos(ctx, ti, rid, sid, pos)) { break; }
+        if (ti->p->rid != rid || ti->p->sid != sid) { break; }
+        if (ti->pos == pos) {
+          pscore += ti->p->weight + ti->cursors->bins[0]->weight;
+          count++;
+        } else {
+          pscore = ti->p->weight + ti->cursors->bins[0]->weight;
+          count = 1;
+          pos = ti->pos;
+        }
+        if (count == n) {
+          tscore += pscore;
+          pscore = 0;
+          count = 0;
+          pos++;
+          noccur++;
+        }
+      }
+    }
+    if (noccur) {
+      score += (noccur + tscore) * term->weight;
+      (*n_subrecs)++;
+    }
+    sid++;
+  }
+}
+
+static grn_rc
+top_k_term_open(grn_ctx *ctx, grn_ii *ii, const char *string,
+                unsigned int string_len, int weight, top_k_term *term)
+{
+  grn_bool only_skip_token = GRN_FALSE;
+  uint32_t i;
+
+  memset(term, 0, sizeof(top_k_term));
+  term->weight = weight;
+  term->rid = GRN_ID_NIL;
+  if (!string_len) { return GRN_SUCCESS; }
+  if (!(term->tis = GRN_MALLOC(sizeof(token_info *) * string_len * 2))) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[ii][select][top-k] failed to allocate tokens: <%.*s>",
+        string_len, string);
+    return ctx->rc;
+  }
+  if (token_info_build(ctx, ii->lexicon, ii, string, string_len,
+                       term->tis, &(term->n_tis), &only_skip_token,
+                       GRN_OP_EXACT) ||
+      !term->n_tis) {
+    return ctx->rc;
+  }
+  qsort(term->tis, term->n_tis, sizeof(token_info *), token_compare);
+  term->block_maxes = GRN_CALLOC(sizeof(block_max) * term->n_tis);
+  term->bounds = GRN_MALLOCN(double, term->n_tis);
+  if (!term->block_maxes || !term->bounds) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[ii][select][top-k] failed to allocate block maxes: <%.*s>",
+        string_len, string);
+    return ctx->rc;
+  }
+  for (i = 0; i < term->n_tis; i++) {
+    block_max_open(ctx, ii, term->tis[i], &(term->block_maxes[i]));
+  }
+  if (ctx->rc != GRN_SUCCESS) {
+    return ctx->rc;
+  }
+  for (i = 0; i < term->n_tis; i++) {
+    term->bounds[i] = term->block_maxes[i].max_score;
+  }
+  term->max_score = top_k_term_bound_scores(ii, term, term->bounds);
+  top_k_term_seek(ctx, term, GRN_ID_NIL);
+  return ctx->rc;
+}
+
+static void
+top_k_term_close(grn_ctx *ctx, top_k_term *term)
+{
+  uint32_t i;
+  for (i = 0; i < term->n_tis; i++) {
+    token_info_close(ctx, term->tis[i]);
+    if (term->block_maxes) {
+      block_max_close(ctx, &(term->block_maxes[i]));
+    }
+  }
+  if (term->tis) { GRN_FREE(term->tis); }
+  if (term->block_maxes) { GRN_FREE(term->block_maxes); }
+  if (term->bounds) { GRN_FREE(term->bounds); }
+}
+
+/*
+ * top_k_term_has_match returns whether the query matches any record. It's
+ * used to keep the behavior of match escalation.
+ */
+static grn_bool
+top_k_term_has_match(grn_ctx *ctx, grn_ii *ii, grn_obj *query)
+{
+  grn_bool has_match = GRN_FALSE;
+  top_k_term term;
+  if (top_k_term_open(ctx, ii, GRN_TEXT_VALUE(query), GRN_TEXT_LEN(query), 1,
+                      &term) == GRN_SUCCESS) {
+    while (term.rid != GRN_ID_NIL) {
+      grn_id rid = term.rid;
+      uint32_t n_subrecs;
+      top_k_term_score(ctx, &term, &n_subrecs);
+      if (n_subrecs > 0) {
+        has_match = GRN_TRUE;
+        break;
+      }
+      top_k_term_seek(ctx, &term, rid + 1);
+    }
+  }
+  top_k_term_close(ctx, &term);
+  return has_match;
+}
+
+typedef struct {
+  grn_id rid;
+  double score;
+  uint32_t n_subrecs;
+} top_k_record;
+
+/*
+ * top_k_record_is_worse returns whether record is ranked lower than the
+ * record of rid and score. Records with the same score are ranked by ID like
+ * the normal path, so smaller IDs win ties.
+ */
+static grn_bool
+top_k_record_is_worse(top_k_record *record, grn_id rid, double score)
+{
+  if (record->score < score) { return GRN_TRUE; }
+  if (record->score > score) { return GRN_FALSE; }
+  return record->rid > rid;
+}
+
+/* The records are kept as a min-heap of ranks. records[0] is the worst. */
+static void
+top_k_records_push(top_k_record *records, uint32_t *n_records, uint32_t k,
+                   grn_id rid, double score, uint32_t n_subrecs)
+{
+  uint32_t n, n1, n2;
+  if (*n_records < k) {
+    n = (*n_records)++;
+    while (n) {
+      n2 = (n - 1) >> 1;
+      if (top_k_record_is_worse(&(records[n2]), rid, score)) { break; }
+      records[n] = records[n2];
+      n = n2;
+    }
+  } else {
+    if (!top_k_record_is_worse(&(records[0]), rid, score)) { return; }
+    n = 0;
+    for (;;) {
+      n1 = n * 2 + 1;
+      n2 = n1 + 1;
+      if (n1 >= k) { break; }
+      if (n2 < k &&
+          top_k_record_is_worse(&(records[n2]),
+                                records[n1].rid, records[n1].score)) {
+        n1 = n2;
+      }
+      if (!top_k_record_is_worse(&(records[n1]), rid, score)) { break; }
+      records[n] = records[n1];
+      n = n1;
+    }
+  }
+  records[n].rid = rid;
+  records[n].score = score;
+  records[n].n_subrecs = n_subrecs;
+}
+
+static int
+top_k_term_compare(const void *a, const void *b)
+{
+  const top_k_term *t1 = *((top_k_term **)a), *t2 = *((top_k_term **)b);
+  if (t1->max_score < t2->max_score) { return -1; }
+  if (t1->max_score > t2->max_score) { return 1; }
+  return 0;
+}
+
+/*
+ * top_k_count_hits counts the records that match any of the queries. The
+ * top k search skips records that can't be in the top k, so the number of
+ * the matched records is counted separately without scoring and adding them
+ * to the result set.
+ */
+static grn_rc
+top_k_count_hits(grn_ctx *ctx, grn_ii *ii,
+                 grn_obj **queries, unsigned int n_queries, uint32_t *n_hits)
+{
+  top_k_term *terms;
+  uint32_t i, n_terms = 0;
+
+  *n_hits = 0;
+  terms = GRN_MALLOCN(top_k_term, n_queries);
+  if (!terms) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[ii][select][top-k][count] failed to allocate: <%u>", n_queries);
+    return ctx->rc;
+  }
+  for (n_terms = 0; n_terms < n_queries; n_terms++) {
+    grn_obj *query = queries[n_terms];
+    if (top_k_term_open(ctx, ii, GRN_TEXT_VALUE(query), GRN_TEXT_LEN(query),
+                        1, &(terms[n_terms])) != GRN_SUCCESS) {
+      n_terms++;
+      goto exit;
+    }
+  }
+
+  for (;;) {
+    grn_id rid = GRN_ID_NIL;
+    grn_bool matched = GRN_FALSE;
+    for (i = 0; i < n_terms; i++) {
+      grn_id term_rid = terms[i].rid;
+      if (term_rid != GRN_ID_NIL && (rid == GRN_ID_NIL || term_rid < rid)) {
+        rid = term_rid;
+      }
+    }
+    if (rid == GRN_ID_NIL) { break; }
+    for (i = 0; i < n_terms; i++) {
+      top_k_term *term = &(terms[i]);
+      if (term->rid != rid) { continue; }
+      if (!matched) {
+        if (term->n_tis == 1) {
+          matched = GRN_TRUE;
+        } else {
+          uint32_t n_subrecs;
+          top_k_term_score(ctx, term, &n_subrecs);
+          matched = (n_subrecs > 0);
+        }
+      }
+      top_k_term_seek(ctx, term, rid + 1);
+    }
+    if (ctx->rc != GRN_SUCCESS) { goto exit; }
+    if (matched) { (*n_hits)++; }
+  }
+
+exit :
+  for (i = 0; i < n_terms; i++) {
+    top_k_term_close(ctx, &(terms[i]));
+  }
+  GRN_FREE(terms);
+  return ctx->rc;
+}
+
+/*
+ * grn_ii_select_top_k adds only the top k records by score for queries
+ * joined by OR to s. It uses MaxScore: terms whose upper bounds sum up to
+ * the current k-th score can't make a new top k record by themselves, so
+ * candidates are only read from the other terms. Per-chunk upper bounds
+ * (GRN_OBJ_INDEX_BLOCK_MAX) are used to skip candidates and chunks that
+ * can't be in the top k.
+ *
+ * n_hits is set to the number of all matched records, not only the top k
+ * records. It's estimated by the sizes of the posting lists because
+ * counting needs to read all postings that the top k search skips. It's
+ * counted only when count_n_hits is true. It returns GRN_FALSE when the
+ * result may be different from grn_ii_sel() because of match escalation or
+ * when the index column doesn't have GRN_OBJ_INDEX_BLOCK_MAX.
+ */
+grn_bool
+grn_ii_select_top_k(grn_ctx *ctx, grn_ii *ii,
+                    grn_obj **queries, int *weights, unsigned int n_queries,
+                    unsigned int k, grn_hash *s, grn_bool count_n_hits,
+                    uint32_t *n_hits)
+{
+  grn_bool processed = GRN_FALSE;
+  top_k_term *terms = NULL, **sorted_terms = NULL;
+  top_k_record *records = NULL;
+  double *max_score_sums = NULL;
+  uint32_t i, n_terms = 0, n_records = 0, n_non_essentials = 0;
+
+  if (!ii->lexicon || !s || n_queries == 0 || k == 0) { return GRN_FALSE; }
+  if (!(ii->header->flags & GRN_OBJ_INDEX_BLOCK_MAX)) { return GRN_FALSE; }
+  if (ctx->impl->match_escalation_threshold > 0) { return GRN_FALSE; }
+  if (ctx->impl->match_escalation_threshold == 0 &&
+      !top_k_term_has_match(ctx, ii, queries[0])) {
+    return GRN_FALSE;
+  }
+
+  terms = GRN_MALLOCN(top_k_term, n_queries);
+  sorted_terms = GRN_MALLOCN(top_k_term *, n_queries);
+  max_score_sums = GRN_MALLOCN(double, n_queries + 1);
+  records = GRN_MALLOCN(top_k_record, k);
+  if (!terms || !sorted_terms || !max_score_sums || !records) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[ii][select][top-k] failed to allocate: <%u>:<%u>", n_queries, k);
+    goto exit;
+  }
+  for (n_terms = 0; n_terms < n_queries; n_terms++) {
+    grn_obj *query = queries[n_terms];
+    top_k_term *term = &(terms[n_terms]);
+    if (top_k_term_open(ctx, ii, GRN_TEXT_VALUE(query), GRN_TEXT_LEN(query),
+                        weights[n_terms], term) != GRN_SUCCESS) {
+      n_terms++;
+      goto exit;
+    }
+    sorted_terms[n_terms] = term;
+  }
+  qsort(sorted_terms, n_terms, sizeof(top_k_term *), top_k_term_compare);
+  max_score_sums[0] = 0;
+  for (i = 0; i < n_terms; i++) {
+    max_score_sums[i + 1] = max_score_sums[i] + sorted_terms[i]->max_score;
+  }
+
+  for (;;) {
+    grn_bool is_full = (n_records == k);
+    double threshold = is_full ? records[0].score : 0;
+    double score = 0;
+    uint32_t n_subrecs = 0;
+    grn_id rid = GRN_ID_NIL;
+
+    for (i = n_non_essentials; i < n_terms; i++) {
+      grn_id term_rid = sorted_terms[i]->rid;
+      if (term_rid != GRN_ID_NIL && (rid == GRN_ID_NIL || term_rid < rid)) {
+        rid = term_rid;
+      }
+    }
+    if (rid == GRN_ID_NIL) { break; }
+
+    if (is_full) {
+      double bound = 0, range_bound = 0;
+      grn_id range_last_rid = GRN_ID_MAX;
+      for (i = 0; i < n_terms; i++) {
+        top_k_term *term = sorted_terms[i];
+        grn_id last_rid;
+        double term_bound;
+        if (term->rid == GRN_ID_NIL) { continue; }
+        term_bound = top_k_term_bound(ctx, ii, term, rid, &last_rid);
+        range_bound += term_bound;
+        if (last_rid < range_last_rid) { range_last_rid = last_rid; }
+        if (i < n_non_essentials || term->rid == rid) { bound += term_bound; }
+      }
+      if (bound <= threshold) {
+        grn_id next_rid = rid + 1;
+        if (range_bound <= threshold && range_last_rid != GRN_ID_MAX) {
+          next_rid = range_last_rid + 1;
+        }
+        for (i = n_non_essentials; i < n_terms; i++) {
+          top_k_term *term = sorted_terms[i];
+          if (term->rid != GRN_ID_NIL && term->rid < next_rid) {
+            top_k_term_seek(ctx, term, next_rid);
+          }
+        }
+        if (ctx->rc != GRN_SUCCESS) { goto exit; }
+        continue;
+      }
+    }
+
+    for (i = n_non_essentials; i < n_terms; i++) {
+      top_k_term *term = sorted_terms[i];
+      if (term->rid == rid) {
+        uint32_t term_n_subrecs;
+        score += top_k_term_score(ctx, term, &term_n_subrecs);
+        n_subrecs += term_n_subrecs;
+        top_k_term_seek(ctx, term, rid + 1);
+      }
+    }
+    for (i = n_non_essentials; i > 0; i--) {
+      top_k_term *term = sorted_terms[i - 1];
+      if (is_full && score + max_score_sums[i] <= threshold) { break; }
+      if (term->rid != GRN_ID_NIL && term->rid < rid) {
+        top_k_term_seek(ctx, term, rid);
+      }
+      if (term->rid == rid) {
+        uint32_t term_n_subrecs;
+        score += top_k_term_score(ctx, term, &term_n_subrecs);
+        n_subrecs += term_n_subrecs;
+        top_k_term_seek(ctx, term, rid + 1);
+      }
+    }
+    if (ctx->rc != GRN_SUCCESS) { goto exit; }
+
+    if (n_subrecs > 0 && (!is_full || score > threshold)) {
+      top_k_records_push(records, &n_records, k, rid, score, n_subrecs);
+      if (n_records == k) {
+        while (n_non_essentials < n_terms &&
+               max_score_sums[n_non_essentials + 1] <= records[0].score) {
+          n_non_essentials++;
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < n_records; i++) {
+    grn_rset_recinfo *ri;
+    grn_rset_posinfo pi = {records[i].rid, 0, 0};
+    if (grn_hash_add(ctx, s, &pi, s->key_size, (void **)&ri, NULL)) {
+      uint32_t j;
+      grn_table_add_subrec((grn_obj *)s, ri, records[i].score, &pi, 1);
+      for (j = 1; j < records[i].n_subrecs; j++) {
+        grn_table_add_subrec((grn_obj *)s, ri, 0, &pi, 1);
+      }
+    }
+  }
+  if (count_n_hits) {
+    if (top_k_count_hits(ctx, ii, queries, n_queries, n_hits) != GRN_SUCCESS) {
+      goto exit;
+    }
+  } else {
+    *n_hits = 0;
+    for (i = 0; i < n_queries; i++) {
+      grn_obj *query = queries[i];
+      *n_hits += grn_ii_estimate_size_for_query(ctx, ii,
+                                                GRN_TEXT_VALUE(query),
+                                                GRN_TEXT_LEN(query),
+                                                NULL);
+    }
+    if (*n_hits < n_records) {
+      *n_hits = n_records;
+    }
+  }
+  GRN_LOG(ctx, GRN_LOG_INFO, "[ii][select][top-k] n=%u k=%u hits=%u/%u",
+          n_queries, k, n_records, *n_hits);
+  processed = GRN_TRUE;
+
+exit :
+  if (terms) {
+    for (i = 0; i < n_terms; i++) {
+      top_k_term_close(ctx, &(terms[i]));
+    }
+    GRN_FREE(terms);
+  }
+  if (sorted_terms) { GRN_FREE(sorted_terms); }
+  if (max_score_sums) { GRN_FREE(max_score_sums); }
+  if (records) { GRN_FREE(records); }
+  return processed;
+}
+
+static uint32_t
+grn_ii_estimate_size_for_query_regexp(grn_ctx *ctx, grn_ii *ii,
+                                      const char *query, unsigned int query_len,
+                                      grn_search_optarg *optarg)
+{
+  grn_rc rc;
+  grn_obj parsed_query;
+  uint32_t size;
+
+  GRN_TEXT_INIT(&parsed_query, 0);
+  rc = grn_ii_parse_regexp_query(ctx, "[ii][estimate-size][query][regexp]",
+                                 query, query_len, &parsed_query);
+  if (rc != GRN_SUCCESS) {
+    GRN_OBJ_FIN(ctx, &parsed_query);
+    return 0;
+  }
+
+  if (optarg) {
+    optarg->mode = GRN_OP_MATCH;
+  }
+
+  size = grn_ii_estimate_size_for_query(ctx, ii,
+                                        GRN_TEXT_VALUE(&parsed_query),
+                                        GRN_TEXT_LEN(&parsed_query),
+                                        optarg);
+  GRN_OBJ_FIN(ctx, &parsed_query);
+
+  if (optarg) {
+    optarg->mode = GRN_OP_REGEXP;
+  }
+
+  return size;
+}
+
+uint32_t
+grn_ii_estimate_size_for_query(grn_ctx *ctx, grn_ii *ii,
+                               const char *query, unsigned int query_len,
+                               grn_search_optarg *optarg)
+{
+  grn_rc rc;
   grn_obj *lexicon = ii->lexicon;
   token_info **tis = NULL;
   uint32_t i;
@@ -8254,10 +9447,11 @@ grn_ii_buffer_merge(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
       bt = &term_buffer->terms[nterm];
       a[0] = SEG2POS(ii_buffer->lseg,
                      (sizeof(buffer_header) + sizeof(buffer_term) * nterm));
-      packed_len = grn_p_encv(ctx, ii_buffer->data_vectors,
-                              ii_buffer->ii->n_elements,
-                              ii_buffer->packed_buf +
-                              ii_buffer->packed_len);
+      packed_len = grn_ii_p_encv(ctx, ii_buffer->ii,
+                                 ii_buffer->data_vectors,
+                                 ii_buffer->ii->n_elements,
+                                 ii_buffer->packed_buf +
+                                 ii_buffer->packed_len);
       a[1] = ii_buffer->data_vectors[0].data_size;
       bt->tid = tid;
       bt->size_in_buffer = 0;
@@ -8728,6 +9922,15 @@ grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity)
 #define GRN_II_BUILDER_MAX_BUFFER_MAX_N_TERMS \
   ((S_SEGMENT - sizeof(buffer_header)) / sizeof(buffer_term))
 
+#define GRN_II_BUILDER_MIN_N_WORKERS          1
+#define GRN_II_BUILDER_MAX_N_WORKERS          256
+
+/* A seek point is put at every GRN_II_BUILDER_SEEK_POINT_INTERVAL terms. */
+#define GRN_II_BUILDER_SEEK_POINT_INTERVAL    256
+
+/* Paths in worker error messages are cut to fit the message buffer. */
+#define GRN_II_BUILDER_PATH_MESSAGE_SIZE      512
+
 struct grn_ii_builder_options {
   uint32_t lexicon_cache_size; /* Cache size of temporary lexicon */
   /* A block is flushed if builder->n reaches this value. */
@@ -8737,6 +9940,8 @@ struct grn_ii_builder_options {
   /* A chunk is flushed if chunk->n reaches this value. */
   uint32_t chunk_threshold;
   uint32_t buffer_max_n_terms; /* Maximum number of terms in each buffer */
+  /* The number of threads (0 means grn_ctx_get_n_workers). */
+  uint32_t n_workers;
 };
 
 static const grn_ii_builder_options grn_ii_builder_default_options = {
@@ -8746,6 +9951,7 @@ static const grn_ii_builder_options grn_ii_builder_default_options = {
   0x10000,   /* block_buf_size */
   0x1000,    /* chunk_threshold */
   0x3000,    /* buffer_max_n_terms */
+  0,         /* n_workers */
 };
 
 /* grn_ii_builder_options_init fills options with the default options. */
@@ -8797,6 +10003,13 @@ grn_ii_builder_options_fix(grn_ii_builder_options *options)
   if (options->buffer_max_n_terms > GRN_II_BUILDER_MAX_BUFFER_MAX_N_TERMS) {
     options->buffer_max_n_terms = GRN_II_BUILDER_MAX_BUFFER_MAX_N_TERMS;
   }
+
+  if (options->n_workers < GRN_II_BUILDER_MIN_N_WORKERS) {
+    options->n_workers = GRN_II_BUILDER_MIN_N_WORKERS;
+  }
+  if (options->n_workers > GRN_II_BUILDER_MAX_N_WORKERS) {
+    options->n_workers = GRN_II_BUILDER_MAX_N_WORKERS;
+  }
 }
 
 #define GRN_II_BUILDER_TERM_INPLACE_SIZE\
@@ -8952,6 +10165,7 @@ grn_ii_builder_term_append(grn_ctx *ctx, grn_ii_builder_term *term,
 }
 
 typedef struct {
+  int      fd;     /* File descriptor (not to be closed) */
   uint64_t offset; /* File offset */
   uint32_t rest;   /* Remaining size */
   uint8_t  *buf;   /* Buffer (to be freed) */
@@ -8967,6 +10181,7 @@ typedef struct {
 static void
 grn_ii_builder_block_init(grn_ctx *ctx, grn_ii_builder_block *block)
 {
+  block->fd = -1;
   block->offset = 0;
   block->rest = 0;
   block->buf = NULL;
@@ -9349,13 +10564,20 @@ grn_ii_builder_chunk_reserve_enc_buf(grn_ctx *ctx, grn_ii_builder_chunk *chunk,
 static void
 grn_ii_builder_chunk_encode_buf(grn_ctx *ctx, grn_ii_builder_chunk *chunk,
                                 uint32_t *values, uint32_t n_values,
-                                grn_bool use_p_enc)
+                                grn_bool use_p_enc, grn_bool use_bp128)
 {
   uint8_t *p = chunk->enc_buf + chunk->enc_offset;
   uint32_t i;
   if (use_p_enc) {
     uint8_t freq[33];
     uint32_t buf[UNIT_SIZE];
+    if (use_bp128) {
+      while (n_values >= UNIT_SIZE) {
+        p = pack_bp128(values, p);
+        values += UNIT_SIZE;
+        n_values -= UNIT_SIZE;
+      }
+    }
     while (n_values >= UNIT_SIZE) {
       memset(freq, 0, 33);
       for (i = 0; i < UNIT_SIZE; i++) {
@@ -9397,12 +10619,14 @@ grn_ii_builder_chunk_encode_buf(grn_ctx *ctx, grn_ii_builder_chunk *chunk,
 /* grn_ii_builder_chunk_encode encodes a chunk. */
 static grn_rc
 grn_ii_builder_chunk_encode(grn_ctx *ctx, grn_ii_builder_chunk *chunk,
-                            chunk_info *cinfos, uint32_t n_cinfos)
+                            chunk_info *cinfos, uint32_t n_cinfos,
+                            uint32_t ii_flags)
 {
   grn_rc rc;
   uint8_t *p;
   uint8_t shift = 0, use_p_enc_flags = 0;
   uint8_t rid_use_p_enc, rest_use_p_enc, pos_use_p_enc = 0;
+  grn_bool use_bp128 = (ii_flags & GRN_OBJ_INDEX_SIMD_PACK) != 0;
 
   /* Choose an encoding. */
   rid_use_p_enc = chunk->offset >= 16 && chunk->offset > (chunk->rid >> 8);
@@ -9432,13 +10656,11 @@ grn_ii_builder_chunk_encode(grn_ctx *ctx, grn_ii_builder_chunk *chunk,
     uint32_t i;
     GRN_B_ENC(n_cinfos, p);
     for (i = 0; i < n_cinfos; i++) {
-      GRN_B_ENC(cinfos[i].segno, p);
-      GRN_B_ENC(cinfos[i].size, p);
-      GRN_B_ENC(cinfos[i].dgap, p);
+      CHUNK_INFO_ENC(&cinfos[i], ii_flags, p);
     }
   }
   if (use_p_enc_flags) {
-    GRN_B_ENC(use_p_enc_flags << 1, p);
+    GRN_B_ENC((use_p_enc_flags << 1) | (use_bp128 ? P_ENC_BP128 : 0), p);
     GRN_B_ENC(chunk->offset, p);
     if (chunk->pos_buf) {
       GRN_B_ENC(chunk->pos_offset - chunk->offset, p);
@@ -9450,28 +10672,46 @@ grn_ii_builder_chunk_encode(grn_ctx *ctx, grn_ii_builder_chunk *chunk,
 
   /* Encode a body. */
   grn_ii_builder_chunk_encode_buf(ctx, chunk, chunk->rid_buf, chunk->offset,
-                                  rid_use_p_enc);
+                                  rid_use_p_enc, use_bp128);
   if (chunk->sid_buf) {
     grn_ii_builder_chunk_encode_buf(ctx, chunk, chunk->sid_buf, chunk->offset,
-                                    rest_use_p_enc);
+                                    rest_use_p_enc, use_bp128);
   }
   grn_ii_builder_chunk_encode_buf(ctx, chunk, chunk->freq_buf, chunk->offset,
-                                  rest_use_p_enc);
+                                  rest_use_p_enc, use_bp128);
   if (chunk->weight_buf) {
     grn_ii_builder_chunk_encode_buf(ctx, chunk, chunk->weight_buf,
-                                    chunk->offset, rest_use_p_enc);
+                                    chunk->offset, rest_use_p_enc, use_bp128);
   }
   if (chunk->pos_buf) {
     grn_ii_builder_chunk_encode_buf(ctx, chunk, chunk->pos_buf,
-                                    chunk->pos_offset, pos_use_p_enc);
+                                    chunk->pos_offset, pos_use_p_enc,
+                                    use_bp128);
   }
 
   return GRN_SUCCESS;
 }
 
+/*
+ * grn_ii_builder_seek_point tells where a term starts in a block. Seek points
+ * are used to start merging blocks from the middle of the lexicon.
+ */
+typedef struct {
+  uint32_t block_id; /* Block ID */
+  grn_id   tid;      /* Global term ID */
+  uint64_t offset;   /* File offset */
+} grn_ii_builder_seek_point;
+
+/* grn_ii_builder_file is a temporary file taken over from a worker. */
+typedef struct {
+  char path[PATH_MAX]; /* File path */
+  int  fd;             /* File descriptor (to be closed) */
+} grn_ii_builder_file;
+
 typedef struct {
   grn_ii                 *ii;     /* Building inverted index */
   grn_ii_builder_options options; /* Options */
+  grn_critical_section   *lock;   /* Lock shared by workers (or NULL) */
 
   grn_obj  *src_table; /* Source table */
   grn_obj  **srcs;     /* Source columns (to be freed) */
@@ -9479,6 +10719,9 @@ typedef struct {
   uint8_t  sid_bits;   /* Number of bits for section ID */
   uint64_t sid_mask;   /* Mask bits for section ID */
 
+  int      src_offset; /* Number of records to be skipped */
+  int      src_limit;  /* Number of records to be indexed (-1 means all) */
+
   grn_obj  *lexicon; /* Block lexicon (to be closed) */
 
   uint32_t n;   /* Number of integers appended to the current block */
@@ -9501,6 +10744,13 @@ typedef struct {
   uint32_t             n_blocks;    /* Number of blocks */
   uint32_t             blocks_size; /* Buffer size of blocks */
 
+  grn_ii_builder_seek_point *points;     /* Seek points (to be freed) */
+  uint32_t                  n_points;    /* Number of seek points */
+  uint32_t                  points_size; /* Buffer size of points */
+
+  grn_ii_builder_file *files;   /* Files taken over from workers */
+  uint32_t            n_files;  /* Number of files */
+
   grn_ii_builder_buffer buf;   /* Buffer (to be finalized) */
   grn_ii_builder_chunk  chunk; /* Chunk (to be finalized) */
 
@@ -9520,7 +10770,11 @@ grn_ii_builder_init(grn_ctx *ctx, grn_ii_builder *builder,
 {
   builder->ii = ii;
   builder->options = *options;
+  if (!builder->options.n_workers) {
+    builder->options.n_workers = grn_ctx_get_n_workers(ctx);
+  }
   grn_ii_builder_options_fix(&builder->options);
+  builder->lock = NULL;
 
   builder->src_table = NULL;
   builder->srcs = NULL;
@@ -9528,6 +10782,9 @@ grn_ii_builder_init(grn_ctx *ctx, grn_ii_builder *builder,
   builder->sid_bits = 0;
   builder->sid_mask = 0;
 
+  builder->src_offset = 0;
+  builder->src_limit = -1;
+
   builder->lexicon = NULL;
 
   builder->n = 0;
@@ -9549,6 +10806,13 @@ grn_ii_builder_init(grn_ctx *ctx, grn_ii_builder *builder,
   builder->n_blocks = 0;
   builder->blocks_size = 0;
 
+  builder->points = NULL;
+  builder->n_points = 0;
+  builder->points_size = 0;
+
+  builder->files = NULL;
+  builder->n_files = 0;
+
   grn_ii_builder_buffer_init(ctx, &builder->buf, ii);
   grn_ii_builder_chunk_init(ctx, &builder->chunk);
 
@@ -9592,6 +10856,17 @@ grn_ii_builder_fin(grn_ctx *ctx, grn_ii_builder *builder)
     }
     GRN_FREE(builder->blocks);
   }
+  if (builder->files) {
+    uint32_t i;
+    for (i = 0; i < builder->n_files; i++) {
+      grn_close(builder->files[i].fd);
+      grn_unlink(builder->files[i].path);
+    }
+    GRN_FREE(builder->files);
+  }
+  if (builder->points) {
+    GRN_FREE(builder->points);
+  }
   if (builder->file_buf) {
     GRN_FREE(builder->file_buf);
   }
@@ -9649,6 +10924,27 @@ grn_ii_builder_close(grn_ctx *ctx, grn_ii_builder *builder)
   return rc;
 }
 
+/*
+ * grn_ii_builder_lock locks objects shared by workers, such as the global
+ * lexicon and the inverted index. Nothing is done if workers are not running.
+ */
+inline static void
+grn_ii_builder_lock(grn_ctx *ctx, grn_ii_builder *builder)
+{
+  if (builder->lock) {
+    CRITICAL_SECTION_ENTER(*builder->lock);
+  }
+}
+
+/* grn_ii_builder_unlock unlocks objects locked by grn_ii_builder_lock. */
+inline static void
+grn_ii_builder_unlock(grn_ctx *ctx, grn_ii_builder *builder)
+{
+  if (builder->lock) {
+    CRITICAL_SECTION_LEAVE(*builder->lock);
+  }
+}
+
 /* grn_ii_builder_create_lexicon creates a block lexicon. */
 static grn_rc
 grn_ii_builder_create_lexicon(grn_ctx *ctx, grn_ii_builder *builder)
@@ -9773,10 +11069,46 @@ grn_ii_builder_flush_file_buf(grn_ctx *ctx, grn_ii_builder *builder)
   return GRN_SUCCESS;
 }
 
-/* grn_ii_builder_flush_term flushes a term and clears it */
+/* grn_ii_builder_add_seek_point adds a seek point to the current block. */
+static grn_rc
+grn_ii_builder_add_seek_point(grn_ctx *ctx, grn_ii_builder *builder,
+                              grn_id tid)
+{
+  grn_ii_builder_seek_point *point;
+  uint64_t file_offset = grn_lseek(builder->fd, 0, SEEK_CUR);
+  if (file_offset == (uint64_t)-1) {
+    SERR("failed to get file offset");
+    return ctx->rc;
+  }
+  if (builder->n_points == builder->points_size) {
+    uint32_t size = builder->points_size ? (builder->points_size * 2) : 1;
+    size_t n_bytes = size * sizeof(grn_ii_builder_seek_point);
+    grn_ii_builder_seek_point *points =
+      (grn_ii_builder_seek_point *)GRN_REALLOC(builder->points, n_bytes);
+    if (!points) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "failed to allocate memory for seek points: n_bytes = %"
+          GRN_FMT_SIZE,
+          n_bytes);
+      return ctx->rc;
+    }
+    builder->points = points;
+    builder->points_size = size;
+  }
+  point = &builder->points[builder->n_points++];
+  point->block_id = builder->n_blocks;
+  point->tid = tid;
+  point->offset = file_offset + builder->file_buf_offset;
+  return GRN_SUCCESS;
+}
+
+/*
+ * grn_ii_builder_flush_term flushes a term and clears it. If is_seek_point is
+ * true and there are multiple workers, a seek point is added for the term.
+ */
 static grn_rc
 grn_ii_builder_flush_term(grn_ctx *ctx, grn_ii_builder *builder,
-                          grn_ii_builder_term *term)
+                          grn_ii_builder_term *term, grn_bool is_seek_point)
 {
   grn_rc rc;
   uint8_t *term_buf;
@@ -9813,7 +11145,9 @@ grn_ii_builder_flush_term(grn_ctx *ctx, grn_ii_builder *builder,
       }
       return ctx->rc;
     }
+    grn_ii_builder_lock(ctx, builder);
     global_tid = grn_table_add(ctx, builder->ii->lexicon, key, key_size, NULL);
+    grn_ii_builder_unlock(ctx, builder);
     if (global_tid == GRN_ID_NIL) {
       if (ctx->rc == GRN_SUCCESS) {
         ERR(GRN_UNKNOWN_ERROR,
@@ -9830,6 +11164,12 @@ grn_ii_builder_flush_term(grn_ctx *ctx, grn_ii_builder *builder,
         return rc;
       }
     }
+    if (is_seek_point && builder->options.n_workers > 1) {
+      rc = grn_ii_builder_add_seek_point(ctx, builder, global_tid);
+      if (rc != GRN_SUCCESS) {
+        return rc;
+      }
+    }
     value = global_tid;
     p = builder->file_buf + builder->file_buf_offset;
     if (value < 1U << 5) {
@@ -9948,6 +11288,7 @@ grn_ii_builder_register_block(grn_ctx *ctx, grn_ii_builder *builder)
   }
   block = &builder->blocks[builder->n_blocks];
   grn_ii_builder_block_init(ctx, block);
+  block->fd = builder->fd;
   if (!builder->n_blocks) {
     block->offset = 0;
   } else {
@@ -9965,6 +11306,7 @@ grn_ii_builder_flush_block(grn_ctx *ctx, grn_ii_builder *builder)
 {
   grn_rc rc;
   grn_table_cursor *cursor;
+  uint32_t n_flushed_terms = 0;
 
   if (!builder->n) {
     /* Do nothing if there are no output data. */
@@ -9985,11 +11327,16 @@ grn_ii_builder_flush_block(grn_ctx *ctx, grn_ii_builder *builder)
     if (tid == GRN_ID_NIL) {
       break;
     }
-    rc = grn_ii_builder_flush_term(ctx, builder, &builder->terms[tid - 1]);
+    rc = grn_ii_builder_flush_term(ctx, builder, &builder->terms[tid - 1],
+                                   n_flushed_terms %
+                                   GRN_II_BUILDER_SEEK_POINT_INTERVAL == 0);
     if (rc != GRN_SUCCESS) {
+      grn_table_cursor_close(ctx, cursor);
       return rc;
     }
+    n_flushed_terms++;
   }
+  grn_table_cursor_close(ctx, cursor);
   rc = grn_ii_builder_flush_file_buf(ctx, builder);
   if (rc != GRN_SUCCESS) {
     return rc;
@@ -10203,7 +11550,8 @@ grn_ii_builder_append_srcs(grn_ctx *ctx, grn_ii_builder *builder)
 
   /* Create a cursor to get records in the ID order. */
   cursor = grn_table_cursor_open(ctx, builder->src_table, NULL, 0, NULL, 0,
-                                 0, -1, GRN_CURSOR_BY_ID);
+                                 builder->src_offset, builder->src_limit,
+                                 GRN_CURSOR_BY_ID);
   if (!cursor) {
     if (ctx->rc == GRN_SUCCESS) {
       ERR(GRN_OBJECT_CORRUPT, "[index] failed to open table cursor");
@@ -10246,13 +11594,17 @@ grn_ii_builder_append_srcs(grn_ctx *ctx, grn_ii_builder *builder)
         if (rc == GRN_SUCCESS) {
           uint32_t sid = (uint32_t)(i + 1);
           rc = grn_ii_builder_append_obj(ctx, builder, rid, sid, obj);
-          if (rc == GRN_SUCCESS &&
-              builder->n >= builder->options.block_threshold) {
-            rc = grn_ii_builder_flush_block(ctx, builder);
-          }
         }
       }
     }
+    /*
+     * A block must not be flushed in the middle of a record because section
+     * IDs are delta-encoded per record in a chunk.
+     */
+    if (rc == GRN_SUCCESS &&
+        builder->n >= builder->options.block_threshold) {
+      rc = grn_ii_builder_flush_block(ctx, builder);
+    }
   }
   if (rc == GRN_SUCCESS) {
     rc = grn_ii_builder_flush_block(ctx, builder);
@@ -10315,10 +11667,277 @@ grn_ii_builder_set_srcs(grn_ctx *ctx, grn_ii_builder *builder)
   return GRN_SUCCESS;
 }
 
+/*
+ * grn_ii_builder_worker is a thread that builds a part of an inverted index
+ * with its own context and builder.
+ */
+typedef struct {
+  grn_ii_builder *parent;  /* Parent builder */
+  grn_ctx        ctx;      /* Context (to be finalized) */
+  grn_ii_builder builder;  /* Builder (to be finalized) */
+  grn_thread     thread;   /* Thread */
+  grn_bool       running;  /* Whether the thread is running */
+  int            *fds;     /* Descriptors of parent's files (to be closed) */
+  const grn_id   *tids;    /* Term IDs in key order */
+  const uint32_t *ranks;   /* Ranks of terms in key order */
+  uint32_t       min_rank; /* First rank to be merged */
+  uint32_t       max_rank; /* End of ranks to be merged (exclusive) */
+} grn_ii_builder_worker;
+
+typedef grn_thread_func_result (CALLBACK *grn_ii_builder_worker_func)(void *);
+
+/*
+ * grn_ii_builder_worker_init initializes a worker. Note that an initialized
+ * worker must be finalized by grn_ii_builder_worker_fin.
+ */
+static grn_rc
+grn_ii_builder_worker_init(grn_ctx *ctx, grn_ii_builder_worker *worker,
+                           grn_ii_builder *parent, grn_critical_section *lock)
+{
+  grn_rc rc;
+  grn_ii_builder *builder = &worker->builder;
+  worker->parent = parent;
+  worker->running = GRN_FALSE;
+  worker->fds = NULL;
+  worker->tids = NULL;
+  worker->ranks = NULL;
+  worker->min_rank = 0;
+  worker->max_rank = 0;
+  rc = grn_ctx_init(&worker->ctx, 0);
+  if (rc != GRN_SUCCESS) {
+    ERR(rc, "[index] failed to initialize a worker context");
+    return ctx->rc;
+  }
+  grn_ctx_use(&worker->ctx, grn_ctx_db(ctx));
+  grn_ii_builder_init(&worker->ctx, builder, parent->ii, &parent->options);
+  builder->lock = lock;
+  builder->src_table = parent->src_table;
+  builder->srcs = parent->srcs; /* Not to be freed by the worker. */
+  builder->n_srcs = parent->n_srcs;
+  builder->sid_bits = parent->sid_bits;
+  builder->sid_mask = parent->sid_mask;
+  return GRN_SUCCESS;
+}
+
+/* grn_ii_builder_worker_fin finalizes a worker. */
+static void
+grn_ii_builder_worker_fin(grn_ii_builder_worker *worker)
+{
+  grn_ctx *ctx = &worker->ctx;
+  worker->builder.srcs = NULL;
+  grn_ii_builder_fin(ctx, &worker->builder);
+  if (worker->fds) {
+    uint32_t i;
+    for (i = 0; i < worker->parent->n_files; i++) {
+      if (worker->fds[i] != -1) {
+        grn_close(worker->fds[i]);
+      }
+    }
+    GRN_FREE(worker->fds);
+  }
+  grn_ctx_fin(ctx);
+}
+
+/* grn_ii_builder_worker_report copies an error of a worker to ctx. */
+static void
+grn_ii_builder_worker_report(grn_ctx *ctx, grn_ii_builder_worker *worker)
+{
+  if (worker->ctx.rc != GRN_SUCCESS && ctx->rc == GRN_SUCCESS) {
+    ERR(worker->ctx.rc, "[index] worker failed: %s", worker->ctx.errbuf);
+  }
+}
+
+/* grn_ii_builder_run_workers runs func in worker threads and waits them. */
+static grn_rc
+grn_ii_builder_run_workers(grn_ctx *ctx, grn_ii_builder_worker *workers,
+                           uint32_t n_workers, grn_ii_builder_worker_func func)
+{
+  uint32_t i;
+  for (i = 0; i < n_workers; i++) {
+    if (THREAD_CREATE(workers[i].thread, func, &workers[i])) {
+      ERR(GRN_RESOURCE_TEMPORARILY_UNAVAILABLE,
+          "[index] failed to create a worker thread: i = %u, n_workers = %u",
+          i, n_workers);
+      break;
+    }
+    workers[i].running = GRN_TRUE;
+  }
+  for (i = 0; i < n_workers; i++) {
+    if (workers[i].running) {
+      THREAD_JOIN(workers[i].thread);
+      workers[i].running = GRN_FALSE;
+    }
+    grn_ii_builder_worker_report(ctx, &workers[i]);
+  }
+  return ctx->rc;
+}
+
+/* grn_ii_builder_add_file adds a temporary file to be closed and removed. */
+static grn_rc
+grn_ii_builder_add_file(grn_ctx *ctx, grn_ii_builder *builder,
+                        const char *path, int fd)
+{
+  grn_ii_builder_file *file;
+  size_t n_bytes = (builder->n_files + 1) * sizeof(grn_ii_builder_file);
+  grn_ii_builder_file *files =
+    (grn_ii_builder_file *)GRN_REALLOC(builder->files, n_bytes);
+  if (!files) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "failed to allocate memory for files: n_bytes = %" GRN_FMT_SIZE,
+        n_bytes);
+    return ctx->rc;
+  }
+  builder->files = files;
+  file = &builder->files[builder->n_files++];
+  grn_strcpy(file->path, PATH_MAX, path);
+  file->fd = fd;
+  return GRN_SUCCESS;
+}
+
+/*
+ * grn_ii_builder_take_over_blocks takes over blocks, seek points and a
+ * temporary file from a worker builder. Blocks must be taken over in record
+ * ID order because postings are merged in block order.
+ */
+static grn_rc
+grn_ii_builder_take_over_blocks(grn_ctx *ctx, grn_ii_builder *builder,
+                                grn_ii_builder *worker_builder)
+{
+  grn_rc rc;
+  uint32_t i, n_blocks = builder->n_blocks;
+  uint32_t n_points = builder->n_points;
+
+  if (!worker_builder->n_blocks) {
+    return GRN_SUCCESS;
+  }
+  rc = grn_ii_builder_add_file(ctx, builder,
+                               worker_builder->path, worker_builder->fd);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+  worker_builder->fd = -1;
+
+  if (n_blocks + worker_builder->n_blocks > builder->blocks_size) {
+    size_t n_bytes;
+    uint32_t blocks_size = builder->blocks_size ? builder->blocks_size : 1;
+    grn_ii_builder_block *blocks;
+    while (blocks_size < n_blocks + worker_builder->n_blocks) {
+      blocks_size *= 2;
+    }
+    n_bytes = blocks_size * sizeof(grn_ii_builder_block);
+    blocks = (grn_ii_builder_block *)GRN_REALLOC(builder->blocks, n_bytes);
+    if (!blocks) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "failed to allocate memory for block: n_bytes = %" GRN_FMT_SIZE,
+          n_bytes);
+      return ctx->rc;
+    }
+    builder->blocks = blocks;
+    builder->blocks_size = blocks_size;
+  }
+  for (i = 0; i < worker_builder->n_blocks; i++) {
+    grn_ii_builder_block *block = &builder->blocks[n_blocks + i];
+    grn_ii_builder_block_init(ctx, block);
+    block->fd = worker_builder->blocks[i].fd;
+    block->offset = worker_builder->blocks[i].offset;
+    block->rest = worker_builder->blocks[i].rest;
+    builder->n_blocks++;
+  }
+
+  if (n_points + worker_builder->n_points > builder->points_size) {
+    size_t n_bytes;
+    uint32_t points_size = n_points + worker_builder->n_points;
+    grn_ii_builder_seek_point *points;
+    n_bytes = points_size * sizeof(grn_ii_builder_seek_point);
+    points = (grn_ii_builder_seek_point *)GRN_REALLOC(builder->points,
+                                                      n_bytes);
+    if (!points) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "failed to allocate memory for seek points: n_bytes = %"
+          GRN_FMT_SIZE,
+          n_bytes);
+      return ctx->rc;
+    }
+    builder->points = points;
+    builder->points_size = points_size;
+  }
+  for (i = 0; i < worker_builder->n_points; i++) {
+    grn_ii_builder_seek_point *point = &builder->points[n_points + i];
+    *point = worker_builder->points[i];
+    point->block_id += n_blocks;
+  }
+  builder->n_points += worker_builder->n_points;
+  return GRN_SUCCESS;
+}
+
+/* grn_ii_builder_append_srcs_worker is the body of a tokenizer worker. */
+static grn_thread_func_result CALLBACK
+grn_ii_builder_append_srcs_worker(void *arg)
+{
+  grn_ii_builder_worker *worker = (grn_ii_builder_worker *)arg;
+  grn_ii_builder_append_srcs(&worker->ctx, &worker->builder);
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+/*
+ * grn_ii_builder_append_srcs_parallel splits records into n_workers ranges in
+ * the ID order and appends values in the ranges in parallel. Each worker has
+ * its own block lexicon and temporary file, and the workers share the memory
+ * budget given by block_threshold.
+ */
+static grn_rc
+grn_ii_builder_append_srcs_parallel(grn_ctx *ctx, grn_ii_builder *builder,
+                                    uint32_t n_workers)
+{
+  uint32_t i, n_inited = 0;
+  uint64_t n_records = grn_table_size(ctx, builder->src_table);
+  grn_critical_section lock;
+  grn_ii_builder_worker *workers;
+
+  workers = GRN_MALLOCN(grn_ii_builder_worker, n_workers);
+  if (!workers) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "failed to allocate memory for workers: n_workers = %u", n_workers);
+    return ctx->rc;
+  }
+  CRITICAL_SECTION_INIT(lock);
+  for (i = 0; i < n_workers; i++) {
+    grn_ii_builder_worker *worker = &workers[i];
+    grn_ii_builder_options *options = &worker->builder.options;
+    uint64_t offset = n_records * i / n_workers;
+    uint64_t next_offset = n_records * (i + 1) / n_workers;
+    if (grn_ii_builder_worker_init(ctx, worker, builder,
+                                   &lock) != GRN_SUCCESS) {
+      break;
+    }
+    n_inited++;
+    worker->builder.src_offset = (int)offset;
+    worker->builder.src_limit = (int)(next_offset - offset);
+    options->block_threshold /= n_workers;
+    if (options->block_threshold < GRN_II_BUILDER_MIN_BLOCK_THRESHOLD) {
+      options->block_threshold = GRN_II_BUILDER_MIN_BLOCK_THRESHOLD;
+    }
+  }
+  if (ctx->rc == GRN_SUCCESS) {
+    grn_ii_builder_run_workers(ctx, workers, n_workers,
+                               grn_ii_builder_append_srcs_worker);
+  }
+  for (i = 0; i < n_inited; i++) {
+    if (ctx->rc == GRN_SUCCESS) {
+      grn_ii_builder_take_over_blocks(ctx, builder, &workers[i].builder);
+    }
+    grn_ii_builder_worker_fin(&workers[i]);
+  }
+  CRITICAL_SECTION_FIN(lock);
+  GRN_FREE(workers);
+  return ctx->rc;
+}
+
 /* grn_ii_builder_append_source appends values in source columns. */
 static grn_rc
 grn_ii_builder_append_source(grn_ctx *ctx, grn_ii_builder *builder)
 {
+  uint32_t n_workers, n_records;
   grn_rc rc = grn_ii_builder_set_src_table(ctx, builder);
   if (rc != GRN_SUCCESS) {
     return rc;
@@ -10331,7 +11950,16 @@ grn_ii_builder_append_source(grn_ctx *ctx, grn_ii_builder *builder)
   if (rc != GRN_SUCCESS) {
     return rc;
   }
-  rc = grn_ii_builder_append_srcs(ctx, builder);
+  n_workers = builder->options.n_workers;
+  n_records = grn_table_size(ctx, builder->src_table);
+  if (n_workers > n_records) {
+    n_workers = n_records;
+  }
+  if (n_workers > 1) {
+    rc = grn_ii_builder_append_srcs_parallel(ctx, builder, n_workers);
+  } else {
+    rc = grn_ii_builder_append_srcs(ctx, builder);
+  }
   if (rc != GRN_SUCCESS) {
     return rc;
   }
@@ -10373,7 +12001,7 @@ grn_ii_builder_fill_block(grn_ctx *ctx, grn_ii_builder *builder,
   block->end = block->buf + buf_rest;
 
   /* Read the next data. */
-  file_offset = grn_lseek(builder->fd, block->offset, SEEK_SET);
+  file_offset = grn_lseek(block->fd, block->offset, SEEK_SET);
   if (file_offset != block->offset) {
     SERR("failed to seek file: expected = %" GRN_FMT_INT64U
          ", actual = %" GRN_FMT_INT64D,
@@ -10384,7 +12012,7 @@ grn_ii_builder_fill_block(grn_ctx *ctx, grn_ii_builder *builder,
   if (block->rest < buf_rest) {
     buf_rest = block->rest;
   }
-  size = grn_read(builder->fd, block->end, buf_rest);
+  size = grn_read(block->fd, block->end, buf_rest);
   if (size <= 0) {
     SERR("failed to read data: expected = %u, actual = %" GRN_FMT_INT64D,
          buf_rest, (int64_t)size);
@@ -10421,7 +12049,7 @@ grn_ii_builder_pack_chunk(grn_ctx *ctx, grn_ii_builder *builder,
                           grn_bool *packed)
 {
   grn_id rid;
-  uint32_t sid, pos, *a;
+  uint32_t sid = 0, pos, *a;
   grn_ii_builder_chunk *chunk = &builder->chunk;
   *packed = GRN_FALSE;
   if (chunk->offset != 1) { /* df != 1 */
@@ -10442,18 +12070,29 @@ grn_ii_builder_pack_chunk(grn_ctx *ctx, grn_ii_builder *builder,
     if (sid >= 0x800) {
       return GRN_SUCCESS;
     }
-    a = array_get(ctx, builder->ii, chunk->tid);
-    a[0] = ((rid << 12) + (sid << 1)) | 1;
-  } else {
-    a = array_get(ctx, builder->ii, chunk->tid);
-    a[0] = (rid << 1) | 1;
   }
   pos = 0;
   if (chunk->pos_buf) {
     pos = chunk->pos_buf[0];
   }
+  grn_ii_builder_lock(ctx, builder);
+  a = array_get(ctx, builder->ii, chunk->tid);
+  if (!a) {
+    grn_ii_builder_unlock(ctx, builder);
+    if (ctx->rc == GRN_SUCCESS) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "failed to access array: tid = %u", chunk->tid);
+    }
+    return ctx->rc;
+  }
+  if (chunk->sid_buf) {
+    a[0] = ((rid << 12) + (sid << 1)) | 1;
+  } else {
+    a[0] = (rid << 1) | 1;
+  }
   a[1] = pos;
   array_unref(builder->ii, chunk->tid);
+  grn_ii_builder_unlock(ctx, builder);
   *packed = GRN_TRUE;
 
   grn_ii_builder_chunk_clear(ctx, chunk);
@@ -10482,21 +12121,20 @@ grn_ii_builder_get_cinfo(grn_ctx *ctx, grn_ii_builder *builder,
   return GRN_SUCCESS;
 }
 
-/* grn_ii_builder_flush_chunk flushes a chunk. */
+/*
+ * grn_ii_builder_write_chunk writes an encoded chunk to a new chunk. Note that
+ * this function must be called with grn_ii_builder_lock.
+ */
 static grn_rc
-grn_ii_builder_flush_chunk(grn_ctx *ctx, grn_ii_builder *builder)
+grn_ii_builder_write_chunk(grn_ctx *ctx, grn_ii_builder *builder,
+                           uint32_t *chunk_id_out)
 {
   grn_rc rc;
-  chunk_info *cinfo = NULL;
   grn_ii_builder_chunk *chunk = &builder->chunk;
   void *seg;
   uint8_t *in;
   uint32_t in_size, chunk_id, seg_id, seg_offset, seg_rest;
 
-  rc = grn_ii_builder_chunk_encode(ctx, chunk, NULL, 0);
-  if (rc != GRN_SUCCESS) {
-    return rc;
-  }
   in = chunk->enc_buf;
   in_size = chunk->enc_offset;
 
@@ -10552,6 +12190,33 @@ grn_ii_builder_flush_chunk(grn_ctx *ctx, grn_ii_builder *builder)
     GRN_IO_SEG_UNREF(builder->ii->chunk, seg_id);
   }
 
+  builder->ii->header->total_chunk_size += chunk->enc_offset;
+  *chunk_id_out = chunk_id;
+  return GRN_SUCCESS;
+}
+
+/* grn_ii_builder_flush_chunk flushes a chunk. */
+static grn_rc
+grn_ii_builder_flush_chunk(grn_ctx *ctx, grn_ii_builder *builder)
+{
+  grn_rc rc;
+  chunk_info *cinfo = NULL;
+  grn_ii_builder_chunk *chunk = &builder->chunk;
+  uint32_t chunk_id = 0;
+
+  rc = grn_ii_builder_chunk_encode(ctx, chunk, NULL, 0,
+                                   builder->ii->header->flags);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+
+  grn_ii_builder_lock(ctx, builder);
+  rc = grn_ii_builder_write_chunk(ctx, builder, &chunk_id);
+  grn_ii_builder_unlock(ctx, builder);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+
   /* Append a cinfo. */
   rc = grn_ii_builder_get_cinfo(ctx, builder, &cinfo);
   if (rc != GRN_SUCCESS) {
@@ -10560,8 +12225,9 @@ grn_ii_builder_flush_chunk(grn_ctx *ctx, grn_ii_builder *builder)
   cinfo->segno = chunk_id;
   cinfo->size = chunk->enc_offset;
   cinfo->dgap = chunk->rid_gap;
+  cinfo->max_score = chunk_max_score(chunk->rid_buf, chunk->freq_buf,
+                                     chunk->weight_buf, chunk->offset);
 
-  builder->buf.ii->header->total_chunk_size += chunk->enc_offset;
   grn_ii_builder_chunk_clear(ctx, chunk);
   return GRN_SUCCESS;
 }
@@ -10684,20 +12350,17 @@ grn_ii_builder_read_to_chunk(grn_ctx *ctx, grn_ii_builder *builder,
   return GRN_SUCCESS;
 }
 
-/* grn_ii_builder_register_chunks registers chunks. */
+/*
+ * grn_ii_builder_put_chunks puts an encoded chunk into a buffer. Note that
+ * this function must be called with grn_ii_builder_lock.
+ */
 static grn_rc
-grn_ii_builder_register_chunks(grn_ctx *ctx, grn_ii_builder *builder)
+grn_ii_builder_put_chunks(grn_ctx *ctx, grn_ii_builder *builder)
 {
   grn_rc rc;
   uint32_t buf_tid, *a;
   buffer_term *buf_term;
 
-  rc = grn_ii_builder_chunk_encode(ctx, &builder->chunk, builder->cinfos,
-                                   builder->n_cinfos);
-  if (rc != GRN_SUCCESS) {
-    return rc;
-  }
-
   if (!grn_ii_builder_buffer_is_assigned(ctx, &builder->buf)) {
     rc = grn_ii_builder_buffer_assign(ctx, &builder->buf);
     if (rc != GRN_SUCCESS) {
@@ -10733,77 +12396,460 @@ grn_ii_builder_register_chunks(grn_ctx *ctx, grn_ii_builder *builder)
   builder->buf.chunk_offset += builder->chunk.enc_offset;
 
   a = array_get(ctx, builder->ii, builder->chunk.tid);
+  if (!a) {
+    if (ctx->rc == GRN_SUCCESS) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "failed to access array: tid = %u", builder->chunk.tid);
+    }
+    return ctx->rc;
+  }
   a[0] = SEG2POS(builder->buf.buf_id,
                  sizeof(buffer_header) + buf_tid * sizeof(buffer_term));
   a[1] = builder->df;
   array_unref(builder->ii, builder->chunk.tid);
 
   builder->buf.buf->header.nterms++;
+  return GRN_SUCCESS;
+}
+
+/* grn_ii_builder_register_chunks registers chunks. */
+static grn_rc
+grn_ii_builder_register_chunks(grn_ctx *ctx, grn_ii_builder *builder)
+{
+  grn_rc rc;
+
+  rc = grn_ii_builder_chunk_encode(ctx, &builder->chunk, builder->cinfos,
+                                   builder->n_cinfos,
+                                   builder->ii->header->flags);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+
+  grn_ii_builder_lock(ctx, builder);
+  rc = grn_ii_builder_put_chunks(ctx, builder);
+  grn_ii_builder_unlock(ctx, builder);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+
   builder->n_cinfos = 0;
   grn_ii_builder_chunk_clear(ctx, &builder->chunk);
   return GRN_SUCCESS;
 }
 
+/*
+ * grn_ii_builder_merge_term merges postings of a term in blocks and registers
+ * the merged postings.
+ */
 static grn_rc
-grn_ii_builder_commit(grn_ctx *ctx, grn_ii_builder *builder)
+grn_ii_builder_merge_term(grn_ctx *ctx, grn_ii_builder *builder, grn_id tid)
 {
   uint32_t i;
   grn_rc rc;
-  grn_table_cursor *cursor;
-
+  builder->chunk.tid = tid;
+  builder->chunk.rid = GRN_ID_NIL;
+  builder->df = 0;
   for (i = 0; i < builder->n_blocks; i++) {
-    uint64_t value;
-    rc = grn_ii_builder_read_from_block(ctx, builder, i, &value);
+    if (tid == builder->blocks[i].tid) {
+      rc = grn_ii_builder_read_to_chunk(ctx, builder, i);
+      if (rc != GRN_SUCCESS) {
+        return rc;
+      }
+    }
+  }
+  if (!builder->chunk.n) {
+    /* This term does not appear. */
+    return GRN_SUCCESS;
+  }
+  if (!builder->n_cinfos) {
+    grn_bool packed;
+    rc = grn_ii_builder_pack_chunk(ctx, builder, &packed);
     if (rc != GRN_SUCCESS) {
       return rc;
     }
-    builder->blocks[i].tid = value;
+    if (packed) {
+      return GRN_SUCCESS;
+    }
   }
+  return grn_ii_builder_register_chunks(ctx, builder);
+}
 
-  cursor = grn_table_cursor_open(ctx, builder->ii->lexicon,
-                                 NULL, 0, NULL, 0, 0, -1, GRN_CURSOR_BY_KEY);
+/* grn_ii_builder_flush_buffer flushes the last buffer if assigned. */
+static grn_rc
+grn_ii_builder_flush_buffer(grn_ctx *ctx, grn_ii_builder *builder)
+{
+  grn_rc rc = GRN_SUCCESS;
+  if (grn_ii_builder_buffer_is_assigned(ctx, &builder->buf)) {
+    grn_ii_builder_lock(ctx, builder);
+    rc = grn_ii_builder_buffer_flush(ctx, &builder->buf);
+    grn_ii_builder_unlock(ctx, builder);
+  }
+  return rc;
+}
+
+/* grn_ii_builder_skip_term skips the current term in a block. */
+static grn_rc
+grn_ii_builder_skip_term(grn_ctx *ctx, grn_ii_builder *builder,
+                         uint32_t block_id)
+{
+  grn_rc rc;
+  uint64_t value;
+  uint32_t ii_flags = builder->ii->header->flags;
   for (;;) {
-    grn_id tid = grn_table_cursor_next(ctx, cursor);
-    if (tid == GRN_ID_NIL) {
+    rc = grn_ii_builder_read_from_block(ctx, builder, block_id, &value);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+    if (!value) {
       break;
     }
-    builder->chunk.tid = tid;
-    builder->chunk.rid = GRN_ID_NIL;
-    builder->df = 0;
-    for (i = 0; i < builder->n_blocks; i++) {
-      if (tid == builder->blocks[i].tid) {
-        rc = grn_ii_builder_read_to_chunk(ctx, builder, i);
+    if (ii_flags & GRN_OBJ_WITH_WEIGHT) {
+      rc = grn_ii_builder_read_from_block(ctx, builder, block_id, &value);
+      if (rc != GRN_SUCCESS) {
+        return rc;
+      }
+    }
+    if (ii_flags & GRN_OBJ_WITH_POSITION) {
+      do {
+        rc = grn_ii_builder_read_from_block(ctx, builder, block_id, &value);
         if (rc != GRN_SUCCESS) {
           return rc;
         }
-      }
-    }
-    if (!builder->chunk.n) {
-      /* This term does not appear. */
-      continue;
-    }
-    if (!builder->n_cinfos) {
-      grn_bool packed;
-      rc = grn_ii_builder_pack_chunk(ctx, builder, &packed);
+      } while (value);
+    } else {
+      rc = grn_ii_builder_read_from_block(ctx, builder, block_id, &value);
       if (rc != GRN_SUCCESS) {
         return rc;
       }
-      if (packed) {
-        continue;
+    }
+  }
+  rc = grn_ii_builder_read_from_block(ctx, builder, block_id, &value);
+  if (rc == GRN_SUCCESS) {
+    builder->blocks[block_id].tid = value;
+  } else if (rc == GRN_END_OF_DATA) {
+    builder->blocks[block_id].tid = GRN_ID_NIL;
+  } else {
+    return rc;
+  }
+  return GRN_SUCCESS;
+}
+
+/*
+ * grn_ii_builder_seek_block moves a block to the first term whose rank is
+ * min_rank or more. points must be the seek points of the block.
+ */
+static grn_rc
+grn_ii_builder_seek_block(grn_ctx *ctx, grn_ii_builder *builder,
+                          uint32_t block_id,
+                          const grn_ii_builder_seek_point *points,
+                          uint32_t n_points, const uint32_t *ranks,
+                          uint32_t min_rank)
+{
+  grn_rc rc;
+  uint64_t value;
+  uint32_t left = 0, right = n_points;
+  grn_ii_builder_block *block = &builder->blocks[block_id];
+
+  /* Find the last seek point whose rank is min_rank or less. */
+  while (left < right) {
+    uint32_t mid = left + (right - left) / 2;
+    if (ranks[points[mid].tid] <= min_rank) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  if (left) {
+    uint64_t end = block->offset + block->rest;
+    block->offset = points[left - 1].offset;
+    block->rest = (uint32_t)(end - block->offset);
+  }
+
+  rc = grn_ii_builder_read_from_block(ctx, builder, block_id, &value);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+  block->tid = value;
+  while (block->tid != GRN_ID_NIL && ranks[block->tid] < min_rank) {
+    rc = grn_ii_builder_skip_term(ctx, builder, block_id);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+  }
+  return GRN_SUCCESS;
+}
+
+/*
+ * grn_ii_builder_worker_open_blocks opens parent's temporary files and copies
+ * parent's blocks for a merger worker. Files are opened again because workers
+ * read the same file at different offsets.
+ */
+static grn_rc
+grn_ii_builder_worker_open_blocks(grn_ii_builder_worker *worker)
+{
+  uint32_t i, j;
+  grn_ctx *ctx = &worker->ctx;
+  grn_ii_builder *parent = worker->parent;
+  grn_ii_builder *builder = &worker->builder;
+
+  worker->fds = GRN_MALLOCN(int, parent->n_files);
+  if (!worker->fds) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "failed to allocate memory for files: n_files = %u", parent->n_files);
+    return ctx->rc;
+  }
+  for (i = 0; i < parent->n_files; i++) {
+    worker->fds[i] = -1;
+  }
+  for (i = 0; i < parent->n_files; i++) {
+    grn_open(worker->fds[i], parent->files[i].path,
+             O_RDONLY | GRN_OPEN_FLAG_BINARY);
+    if (worker->fds[i] == -1) {
+      SERR("failed to open a temporary file: path = \"%.*s\"",
+           GRN_II_BUILDER_PATH_MESSAGE_SIZE, parent->files[i].path);
+      return ctx->rc;
+    }
+  }
+
+  builder->blocks = GRN_MALLOCN(grn_ii_builder_block, parent->n_blocks);
+  if (!builder->blocks) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "failed to allocate memory for blocks: n_blocks = %u",
+        parent->n_blocks);
+    return ctx->rc;
+  }
+  builder->blocks_size = parent->n_blocks;
+  for (i = 0; i < parent->n_blocks; i++) {
+    grn_ii_builder_block *block = &builder->blocks[i];
+    grn_ii_builder_block_init(ctx, block);
+    block->offset = parent->blocks[i].offset;
+    block->rest = parent->blocks[i].rest;
+    for (j = 0; j < parent->n_files; j++) {
+      if (parent->files[j].fd == parent->blocks[i].fd) {
+        block->fd = worker->fds[j];
+        break;
       }
     }
-    rc = grn_ii_builder_register_chunks(ctx, builder);
+    builder->n_blocks++;
+  }
+  return GRN_SUCCESS;
+}
+
+/*
+ * grn_ii_builder_merge_worker is the body of a merger worker. It merges terms
+ * in [min_rank, max_rank) and flushes its own buffer.
+ */
+static grn_thread_func_result CALLBACK
+grn_ii_builder_merge_worker(void *arg)
+{
+  grn_ii_builder_worker *worker = (grn_ii_builder_worker *)arg;
+  grn_ctx *ctx = &worker->ctx;
+  grn_ii_builder *builder = &worker->builder;
+  grn_ii_builder *parent = worker->parent;
+  grn_rc rc = GRN_SUCCESS;
+  uint32_t i, rank, point_id = 0;
+
+  if (worker->min_rank >= worker->max_rank) {
+    return GRN_THREAD_FUNC_RETURN_VALUE;
+  }
+  for (i = 0; i < builder->n_blocks && rc == GRN_SUCCESS; i++) {
+    uint32_t first_point_id = point_id;
+    while (point_id < parent->n_points &&
+           parent->points[point_id].block_id == i) {
+      point_id++;
+    }
+    rc = grn_ii_builder_seek_block(ctx, builder, i,
+                                   parent->points + first_point_id,
+                                   point_id - first_point_id,
+                                   worker->ranks, worker->min_rank);
+  }
+  for (rank = worker->min_rank;
+       rank < worker->max_rank && rc == GRN_SUCCESS;
+       rank++) {
+    rc = grn_ii_builder_merge_term(ctx, builder, worker->tids[rank]);
+  }
+  if (rc == GRN_SUCCESS) {
+    grn_ii_builder_flush_buffer(ctx, builder);
+  }
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+/*
+ * grn_ii_builder_commit_parallel splits the lexicon into n_workers key ranges
+ * that have about the same amount of postings, which is estimated from seek
+ * points, and merges blocks in the ranges in parallel.
+ */
+static grn_rc
+grn_ii_builder_commit_parallel(grn_ctx *ctx, grn_ii_builder *builder)
+{
+  uint32_t i, n_inited = 0, n_workers = builder->options.n_workers;
+  uint32_t n_terms = 0, max_n_terms, rank;
+  grn_id tid, max_tid = GRN_ID_NIL;
+  grn_id *tids = NULL;
+  uint32_t *ranks = NULL, *bounds = NULL;
+  uint64_t *sizes = NULL, total_size = 0, size;
+  grn_table_cursor *cursor;
+  grn_critical_section lock;
+  grn_ii_builder_worker *workers = NULL;
+
+  if (builder->fd != -1) {
+    /* Blocks are written by this builder. */
+    if (grn_ii_builder_add_file(ctx, builder,
+                                builder->path, builder->fd) != GRN_SUCCESS) {
+      return ctx->rc;
+    }
+    builder->fd = -1;
+  }
+
+  /* Sort terms in key order. */
+  max_n_terms = grn_table_size(ctx, builder->ii->lexicon);
+  tids = GRN_MALLOCN(grn_id, max_n_terms + 1);
+  if (!tids) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "failed to allocate memory for terms: n_terms = %u", max_n_terms);
+    goto exit;
+  }
+  cursor = grn_table_cursor_open(ctx, builder->ii->lexicon,
+                                 NULL, 0, NULL, 0, 0, -1, GRN_CURSOR_BY_KEY);
+  if (!cursor) {
+    if (ctx->rc == GRN_SUCCESS) {
+      ERR(GRN_OBJECT_CORRUPT, "[index] failed to open lexicon cursor");
+    }
+    goto exit;
+  }
+  while (n_terms < max_n_terms &&
+         (tid = grn_table_cursor_next(ctx, cursor)) != GRN_ID_NIL) {
+    tids[n_terms++] = tid;
+    if (tid > max_tid) {
+      max_tid = tid;
+    }
+  }
+  grn_table_cursor_close(ctx, cursor);
+  ranks = (uint32_t *)GRN_CALLOC((max_tid + 1) * sizeof(uint32_t));
+  sizes = (uint64_t *)GRN_CALLOC((n_terms + 1) * sizeof(uint64_t));
+  bounds = GRN_MALLOCN(uint32_t, n_workers + 1);
+  if (!ranks || !sizes || !bounds) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "failed to allocate memory for ranks: n_terms = %u", n_terms);
+    goto exit;
+  }
+  for (rank = 0; rank < n_terms; rank++) {
+    ranks[tids[rank]] = rank;
+  }
+
+  /* Estimate sizes of terms by distances between seek points. */
+  for (i = 0; i < builder->n_points; i++) {
+    grn_ii_builder_seek_point *point = &builder->points[i];
+    grn_ii_builder_block *block = &builder->blocks[point->block_id];
+    uint64_t end = block->offset + block->rest;
+    if (i + 1 < builder->n_points &&
+        builder->points[i + 1].block_id == point->block_id) {
+      end = builder->points[i + 1].offset;
+    }
+    size = end - point->offset;
+    sizes[ranks[point->tid]] += size;
+    total_size += size;
+  }
+
+  /* Split ranks into ranges of about the same size. */
+  bounds[0] = 0;
+  rank = 0;
+  size = 0;
+  for (i = 1; i < n_workers; i++) {
+    uint64_t target_size = total_size * i / n_workers;
+    while (rank < n_terms && size < target_size) {
+      size += sizes[rank++];
+    }
+    bounds[i] = rank;
+  }
+  bounds[n_workers] = n_terms;
+
+  workers = GRN_MALLOCN(grn_ii_builder_worker, n_workers);
+  if (!workers) {
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "failed to allocate memory for workers: n_workers = %u", n_workers);
+    goto exit;
+  }
+  CRITICAL_SECTION_INIT(lock);
+  for (i = 0; i < n_workers; i++) {
+    grn_ii_builder_worker *worker = &workers[i];
+    if (grn_ii_builder_worker_init(ctx, worker, builder,
+                                   &lock) != GRN_SUCCESS) {
+      break;
+    }
+    n_inited++;
+    worker->tids = tids;
+    worker->ranks = ranks;
+    worker->min_rank = bounds[i];
+    worker->max_rank = bounds[i + 1];
+    if (grn_ii_builder_worker_open_blocks(worker) != GRN_SUCCESS) {
+      grn_ii_builder_worker_report(ctx, worker);
+      break;
+    }
+  }
+  if (ctx->rc == GRN_SUCCESS) {
+    grn_ii_builder_run_workers(ctx, workers, n_workers,
+                               grn_ii_builder_merge_worker);
+  }
+  for (i = 0; i < n_inited; i++) {
+    grn_ii_builder_worker_fin(&workers[i]);
+  }
+  CRITICAL_SECTION_FIN(lock);
+
+exit :
+  if (workers) {
+    GRN_FREE(workers);
+  }
+  if (bounds) {
+    GRN_FREE(bounds);
+  }
+  if (sizes) {
+    GRN_FREE(sizes);
+  }
+  if (ranks) {
+    GRN_FREE(ranks);
+  }
+  if (tids) {
+    GRN_FREE(tids);
+  }
+  return ctx->rc;
+}
+
+static grn_rc
+grn_ii_builder_commit(grn_ctx *ctx, grn_ii_builder *builder)
+{
+  uint32_t i;
+  grn_rc rc;
+  grn_table_cursor *cursor;
+
+  if (builder->options.n_workers > 1 && builder->n_points) {
+    return grn_ii_builder_commit_parallel(ctx, builder);
+  }
+
+  for (i = 0; i < builder->n_blocks; i++) {
+    uint64_t value;
+    rc = grn_ii_builder_read_from_block(ctx, builder, i, &value);
     if (rc != GRN_SUCCESS) {
       return rc;
     }
+    builder->blocks[i].tid = value;
   }
-  if (grn_ii_builder_buffer_is_assigned(ctx, &builder->buf)) {
-    rc = grn_ii_builder_buffer_flush(ctx, &builder->buf);
+
+  cursor = grn_table_cursor_open(ctx, builder->ii->lexicon,
+                                 NULL, 0, NULL, 0, 0, -1, GRN_CURSOR_BY_KEY);
+  for (;;) {
+    grn_id tid = grn_table_cursor_next(ctx, cursor);
+    if (tid == GRN_ID_NIL) {
+      break;
+    }
+    rc = grn_ii_builder_merge_term(ctx, builder, tid);
     if (rc != GRN_SUCCESS) {
+      grn_table_cursor_close(ctx, cursor);
       return rc;
     }
   }
-  return GRN_SUCCESS;
+  grn_table_cursor_close(ctx, cursor);
+  return grn_ii_builder_flush_buffer(ctx, builder);
 }
 
 grn_rc
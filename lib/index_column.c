@@ -141,7 +141,8 @@ grn_index_column_build(grn_ctx *ctx, grn_obj *index_column)
           }
         }
         if (use_grn_ii_build) {
-          if (grn_index_chunk_split_enable) {
+          if (grn_index_chunk_split_enable ||
+              grn_ctx_get_n_workers(ctx) > 1) {
             grn_ii_build2(ctx, ii, NULL);
           } else {
             grn_ii_build(ctx, ii, grn_index_sparsity);
@@ -34,6 +34,12 @@
 # include <share.h>
 #endif /* WIN32 */
 
+#if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H)
+# define GRN_IO_LOCK_USE_FUTEX
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif /* defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H) */
+
 #define GRN_IO_IDSTR "GROONGA:IO:00001"
 #define GRN_IO_IDSTR_LEN (sizeof(GRN_IO_IDSTR) - 1)
 
@@ -225,6 +231,7 @@ grn_io_create_tmp(grn_ctx *ctx, uint32_t header_size, uint32_t segment_size,
         io->count = 0;
         io->flags = GRN_IO_TEMPORARY;
         io->lock = &header->lock;
+        memset(&(io->lock_stats), 0, sizeof(grn_io_lock_stats));
         io->path[0] = '\0';
         return io;
       }
@@ -329,6 +336,7 @@ grn_io_create(grn_ctx *ctx, const char *path, uint32_t header_size,
             io->count = 0;
             io->flags = flags;
             io->lock = &header->lock;
+            memset(&(io->lock_stats), 0, sizeof(grn_io_lock_stats));
             grn_io_register(ctx, io);
             return io;
           }
@@ -648,6 +656,7 @@ grn_io_open(grn_ctx *ctx, const char *path, grn_io_mode mode)
             io->count = 0;
             io->flags = header->flags;
             io->lock = &header->lock;
+            memset(&(io->lock_stats), 0, sizeof(grn_io_lock_stats));
             if (!array_init(ctx, io, io->header->n_arrays)) {
               grn_io_register(ctx, io);
               return io;
@@ -1314,65 +1323,240 @@ grn_io_anon_unmap(grn_ctx *ctx, grn_io_mapinfo *mi, size_t length)
   GRN_MUNMAP(ctx, ctx, NULL, &mi->fmo, NULL, mi->map, length);
 }
 
+/*
+ * The lock word in the header is shared by all processes that map the
+ * file. The lowest bit is set while the lock is acquired and the other
+ * bits are the number of waiters. 0 means that nobody uses the lock.
+ *
+ * grn_io_lock() spins for a while at first because the lock is held
+ * only for a short time in most cases. Then it sleeps on the lock word
+ * by futex on Linux until grn_io_unlock() wakes it up. New lockers stop
+ * spinning while there are waiters, but the lock isn't fair: any waiter
+ * or new locker that sees the released lock first takes it.
+ *
+ * A process that is killed while it waits leaves its count in the lock
+ * word. grn_io_clear_lock() and grn_io_clear_waiters() reset it.
+ */
+#define GRN_IO_LOCK_LOCKED 1
+#define GRN_IO_LOCK_WAITER 2
+#define GRN_IO_LOCK_N_SPINS 128
+
+/* It returns when the lock word isn't value or timeout is elapsed. */
+static void
+grn_io_lock_wait(uint32_t *lock, uint32_t value, int64_t timeout)
+{
+#ifdef GRN_IO_LOCK_USE_FUTEX
+  struct timespec timeout_spec;
+  struct timespec *timeout_spec_p = NULL;
+
+  if (timeout >= 0) {
+    timeout_spec.tv_sec = timeout / GRN_TIME_NSEC_PER_SEC;
+    timeout_spec.tv_nsec = timeout % GRN_TIME_NSEC_PER_SEC;
+    timeout_spec_p = &timeout_spec;
+  }
+  /* The lock may be shared with other processes. So it isn't
+     FUTEX_WAIT_PRIVATE. */
+  syscall(SYS_futex, lock, FUTEX_WAIT, value, timeout_spec_p, NULL, 0);
+#else /* GRN_IO_LOCK_USE_FUTEX */
+  if (timeout < 0 || timeout > GRN_LOCK_WAIT_TIME_NANOSECOND) {
+    timeout = GRN_LOCK_WAIT_TIME_NANOSECOND;
+  }
+  grn_nanosleep(timeout);
+#endif /* GRN_IO_LOCK_USE_FUTEX */
+}
+
+static void
+grn_io_lock_wake(uint32_t *lock)
+{
+#ifdef GRN_IO_LOCK_USE_FUTEX
+  syscall(SYS_futex, lock, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif /* GRN_IO_LOCK_USE_FUTEX */
+}
+
+static grn_bool
+grn_io_lock_try(uint32_t *lock, uint32_t value, uint32_t new_value)
+{
+  uint32_t current_value;
+  GRN_ATOMIC_CAS_EX(lock, value, new_value, current_value);
+  return current_value == value;
+}
+
+static int64_t
+grn_io_lock_elapsed_time(grn_ctx *ctx, grn_timeval *start_time)
+{
+  grn_timeval now;
+  grn_timeval_now(ctx, &now);
+  return
+    (now.tv_sec - start_time->tv_sec) * GRN_TIME_NSEC_PER_SEC +
+    (now.tv_nsec - start_time->tv_nsec);
+}
+
+static void
+grn_io_lock_unregister_waiter(uint32_t *lock)
+{
+  uint32_t value;
+
+  for (;;) {
+    value = *lock;
+    if (value < GRN_IO_LOCK_WAITER) {
+      /* grn_io_clear_lock() cleared waiters. */
+      return;
+    }
+    if (grn_io_lock_try(lock, value, value - GRN_IO_LOCK_WAITER)) {
+      break;
+    }
+  }
+  value -= GRN_IO_LOCK_WAITER;
+  /* Passes the wake up that may be sent to this waiter. */
+  if (!(value & GRN_IO_LOCK_LOCKED) && value >= GRN_IO_LOCK_WAITER) {
+    grn_io_lock_wake(lock);
+  }
+}
+
 grn_rc
 grn_io_lock(grn_ctx *ctx, grn_io *io, int timeout)
 {
-  static int _ncalls = 0, _ncolls = 0;
-  uint32_t count, count_log_border = 1000;
-  _ncalls++;
+  uint32_t *lock;
+  uint32_t value;
+  int64_t timeout_nsec = -1;
+  grn_timeval start_time;
+  int i;
+
   if (!io) { return GRN_INVALID_ARGUMENT; }
-  for (count = 0;; count++) {
-    uint32_t lock;
-    GRN_ATOMIC_ADD_EX(io->lock, 1, lock);
-    if (lock) {
-      GRN_ATOMIC_ADD_EX(io->lock, -1, lock);
-      if (count == count_log_border) {
-        GRN_LOG(ctx, GRN_LOG_NOTICE,
-                "io(%s) collisions(%d/%d): lock failed %d times",
-                io->path, _ncolls, _ncalls, count_log_border);
-      }
-      if (!timeout || (timeout > 0 && timeout == count)) {
-        GRN_LOG(ctx, GRN_LOG_WARNING,
-                "[DB Locked] time out(%d): io(%s) collisions(%d/%d)",
-                timeout, io->path, _ncolls, _ncalls);
-        break;
+  lock = io->lock;
+
+  if (grn_io_lock_try(lock, 0, GRN_IO_LOCK_LOCKED)) {
+    io->lock_stats.n_acquisitions++;
+    return GRN_SUCCESS;
+  }
+  if (timeout == 0) {
+    GRN_LOG(ctx, GRN_LOG_WARNING,
+            "[DB Locked] time out(%d): io(%s)", timeout, io->path);
+    ERR(GRN_RESOURCE_DEADLOCK_AVOIDED, "grn_io_lock failed");
+    return ctx->rc;
+  }
+
+  grn_timeval_now(ctx, &start_time);
+  if (timeout > 0) {
+    timeout_nsec = (int64_t)timeout * GRN_LOCK_WAIT_TIME_NANOSECOND;
+  }
+
+  for (i = 0; i < GRN_IO_LOCK_N_SPINS; i++) {
+    value = *lock;
+    if (value >= GRN_IO_LOCK_WAITER) {
+      break;
+    }
+    if (value == 0 && grn_io_lock_try(lock, 0, GRN_IO_LOCK_LOCKED)) {
+      goto exit;
+    }
+  }
+
+  GRN_ATOMIC_ADD_EX(lock, GRN_IO_LOCK_WAITER, value);
+  for (;;) {
+    int64_t remaining_time = -1;
+    value = *lock;
+    if (!(value & GRN_IO_LOCK_LOCKED)) {
+      uint32_t new_value = value;
+      if (new_value >= GRN_IO_LOCK_WAITER) {
+        new_value -= GRN_IO_LOCK_WAITER;
       }
-      if (!(++_ncolls % 1000000) && (_ncolls > _ncalls)) {
-        if (_ncolls < 0 || _ncalls < 0) {
-          _ncolls = 0; _ncalls = 0;
-        } else {
-          GRN_LOG(ctx, GRN_LOG_NOTICE,
-                  "io(%s) collisions(%d/%d)", io->path, _ncolls, _ncalls);
-        }
+      if (grn_io_lock_try(lock, value, new_value | GRN_IO_LOCK_LOCKED)) {
+        goto exit;
       }
-      grn_nanosleep(GRN_LOCK_WAIT_TIME_NANOSECOND);
       continue;
     }
-    return GRN_SUCCESS;
+    if (timeout_nsec >= 0) {
+      remaining_time =
+        timeout_nsec - grn_io_lock_elapsed_time(ctx, &start_time);
+      if (remaining_time <= 0) {
+        break;
+      }
+    }
+    grn_io_lock_wait(lock, value, remaining_time);
   }
+
+  grn_io_lock_unregister_waiter(lock);
+  GRN_LOG(ctx, GRN_LOG_WARNING,
+          "[DB Locked] time out(%d): io(%s) "
+          "acquisitions(%" GRN_FMT_INT64U ") waits(%" GRN_FMT_INT64U ")",
+          timeout, io->path,
+          io->lock_stats.n_acquisitions,
+          io->lock_stats.n_waits);
   ERR(GRN_RESOURCE_DEADLOCK_AVOIDED, "grn_io_lock failed");
   return ctx->rc;
+
+exit :
+  io->lock_stats.n_acquisitions++;
+  io->lock_stats.n_waits++;
+  io->lock_stats.total_wait_time +=
+    grn_io_lock_elapsed_time(ctx, &start_time);
+  return GRN_SUCCESS;
 }
 
 void
 grn_io_unlock(grn_io *io)
 {
-  if (io) {
-    uint32_t lock;
-    GRN_ATOMIC_ADD_EX(io->lock, -1, lock);
+  uint32_t *lock;
+  uint32_t value;
+
+  if (!io) { return; }
+  lock = io->lock;
+  for (;;) {
+    value = *lock;
+    if (!(value & GRN_IO_LOCK_LOCKED)) {
+      /* grn_io_clear_lock() cleared the lock. */
+      return;
+    }
+    if (grn_io_lock_try(lock, value, value & ~GRN_IO_LOCK_LOCKED)) {
+      break;
+    }
+  }
+  if (value >= GRN_IO_LOCK_WAITER) {
+    grn_io_lock_wake(lock);
   }
 }
 
+/* grn_io_clear_lock releases the lock and resets the number of waiters. */
 void
 grn_io_clear_lock(grn_io *io)
 {
-  if (io) { *io->lock = 0; }
+  if (io) {
+    *io->lock = 0;
+#ifdef GRN_IO_LOCK_USE_FUTEX
+    /* Waiters retry to take the lock. */
+    syscall(SYS_futex, io->lock, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif /* GRN_IO_LOCK_USE_FUTEX */
+  }
+}
+
+/*
+ * grn_io_clear_waiters resets the number of waiters but keeps the lock
+ * bit. It must be called only when no process waits for the lock such
+ * as while recovering a database.
+ */
+void
+grn_io_clear_waiters(grn_io *io)
+{
+  uint32_t *lock;
+  uint32_t value;
+
+  if (!io) { return; }
+  lock = io->lock;
+  for (;;) {
+    value = *lock;
+    if (value < GRN_IO_LOCK_WAITER) {
+      return;
+    }
+    if (grn_io_lock_try(lock, value, value & GRN_IO_LOCK_LOCKED)) {
+      break;
+    }
+  }
 }
 
 uint32_t
 grn_io_is_locked(grn_io *io)
 {
-  return io ? *io->lock : 0;
+  return io ? (*io->lock & GRN_IO_LOCK_LOCKED) : 0;
 }
 
 grn_rc
@@ -639,6 +639,12 @@ grn_mrb_ctx_check(mrb_state *mrb)
                  "LZ4 error: <%s>(%d)",
                  ctx->errbuf, ctx->rc);
     break;
+  case GRN_ZSTD_ERROR:
+    error_class = mrb_class_get_under(mrb, module, "ZstdError");
+    grn_snprintf(message, MESSAGE_SIZE, MESSAGE_SIZE,
+                 "Zstandard error: <%s>(%d)",
+                 ctx->errbuf, ctx->rc);
+    break;
   case GRN_STACK_OVER_FLOW:
     error_class = mrb_class_get_under(mrb, module, "StackOverFlow");
     grn_snprintf(message, MESSAGE_SIZE, MESSAGE_SIZE,
@@ -194,5 +194,7 @@ grn_mrb_error_init(grn_ctx *ctx)
                          groonga_error_class);
   mrb_define_class_under(mrb, module, "Cancel",
                          groonga_error_class);
+  mrb_define_class_under(mrb, module, "ZstdError",
+                         groonga_error_class);
 }
 #endif
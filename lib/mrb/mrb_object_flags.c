@@ -67,11 +67,17 @@ grn_mrb_object_flags_init(grn_ctx *ctx)
   MRB_DEFINE_FLAG(COMPRESS_NONE);
   MRB_DEFINE_FLAG(COMPRESS_ZLIB);
   MRB_DEFINE_FLAG(COMPRESS_LZ4);
+  MRB_DEFINE_FLAG(COMPRESS_ZSTD);
+  MRB_DEFINE_FLAG(COMPRESS_BLOCK);
 
   MRB_DEFINE_FLAG(WITH_SECTION);
   MRB_DEFINE_FLAG(WITH_WEIGHT);
   MRB_DEFINE_FLAG(WITH_POSITION);
   MRB_DEFINE_FLAG(RING_BUFFER);
+  MRB_DEFINE_FLAG(WITH_ZONE_MAP);
+
+  MRB_DEFINE_FLAG(INDEX_SIMD_PACK);
+  MRB_DEFINE_FLAG(INDEX_BLOCK_MAX);
 
   MRB_DEFINE_FLAG(UNIT_MASK);
   MRB_DEFINE_FLAG(UNIT_DOCUMENT_NONE);
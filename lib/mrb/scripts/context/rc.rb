@@ -186,6 +186,8 @@ module Groonga
         register(:scorer_error, -76, ScorerError)
       CANCEL =
         register(:cancel, -77, Cancel)
+      ZSTD_ERROR =
+        register(:zstd_error, -78, ZstdError)
 
       GroongaError.rc = UNKNOWN_ERROR
     end
@@ -2080,7 +2080,7 @@ grn_pat_next(grn_ctx *ctx, grn_pat *pat, grn_id id)
   while (++id <= pat->header->curr_rec) {
     uint32_t key_size;
     const char *key = _grn_pat_key(ctx, pat, id, &key_size);
-    if (id == grn_pat_get(ctx, pat, key, key_size, NULL)) {
+    if (key && id == _grn_pat_get(ctx, pat, key, key_size, NULL)) {
       return id;
     }
   }
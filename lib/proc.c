@@ -73,6 +73,8 @@ grn_proc_init_from_env(void)
         atof(grn_in_values_too_many_index_match_ratio_env);
     }
   }
+
+  grn_proc_select_init_from_env();
 }
 
 /* bulk must be initialized grn_bulk or grn_msg */
@@ -152,9 +154,6 @@ proc_load(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
       strcpy(ctx->errbuf, ctx->impl->loader.errbuf);
     }
     GRN_OUTPUT_INT64(ctx->impl->loader.nrecords);
-    if (ctx->impl->loader.table) {
-      grn_db_touch(ctx, DB_OBJ(ctx->impl->loader.table)->db);
-    }
     grn_ctx_loader_clear(ctx);
   }
   return NULL;
@@ -166,11 +165,29 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   grn_timeval now;
   grn_cache *cache;
   grn_cache_statistics statistics;
+  grn_thread_worker_status *worker_statuses = NULL;
+  uint32_t n_workers;
+  uint32_t n_queued_jobs = 0;
 
   grn_timeval_now(ctx, &now);
   cache = grn_cache_current_get(ctx);
+  statistics.entries = NULL;
   grn_cache_get_statistics(ctx, cache, &statistics);
-  GRN_OUTPUT_MAP_OPEN("RESULT", 10);
+  n_workers = grn_thread_get_worker_statuses(NULL, 0);
+  if (n_workers > 0) {
+    worker_statuses =
+      GRN_MALLOC(sizeof(grn_thread_worker_status) * n_workers);
+    if (worker_statuses) {
+      uint32_t i;
+      n_workers = grn_thread_get_worker_statuses(worker_statuses, n_workers);
+      for (i = 0; i < n_workers; i++) {
+        n_queued_jobs += worker_statuses[i].n_queued_jobs;
+      }
+    } else {
+      n_workers = 0;
+    }
+  }
+  GRN_OUTPUT_MAP_OPEN("RESULT", 19);
   GRN_OUTPUT_CSTR("alloc_count");
   GRN_OUTPUT_INT32(grn_alloc_count());
   GRN_OUTPUT_CSTR("starttime");
@@ -191,6 +208,46 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
     cache_hit_rate = (double)statistics.nhits / (double)statistics.nfetches;
     GRN_OUTPUT_FLOAT(cache_hit_rate * 100.0);
   }
+  GRN_OUTPUT_CSTR("n_cache_entries");
+  GRN_OUTPUT_INT64(statistics.nentries);
+  GRN_OUTPUT_CSTR("n_cache_bytes");
+  GRN_OUTPUT_INT64(statistics.n_bytes);
+  GRN_OUTPUT_CSTR("max_n_cache_bytes");
+  GRN_OUTPUT_INT64(statistics.max_n_bytes);
+  GRN_OUTPUT_CSTR("n_cache_evictions");
+  GRN_OUTPUT_INT64(statistics.n_evictions);
+  GRN_OUTPUT_CSTR("n_cache_rejections");
+  GRN_OUTPUT_INT64(statistics.n_rejections);
+  GRN_OUTPUT_CSTR("n_cache_result_set_bytes");
+  GRN_OUTPUT_INT64(statistics.n_result_set_bytes);
+  GRN_OUTPUT_CSTR("max_n_cache_result_set_bytes");
+  GRN_OUTPUT_INT64(statistics.max_n_result_set_bytes);
+  GRN_OUTPUT_CSTR("n_queued_jobs");
+  GRN_OUTPUT_INT64(n_queued_jobs);
+  GRN_OUTPUT_CSTR("workers");
+  {
+    uint32_t i;
+    GRN_OUTPUT_ARRAY_OPEN("WORKERS", n_workers);
+    for (i = 0; i < n_workers; i++) {
+      grn_thread_worker_status *worker_status = &(worker_statuses[i]);
+      GRN_OUTPUT_MAP_OPEN("WORKER", 4);
+      GRN_OUTPUT_CSTR("n_queued_jobs");
+      GRN_OUTPUT_INT64(worker_status->n_queued_jobs);
+      GRN_OUTPUT_CSTR("n_processed_jobs");
+      GRN_OUTPUT_UINT64(worker_status->n_processed_jobs);
+      GRN_OUTPUT_CSTR("utilization");
+      if (worker_status->elapsed_time > 0.0) {
+        GRN_OUTPUT_FLOAT(worker_status->busy_time /
+                         worker_status->elapsed_time * 100.0);
+      } else {
+        GRN_OUTPUT_FLOAT(0.0);
+      }
+      GRN_OUTPUT_CSTR("parked");
+      GRN_OUTPUT_BOOL(worker_status->parked);
+      GRN_OUTPUT_MAP_CLOSE();
+    }
+    GRN_OUTPUT_ARRAY_CLOSE();
+  }
   GRN_OUTPUT_CSTR("command_version");
   GRN_OUTPUT_INT32(grn_ctx_get_command_version(ctx));
   GRN_OUTPUT_CSTR("default_command_version");
@@ -199,6 +256,10 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   GRN_OUTPUT_INT32(GRN_COMMAND_VERSION_MAX);
   GRN_OUTPUT_MAP_CLOSE();
 
+  if (worker_statuses) {
+    GRN_FREE(worker_statuses);
+  }
+
 #ifdef USE_MEMORY_DEBUG
   grn_alloc_info_dump(&grn_gctx);
 #endif /* USE_MEMORY_DEBUG */
@@ -544,17 +605,21 @@ proc_delete(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
     } else {
       grn_obj *records;
 
-      records = grn_table_select(ctx, table, cond, NULL, GRN_OP_OR);
+      records = grn_table_create(ctx, NULL, 0, NULL,
+                                 GRN_TABLE_HASH_KEY, table, NULL);
       if (records) {
-        void *key = NULL;
-        GRN_TABLE_EACH(ctx, records, GRN_ID_NIL, GRN_ID_NIL,
-                       result_id, &key, NULL, NULL, {
-          grn_id id = *(grn_id *)key;
-          grn_table_delete_by_id(ctx, table, id);
-          if (ctx->rc == GRN_OPERATION_NOT_PERMITTED) {
-            ERRCLR(ctx);
-          }
-        });
+        grn_table_select(ctx, table, cond, records, GRN_OP_OR);
+        if (ctx->rc == GRN_SUCCESS) {
+          void *key = NULL;
+          GRN_TABLE_EACH(ctx, records, GRN_ID_NIL, GRN_ID_NIL,
+                         result_id, &key, NULL, NULL, {
+            grn_id id = *(grn_id *)key;
+            grn_table_delete_by_id(ctx, table, id);
+            if (ctx->rc == GRN_OPERATION_NOT_PERMITTED) {
+              ERRCLR(ctx);
+            }
+          });
+        }
         grn_obj_unlink(ctx, records);
       }
     }
@@ -1420,6 +1485,31 @@ proc_cache_limit(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_da
           (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)));
     }
   }
+  if (ctx->rc == GRN_SUCCESS && GRN_TEXT_LEN(VAR(1))) {
+    const char *rest;
+    uint64_t max_n_bytes = grn_atoull(GRN_TEXT_VALUE(VAR(1)),
+                                      GRN_BULK_CURR(VAR(1)), &rest);
+    if (GRN_BULK_CURR(VAR(1)) == rest) {
+      grn_cache_set_max_n_bytes(ctx, cache, max_n_bytes);
+    } else {
+      ERR(GRN_INVALID_ARGUMENT,
+          "max_n_bytes value is invalid unsigned integer format: <%.*s>",
+          (int)GRN_TEXT_LEN(VAR(1)), GRN_TEXT_VALUE(VAR(1)));
+    }
+  }
+  if (ctx->rc == GRN_SUCCESS && GRN_TEXT_LEN(VAR(2))) {
+    const char *rest;
+    uint64_t max_n_bytes = grn_atoull(GRN_TEXT_VALUE(VAR(2)),
+                                      GRN_BULK_CURR(VAR(2)), &rest);
+    if (GRN_BULK_CURR(VAR(2)) == rest) {
+      grn_cache_set_max_n_result_set_bytes(ctx, cache, max_n_bytes);
+    } else {
+      ERR(GRN_INVALID_ARGUMENT,
+          "max_n_result_set_bytes value is "
+          "invalid unsigned integer format: <%.*s>",
+          (int)GRN_TEXT_LEN(VAR(2)), GRN_TEXT_VALUE(VAR(2)));
+    }
+  }
   if (ctx->rc == GRN_SUCCESS) {
     GRN_OUTPUT_INT64(current_max_n_entries);
   }
@@ -3181,6 +3271,184 @@ selector_between_sequential_search(grn_ctx *ctx,
   return GRN_TRUE;
 }
 
+static grn_bool
+selector_between_block_summary_search_should_use(grn_ctx *ctx,
+                                                 grn_obj *table,
+                                                 grn_obj *value,
+                                                 grn_operator op)
+{
+  if (value->header.type != GRN_COLUMN_FIX_SIZE) {
+    return GRN_FALSE;
+  }
+  if (value->header.domain != grn_obj_id(ctx, table)) {
+    return GRN_FALSE;
+  }
+  if (!GRN_RA_HAS_BLOCK_SUMMARY((grn_ra *)value)) {
+    return GRN_FALSE;
+  }
+
+  switch (DB_OBJ(value)->range) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_TIME :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+
+  switch (op) {
+  case GRN_OP_OR :
+    /* Records are found in the ID order. It's the same as the table
+       cursor order only for hash tables and arrays. */
+    return (table->header.type == GRN_TABLE_HASH_KEY ||
+            table->header.type == GRN_TABLE_NO_KEY);
+  case GRN_OP_AND :
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+/*
+ * It returns GRN_FALSE when the block of the record doesn't have any
+ * value in the range. summary and may_match are kept while records in
+ * the block are processed.
+ */
+static grn_bool
+selector_between_block_may_match(grn_ctx *ctx,
+                                 grn_ra *column,
+                                 grn_id id,
+                                 grn_id max_id,
+                                 between_data *data,
+                                 grn_ra_block_summary *summary,
+                                 grn_bool *may_match)
+{
+  grn_operator min_op;
+  grn_operator max_op;
+
+  if (summary->min_id <= id && id <= summary->max_id) {
+    return *may_match;
+  }
+  if (grn_ra_get_block_summary(ctx, column, id, max_id, summary) !=
+      GRN_SUCCESS) {
+    return GRN_TRUE;
+  }
+
+  if (data->min_border_type == BETWEEN_BORDER_INCLUDE) {
+    min_op = GRN_OP_GREATER_EQUAL;
+  } else {
+    min_op = GRN_OP_GREATER;
+  }
+  if (data->max_border_type == BETWEEN_BORDER_INCLUDE) {
+    max_op = GRN_OP_LESS_EQUAL;
+  } else {
+    max_op = GRN_OP_LESS;
+  }
+  *may_match =
+    grn_ra_block_summary_may_match(ctx, column, summary,
+                                   min_op, GRN_BULK_HEAD(data->min)) &&
+    grn_ra_block_summary_may_match(ctx, column, summary,
+                                   max_op, GRN_BULK_HEAD(data->max));
+  return *may_match;
+}
+
+/*
+ * Finds records by a fixed size column that doesn't have any index but
+ * has block summaries. Records in blocks that don't have any value in
+ * the range aren't evaluated.
+ */
+static grn_rc
+selector_between_block_summary_search(grn_ctx *ctx,
+                                      grn_obj *table,
+                                      between_data *data,
+                                      grn_obj *res,
+                                      grn_operator op)
+{
+  grn_ra *column = (grn_ra *)(data->value);
+  grn_id max_id;
+  grn_ra_block_summary summary;
+  grn_bool may_match = GRN_TRUE;
+  grn_obj *expr;
+  grn_obj *variable;
+  grn_id id;
+
+  if (!between_create_expr(ctx, table, data, &expr, &variable)) {
+    return ctx->rc == GRN_SUCCESS ? GRN_NO_MEMORY_AVAILABLE : ctx->rc;
+  }
+
+  max_id = grn_table_curr_id(ctx, table);
+  summary.min_id = GRN_ID_NIL + 1;
+  summary.max_id = GRN_ID_NIL;
+
+  if (op == GRN_OP_OR) {
+    id = GRN_ID_NIL;
+    while ((id = grn_table_next(ctx, table, id)) != GRN_ID_NIL &&
+           id <= max_id) {
+      grn_obj *result;
+      if (!selector_between_block_may_match(ctx, column, id, max_id, data,
+                                            &summary, &may_match)) {
+        id = summary.max_id;
+        continue;
+      }
+      GRN_RECORD_SET(ctx, variable, id);
+      result = grn_expr_exec(ctx, expr, 0);
+      if (ctx->rc) {
+        break;
+      }
+      if (grn_obj_is_true(ctx, result)) {
+        grn_posting posting;
+        posting.rid = id;
+        posting.sid = 1;
+        posting.pos = 0;
+        posting.weight = 0;
+        grn_ii_posting_add(ctx, &posting, (grn_hash *)res, op);
+      }
+    }
+  } else {
+    grn_table_cursor *cursor;
+    cursor = grn_table_cursor_open(ctx, res, NULL, 0, NULL, 0, 0, -1, 0);
+    if (!cursor) {
+      grn_obj_unlink(ctx, expr);
+      return ctx->rc == GRN_SUCCESS ? GRN_NO_MEMORY_AVAILABLE : ctx->rc;
+    }
+    while (grn_table_cursor_next(ctx, cursor) != GRN_ID_NIL) {
+      grn_id *key;
+      grn_id record_id;
+      grn_obj *result;
+      grn_table_cursor_get_key(ctx, cursor, (void **)&key);
+      record_id = *key;
+      if (!selector_between_block_may_match(ctx, column, record_id, max_id,
+                                            data, &summary, &may_match)) {
+        continue;
+      }
+      GRN_RECORD_SET(ctx, variable, record_id);
+      result = grn_expr_exec(ctx, expr, 0);
+      if (ctx->rc) {
+        break;
+      }
+      if (grn_obj_is_true(ctx, result)) {
+        grn_posting posting;
+        posting.rid = record_id;
+        posting.sid = 1;
+        posting.pos = 0;
+        posting.weight = 0;
+        grn_ii_posting_add(ctx, &posting, (grn_hash *)res, op);
+      }
+    }
+    grn_table_cursor_close(ctx, cursor);
+    grn_ii_resolve_sel_and(ctx, (grn_hash *)res, op);
+  }
+  grn_obj_unlink(ctx, expr);
+
+  return ctx->rc;
+}
+
 static grn_rc
 selector_between(grn_ctx *ctx, grn_obj *table, grn_obj *index,
                  int nargs, grn_obj **args,
@@ -3196,7 +3464,11 @@ selector_between(grn_ctx *ctx, grn_obj *table, grn_obj *index,
   grn_id id;
 
   if (!index) {
-    return GRN_INVALID_ARGUMENT;
+    if (nargs < 2 ||
+        !selector_between_block_summary_search_should_use(ctx, table,
+                                                          args[1], op)) {
+      return GRN_INVALID_ARGUMENT;
+    }
   }
 
   between_data_init(ctx, &data);
@@ -3205,6 +3477,11 @@ selector_between(grn_ctx *ctx, grn_obj *table, grn_obj *index,
     goto exit;
   }
 
+  if (!index) {
+    rc = selector_between_block_summary_search(ctx, table, &data, res, op);
+    goto exit;
+  }
+
   if (data.min_border_type == BETWEEN_BORDER_EXCLUDE) {
     flags |= GRN_CURSOR_GT;
   }
@@ -4077,6 +4354,8 @@ grn_db_init_builtin_query(grn_ctx *ctx)
 
   grn_proc_init_column_rename(ctx);
 
+  grn_proc_init_column_analyze(ctx);
+
   DEF_VAR(vars[0], "path");
   DEF_COMMAND(GRN_EXPR_MISSING_NAME, proc_missing, 1, vars);
 
@@ -4108,7 +4387,9 @@ grn_db_init_builtin_query(grn_ctx *ctx)
   DEF_COMMAND("delete", proc_delete, 4, vars);
 
   DEF_VAR(vars[0], "max");
-  DEF_COMMAND("cache_limit", proc_cache_limit, 1, vars);
+  DEF_VAR(vars[1], "max_n_bytes");
+  DEF_VAR(vars[2], "max_n_result_set_bytes");
+  DEF_COMMAND("cache_limit", proc_cache_limit, 3, vars);
 
   DEF_VAR(vars[0], "tables");
   DEF_VAR(vars[1], "dump_plugins");
@@ -30,6 +30,7 @@ command_column_create_parse_flags(grn_ctx *ctx,
                                   const char *end)
 {
   grn_obj_flags flags = 0;
+  const char *index_only_flag_name = NULL;
   while (nptr < end) {
     size_t name_size;
 
@@ -52,18 +53,45 @@ command_column_create_parse_flags(grn_ctx *ctx,
     CHECK_FLAG(COLUMN_INDEX);
     CHECK_FLAG(COMPRESS_ZLIB);
     CHECK_FLAG(COMPRESS_LZ4);
+    CHECK_FLAG(COMPRESS_ZSTD);
+    CHECK_FLAG(COMPRESS_BLOCK);
     CHECK_FLAG(WITH_SECTION);
     CHECK_FLAG(WITH_WEIGHT);
     CHECK_FLAG(WITH_POSITION);
     CHECK_FLAG(RING_BUFFER);
+    CHECK_FLAG(WITH_ZONE_MAP);
 
 #undef CHECK_FLAG
 
+#define CHECK_INDEX_FLAG(name)                                          \
+    name_size = strlen(#name);                                          \
+    if ((end - nptr) >= name_size &&                                    \
+        memcmp(nptr, #name, name_size) == 0) {                          \
+      flags |= GRN_OBJ_ ## name;                                        \
+      if (!index_only_flag_name) {                                      \
+        index_only_flag_name = #name;                                   \
+      }                                                                 \
+      nptr += name_size;                                                \
+      continue;                                                         \
+    }
+
+    CHECK_INDEX_FLAG(INDEX_SIMD_PACK);
+    CHECK_INDEX_FLAG(INDEX_BLOCK_MAX);
+
+#undef CHECK_INDEX_FLAG
+
     ERR(GRN_INVALID_ARGUMENT,
         "[column][create][flags] unknown flag: <%.*s>",
         (int)(end - nptr), nptr);
     return 0;
   }
+  if (index_only_flag_name &&
+      (flags & GRN_OBJ_COLUMN_TYPE_MASK) != GRN_OBJ_COLUMN_INDEX) {
+    ERR(GRN_INVALID_ARGUMENT,
+        "[column][create][flags] %s is only for COLUMN_INDEX",
+        index_only_flag_name);
+    return 0;
+  }
   return flags;
 }
 
@@ -175,12 +203,16 @@ command_column_create(grn_ctx *ctx, int nargs, grn_obj **args,
   grn_obj *source_raw;
   grn_obj_flags flags;
   grn_obj *type = NULL;
+  int32_t n_workers;
 
   table_raw  = grn_plugin_proc_get_var(ctx, user_data, "table", -1);
   name       = grn_plugin_proc_get_var(ctx, user_data, "name", -1);
   flags_raw  = grn_plugin_proc_get_var(ctx, user_data, "flags", -1);
   type_raw   = grn_plugin_proc_get_var(ctx, user_data, "type", -1);
   source_raw = grn_plugin_proc_get_var(ctx, user_data, "source", -1);
+  n_workers  = grn_plugin_proc_get_var_int32(ctx, user_data,
+                                             "n_workers", -1,
+                                             -1);
 
   table = grn_ctx_get(ctx, GRN_TEXT_VALUE(table_raw), GRN_TEXT_LEN(table_raw));
   if (!table) {
@@ -249,8 +281,13 @@ command_column_create(grn_ctx *ctx, int nargs, grn_obj **args,
                                                     source_raw,
                                                     &source_ids);
     if (rc == GRN_SUCCESS && GRN_BULK_VSIZE(&source_ids) > 0) {
+      uint32_t original_n_workers = grn_ctx_get_n_workers(ctx);
+      if (n_workers >= 0) {
+        grn_ctx_set_n_workers(ctx, n_workers);
+      }
       grn_obj_set_info(ctx, column, GRN_INFO_SOURCE, &source_ids);
       rc = ctx->rc;
+      grn_ctx_set_n_workers(ctx, original_n_workers);
     }
     GRN_OBJ_FIN(ctx, &source_ids);
     if (rc != GRN_SUCCESS) {
@@ -273,17 +310,18 @@ exit :
 void
 grn_proc_init_column_create(grn_ctx *ctx)
 {
-  grn_expr_var vars[5];
+  grn_expr_var vars[6];
 
   grn_plugin_expr_var_init(ctx, &(vars[0]), "table", -1);
   grn_plugin_expr_var_init(ctx, &(vars[1]), "name", -1);
   grn_plugin_expr_var_init(ctx, &(vars[2]), "flags", -1);
   grn_plugin_expr_var_init(ctx, &(vars[3]), "type", -1);
   grn_plugin_expr_var_init(ctx, &(vars[4]), "source", -1);
+  grn_plugin_expr_var_init(ctx, &(vars[5]), "n_workers", -1);
   grn_plugin_command_create(ctx,
                             "column_create", -1,
                             command_column_create,
-                            5,
+                            6,
                             vars);
 }
 
@@ -472,6 +510,87 @@ grn_proc_init_column_rename(grn_ctx *ctx)
                             vars);
 }
 
+static grn_obj *
+command_column_analyze(grn_ctx *ctx, int nargs, grn_obj **args,
+                       grn_user_data *user_data)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_obj *table_raw;
+  grn_obj *name;
+  grn_obj *table = NULL;
+  grn_obj *column = NULL;
+
+  table_raw = grn_plugin_proc_get_var(ctx, user_data, "table", -1);
+  name      = grn_plugin_proc_get_var(ctx, user_data, "name", -1);
+
+  if (GRN_TEXT_LEN(table_raw) == 0) {
+    rc = GRN_INVALID_ARGUMENT;
+    GRN_PLUGIN_ERROR(ctx,
+                     rc,
+                     "[column][analyze] table name isn't specified");
+    goto exit;
+  }
+
+  table = grn_ctx_get(ctx, GRN_TEXT_VALUE(table_raw), GRN_TEXT_LEN(table_raw));
+  if (!table) {
+    rc = GRN_INVALID_ARGUMENT;
+    GRN_PLUGIN_ERROR(ctx,
+                     rc,
+                     "[column][analyze] table isn't found: <%.*s>",
+                     (int)GRN_TEXT_LEN(table_raw),
+                     GRN_TEXT_VALUE(table_raw));
+    goto exit;
+  }
+
+  if (GRN_TEXT_LEN(name) == 0) {
+    rc = GRN_INVALID_ARGUMENT;
+    GRN_PLUGIN_ERROR(ctx,
+                     rc,
+                     "[column][analyze] column name isn't specified: <%.*s>",
+                     (int)GRN_TEXT_LEN(table_raw),
+                     GRN_TEXT_VALUE(table_raw));
+    goto exit;
+  }
+
+  column = grn_obj_column(ctx, table,
+                          GRN_TEXT_VALUE(name),
+                          GRN_TEXT_LEN(name));
+  if (!column) {
+    rc = GRN_INVALID_ARGUMENT;
+    GRN_PLUGIN_ERROR(ctx,
+                     rc,
+                     "[column][analyze] column isn't found: <%.*s%c%.*s>",
+                     (int)GRN_TEXT_LEN(table_raw),
+                     GRN_TEXT_VALUE(table_raw),
+                     GRN_DB_DELIMITER,
+                     (int)GRN_TEXT_LEN(name),
+                     GRN_TEXT_VALUE(name));
+    goto exit;
+  }
+
+  rc = grn_column_analyze(ctx, column);
+
+exit :
+  grn_ctx_output_bool(ctx, rc == GRN_SUCCESS);
+  if (column) { grn_obj_unlink(ctx, column); }
+  if (table) { grn_obj_unlink(ctx, table); }
+  return NULL;
+}
+
+void
+grn_proc_init_column_analyze(grn_ctx *ctx)
+{
+  grn_expr_var vars[2];
+
+  grn_plugin_expr_var_init(ctx, &(vars[0]), "table", -1);
+  grn_plugin_expr_var_init(ctx, &(vars[1]), "name", -1);
+  grn_plugin_command_create(ctx,
+                            "column_analyze", -1,
+                            command_column_analyze,
+                            2,
+                            vars);
+}
+
 static void
 output_column_name(grn_ctx *ctx, grn_obj *column)
 {
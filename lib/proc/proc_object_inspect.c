@@ -18,6 +18,7 @@
 
 #include "../grn_pat.h"
 #include "../grn_dat.h"
+#include "../grn_column_stats.h"
 
 #include "../grn_proc.h"
 
@@ -152,10 +153,34 @@ command_object_inspect_table_value(grn_ctx *ctx, grn_obj *table)
   }
 }
 
+static void
+command_object_inspect_lock(grn_ctx *ctx, grn_obj *obj)
+{
+  const grn_io_lock_stats *stats;
+
+  stats = grn_obj_get_lock_stats(ctx, obj);
+  if (!stats) {
+    grn_ctx_output_null(ctx);
+    return;
+  }
+
+  grn_ctx_output_map_open(ctx, "lock", 3);
+  {
+    grn_ctx_output_cstr(ctx, "n_acquisitions");
+    grn_ctx_output_uint64(ctx, stats->n_acquisitions);
+    grn_ctx_output_cstr(ctx, "n_waits");
+    grn_ctx_output_uint64(ctx, stats->n_waits);
+    grn_ctx_output_cstr(ctx, "total_wait_time");
+    grn_ctx_output_float(ctx,
+                         stats->total_wait_time / GRN_TIME_NSEC_PER_SEC_F);
+  }
+  grn_ctx_output_map_close(ctx);
+}
+
 static void
 command_object_inspect_table(grn_ctx *ctx, grn_obj *obj)
 {
-  grn_ctx_output_map_open(ctx, "table", 6);
+  grn_ctx_output_map_open(ctx, "table", 7);
   {
     grn_ctx_output_cstr(ctx, "id");
     grn_ctx_output_uint64(ctx, grn_obj_id(ctx, obj));
@@ -169,6 +194,86 @@ command_object_inspect_table(grn_ctx *ctx, grn_obj *obj)
     command_object_inspect_table_value(ctx, obj);
     grn_ctx_output_cstr(ctx, "n_records");
     grn_ctx_output_uint64(ctx, grn_table_size(ctx, obj));
+    grn_ctx_output_cstr(ctx, "lock");
+    command_object_inspect_lock(ctx, obj);
+  }
+  grn_ctx_output_map_close(ctx);
+}
+
+static void
+command_object_inspect_column_statistics(grn_ctx *ctx, grn_obj *column)
+{
+  grn_column_stats *stats;
+  struct grn_column_stats_header *header;
+
+  stats = grn_column_stats_get(ctx, column);
+  if (!stats) {
+    grn_ctx_output_null(ctx);
+    return;
+  }
+
+  header = stats->header;
+  grn_ctx_output_map_open(ctx, "statistics", 5);
+  {
+    uint32_t i;
+
+    grn_ctx_output_cstr(ctx, "n_values");
+    grn_ctx_output_uint64(ctx, header->n_values);
+    grn_ctx_output_cstr(ctx, "n_nulls");
+    grn_ctx_output_uint64(ctx, header->n_nulls);
+    grn_ctx_output_cstr(ctx, "n_distinct_values");
+    grn_ctx_output_uint64(ctx, grn_column_stats_n_distinct_values(ctx, stats));
+    grn_ctx_output_cstr(ctx, "n_modifications");
+    grn_ctx_output_uint64(ctx, header->n_modifications);
+    grn_ctx_output_cstr(ctx, "histogram");
+    grn_ctx_output_array_open(ctx, "histogram", header->n_buckets);
+    for (i = 0; i < header->n_buckets; i++) {
+      grn_ctx_output_map_open(ctx, "bucket", 3);
+      {
+        grn_ctx_output_cstr(ctx, "min");
+        grn_ctx_output_float(ctx, header->bounds[i]);
+        grn_ctx_output_cstr(ctx, "max");
+        grn_ctx_output_float(ctx, header->bounds[i + 1]);
+        grn_ctx_output_cstr(ctx, "count");
+        grn_ctx_output_uint64(ctx, header->counts[i]);
+      }
+      grn_ctx_output_map_close(ctx);
+    }
+    grn_ctx_output_array_close(ctx);
+  }
+  grn_ctx_output_map_close(ctx);
+}
+
+static void
+command_object_inspect_column(grn_ctx *ctx, grn_obj *obj)
+{
+  grn_ctx_output_map_open(ctx, "column", 7);
+  {
+    grn_ctx_output_cstr(ctx, "id");
+    grn_ctx_output_uint64(ctx, grn_obj_id(ctx, obj));
+    grn_ctx_output_cstr(ctx, "name");
+    {
+      char name[GRN_TABLE_MAX_KEY_SIZE];
+      int name_size;
+      name_size = grn_column_name(ctx, obj, name, GRN_TABLE_MAX_KEY_SIZE);
+      grn_ctx_output_str(ctx, name, name_size);
+    }
+    grn_ctx_output_cstr(ctx, "full_name");
+    command_object_inspect_obj_name(ctx, obj);
+    grn_ctx_output_cstr(ctx, "type");
+    command_object_inspect_obj_type(ctx, obj->header.type);
+    grn_ctx_output_cstr(ctx, "value");
+    grn_ctx_output_map_open(ctx, "value", 1);
+    {
+      grn_id range_id = grn_obj_get_range(ctx, obj);
+      grn_ctx_output_cstr(ctx, "type");
+      command_object_inspect_type(ctx, grn_ctx_at(ctx, range_id));
+    }
+    grn_ctx_output_map_close(ctx);
+    grn_ctx_output_cstr(ctx, "statistics");
+    command_object_inspect_column_statistics(ctx, obj);
+    grn_ctx_output_cstr(ctx, "lock");
+    command_object_inspect_lock(ctx, obj);
   }
   grn_ctx_output_map_close(ctx);
 }
@@ -201,6 +306,10 @@ command_object_inspect_dispatch(grn_ctx *ctx, grn_obj *obj)
   case GRN_TABLE_NO_KEY :
     command_object_inspect_table(ctx, obj);
     break;
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_VAR_SIZE :
+    command_object_inspect_column(ctx, obj);
+    break;
   case GRN_DB :
     command_object_inspect_db(ctx, obj);
     break;
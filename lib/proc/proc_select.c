@@ -34,6 +34,11 @@
 
 #define MAX_N_DRILLDOWNS 10
 
+#define GRN_SELECT_TOP_K_SORT_KEYS "-_score, _id"
+
+static int grn_select_top_k_threshold = 0;
+static grn_bool grn_select_top_k_count_n_hits = GRN_FALSE;
+
 typedef struct {
   const char *value;
   size_t length;
@@ -77,6 +82,28 @@ typedef struct {
   grn_select_string adjuster;
 } grn_select_data;
 
+void
+grn_proc_select_init_from_env(void)
+{
+  char grn_select_top_k_threshold_env[GRN_ENV_BUFFER_SIZE];
+  grn_getenv("GRN_SELECT_TOP_K_THRESHOLD",
+             grn_select_top_k_threshold_env,
+             GRN_ENV_BUFFER_SIZE);
+  if (grn_select_top_k_threshold_env[0]) {
+    grn_select_top_k_threshold = atoi(grn_select_top_k_threshold_env);
+  }
+
+  {
+    char grn_select_top_k_count_n_hits_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_SELECT_TOP_K_COUNT_N_HITS",
+               grn_select_top_k_count_n_hits_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (strcmp(grn_select_top_k_count_n_hits_env, "yes") == 0) {
+      grn_select_top_k_count_n_hits = GRN_TRUE;
+    }
+  }
+}
+
 grn_rc
 grn_proc_syntax_expand_query(grn_ctx *ctx,
                              const char *query,
@@ -586,6 +613,57 @@ drilldown_info_tsort(grn_ctx *ctx, grn_obj *labels,
   return succeeded;
 }
 
+static grn_bool
+grn_select_drilldown_prepare(grn_ctx *ctx,
+                             grn_obj *target_table,
+                             drilldown_info *drilldown,
+                             grn_table_group_result *result,
+                             grn_table_sort_key **keys,
+                             unsigned int *n_keys)
+{
+  result->limit = 1;
+  result->flags = GRN_TABLE_GROUP_CALC_COUNT;
+  result->op = 0;
+  result->max_n_subrecs = 0;
+  result->key_begin = 0;
+  result->key_end = 0;
+  result->calc_target = NULL;
+
+  *keys = NULL;
+  *n_keys = 0;
+  if (drilldown->keys_len > 0) {
+    *keys = grn_table_sort_key_from_str(ctx,
+                                        drilldown->keys,
+                                        drilldown->keys_len,
+                                        target_table, n_keys);
+    if (!*keys) {
+      GRN_PLUGIN_CLEAR_ERROR(ctx);
+      return GRN_FALSE;
+    }
+
+    result->key_end = *n_keys - 1;
+    if (*n_keys > 1) {
+      result->max_n_subrecs = 1;
+    }
+  }
+
+  if (drilldown->calc_target_name) {
+    result->calc_target = grn_obj_column(ctx, target_table,
+                                         drilldown->calc_target_name,
+                                         drilldown->calc_target_name_len);
+  }
+  if (result->calc_target) {
+    result->flags |= drilldown->calc_types;
+  }
+
+  return GRN_TRUE;
+}
+
+/*
+ * Drilldowns that don't have "table" are grouped by scanning the table
+ * only once. Other drilldowns are grouped after them in the dependency
+ * order.
+ */
 static grn_table_group_result *
 grn_select_drilldowns_execute(grn_ctx *ctx,
                               grn_obj *table,
@@ -595,6 +673,8 @@ grn_select_drilldowns_execute(grn_ctx *ctx,
                               grn_obj *condition)
 {
   grn_table_group_result *results = NULL;
+  grn_table_group_spec *specs = NULL;
+  unsigned int n_specs = 0;
   grn_obj tsorted_indexes;
   unsigned int i;
 
@@ -618,6 +698,59 @@ grn_select_drilldowns_execute(grn_ctx *ctx,
     result->table = NULL;
   }
 
+  specs = GRN_PLUGIN_MALLOCN(ctx, grn_table_group_spec, n_drilldowns);
+  if (!specs) {
+    goto exit;
+  }
+
+  for (i = 0; i < n_drilldowns; i++) {
+    grn_table_sort_key *keys = NULL;
+    unsigned int n_keys = 0;
+    unsigned int index;
+    drilldown_info *drilldown;
+    grn_table_group_result *result;
+    grn_table_group_spec *spec;
+
+    index = GRN_UINT32_VALUE_AT(&tsorted_indexes, i);
+    drilldown = drilldowns + index;
+    result = results + index;
+
+    if (drilldown->table_name) {
+      grn_id dependent_id;
+      dependent_id = grn_table_get(ctx,
+                                   labels,
+                                   drilldown->table_name,
+                                   drilldown->table_name_len);
+      if (dependent_id == GRN_ID_NIL) {
+        /* Reported by the following loop. */
+        break;
+      }
+      continue;
+    }
+
+    if (!grn_select_drilldown_prepare(ctx, table, drilldown, result,
+                                      &keys, &n_keys)) {
+      continue;
+    }
+
+    spec = specs + n_specs;
+    spec->keys = keys;
+    spec->n_keys = n_keys;
+    spec->results = result;
+    spec->n_results = 1;
+    n_specs++;
+  }
+
+  if (n_specs > 0) {
+    grn_table_group_multi(ctx, table, specs, n_specs);
+    for (i = 0; i < n_specs; i++) {
+      grn_table_group_spec *spec = specs + i;
+      if (spec->keys) {
+        grn_table_sort_key_close(ctx, spec->keys, spec->n_keys);
+      }
+    }
+  }
+
   for (i = 0; i < n_drilldowns; i++) {
     grn_table_sort_key *keys = NULL;
     unsigned int n_keys = 0;
@@ -630,15 +763,11 @@ grn_select_drilldowns_execute(grn_ctx *ctx,
     drilldown = drilldowns + index;
     result = results + index;
 
-    result->limit = 1;
-    result->flags = GRN_TABLE_GROUP_CALC_COUNT;
-    result->op = 0;
-    result->max_n_subrecs = 0;
-    result->key_begin = 0;
-    result->key_end = 0;
-    result->calc_target = NULL;
+    if (!drilldown->table_name) {
+      continue;
+    }
 
-    if (drilldown->table_name) {
+    {
       grn_id dependent_id;
       dependent_id = grn_table_get(ctx,
                                    labels,
@@ -659,29 +788,9 @@ grn_select_drilldowns_execute(grn_ctx *ctx,
       }
     }
 
-    if (drilldown->keys_len > 0) {
-      keys = grn_table_sort_key_from_str(ctx,
-                                         drilldown->keys,
-                                         drilldown->keys_len,
-                                         target_table, &n_keys);
-      if (!keys) {
-        GRN_PLUGIN_CLEAR_ERROR(ctx);
-        continue;
-      }
-
-      result->key_end = n_keys - 1;
-      if (n_keys > 1) {
-        result->max_n_subrecs = 1;
-      }
-    }
-
-    if (drilldown->calc_target_name) {
-      result->calc_target = grn_obj_column(ctx, target_table,
-                                           drilldown->calc_target_name,
-                                           drilldown->calc_target_name_len);
-    }
-    if (result->calc_target) {
-      result->flags |= drilldown->calc_types;
+    if (!grn_select_drilldown_prepare(ctx, target_table, drilldown, result,
+                                      &keys, &n_keys)) {
+      continue;
     }
 
     grn_table_group(ctx, target_table, keys, n_keys, result, 1);
@@ -691,6 +800,9 @@ grn_select_drilldowns_execute(grn_ctx *ctx,
   }
 
 exit :
+  if (specs) {
+    GRN_PLUGIN_FREE(ctx, specs);
+  }
   GRN_OBJ_FIN(ctx, &tsorted_indexes);
 
   return results;
@@ -817,10 +929,129 @@ grn_select_drilldowns(grn_ctx *ctx, grn_obj *table,
   GRN_PLUGIN_FREE(ctx, results);
 }
 
+/*
+ * grn_select_top_k returns the number of records that are needed when only
+ * the top records by score are needed. It returns 0 when all matched records
+ * are needed. Only query, sortby=-_score, offset and limit are supported.
+ * "nhits" is estimated in this case. It's counted only when
+ * GRN_SELECT_TOP_K_COUNT_N_HITS=yes because counting reads all postings
+ * that the top k search skips. Records that have the same score are sorted
+ * by _id because only the records that have smaller _id are collected for
+ * the same score.
+ */
+static int
+grn_select_top_k(grn_ctx *ctx, grn_select_data *data)
+{
+  const char *sortby;
+  const char *sortby_end;
+
+  if (grn_select_top_k_threshold <= 0) {
+    return 0;
+  }
+  if (data->query.length == 0 ||
+      data->filter.length > 0 ||
+      data->scorer.length > 0 ||
+      data->adjuster.length > 0 ||
+      data->n_drilldowns > 0) {
+    return 0;
+  }
+  if (data->offset < 0 || data->limit < 0 ||
+      data->offset > grn_select_top_k_threshold ||
+      data->limit > grn_select_top_k_threshold - data->offset) {
+    return 0;
+  }
+
+  sortby = data->sortby.value;
+  sortby_end = sortby + data->sortby.length;
+  while (sortby < sortby_end && *sortby == ' ') { sortby++; }
+  while (sortby < sortby_end && sortby_end[-1] == ' ') { sortby_end--; }
+  if (!(sortby_end - sortby == strlen("-_score") &&
+        memcmp(sortby, "-_score", strlen("-_score")) == 0)) {
+    return 0;
+  }
+
+  return data->offset + data->limit;
+}
+
+static grn_bool
+grn_select_is_cache_disabled(grn_ctx *ctx, grn_select_data *data)
+{
+  return (data->cache.value &&
+          data->cache.length == 2 &&
+          data->cache.value[0] == 'n' &&
+          data->cache.value[1] == 'o');
+}
+
+/*
+ * grn_select_filter filters table by cond. The filtered result set is
+ * cached by the parameters that affect only filtering. So requests that
+ * differ only in sortby, offset, limit, output_columns or drilldowns
+ * don't need to filter again.
+ */
+static grn_obj *
+grn_select_filter(grn_ctx *ctx, grn_select_data *data,
+                  grn_obj *table, grn_obj *cond, grn_bool cacheable)
+{
+  grn_cache *cache_obj;
+  char cache_key[GRN_CACHE_MAX_KEY_SIZE];
+  uint32_t cache_key_size;
+  char *cp = cache_key;
+  grn_obj *res;
+
+  cache_obj = grn_cache_current_get(ctx);
+  cache_key_size =
+    data->table.length + 1 +
+    data->match_columns.length + 1 +
+    data->query.length + 1 +
+    data->filter.length + 1 +
+    data->match_escalation_threshold.length + 1 +
+    data->query_expander.length + 1 +
+    data->query_flags.length + 1;
+  if (!cache_obj ||
+      !cacheable ||
+      grn_select_is_cache_disabled(ctx, data) ||
+      cache_key_size > GRN_CACHE_MAX_KEY_SIZE) {
+    return grn_table_select(ctx, table, cond, NULL, GRN_OP_OR);
+  }
+
+#define PUT_CACHE_KEY(string)                                   \
+  grn_memcpy(cp, (string).value, (string).length);              \
+  cp += (string).length;                                        \
+  *cp++ = '\0'
+
+  PUT_CACHE_KEY(data->table);
+  PUT_CACHE_KEY(data->match_columns);
+  PUT_CACHE_KEY(data->query);
+  PUT_CACHE_KEY(data->filter);
+  PUT_CACHE_KEY(data->match_escalation_threshold);
+  PUT_CACHE_KEY(data->query_expander);
+  PUT_CACHE_KEY(data->query_flags);
+#undef PUT_CACHE_KEY
+
+  res = grn_cache_fetch_result_set(ctx, cache_obj,
+                                   cache_key, cache_key_size,
+                                   table);
+  if (res) {
+    GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_CACHE,
+                  ":", "cache_result_set(%d)", grn_table_size(ctx, res));
+    return res;
+  }
+
+  res = grn_table_select(ctx, table, cond, NULL, GRN_OP_OR);
+  if (res && !ctx->rc) {
+    grn_cache_update_result_set(ctx, cache_obj,
+                                cache_key, cache_key_size,
+                                res);
+  }
+  return res;
+}
+
 static grn_rc
 grn_select(grn_ctx *ctx, grn_select_data *data)
 {
   uint32_t nkeys, nhits;
+  uint32_t top_k_nhits = 0;
+  grn_bool is_top_k = GRN_FALSE;
   uint16_t cacheable = 1, taintable = 0;
   grn_table_sort_key *keys;
   grn_obj *outbuf = ctx->impl->output.buf;
@@ -1066,7 +1297,19 @@ grn_select(grn_ctx *ctx, grn_select_data *data)
         GRN_LOG(ctx, GRN_LOG_NOTICE, "query=(%s)", GRN_TEXT_VALUE(&strbuf));
         GRN_OBJ_FIN(ctx, &strbuf);
         */
-        if (!ctx->rc) { res = grn_table_select(ctx, table, cond, NULL, GRN_OP_OR); }
+        if (!ctx->rc) {
+          int top_k = grn_select_top_k(ctx, data);
+          if (top_k > 0) {
+            res = grn_table_select_top_k(ctx, table, cond, top_k,
+                                         grn_select_top_k_count_n_hits,
+                                         &top_k_nhits);
+            is_top_k = (res != NULL);
+          }
+          if (!res && !ctx->rc) {
+            res = grn_select_filter(ctx, data, table, cond,
+                                    cacheable && !taintable);
+          }
+        }
       } else {
         /* todo */
         ERRCLR(ctx);
@@ -1074,7 +1317,11 @@ grn_select(grn_ctx *ctx, grn_select_data *data)
     } else {
       res = table;
     }
-    nhits = res ? grn_table_size(ctx, res) : 0;
+    if (is_top_k) {
+      nhits = top_k_nhits;
+    } else {
+      nhits = res ? grn_table_size(ctx, res) : 0;
+    }
     GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
                   ":", "select(%d)", nhits);
 
@@ -1154,12 +1401,22 @@ grn_select(grn_ctx *ctx, grn_select_data *data)
       grn_normalize_offset_and_limit(ctx, nhits,
                                      &(data->offset), &(data->limit));
 
-      if (data->sortby.length > 0 &&
-          (keys = grn_table_sort_key_from_str(ctx,
-                                              data->sortby.value,
-                                              data->sortby.length,
-                                              res,
-                                              &nkeys))) {
+      if (is_top_k) {
+        keys = grn_table_sort_key_from_str(ctx,
+                                           GRN_SELECT_TOP_K_SORT_KEYS,
+                                           strlen(GRN_SELECT_TOP_K_SORT_KEYS),
+                                           res,
+                                           &nkeys);
+      } else if (data->sortby.length > 0) {
+        keys = grn_table_sort_key_from_str(ctx,
+                                           data->sortby.value,
+                                           data->sortby.length,
+                                           res,
+                                           &nkeys);
+      } else {
+        keys = NULL;
+      }
+      if (keys) {
         if ((sorted = grn_table_create(ctx, NULL, 0, NULL,
                                        GRN_OBJ_TABLE_NO_KEY, NULL, res))) {
           grn_table_sort(ctx, res, data->offset, data->limit,
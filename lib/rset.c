@@ -98,6 +98,61 @@ grn_rset_recinfo_update_calc_values(grn_ctx *ctx,
   GRN_OBJ_FIN(ctx, &value_int64);
 }
 
+/*
+ * Merges calc values of other_ri into ri. Both of them must have the
+ * same layout as table. It must be called before ri->n_subrecs is
+ * increased by other_ri's.
+ */
+void
+grn_rset_recinfo_merge_calc_values(grn_ctx *ctx,
+                                   grn_rset_recinfo *ri,
+                                   grn_obj *table,
+                                   grn_rset_recinfo *other_ri)
+{
+  grn_table_group_flags flags;
+  byte *values;
+  byte *other_values;
+  uint32_t subrecs_size;
+
+  flags = DB_OBJ(table)->flags.group;
+
+  subrecs_size = GRN_RSET_SUBRECS_SIZE(DB_OBJ(table)->subrec_size,
+                                       DB_OBJ(table)->max_n_subrecs);
+  values = ((byte *)ri->subrecs) + subrecs_size;
+  other_values = ((byte *)other_ri->subrecs) + subrecs_size;
+
+  if (flags & GRN_TABLE_GROUP_CALC_MAX) {
+    if (*((int64_t *)other_values) > *((int64_t *)values)) {
+      *((int64_t *)values) = *((int64_t *)other_values);
+    }
+    values += GRN_RSET_MAX_SIZE;
+    other_values += GRN_RSET_MAX_SIZE;
+  }
+  if (flags & GRN_TABLE_GROUP_CALC_MIN) {
+    if (*((int64_t *)other_values) < *((int64_t *)values)) {
+      *((int64_t *)values) = *((int64_t *)other_values);
+    }
+    values += GRN_RSET_MIN_SIZE;
+    other_values += GRN_RSET_MIN_SIZE;
+  }
+  if (flags & GRN_TABLE_GROUP_CALC_SUM) {
+    *((int64_t *)values) += *((int64_t *)other_values);
+    values += GRN_RSET_SUM_SIZE;
+    other_values += GRN_RSET_SUM_SIZE;
+  }
+  if (flags & GRN_TABLE_GROUP_CALC_AVG) {
+    double current_average = *((double *)values);
+    double other_average = *((double *)other_values);
+    int n_subrecs = GRN_RSET_N_SUBRECS(ri);
+    int other_n_subrecs = GRN_RSET_N_SUBRECS(other_ri);
+    *((double *)values) +=
+      (other_average - current_average) * other_n_subrecs /
+      (n_subrecs + other_n_subrecs);
+    values += GRN_RSET_AVG_SIZE;
+    other_values += GRN_RSET_AVG_SIZE;
+  }
+}
+
 int64_t *
 grn_rset_recinfo_get_max_(grn_ctx *ctx,
                           grn_rset_recinfo *ri,
@@ -322,3 +377,146 @@ grn_rset_recinfo_set_avg(grn_ctx *ctx,
 
   *avg_address = avg;
 }
+
+void
+grn_rset_bitmap_init(grn_ctx *ctx, grn_rset_bitmap *bitmap)
+{
+  bitmap->words = NULL;
+  bitmap->n_words = 0;
+}
+
+void
+grn_rset_bitmap_fin(grn_ctx *ctx, grn_rset_bitmap *bitmap)
+{
+  if (bitmap->words) {
+    GRN_FREE(bitmap->words);
+    bitmap->words = NULL;
+  }
+  bitmap->n_words = 0;
+}
+
+grn_rc
+grn_rset_bitmap_set(grn_ctx *ctx, grn_rset_bitmap *bitmap, grn_id id)
+{
+  uint32_t word_id = id / GRN_RSET_BITMAP_WORD_BITS;
+
+  if (word_id >= bitmap->n_words) {
+    uint64_t *words;
+    uint32_t n_words = bitmap->n_words > 0 ? bitmap->n_words : 16;
+    while (n_words <= word_id) {
+      n_words *= 2;
+    }
+    words = GRN_REALLOC(bitmap->words, sizeof(uint64_t) * n_words);
+    if (!words) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "[rset][bitmap] failed to extend: <%u> -> <%u>",
+          bitmap->n_words, n_words);
+      return ctx->rc;
+    }
+    memset(words + bitmap->n_words, 0,
+           sizeof(uint64_t) * (n_words - bitmap->n_words));
+    bitmap->words = words;
+    bitmap->n_words = n_words;
+  }
+  bitmap->words[word_id] |= ((uint64_t)1) << (id % GRN_RSET_BITMAP_WORD_BITS);
+  return GRN_SUCCESS;
+}
+
+/* Returns the smallest ID in bitmap that is larger than id. */
+grn_id
+grn_rset_bitmap_next(grn_ctx *ctx, grn_rset_bitmap *bitmap, grn_id id)
+{
+  uint32_t word_id;
+  uint64_t word;
+
+  id++;
+  word_id = id / GRN_RSET_BITMAP_WORD_BITS;
+  if (word_id >= bitmap->n_words) {
+    return GRN_ID_NIL;
+  }
+  word = bitmap->words[word_id] >> (id % GRN_RSET_BITMAP_WORD_BITS);
+  if (!word) {
+    do {
+      word_id++;
+      if (word_id >= bitmap->n_words) {
+        return GRN_ID_NIL;
+      }
+    } while (!bitmap->words[word_id]);
+    word = bitmap->words[word_id];
+    id = word_id * GRN_RSET_BITMAP_WORD_BITS;
+  }
+#ifdef __GNUC__
+  return id + __builtin_ctzll(word);
+#else /* __GNUC__ */
+  while (!(word & 1)) {
+    word >>= 1;
+    id++;
+  }
+  return id;
+#endif /* __GNUC__ */
+}
+
+uint32_t
+grn_rset_bitmap_size(grn_ctx *ctx, grn_rset_bitmap *bitmap)
+{
+  uint32_t i;
+  uint32_t size = 0;
+
+  for (i = 0; i < bitmap->n_words; i++) {
+#ifdef __GNUC__
+    size += __builtin_popcountll(bitmap->words[i]);
+#else /* __GNUC__ */
+    uint64_t word = bitmap->words[i];
+    while (word) {
+      word &= word - 1;
+      size++;
+    }
+#endif /* __GNUC__ */
+  }
+  return size;
+}
+
+/* Stores the result into bitmap1. Records don't have score for ADJUST. */
+void
+grn_rset_bitmap_setoperation(grn_ctx *ctx,
+                             grn_rset_bitmap *bitmap1,
+                             grn_rset_bitmap *bitmap2,
+                             grn_operator op)
+{
+  uint32_t i;
+  uint32_t n_words;
+
+  n_words = bitmap1->n_words;
+  if (n_words > bitmap2->n_words) {
+    n_words = bitmap2->n_words;
+  }
+  switch (op) {
+  case GRN_OP_OR :
+    if (bitmap1->n_words < bitmap2->n_words) {
+      uint64_t *words = bitmap1->words;
+      bitmap1->words = bitmap2->words;
+      bitmap1->n_words = bitmap2->n_words;
+      bitmap2->words = words;
+      bitmap2->n_words = n_words;
+    }
+    for (i = 0; i < n_words; i++) {
+      bitmap1->words[i] |= bitmap2->words[i];
+    }
+    break;
+  case GRN_OP_AND :
+    for (i = 0; i < n_words; i++) {
+      bitmap1->words[i] &= bitmap2->words[i];
+    }
+    for (; i < bitmap1->n_words; i++) {
+      bitmap1->words[i] = 0;
+    }
+    break;
+  case GRN_OP_AND_NOT :
+    for (i = 0; i < n_words; i++) {
+      bitmap1->words[i] &= ~(bitmap2->words[i]);
+    }
+    break;
+  default :
+    break;
+  }
+}
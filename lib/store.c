@@ -17,8 +17,11 @@
 #include "grn.h"
 #include "grn_str.h"
 #include "grn_store.h"
+#include "grn_column_stats.h"
+#include "grn_block_cache.h"
 #include "grn_ctx_impl.h"
 #include "grn_output.h"
+#include "grn_util.h"
 #include <string.h>
 
 /* rectangular arrays */
@@ -26,8 +29,785 @@
 #define GRN_RA_W_SEGMENT    22
 #define GRN_RA_SEGMENT_SIZE (1 << GRN_RA_W_SEGMENT)
 
+/*
+ * GRN_OBJ_COMPRESS_BLOCK packs values of GRN_RA_BLOCK_N_VALUES
+ * consecutive records into a block by frame of reference or delta
+ * encoding. Blocks are stored in a jagged array ("${path}.b") with
+ * block ID + 1. A packed block is:
+ *
+ *   [grn_ra_block_header][bit packed offsets (uint64_t words)]
+ *
+ * In frame of reference mode, each offset is the difference from the
+ * minimum value in the block. In delta mode, each offset is the
+ * difference from the previous value minus the minimum difference. The
+ * mode that needs less bits is used.
+ *
+ * The last written block (the tail block) isn't packed. It's stored in
+ * the first segment of the rectangular array and it's packed when a
+ * record in a later block is written. Two tail block areas are used by
+ * turns so that readers of the previous tail block aren't broken while
+ * the next tail block is written.
+ *
+ * Updating a packed block increments header->generation. Decoded
+ * blocks in grn_block_cache are identified by an owner ID that is
+ * changed when the generation is changed. So updated blocks are
+ * decoded again even in other processes.
+ *
+ * GRN_OBJ_WITH_ZONE_MAP keeps the range of values for each block of a
+ * column that isn't compressed in a rectangular array ("${path}.z")
+ * by block ID. A range is only widened. It covers the first n_values
+ * records in the block. Records after them aren't stored yet. So they
+ * have zero. Compressed columns don't need it because their blocks
+ * have ranges.
+ */
+#define GRN_RA_BLOCK_PATH_SUFFIX ".b"
+#define GRN_RA_ZONE_MAP_PATH_SUFFIX ".z"
+#define GRN_RA_BLOCK_MODE_FOR    0x00
+#define GRN_RA_BLOCK_MODE_DELTA  0x01
+#define GRN_RA_BLOCK_MASK        (GRN_RA_BLOCK_N_VALUES - 1)
+#define GRN_RA_BLOCK_MAX_SIZE    sizeof(uint64_t)
+
+typedef struct {
+  uint8_t mode;
+  uint8_t width;       /* Bits of an offset. */
+  uint16_t reserved1;
+  uint32_t reserved2;
+  uint64_t base;       /* The minimum value or the first value. */
+  uint64_t delta_min;  /* The minimum difference in delta mode. */
+  uint64_t min;        /* The minimum value except GRN_ID_NIL. */
+  uint64_t max;        /* The maximum value except GRN_ID_NIL. */
+} grn_ra_block_header;
+
+#define GRN_RA_BLOCK_N_WORDS(width) \
+  ((GRN_RA_BLOCK_N_VALUES * (width) + 63) / 64)
+
+typedef struct {
+  uint64_t min;
+  uint64_t max;
+  uint32_t n_values;   /* The number of records in the range. */
+  uint32_t reserved1;
+  uint64_t reserved2;
+} grn_ra_zone;
+
+static const uint64_t grn_ra_block_zero_values[GRN_RA_BLOCK_N_VALUES];
+
+static grn_bool
+grn_ra_build_path(grn_ctx *ctx, const char *path, const char *suffix,
+                  char *built_path)
+{
+  if (strlen(path) + strlen(suffix) >= PATH_MAX) {
+    ERR(GRN_FILENAME_TOO_LONG,
+        "[ra] too long path: <%s%s>",
+        path, suffix);
+    return GRN_FALSE;
+  }
+  grn_strcpy(built_path, PATH_MAX, path);
+  grn_strcat(built_path, PATH_MAX, suffix);
+  return GRN_TRUE;
+}
+
+static void
+grn_ra_block_init(grn_ctx *ctx, grn_ra *ra)
+{
+  CRITICAL_SECTION_INIT(ra->block.lock);
+  ra->block.store = NULL;
+  ra->block.tail = NULL;
+  ra->block.cache_owner_id = grn_block_cache_generate_owner_id();
+  ra->block.generation = 0;
+}
+
+/* It refers the first segment that has tail blocks while the column is open. */
+static grn_rc
+grn_ra_block_setup(grn_ctx *ctx, grn_ra *ra)
+{
+  void *tail = NULL;
+  ra->element_width = GRN_RA_BLOCK_W_N_VALUES;
+  ra->element_mask = GRN_RA_BLOCK_MASK;
+  ra->block.generation = ra->header->generation;
+  GRN_IO_SEG_REF(ra->io, 0, tail);
+  if (!tail) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "[ra][block] failed to map tail blocks");
+    return ctx->rc;
+  }
+  ra->block.tail = tail;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+grn_ra_block_create(grn_ctx *ctx, grn_ra *ra, const char *path)
+{
+  char block_path[PATH_MAX];
+  const char *io_path = NULL;
+
+  if (!GRN_RA_IS_COMPRESSED(ra)) {
+    return GRN_SUCCESS;
+  }
+  if (path) {
+    if (!grn_ra_build_path(ctx, path, GRN_RA_BLOCK_PATH_SUFFIX, block_path)) {
+      return ctx->rc;
+    }
+    io_path = block_path;
+  }
+  ra->block.store =
+    grn_ja_create(ctx, io_path,
+                  sizeof(grn_ra_block_header) +
+                  GRN_RA_BLOCK_N_WORDS(64) * sizeof(uint64_t),
+                  0);
+  if (!ra->block.store) {
+    return ctx->rc == GRN_SUCCESS ? GRN_NO_MEMORY_AVAILABLE : ctx->rc;
+  }
+  return grn_ra_block_setup(ctx, ra);
+}
+
+static grn_rc
+grn_ra_block_open(grn_ctx *ctx, grn_ra *ra, const char *path)
+{
+  char block_path[PATH_MAX];
+
+  if (!GRN_RA_IS_COMPRESSED(ra)) {
+    return GRN_SUCCESS;
+  }
+  if (!grn_ra_build_path(ctx, path, GRN_RA_BLOCK_PATH_SUFFIX, block_path)) {
+    return ctx->rc;
+  }
+  ra->block.store = grn_ja_open(ctx, block_path);
+  if (!ra->block.store) {
+    return ctx->rc == GRN_SUCCESS ? GRN_FILE_CORRUPT : ctx->rc;
+  }
+  return grn_ra_block_setup(ctx, ra);
+}
+
+static void
+grn_ra_block_close(grn_ctx *ctx, grn_ra *ra)
+{
+  if (ra->block.tail) {
+    GRN_IO_SEG_UNREF(ra->io, 0);
+    ra->block.tail = NULL;
+  }
+  if (ra->block.store) {
+    grn_ja_close(ctx, ra->block.store);
+    ra->block.store = NULL;
+    grn_block_cache_expire(ctx, ra->block.cache_owner_id);
+  }
+}
+
+static void
+grn_ra_block_fin(grn_ctx *ctx, grn_ra *ra)
+{
+  grn_ra_block_close(ctx, ra);
+  CRITICAL_SECTION_FIN(ra->block.lock);
+}
+
+static grn_rc
+grn_ra_block_remove(grn_ctx *ctx, const char *path)
+{
+  char block_path[PATH_MAX];
+
+  if (!grn_ra_build_path(ctx, path, GRN_RA_BLOCK_PATH_SUFFIX, block_path)) {
+    return ctx->rc;
+  }
+  if (!grn_path_exist(block_path)) {
+    return GRN_SUCCESS;
+  }
+  return grn_ja_remove(ctx, block_path);
+}
+
+static grn_rc
+grn_ra_zone_map_create(grn_ctx *ctx, grn_ra *ra, const char *path)
+{
+  char zone_map_path[PATH_MAX];
+  const char *io_path = NULL;
+
+  if (!(ra->header->flags & GRN_OBJ_WITH_ZONE_MAP) ||
+      GRN_RA_IS_COMPRESSED(ra)) {
+    return GRN_SUCCESS;
+  }
+  if (path) {
+    if (!grn_ra_build_path(ctx, path, GRN_RA_ZONE_MAP_PATH_SUFFIX,
+                           zone_map_path)) {
+      return ctx->rc;
+    }
+    io_path = zone_map_path;
+  }
+  ra->zone_map = grn_ra_create(ctx, io_path, sizeof(grn_ra_zone), 0);
+  if (!ra->zone_map) {
+    return ctx->rc == GRN_SUCCESS ? GRN_NO_MEMORY_AVAILABLE : ctx->rc;
+  }
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+grn_ra_zone_map_open(grn_ctx *ctx, grn_ra *ra, const char *path)
+{
+  char zone_map_path[PATH_MAX];
+
+  if (!(ra->header->flags & GRN_OBJ_WITH_ZONE_MAP) ||
+      GRN_RA_IS_COMPRESSED(ra)) {
+    return GRN_SUCCESS;
+  }
+  if (!grn_ra_build_path(ctx, path, GRN_RA_ZONE_MAP_PATH_SUFFIX,
+                         zone_map_path)) {
+    return ctx->rc;
+  }
+  ra->zone_map = grn_ra_open(ctx, zone_map_path);
+  if (!ra->zone_map) {
+    return ctx->rc == GRN_SUCCESS ? GRN_FILE_CORRUPT : ctx->rc;
+  }
+  return GRN_SUCCESS;
+}
+
+static void
+grn_ra_zone_map_close(grn_ctx *ctx, grn_ra *ra)
+{
+  if (ra->zone_map) {
+    grn_ra_close(ctx, ra->zone_map);
+    ra->zone_map = NULL;
+  }
+}
+
+static grn_rc
+grn_ra_zone_map_remove(grn_ctx *ctx, const char *path)
+{
+  char zone_map_path[PATH_MAX];
+
+  if (!grn_ra_build_path(ctx, path, GRN_RA_ZONE_MAP_PATH_SUFFIX,
+                         zone_map_path)) {
+    return ctx->rc;
+  }
+  if (!grn_path_exist(zone_map_path)) {
+    return GRN_SUCCESS;
+  }
+  return grn_ra_remove(ctx, zone_map_path);
+}
+
+static grn_bool
+grn_ra_block_is_signed(grn_ra *ra)
+{
+  return (ra->header->flags & GRN_OBJ_KEY_MASK) == GRN_OBJ_KEY_INT;
+}
+
+static grn_bool
+grn_ra_block_less(grn_bool is_signed, uint64_t a, uint64_t b)
+{
+  if (is_signed) {
+    return (int64_t)a < (int64_t)b;
+  } else {
+    return a < b;
+  }
+}
+
+static uint8_t
+grn_ra_block_bit_width(uint64_t value)
+{
+  uint8_t width = 0;
+  while (value > 0) {
+    width++;
+    value >>= 1;
+  }
+  return width;
+}
+
+#define GRN_RA_BLOCK_LOAD(signed_type, unsigned_type) do {              \
+  if (is_signed) {                                                      \
+    const signed_type *raw_values = raw;                                \
+    for (i = 0; i < GRN_RA_BLOCK_N_VALUES; i++) {                       \
+      values[i] = (uint64_t)(int64_t)raw_values[i];                     \
+    }                                                                   \
+  } else {                                                              \
+    const unsigned_type *raw_values = raw;                              \
+    for (i = 0; i < GRN_RA_BLOCK_N_VALUES; i++) {                       \
+      values[i] = raw_values[i];                                        \
+    }                                                                   \
+  }                                                                     \
+} while (0)
+
+/* Values are sign extended for signed columns. */
+static void
+grn_ra_block_load(grn_ra *ra, const void *raw, uint64_t *values)
+{
+  grn_bool is_signed = grn_ra_block_is_signed(ra);
+  uint32_t i;
+  switch (ra->header->element_size) {
+  case 1 :
+    GRN_RA_BLOCK_LOAD(int8_t, uint8_t);
+    break;
+  case 2 :
+    GRN_RA_BLOCK_LOAD(int16_t, uint16_t);
+    break;
+  case 4 :
+    GRN_RA_BLOCK_LOAD(int32_t, uint32_t);
+    break;
+  default :
+    grn_memcpy(values, raw, sizeof(uint64_t) * GRN_RA_BLOCK_N_VALUES);
+    break;
+  }
+}
+
+#undef GRN_RA_BLOCK_LOAD
+
+/* It's the same as grn_ra_block_load() for a value. */
+static uint64_t
+grn_ra_block_load_value(grn_ra *ra, const void *raw)
+{
+  grn_bool is_signed = grn_ra_block_is_signed(ra);
+  uint64_t value;
+  switch (ra->header->element_size) {
+  case 1 :
+    if (is_signed) {
+      return (uint64_t)(int64_t)*((const int8_t *)raw);
+    } else {
+      return *((const uint8_t *)raw);
+    }
+  case 2 :
+    if (is_signed) {
+      return (uint64_t)(int64_t)*((const int16_t *)raw);
+    } else {
+      return *((const uint16_t *)raw);
+    }
+  case 4 :
+    if (is_signed) {
+      return (uint64_t)(int64_t)*((const int32_t *)raw);
+    } else {
+      return *((const uint32_t *)raw);
+    }
+  default :
+    grn_memcpy(&value, raw, sizeof(uint64_t));
+    return value;
+  }
+}
+
+#define GRN_RA_BLOCK_STORE(type) do {                                   \
+  type *raw_values = raw;                                               \
+  for (i = 0; i < GRN_RA_BLOCK_N_VALUES; i++) {                         \
+    raw_values[i] = (type)values[i];                                    \
+  }                                                                     \
+} while (0)
+
+static void
+grn_ra_block_store(grn_ra *ra, const uint64_t *values, void *raw)
+{
+  uint32_t i;
+  switch (ra->header->element_size) {
+  case 1 :
+    GRN_RA_BLOCK_STORE(uint8_t);
+    break;
+  case 2 :
+    GRN_RA_BLOCK_STORE(uint16_t);
+    break;
+  case 4 :
+    GRN_RA_BLOCK_STORE(uint32_t);
+    break;
+  default :
+    grn_memcpy(raw, values, sizeof(uint64_t) * GRN_RA_BLOCK_N_VALUES);
+    break;
+  }
+}
+
+#undef GRN_RA_BLOCK_STORE
+
+/*
+ * The first value of block 0 is GRN_ID_NIL's value. It isn't a
+ * record. Values after last_offset are ignored.
+ */
+static void
+grn_ra_block_range(grn_bool is_signed, uint32_t block_id,
+                   const uint64_t *values, uint32_t last_offset,
+                   uint64_t *min, uint64_t *max)
+{
+  uint32_t i = (block_id == 0) ? 1 : 0;
+  *min = values[i];
+  *max = values[i];
+  for (i++; i <= last_offset; i++) {
+    if (grn_ra_block_less(is_signed, values[i], *min)) {
+      *min = values[i];
+    }
+    if (grn_ra_block_less(is_signed, *max, values[i])) {
+      *max = values[i];
+    }
+  }
+}
+
+static void
+grn_ra_block_pack_offsets(const uint64_t *offsets, uint8_t width,
+                          uint64_t *words)
+{
+  uint32_t i;
+  memset(words, 0, sizeof(uint64_t) * GRN_RA_BLOCK_N_WORDS(width));
+  if (width == 0) {
+    return;
+  }
+  for (i = 0; i < GRN_RA_BLOCK_N_VALUES; i++) {
+    uint64_t bit = (uint64_t)i * width;
+    uint32_t word = (uint32_t)(bit >> 6);
+    uint32_t shift = (uint32_t)(bit & 63);
+    words[word] |= offsets[i] << shift;
+    if (shift + width > 64) {
+      words[word + 1] |= offsets[i] >> (64 - shift);
+    }
+  }
+}
+
+static void
+grn_ra_block_unpack_offsets(const uint64_t *words, uint8_t width,
+                            uint64_t *offsets)
+{
+  uint32_t i;
+  uint64_t mask;
+  if (width == 0) {
+    memset(offsets, 0, sizeof(uint64_t) * GRN_RA_BLOCK_N_VALUES);
+    return;
+  }
+  mask = (width == 64) ? ~((uint64_t)0) : ((((uint64_t)1) << width) - 1);
+  for (i = 0; i < GRN_RA_BLOCK_N_VALUES; i++) {
+    uint64_t bit = (uint64_t)i * width;
+    uint32_t word = (uint32_t)(bit >> 6);
+    uint32_t shift = (uint32_t)(bit & 63);
+    uint64_t offset = words[word] >> shift;
+    if (shift + width > 64) {
+      offset |= words[word + 1] << (64 - shift);
+    }
+    offsets[i] = offset & mask;
+  }
+}
+
+/*
+ * grn_ra_block_encode() packs a raw block to `packed` and returns the
+ * size of the packed block. `packed` must have
+ * sizeof(grn_ra_block_header) / sizeof(uint64_t) +
+ * GRN_RA_BLOCK_N_VALUES words.
+ */
+static uint32_t
+grn_ra_block_encode(grn_ra *ra, uint32_t block_id, const void *raw,
+                    uint64_t *packed)
+{
+  grn_bool is_signed = grn_ra_block_is_signed(ra);
+  uint64_t values[GRN_RA_BLOCK_N_VALUES];
+  grn_ra_block_header header;
+  uint64_t for_min, for_max;
+  int64_t delta_min, delta_max;
+  uint8_t for_width, delta_width;
+  uint32_t i;
+
+  grn_ra_block_load(ra, raw, values);
+  memset(&header, 0, sizeof(header));
+  grn_ra_block_range(is_signed, block_id, values, GRN_RA_BLOCK_MASK,
+                     &(header.min), &(header.max));
+
+  for_min = for_max = values[0];
+  delta_min = delta_max = (int64_t)(values[1] - values[0]);
+  for (i = 1; i < GRN_RA_BLOCK_N_VALUES; i++) {
+    int64_t delta = (int64_t)(values[i] - values[i - 1]);
+    if (grn_ra_block_less(is_signed, values[i], for_min)) {
+      for_min = values[i];
+    }
+    if (grn_ra_block_less(is_signed, for_max, values[i])) {
+      for_max = values[i];
+    }
+    if (delta < delta_min) {
+      delta_min = delta;
+    }
+    if (delta_max < delta) {
+      delta_max = delta;
+    }
+  }
+  for_width = grn_ra_block_bit_width(for_max - for_min);
+  delta_width =
+    grn_ra_block_bit_width((uint64_t)delta_max - (uint64_t)delta_min);
+
+  if (delta_width < for_width) {
+    header.mode = GRN_RA_BLOCK_MODE_DELTA;
+    header.width = delta_width;
+    header.base = values[0];
+    header.delta_min = (uint64_t)delta_min;
+    for (i = GRN_RA_BLOCK_N_VALUES - 1; i > 0; i--) {
+      values[i] = values[i] - values[i - 1] - header.delta_min;
+    }
+    values[0] = 0;
+  } else {
+    header.mode = GRN_RA_BLOCK_MODE_FOR;
+    header.width = for_width;
+    header.base = for_min;
+    for (i = 0; i < GRN_RA_BLOCK_N_VALUES; i++) {
+      values[i] -= for_min;
+    }
+  }
+  grn_memcpy(packed, &header, sizeof(header));
+  grn_ra_block_pack_offsets(values, header.width,
+                            packed + sizeof(header) / sizeof(uint64_t));
+  return sizeof(header) + GRN_RA_BLOCK_N_WORDS(header.width) * sizeof(uint64_t);
+}
+
+static grn_rc
+grn_ra_block_decode(grn_ctx *ctx, grn_ra *ra, uint32_t block_id,
+                    const void *packed, uint32_t packed_size, void *raw)
+{
+  grn_ra_block_header header;
+  uint64_t words[GRN_RA_BLOCK_N_VALUES];
+  uint64_t values[GRN_RA_BLOCK_N_VALUES];
+  uint32_t i;
+
+  if (packed_size < sizeof(header)) {
+    ERR(GRN_FILE_CORRUPT, "[ra][block] block is too small: <%u>", block_id);
+    return ctx->rc;
+  }
+  grn_memcpy(&header, packed, sizeof(header));
+  if (header.mode > GRN_RA_BLOCK_MODE_DELTA ||
+      header.width > 64 ||
+      packed_size != sizeof(header) +
+                     GRN_RA_BLOCK_N_WORDS(header.width) * sizeof(uint64_t)) {
+    ERR(GRN_FILE_CORRUPT, "[ra][block] broken block: <%u>", block_id);
+    return ctx->rc;
+  }
+  grn_memcpy(words, (const byte *)packed + sizeof(header),
+             packed_size - sizeof(header));
+  grn_ra_block_unpack_offsets(words, header.width, values);
+  if (header.mode == GRN_RA_BLOCK_MODE_DELTA) {
+    values[0] = header.base;
+    for (i = 1; i < GRN_RA_BLOCK_N_VALUES; i++) {
+      values[i] += values[i - 1] + header.delta_min;
+    }
+  } else {
+    for (i = 0; i < GRN_RA_BLOCK_N_VALUES; i++) {
+      values[i] += header.base;
+    }
+  }
+  grn_ra_block_store(ra, values, raw);
+  return GRN_SUCCESS;
+}
+
+static void *
+grn_ra_block_tail(grn_ra *ra, uint32_t block_id)
+{
+  return ((byte *)ra->block.tail) +
+    (block_id & 1) * GRN_RA_BLOCK_N_VALUES * ra->header->element_size;
+}
+
+/* A block that isn't stored yet has only zeros. */
+static grn_rc
+grn_ra_block_read(grn_ctx *ctx, grn_ra *ra, uint32_t block_id, void *raw)
+{
+  grn_io_win iw;
+  void *packed;
+  uint32_t packed_size;
+  grn_rc rc;
+
+  packed = grn_ja_ref(ctx, ra->block.store, block_id + 1, &iw, &packed_size);
+  if (!packed) {
+    memset(raw, 0, GRN_RA_BLOCK_N_VALUES * ra->header->element_size);
+    return GRN_SUCCESS;
+  }
+  rc = grn_ra_block_decode(ctx, ra, block_id, packed, packed_size, raw);
+  grn_ja_unref(ctx, &iw);
+  return rc;
+}
+
+static void
+grn_ra_block_check_generation(grn_ctx *ctx, grn_ra *ra)
+{
+  uint32_t generation = ra->header->generation;
+  if (ra->block.generation != generation) {
+    ra->block.cache_owner_id = grn_block_cache_generate_owner_id();
+    ra->block.generation = generation;
+  }
+}
+
+/*
+ * grn_ra_block_fetch() sets a referenced block cache entry to `entry`.
+ * It sets NULL for a block that isn't stored yet. The entry must be
+ * released by grn_block_cache_unref().
+ */
+static grn_rc
+grn_ra_block_fetch(grn_ctx *ctx, grn_ra *ra, uint32_t block_id,
+                   grn_block_cache_entry **entry)
+{
+  uint32_t owner_id;
+  grn_io_win iw;
+  void *packed;
+  uint32_t packed_size;
+  grn_rc rc;
+
+  grn_ra_block_check_generation(ctx, ra);
+  owner_id = ra->block.cache_owner_id;
+  *entry = grn_block_cache_fetch(ctx, owner_id, block_id);
+  if (*entry) {
+    return GRN_SUCCESS;
+  }
+
+  packed = grn_ja_ref(ctx, ra->block.store, block_id + 1, &iw, &packed_size);
+  if (!packed) {
+    return GRN_SUCCESS;
+  }
+  *entry = grn_block_cache_entry_open(ctx,
+                                      GRN_RA_BLOCK_N_VALUES *
+                                      ra->header->element_size);
+  if (!*entry) {
+    grn_ja_unref(ctx, &iw);
+    return ctx->rc;
+  }
+  rc = grn_ra_block_decode(ctx, ra, block_id, packed, packed_size,
+                           (*entry)->data);
+  grn_ja_unref(ctx, &iw);
+  if (rc != GRN_SUCCESS) {
+    grn_block_cache_entry_close(ctx, *entry);
+    *entry = NULL;
+    return rc;
+  }
+  *entry = grn_block_cache_add(ctx, owner_id, block_id, *entry);
+  return GRN_SUCCESS;
+}
+
+/*
+ * grn_ra_block_ref() returns the value of the record. It sets a
+ * referenced block cache entry to `entry` when the value is in a
+ * packed block.
+ */
+static void *
+grn_ra_block_ref(grn_ctx *ctx, grn_ra *ra, grn_id id,
+                 grn_block_cache_entry **entry)
+{
+  uint32_t block_id = id >> GRN_RA_BLOCK_W_N_VALUES;
+  uint32_t offset = (id & GRN_RA_BLOCK_MASK) * ra->header->element_size;
+  *entry = NULL;
+  if (ra->header->tail_block == block_id + 1) {
+    return ((byte *)grn_ra_block_tail(ra, block_id)) + offset;
+  }
+  if (grn_ra_block_fetch(ctx, ra, block_id, entry) != GRN_SUCCESS) {
+    return NULL;
+  }
+  if (!*entry) {
+    return ((byte *)grn_ra_block_zero_values) + offset;
+  }
+  return ((byte *)((*entry)->data)) + offset;
+}
+
+/* It must be called with ra->block.lock locked. */
+static grn_rc
+grn_ra_block_pack(grn_ctx *ctx, grn_ra *ra, uint32_t block_id, const void *raw)
+{
+  uint64_t packed[sizeof(grn_ra_block_header) / sizeof(uint64_t) +
+                  GRN_RA_BLOCK_N_VALUES];
+  uint32_t packed_size;
+
+  packed_size = grn_ra_block_encode(ra, block_id, raw, packed);
+  return grn_ja_put(ctx, ra->block.store, block_id + 1,
+                    packed, packed_size, GRN_OBJ_SET, NULL);
+}
+
+/* It must be called with ra->block.lock locked. */
+static grn_rc
+grn_ra_block_update(grn_ctx *ctx, grn_ra *ra, grn_id id, const void *value)
+{
+  uint32_t block_id = id >> GRN_RA_BLOCK_W_N_VALUES;
+  uint32_t element_size = ra->header->element_size;
+  uint64_t raw[GRN_RA_BLOCK_N_VALUES];
+  uint32_t generation;
+  grn_rc rc;
+
+  rc = grn_ra_block_read(ctx, ra, block_id, raw);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+  grn_memcpy(((byte *)raw) + (id & GRN_RA_BLOCK_MASK) * element_size,
+             value, element_size);
+  rc = grn_ra_block_pack(ctx, ra, block_id, raw);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+  GRN_ATOMIC_ADD_EX(&(ra->header->generation), 1, generation);
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+grn_ra_block_put(grn_ctx *ctx, grn_ra *ra, grn_id id, const void *value)
+{
+  uint32_t block_id = id >> GRN_RA_BLOCK_W_N_VALUES;
+  uint32_t element_size = ra->header->element_size;
+  uint32_t tail_block;
+  grn_rc rc = GRN_SUCCESS;
+
+  CRITICAL_SECTION_ENTER(ra->block.lock);
+  tail_block = ra->header->tail_block;
+  if (tail_block == 0 || block_id + 1 > tail_block) {
+    if (tail_block > 0) {
+      rc = grn_ra_block_pack(ctx, ra, tail_block - 1,
+                             grn_ra_block_tail(ra, tail_block - 1));
+    }
+    if (rc == GRN_SUCCESS) {
+      memset(grn_ra_block_tail(ra, block_id), 0,
+             GRN_RA_BLOCK_N_VALUES * element_size);
+      ra->header->tail_block = block_id + 1;
+    }
+  }
+  if (rc == GRN_SUCCESS) {
+    if (ra->header->tail_block == block_id + 1) {
+      grn_memcpy(((byte *)grn_ra_block_tail(ra, block_id)) +
+                 (id & GRN_RA_BLOCK_MASK) * element_size,
+                 value, element_size);
+    } else {
+      rc = grn_ra_block_update(ctx, ra, id, value);
+    }
+  }
+  CRITICAL_SECTION_LEAVE(ra->block.lock);
+  return rc;
+}
+
+static void
+grn_ra_zone_widen(grn_bool is_signed, uint64_t value,
+                  uint64_t *min, uint64_t *max)
+{
+  if (grn_ra_block_less(is_signed, value, *min)) {
+    *min = value;
+  }
+  if (grn_ra_block_less(is_signed, *max, value)) {
+    *max = value;
+  }
+}
+
+/* It's called before the value is stored. */
+static grn_rc
+grn_ra_zone_map_update(grn_ctx *ctx, grn_ra *ra, grn_id id, const void *value)
+{
+  uint32_t block_id = id >> GRN_RA_BLOCK_W_N_VALUES;
+  uint32_t offset = id & GRN_RA_BLOCK_MASK;
+  grn_bool is_signed = grn_ra_block_is_signed(ra);
+  uint64_t new_value = grn_ra_block_load_value(ra, value);
+  uint32_t first_unstored_offset;
+  uint64_t min, max;
+  grn_ra_zone *zone;
+
+  CRITICAL_SECTION_ENTER(ra->block.lock);
+  zone = grn_ra_ref(ctx, ra->zone_map, block_id);
+  if (!zone) {
+    CRITICAL_SECTION_LEAVE(ra->block.lock);
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[ra][zone-map] failed to refer zone: <%u>", block_id);
+    return ctx->rc;
+  }
+  if (zone->n_values == 0) {
+    min = max = new_value;
+    first_unstored_offset = (block_id == 0) ? 1 : 0;
+  } else {
+    min = zone->min;
+    max = zone->max;
+    grn_ra_zone_widen(is_signed, new_value, &min, &max);
+    first_unstored_offset = zone->n_values;
+  }
+  if (offset > first_unstored_offset) {
+    grn_ra_zone_widen(is_signed, 0, &min, &max);
+  }
+  zone->min = min;
+  zone->max = max;
+  if (offset >= zone->n_values) {
+    zone->n_values = offset + 1;
+  }
+  grn_ra_unref(ctx, ra->zone_map, block_id);
+  CRITICAL_SECTION_LEAVE(ra->block.lock);
+  return GRN_SUCCESS;
+}
+
 static grn_ra *
-_grn_ra_create(grn_ctx *ctx, grn_ra *ra, const char *path, unsigned int element_size)
+_grn_ra_create(grn_ctx *ctx, grn_ra *ra, const char *path,
+               unsigned int element_size, uint32_t flags)
 {
   grn_io *io;
   int max_segments, n_elm, w_elm;
@@ -38,7 +818,16 @@ _grn_ra_create(grn_ctx *ctx, grn_ra *ra, const char *path, unsigned int element_
     return NULL;
   }
   for (actual_size = 1; actual_size < element_size; actual_size *= 2) ;
-  max_segments = ((GRN_ID_MAX + 1) / GRN_RA_SEGMENT_SIZE) * actual_size;
+  if ((flags & GRN_OBJ_COMPRESS_BLOCK) && actual_size > GRN_RA_BLOCK_MAX_SIZE) {
+    ERR(GRN_INVALID_ARGUMENT,
+        "[ra][block] element_size too large (%d)", element_size);
+    return NULL;
+  }
+  if (flags & GRN_OBJ_COMPRESS_BLOCK) {
+    max_segments = 1;
+  } else {
+    max_segments = ((GRN_ID_MAX + 1) / GRN_RA_SEGMENT_SIZE) * actual_size;
+  }
   io = grn_io_create(ctx, path, sizeof(struct grn_ra_header),
                      GRN_RA_SEGMENT_SIZE, max_segments, grn_io_auto,
                      GRN_IO_EXPIRE_SEGMENT);
@@ -46,24 +835,41 @@ _grn_ra_create(grn_ctx *ctx, grn_ra *ra, const char *path, unsigned int element_
   header = grn_io_header(io);
   grn_io_set_type(io, GRN_COLUMN_FIX_SIZE);
   header->element_size = actual_size;
+  header->flags =
+    flags & (GRN_OBJ_COMPRESS_BLOCK | GRN_OBJ_KEY_MASK | GRN_OBJ_WITH_ZONE_MAP);
   n_elm = GRN_RA_SEGMENT_SIZE / header->element_size;
   for (w_elm = GRN_RA_W_SEGMENT; (1 << w_elm) > n_elm; w_elm--);
   ra->io = io;
   ra->header = header;
   ra->element_mask =  n_elm - 1;
   ra->element_width = w_elm;
+  ra->stats = NULL;
+  if (grn_ra_block_create(ctx, ra, path) != GRN_SUCCESS ||
+      grn_ra_zone_map_create(ctx, ra, path) != GRN_SUCCESS) {
+    grn_ra_block_close(ctx, ra);
+    grn_io_close(ctx, io);
+    if (path) {
+      grn_ra_block_remove(ctx, path);
+      grn_io_remove(ctx, path);
+    }
+    return NULL;
+  }
   return ra;
 }
 
 grn_ra *
-grn_ra_create(grn_ctx *ctx, const char *path, unsigned int element_size)
+grn_ra_create(grn_ctx *ctx, const char *path, unsigned int element_size,
+              uint32_t flags)
 {
   grn_ra *ra = GRN_MALLOCN(grn_ra, 1);
   if (!ra) {
     return NULL;
   }
   GRN_DB_OBJ_SET_TYPE(ra, GRN_COLUMN_FIX_SIZE);
-  if (!_grn_ra_create(ctx, ra, path, element_size)) {
+  grn_ra_block_init(ctx, ra);
+  ra->zone_map = NULL;
+  if (!_grn_ra_create(ctx, ra, path, element_size, flags)) {
+    grn_ra_block_fin(ctx, ra);
     GRN_FREE(ra);
     return NULL;
   }
@@ -101,6 +907,16 @@ grn_ra_open(grn_ctx *ctx, const char *path)
   ra->header = header;
   ra->element_mask =  n_elm - 1;
   ra->element_width = w_elm;
+  grn_ra_block_init(ctx, ra);
+  ra->zone_map = NULL;
+  if (grn_ra_block_open(ctx, ra, path) != GRN_SUCCESS ||
+      grn_ra_zone_map_open(ctx, ra, path) != GRN_SUCCESS) {
+    grn_ra_block_fin(ctx, ra);
+    grn_io_close(ctx, io);
+    GRN_FREE(ra);
+    return NULL;
+  }
+  ra->stats = grn_column_stats_open(ctx, path);
   return ra;
 }
 
@@ -117,6 +933,9 @@ grn_ra_close(grn_ctx *ctx, grn_ra *ra)
 {
   grn_rc rc;
   if (!ra) { return GRN_INVALID_ARGUMENT; }
+  if (ra->stats) { grn_column_stats_close(ctx, ra->stats); }
+  grn_ra_zone_map_close(ctx, ra);
+  grn_ra_block_fin(ctx, ra);
   rc = grn_io_close(ctx, ra->io);
   GRN_FREE(ra);
   return rc;
@@ -125,7 +944,14 @@ grn_ra_close(grn_ctx *ctx, grn_ra *ra)
 grn_rc
 grn_ra_remove(grn_ctx *ctx, const char *path)
 {
+  grn_rc rc;
   if (!path) { return GRN_INVALID_ARGUMENT; }
+  rc = grn_column_stats_remove(ctx, path);
+  if (rc != GRN_SUCCESS) { return rc; }
+  rc = grn_ra_block_remove(ctx, path);
+  if (rc != GRN_SUCCESS) { return rc; }
+  rc = grn_ra_zone_map_remove(ctx, path);
+  if (rc != GRN_SUCCESS) { return rc; }
   return grn_io_remove(ctx, path);
 }
 
@@ -136,6 +962,7 @@ grn_ra_truncate(grn_ctx *ctx, grn_ra *ra)
   const char *io_path;
   char *path;
   unsigned int element_size;
+  uint32_t flags;
   if ((io_path = grn_io_path(ra->io)) && *io_path != '\0') {
     if (!(path = GRN_STRDUP(io_path))) {
       ERR(GRN_NO_MEMORY_AVAILABLE, "cannot duplicate path: <%s>", io_path);
@@ -145,10 +972,21 @@ grn_ra_truncate(grn_ctx *ctx, grn_ra *ra)
     path = NULL;
   }
   element_size = ra->header->element_size;
+  flags = ra->header->flags;
+  if (ra->stats) {
+    grn_column_stats_close(ctx, ra->stats);
+    ra->stats = NULL;
+    if (path && (rc = grn_column_stats_remove(ctx, path))) { goto exit; }
+  }
+  grn_ra_zone_map_close(ctx, ra);
+  if (path && (rc = grn_ra_zone_map_remove(ctx, path))) { goto exit; }
+  grn_ra_block_close(ctx, ra);
+  if (path && (rc = grn_ra_block_remove(ctx, path))) { goto exit; }
   if ((rc = grn_io_close(ctx, ra->io))) { goto exit; }
   ra->io = NULL;
   if (path && (rc = grn_io_remove(ctx, path))) { goto exit; }
-  if (!_grn_ra_create(ctx, ra, path, element_size)) {
+  ra->block.cache_owner_id = grn_block_cache_generate_owner_id();
+  if (!_grn_ra_create(ctx, ra, path, element_size, flags)) {
     rc = GRN_UNKNOWN_ERROR;
   }
 exit:
@@ -162,6 +1000,13 @@ grn_ra_ref(grn_ctx *ctx, grn_ra *ra, grn_id id)
   void *p = NULL;
   uint16_t seg;
   if (id > GRN_ID_MAX) { return NULL; }
+  if (GRN_RA_IS_COMPRESSED(ra)) {
+    /* grn_ra_unref() can't release the block cache entry. */
+    ERR(GRN_OPERATION_NOT_SUPPORTED,
+        "[ra][ref] compressed column must be referred by "
+        "grn_ra_get_value() or grn_ra_ref_cache()");
+    return NULL;
+  }
   seg = id >> ra->element_width;
   GRN_IO_SEG_REF(ra->io, seg, p);
   if (!p) { return NULL; }
@@ -173,17 +1018,207 @@ grn_ra_unref(grn_ctx *ctx, grn_ra *ra, grn_id id)
 {
   uint16_t seg;
   if (id > GRN_ID_MAX) { return GRN_INVALID_ARGUMENT; }
+  if (GRN_RA_IS_COMPRESSED(ra)) { return GRN_SUCCESS; }
   seg = id >> ra->element_width;
   GRN_IO_SEG_UNREF(ra->io, seg);
   return GRN_SUCCESS;
 }
 
+grn_rc
+grn_ra_get_value(grn_ctx *ctx, grn_ra *ra, grn_id id, void *value)
+{
+  void *p;
+  if (id > GRN_ID_MAX) { return GRN_INVALID_ARGUMENT; }
+  if (GRN_RA_IS_COMPRESSED(ra)) {
+    grn_block_cache_entry *entry;
+    p = grn_ra_block_ref(ctx, ra, id, &entry);
+    if (p) {
+      grn_memcpy(value, p, ra->header->element_size);
+    }
+    if (entry) {
+      grn_block_cache_unref(ctx, entry);
+    }
+  } else {
+    p = grn_ra_ref(ctx, ra, id);
+    if (p) {
+      grn_memcpy(value, p, ra->header->element_size);
+      grn_ra_unref(ctx, ra, id);
+    }
+  }
+  if (!p) {
+    if (ctx->rc == GRN_SUCCESS) {
+      ERR(GRN_NO_MEMORY_AVAILABLE, "[ra][get-value] failed to refer: <%u>",
+          id);
+    }
+    return ctx->rc;
+  }
+  return GRN_SUCCESS;
+}
+
+grn_rc
+grn_ra_put(grn_ctx *ctx, grn_ra *ra, grn_id id, const void *value)
+{
+  void *p;
+  if (id > GRN_ID_MAX) { return GRN_INVALID_ARGUMENT; }
+  if (GRN_RA_IS_COMPRESSED(ra)) {
+    return grn_ra_block_put(ctx, ra, id, value);
+  }
+  if (GRN_RA_HAS_ZONE_MAP(ra)) {
+    grn_rc rc = grn_ra_zone_map_update(ctx, ra, id, value);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+  }
+  p = grn_ra_ref(ctx, ra, id);
+  if (!p) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "ra get failed");
+    return ctx->rc;
+  }
+  grn_memcpy(p, value, ra->header->element_size);
+  grn_ra_unref(ctx, ra, id);
+  return GRN_SUCCESS;
+}
+
+grn_rc
+grn_ra_get_block_summary(grn_ctx *ctx, grn_ra *ra, grn_id id, grn_id max_id,
+                         grn_ra_block_summary *summary)
+{
+  uint32_t block_id = id >> GRN_RA_BLOCK_W_N_VALUES;
+  uint32_t last_offset = GRN_RA_BLOCK_MASK;
+  grn_bool is_signed;
+  uint64_t min, max;
+
+  if (id > GRN_ID_MAX) { return GRN_INVALID_ARGUMENT; }
+  if (!GRN_RA_HAS_BLOCK_SUMMARY(ra)) {
+    return GRN_OPERATION_NOT_SUPPORTED;
+  }
+
+  if ((max_id >> GRN_RA_BLOCK_W_N_VALUES) == block_id) {
+    last_offset = max_id & GRN_RA_BLOCK_MASK;
+  }
+  is_signed = grn_ra_block_is_signed(ra);
+  if (GRN_RA_HAS_ZONE_MAP(ra)) {
+    grn_ra_zone *zone;
+    uint32_t n_values;
+    zone = grn_ra_ref(ctx, ra->zone_map, block_id);
+    if (!zone) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "[ra][zone-map] failed to refer zone: <%u>", block_id);
+      return ctx->rc;
+    }
+    n_values = zone->n_values;
+    min = zone->min;
+    max = zone->max;
+    grn_ra_unref(ctx, ra->zone_map, block_id);
+    if (n_values == 0) {
+      min = max = 0;
+    } else if (last_offset >= n_values) {
+      grn_ra_zone_widen(is_signed, 0, &min, &max);
+    }
+  } else if (ra->header->tail_block == block_id + 1) {
+    uint64_t values[GRN_RA_BLOCK_N_VALUES];
+    grn_ra_block_load(ra, grn_ra_block_tail(ra, block_id), values);
+    grn_ra_block_range(is_signed, block_id, values, last_offset, &min, &max);
+  } else {
+    grn_io_win iw;
+    void *packed;
+    uint32_t packed_size;
+    packed = grn_ja_ref(ctx, ra->block.store, block_id + 1, &iw, &packed_size);
+    if (packed) {
+      grn_ra_block_header header;
+      if (packed_size < sizeof(header)) {
+        grn_ja_unref(ctx, &iw);
+        ERR(GRN_FILE_CORRUPT, "[ra][block] block is too small: <%u>", block_id);
+        return ctx->rc;
+      }
+      grn_memcpy(&header, packed, sizeof(header));
+      grn_ja_unref(ctx, &iw);
+      min = header.min;
+      max = header.max;
+    } else {
+      min = max = 0;
+    }
+  }
+
+  summary->min_id = block_id << GRN_RA_BLOCK_W_N_VALUES;
+  if (summary->min_id == GRN_ID_NIL) {
+    summary->min_id++;
+  }
+  summary->max_id = (block_id << GRN_RA_BLOCK_W_N_VALUES) + GRN_RA_BLOCK_MASK;
+  summary->is_signed = is_signed;
+  summary->min.u = min;
+  summary->max.u = max;
+  return GRN_SUCCESS;
+}
+
+grn_bool
+grn_ra_block_summary_may_match(grn_ctx *ctx, grn_ra *ra,
+                               grn_ra_block_summary *summary,
+                               grn_operator op, const void *operand)
+{
+  grn_bool is_signed = summary->is_signed;
+  uint64_t min = summary->min.u;
+  uint64_t max = summary->max.u;
+  uint64_t value = grn_ra_block_load_value(ra, operand);
+
+  switch (op) {
+  case GRN_OP_EQUAL :
+    return !grn_ra_block_less(is_signed, value, min) &&
+           !grn_ra_block_less(is_signed, max, value);
+  case GRN_OP_NOT_EQUAL :
+    return !(min == value && max == value);
+  case GRN_OP_LESS :
+    return grn_ra_block_less(is_signed, min, value);
+  case GRN_OP_LESS_EQUAL :
+    return !grn_ra_block_less(is_signed, value, min);
+  case GRN_OP_GREATER :
+    return grn_ra_block_less(is_signed, value, max);
+  case GRN_OP_GREATER_EQUAL :
+    return !grn_ra_block_less(is_signed, max, value);
+  default :
+    return GRN_TRUE;
+  }
+}
+
+grn_rc
+grn_ra_flush(grn_ctx *ctx, grn_ra *ra)
+{
+  grn_rc rc;
+  rc = grn_io_flush(ctx, ra->io);
+  if (rc == GRN_SUCCESS && ra->block.store) {
+    rc = grn_io_flush(ctx, ra->block.store->io);
+  }
+  if (rc == GRN_SUCCESS && ra->zone_map) {
+    rc = grn_ra_flush(ctx, ra->zone_map);
+  }
+  return rc;
+}
+
 void *
 grn_ra_ref_cache(grn_ctx *ctx, grn_ra *ra, grn_id id, grn_ra_cache *cache)
 {
   void *p = NULL;
   uint16_t seg;
   if (id > GRN_ID_MAX) { return NULL; }
+  if (GRN_RA_IS_COMPRESSED(ra)) {
+    uint32_t block_id = id >> GRN_RA_BLOCK_W_N_VALUES;
+    grn_block_cache_entry *entry = cache->block;
+    if (ra->header->tail_block != block_id + 1 &&
+        entry &&
+        entry->block_id == block_id &&
+        entry->owner_id == ra->block.cache_owner_id &&
+        ra->block.generation == ra->header->generation) {
+      return ((byte *)entry->data) +
+        (id & GRN_RA_BLOCK_MASK) * ra->header->element_size;
+    }
+    if (entry) {
+      grn_block_cache_unref(ctx, entry);
+      cache->block = NULL;
+    }
+    p = grn_ra_block_ref(ctx, ra, id, &entry);
+    cache->block = entry;
+    return p;
+  }
   seg = id >> ra->element_width;
   if (seg == cache->seg) {
     p = cache->p;
@@ -197,11 +1232,21 @@ grn_ra_ref_cache(grn_ctx *ctx, grn_ra *ra, grn_id id, grn_ra_cache *cache)
   return (void *)(((byte *)p) + ((id & ra->element_mask) * ra->header->element_size));
 }
 
+void
+grn_ra_cache_fin_block(grn_ctx *ctx, grn_ra *ra, grn_ra_cache *cache)
+{
+  if (cache->block) {
+    grn_block_cache_unref(ctx, cache->block);
+    cache->block = NULL;
+  }
+}
+
 grn_rc
 grn_ra_cache_fin(grn_ctx *ctx, grn_ra *ra, grn_id id)
 {
   uint16_t seg;
   if (id > GRN_ID_MAX) { return GRN_INVALID_ARGUMENT; }
+  if (GRN_RA_IS_COMPRESSED(ra)) { return GRN_SUCCESS; }
   seg = id >> ra->element_width;
   GRN_IO_SEG_UNREF(ra->io, seg);
   return GRN_SUCCESS;
@@ -330,19 +1375,287 @@ struct grn_ja_header {
   uint8_t n_element_variation;
 };
 
-#define SEG_SEQ        (0x10000000U)
-#define SEG_HUGE       (0x20000000U)
-#define SEG_EINFO      (0x30000000U)
-#define SEG_GINFO      (0x40000000U)
-#define SEG_MASK       (0xf0000000U)
+#define SEG_SEQ        (0x10000000U)
+#define SEG_HUGE       (0x20000000U)
+#define SEG_EINFO      (0x30000000U)
+#define SEG_GINFO      (0x40000000U)
+#define SEG_MASK       (0xf0000000U)
+
+#define SEGMENTS_AT(ja,seg) ((ja)->header->dsegs[seg])
+#define SEGMENTS_SEGRE_ON(ja,seg,width) (SEGMENTS_AT(ja,seg) = width)
+#define SEGMENTS_SEQ_ON(ja,seg) (SEGMENTS_AT(ja,seg) = SEG_SEQ)
+#define SEGMENTS_HUGE_ON(ja,seg) (SEGMENTS_AT(ja,seg) = SEG_HUGE)
+#define SEGMENTS_EINFO_ON(ja,seg,lseg) (SEGMENTS_AT(ja,seg) = SEG_EINFO|(lseg))
+#define SEGMENTS_GINFO_ON(ja,seg,width) (SEGMENTS_AT(ja,seg) = SEG_GINFO|(width))
+#define SEGMENTS_OFF(ja,seg) (SEGMENTS_AT(ja,seg) = 0)
+
+/*
+ * COMPRESS_ZSTD columns keep the trained dictionary just after
+ * struct grn_ja_header_v2 in the file header. Values stored before the
+ * dictionary is trained are compressed without dictionary. They can be
+ * distinguished by the dictionary ID in the Zstandard frame.
+ *
+ * size is GRN_JA_ZSTD_DICTIONARY_WRITING while a process is writing the
+ * dictionary. It's set after data is written.
+ */
+#define GRN_JA_ZSTD_DICTIONARY_MAX_SIZE    (16 * 1024)
+#define GRN_JA_ZSTD_DICTIONARY_WRITING     UINT32_MAX
+
+typedef struct {
+  uint32_t size;
+  uint8_t data[GRN_JA_ZSTD_DICTIONARY_MAX_SIZE];
+} grn_ja_zstd_dictionary;
+
+static uint32_t
+grn_ja_header_size(uint32_t flags)
+{
+  uint32_t size = sizeof(struct grn_ja_header_v2);
+  if ((flags & GRN_OBJ_COMPRESS_MASK) == GRN_OBJ_COMPRESS_ZSTD) {
+    size += sizeof(grn_ja_zstd_dictionary);
+  }
+  return size;
+}
+
+#ifdef GRN_WITH_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+
+#define GRN_JA_ZSTD_DICTIONARY_MIN_SIZE    1024
+#define GRN_JA_ZSTD_N_SAMPLES              1024
+#define GRN_JA_ZSTD_MAX_SAMPLES_SIZE       (1024 * 1024)
+#define GRN_JA_ZSTD_COMPRESSION_LEVEL      3
+
+static void
+grn_ja_zstd_init(grn_ctx *ctx, grn_ja *ja)
+{
+  CRITICAL_SECTION_INIT(ja->zstd.lock);
+  ja->zstd.loaded = GRN_FALSE;
+  ja->zstd.trained = GRN_FALSE;
+  ja->zstd.n_cctxs = 0;
+  ja->zstd.n_dctxs = 0;
+  ja->zstd.cdict = NULL;
+  ja->zstd.ddict = NULL;
+}
+
+static void
+grn_ja_zstd_reset(grn_ctx *ctx, grn_ja *ja)
+{
+  uint32_t i;
+  for (i = 0; i < ja->zstd.n_cctxs; i++) {
+    ZSTD_freeCCtx(ja->zstd.cctxs[i]);
+  }
+  ja->zstd.n_cctxs = 0;
+  for (i = 0; i < ja->zstd.n_dctxs; i++) {
+    ZSTD_freeDCtx(ja->zstd.dctxs[i]);
+  }
+  ja->zstd.n_dctxs = 0;
+  if (ja->zstd.cdict) {
+    ZSTD_freeCDict(ja->zstd.cdict);
+    ja->zstd.cdict = NULL;
+  }
+  if (ja->zstd.ddict) {
+    ZSTD_freeDDict(ja->zstd.ddict);
+    ja->zstd.ddict = NULL;
+  }
+  ja->zstd.loaded = GRN_FALSE;
+  ja->zstd.trained = GRN_FALSE;
+}
+
+static void
+grn_ja_zstd_fin(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_ja_zstd_reset(ctx, ja);
+  CRITICAL_SECTION_FIN(ja->zstd.lock);
+}
+
+/*
+ * Compression and decompression contexts are taken from the cache of the
+ * column and are put back after use. So they are reused without
+ * serializing compression and decompression of the column.
+ */
+static ZSTD_CCtx *
+grn_ja_zstd_cctx_open(grn_ctx *ctx, grn_ja *ja)
+{
+  ZSTD_CCtx *cctx = NULL;
+  CRITICAL_SECTION_ENTER(ja->zstd.lock);
+  if (ja->zstd.n_cctxs > 0) {
+    cctx = ja->zstd.cctxs[--ja->zstd.n_cctxs];
+  }
+  CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+  if (!cctx) {
+    cctx = ZSTD_createCCtx();
+  }
+  return cctx;
+}
+
+static void
+grn_ja_zstd_cctx_close(grn_ctx *ctx, grn_ja *ja, ZSTD_CCtx *cctx)
+{
+  CRITICAL_SECTION_ENTER(ja->zstd.lock);
+  if (ja->zstd.n_cctxs < GRN_JA_ZSTD_N_CACHED_CONTEXTS) {
+    ja->zstd.cctxs[ja->zstd.n_cctxs++] = cctx;
+    cctx = NULL;
+  }
+  CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+  if (cctx) {
+    ZSTD_freeCCtx(cctx);
+  }
+}
+
+static ZSTD_DCtx *
+grn_ja_zstd_dctx_open(grn_ctx *ctx, grn_ja *ja)
+{
+  ZSTD_DCtx *dctx = NULL;
+  CRITICAL_SECTION_ENTER(ja->zstd.lock);
+  if (ja->zstd.n_dctxs > 0) {
+    dctx = ja->zstd.dctxs[--ja->zstd.n_dctxs];
+  }
+  CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+  if (!dctx) {
+    dctx = ZSTD_createDCtx();
+  }
+  return dctx;
+}
+
+static void
+grn_ja_zstd_dctx_close(grn_ctx *ctx, grn_ja *ja, ZSTD_DCtx *dctx)
+{
+  CRITICAL_SECTION_ENTER(ja->zstd.lock);
+  if (ja->zstd.n_dctxs < GRN_JA_ZSTD_N_CACHED_CONTEXTS) {
+    ja->zstd.dctxs[ja->zstd.n_dctxs++] = dctx;
+    dctx = NULL;
+  }
+  CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+  if (dctx) {
+    ZSTD_freeDCtx(dctx);
+  }
+}
+#endif /* GRN_WITH_ZSTD */
+
+/*
+ * GRN_OBJ_COMPRESS_BLOCK packs values of consecutive records into a
+ * block and compresses the whole block by the codec in
+ * GRN_OBJ_COMPRESS_MASK. Blocks are stored in another jagged array
+ * ("${path}.b") with the ID of the first record in the block. The raw
+ * value of a record ends with a tag:
+ *
+ *   GRN_JA_BLOCK_TAG_DIRECT: [value][tag]
+ *   GRN_JA_BLOCK_TAG_PACKED: [block ID (grn_id)][tag]
+ *
+ * Values are stored directly at first. They are packed when the size
+ * of values that aren't packed yet reaches GRN_JA_BLOCK_SIZE. Updated
+ * values of packed records are stored directly again and their old
+ * values are left in the block.
+ *
+ * The raw value of GRN_ID_NIL in the block store is the ID of the
+ * next record to be packed. It's a tiny value that is stored in the
+ * element info. So it doesn't conflict with the zero ID that
+ * terminates elements in a segment.
+ */
+#define GRN_JA_BLOCK_PATH_SUFFIX     ".b"
+#define GRN_JA_BLOCK_TAG_DIRECT      0x00
+#define GRN_JA_BLOCK_TAG_PACKED      0x01
+#define GRN_JA_BLOCK_PACKED_SIZE     (sizeof(grn_id) + 1)
+#define GRN_JA_BLOCK_SIZE            (64 * 1024)
+#define GRN_JA_BLOCK_MAX_N_RECORDS   16384
+#define GRN_JA_BLOCK_MAX_VALUE_SIZE  (16 * 1024)
+
+static grn_bool
+grn_ja_block_build_path(grn_ctx *ctx, const char *path, char *block_path)
+{
+  if (strlen(path) + strlen(GRN_JA_BLOCK_PATH_SUFFIX) >= PATH_MAX) {
+    ERR(GRN_FILENAME_TOO_LONG,
+        "[ja][block] too long path: <%s%s>",
+        path, GRN_JA_BLOCK_PATH_SUFFIX);
+    return GRN_FALSE;
+  }
+  grn_strcpy(block_path, PATH_MAX, path);
+  grn_strcat(block_path, PATH_MAX, GRN_JA_BLOCK_PATH_SUFFIX);
+  return GRN_TRUE;
+}
+
+static void
+grn_ja_block_init(grn_ctx *ctx, grn_ja *ja)
+{
+  CRITICAL_SECTION_INIT(ja->block.lock);
+  ja->block.store = NULL;
+  ja->block.cache_owner_id = grn_block_cache_generate_owner_id();
+  ja->block.next_pack_id = GRN_ID_NIL;
+  ja->block.n_pending_bytes = 0;
+}
+
+static grn_rc
+grn_ja_block_create(grn_ctx *ctx, grn_ja *ja, const char *path)
+{
+  char block_path[PATH_MAX];
+  const char *io_path = NULL;
+
+  if (!(ja->header->flags & GRN_OBJ_COMPRESS_BLOCK)) {
+    return GRN_SUCCESS;
+  }
+  if (path) {
+    if (!grn_ja_block_build_path(ctx, path, block_path)) {
+      return ctx->rc;
+    }
+    io_path = block_path;
+  }
+  ja->block.store = grn_ja_create(ctx, io_path, GRN_JA_BLOCK_SIZE, 0);
+  if (!ja->block.store) {
+    return ctx->rc == GRN_SUCCESS ? GRN_NO_MEMORY_AVAILABLE : ctx->rc;
+  }
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+grn_ja_block_open(grn_ctx *ctx, grn_ja *ja, const char *path)
+{
+  char block_path[PATH_MAX];
+
+  if (!(ja->header->flags & GRN_OBJ_COMPRESS_BLOCK)) {
+    return GRN_SUCCESS;
+  }
+  if (!grn_ja_block_build_path(ctx, path, block_path)) {
+    return ctx->rc;
+  }
+  ja->block.store = grn_ja_open(ctx, block_path);
+  if (!ja->block.store) {
+    return ctx->rc == GRN_SUCCESS ? GRN_FILE_CORRUPT : ctx->rc;
+  }
+  return GRN_SUCCESS;
+}
+
+static void
+grn_ja_block_close(grn_ctx *ctx, grn_ja *ja)
+{
+  if (ja->block.store) {
+    grn_ja_close(ctx, ja->block.store);
+    ja->block.store = NULL;
+    grn_block_cache_expire(ctx, ja->block.cache_owner_id);
+  }
+  ja->block.next_pack_id = GRN_ID_NIL;
+  ja->block.n_pending_bytes = 0;
+}
 
-#define SEGMENTS_AT(ja,seg) ((ja)->header->dsegs[seg])
-#define SEGMENTS_SEGRE_ON(ja,seg,width) (SEGMENTS_AT(ja,seg) = width)
-#define SEGMENTS_SEQ_ON(ja,seg) (SEGMENTS_AT(ja,seg) = SEG_SEQ)
-#define SEGMENTS_HUGE_ON(ja,seg) (SEGMENTS_AT(ja,seg) = SEG_HUGE)
-#define SEGMENTS_EINFO_ON(ja,seg,lseg) (SEGMENTS_AT(ja,seg) = SEG_EINFO|(lseg))
-#define SEGMENTS_GINFO_ON(ja,seg,width) (SEGMENTS_AT(ja,seg) = SEG_GINFO|(width))
-#define SEGMENTS_OFF(ja,seg) (SEGMENTS_AT(ja,seg) = 0)
+static void
+grn_ja_block_fin(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_ja_block_close(ctx, ja);
+  CRITICAL_SECTION_FIN(ja->block.lock);
+}
+
+static grn_rc
+grn_ja_block_remove(grn_ctx *ctx, const char *path)
+{
+  char block_path[PATH_MAX];
+
+  if (!grn_ja_block_build_path(ctx, path, block_path)) {
+    return ctx->rc;
+  }
+  if (!grn_path_exist(block_path)) {
+    return GRN_SUCCESS;
+  }
+  return grn_ja_remove(ctx, block_path);
+}
 
 static grn_ja *
 _grn_ja_create(grn_ctx *ctx, grn_ja *ja, const char *path,
@@ -352,7 +1665,7 @@ _grn_ja_create(grn_ctx *ctx, grn_ja *ja, const char *path,
   grn_io *io;
   struct grn_ja_header *header;
   struct grn_ja_header_v2 *header_v2;
-  io = grn_io_create(ctx, path, sizeof(struct grn_ja_header_v2),
+  io = grn_io_create(ctx, path, grn_ja_header_size(flags),
                      JA_SEGMENT_SIZE, JA_N_DSEGMENTS, grn_io_auto,
                      GRN_IO_EXPIRE_SEGMENT);
   if (!io) { return NULL; }
@@ -386,6 +1699,7 @@ _grn_ja_create(grn_ctx *ctx, grn_ja *ja, const char *path,
 
   ja->io = io;
   ja->header = header;
+  ja->stats = NULL;
   SEGMENTS_EINFO_ON(ja, 0, 0);
   header->esegs[0] = 0;
   return ja;
@@ -404,6 +1718,14 @@ grn_ja_create(grn_ctx *ctx, const char *path, unsigned int max_element_size, uin
     GRN_FREE(ja);
     return NULL;
   }
+#ifdef GRN_WITH_ZSTD
+  grn_ja_zstd_init(ctx, ja);
+#endif /* GRN_WITH_ZSTD */
+  grn_ja_block_init(ctx, ja);
+  if (grn_ja_block_create(ctx, ja, path) != GRN_SUCCESS) {
+    grn_ja_close(ctx, ja);
+    return NULL;
+  }
   return ja;
 }
 
@@ -468,6 +1790,15 @@ grn_ja_open(grn_ctx *ctx, const char *path)
 
   ja->io = io;
   ja->header = header;
+  ja->stats = grn_column_stats_open(ctx, path);
+#ifdef GRN_WITH_ZSTD
+  grn_ja_zstd_init(ctx, ja);
+#endif /* GRN_WITH_ZSTD */
+  grn_ja_block_init(ctx, ja);
+  if (grn_ja_block_open(ctx, ja, path) != GRN_SUCCESS) {
+    grn_ja_close(ctx, ja);
+    return NULL;
+  }
 
   return ja;
 }
@@ -485,6 +1816,11 @@ grn_ja_close(grn_ctx *ctx, grn_ja *ja)
 {
   grn_rc rc;
   if (!ja) { return GRN_INVALID_ARGUMENT; }
+  if (ja->stats) { grn_column_stats_close(ctx, ja->stats); }
+#ifdef GRN_WITH_ZSTD
+  grn_ja_zstd_fin(ctx, ja);
+#endif /* GRN_WITH_ZSTD */
+  grn_ja_block_fin(ctx, ja);
   rc = grn_io_close(ctx, ja->io);
   GRN_FREE(ja->header);
   GRN_FREE(ja);
@@ -494,7 +1830,12 @@ grn_ja_close(grn_ctx *ctx, grn_ja *ja)
 grn_rc
 grn_ja_remove(grn_ctx *ctx, const char *path)
 {
+  grn_rc rc;
   if (!path) { return GRN_INVALID_ARGUMENT; }
+  rc = grn_column_stats_remove(ctx, path);
+  if (rc != GRN_SUCCESS) { return rc; }
+  rc = grn_ja_block_remove(ctx, path);
+  if (rc != GRN_SUCCESS) { return rc; }
   return grn_io_remove(ctx, path);
 }
 
@@ -516,13 +1857,27 @@ grn_ja_truncate(grn_ctx *ctx, grn_ja *ja)
   }
   max_element_size = ja->header->max_element_size;
   flags = ja->header->flags;
+  if (ja->stats) {
+    grn_column_stats_close(ctx, ja->stats);
+    ja->stats = NULL;
+    if (path && (rc = grn_column_stats_remove(ctx, path))) { goto exit; }
+  }
+  if (ja->block.store) {
+    grn_ja_block_close(ctx, ja);
+    if (path && (rc = grn_ja_block_remove(ctx, path))) { goto exit; }
+  }
   if ((rc = grn_io_close(ctx, ja->io))) { goto exit; }
   ja->io = NULL;
   if (path && (rc = grn_io_remove(ctx, path))) { goto exit; }
   GRN_FREE(ja->header);
+#ifdef GRN_WITH_ZSTD
+  grn_ja_zstd_reset(ctx, ja);
+#endif /* GRN_WITH_ZSTD */
   if (!_grn_ja_create(ctx, ja, path, max_element_size, flags)) {
     rc = GRN_UNKNOWN_ERROR;
+    goto exit;
   }
+  rc = grn_ja_block_create(ctx, ja, path);
 exit:
   if (path) { GRN_FREE(path); }
   return rc;
@@ -918,7 +2273,7 @@ grn_ja_put_raw(grn_ctx *ctx, grn_ja *ja, grn_id id,
     void *old_value;
     grn_bool same_value = GRN_FALSE;
 
-    old_value = grn_ja_ref(ctx, ja, id, &jw, &old_len);
+    old_value = grn_ja_ref_raw(ctx, ja, id, &jw, &old_len);
     if (value_len == old_len && memcmp(value, old_value, value_len) == 0) {
       same_value = GRN_TRUE;
     }
@@ -1101,6 +2456,21 @@ grn_ja_putv(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_obj *vector, int flags)
       grn_text_benc(ctx, &footer, vp->domain);
     }
   }
+  if (ja->header->flags & GRN_OBJ_COMPRESS_BLOCK) {
+    grn_obj value;
+    grn_obj *body = vector->u.v.body;
+    GRN_TEXT_INIT(&value, 0);
+    GRN_TEXT_PUT(ctx, &value, GRN_BULK_HEAD(&header), GRN_BULK_VSIZE(&header));
+    if (body) {
+      GRN_TEXT_PUT(ctx, &value, GRN_BULK_HEAD(body), GRN_BULK_VSIZE(body));
+    }
+    GRN_TEXT_PUT(ctx, &value, GRN_BULK_HEAD(&footer), GRN_BULK_VSIZE(&footer));
+    rc = grn_ja_put(ctx, ja, id,
+                    GRN_BULK_HEAD(&value), GRN_BULK_VSIZE(&value),
+                    GRN_OBJ_SET, NULL);
+    GRN_OBJ_FIN(ctx, &value);
+    goto exit;
+  }
   {
     grn_io_win iw;
     grn_ja_einfo einfo;
@@ -1125,6 +2495,17 @@ exit :
   return rc;
 }
 
+grn_rc
+grn_ja_flush(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_rc rc;
+  rc = grn_io_flush(ctx, ja->io);
+  if (rc == GRN_SUCCESS && ja->block.store) {
+    rc = grn_io_flush(ctx, ja->block.store->io);
+  }
+  return rc;
+}
+
 uint32_t
 grn_ja_size(grn_ctx *ctx, grn_ja *ja, grn_id id)
 {
@@ -1228,70 +2609,535 @@ grn_ja_ref_zlib(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *v
     *value_len = 0;
     return NULL;
   }
-  *value_len = zstream.total_out;
-  if (inflateEnd(&zstream) != Z_OK) {
-    GRN_FREE(iw->uncompressed_value);
-    iw->uncompressed_value = NULL;
-    *value_len = 0;
+  *value_len = zstream.total_out;
+  if (inflateEnd(&zstream) != Z_OK) {
+    GRN_FREE(iw->uncompressed_value);
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  return iw->uncompressed_value;
+}
+#endif /* GRN_WITH_ZLIB */
+
+#ifdef GRN_WITH_LZ4
+#include <lz4.h>
+
+static void *
+grn_ja_ref_lz4(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *value_len)
+{
+  void *packed_value;
+  int packed_value_len;
+  void *lz4_value;
+  int lz4_value_len;
+  int original_value_len;
+
+  if (!(packed_value = grn_ja_ref_raw(ctx, ja, id, iw, &packed_value_len))) {
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  original_value_len = *((uint64_t *)packed_value);
+  if (!(iw->uncompressed_value = GRN_MALLOC(original_value_len))) {
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  lz4_value = (void *)((uint64_t *)packed_value + 1);
+  lz4_value_len = packed_value_len - sizeof(uint64_t);
+  if (LZ4_decompress_safe((const char *)(lz4_value),
+                          (char *)(iw->uncompressed_value),
+                          lz4_value_len,
+                          original_value_len) < 0) {
+    GRN_FREE(iw->uncompressed_value);
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  *value_len = original_value_len;
+  return iw->uncompressed_value;
+}
+#endif /* GRN_WITH_LZ4 */
+
+#ifdef GRN_WITH_ZSTD
+static grn_ja_zstd_dictionary *
+grn_ja_zstd_get_dictionary(grn_ctx *ctx, grn_ja *ja)
+{
+  if (ja->io->header->header_size <
+      sizeof(struct grn_ja_header_v2) + sizeof(grn_ja_zstd_dictionary)) {
+    return NULL;
+  }
+  return (grn_ja_zstd_dictionary *)
+    ((uint8_t *)grn_io_header(ja->io) + sizeof(struct grn_ja_header_v2));
+}
+
+/* It must be called in ja->zstd.lock. */
+static void
+grn_ja_zstd_load_dictionary(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_ja_zstd_dictionary *dictionary;
+  uint32_t dictionary_size;
+
+  if (ja->zstd.loaded) {
+    return;
+  }
+
+  dictionary = grn_ja_zstd_get_dictionary(ctx, ja);
+  if (!dictionary) {
+    ja->zstd.loaded = GRN_TRUE;
+    return;
+  }
+  dictionary_size = dictionary->size;
+  if (dictionary_size == GRN_JA_ZSTD_DICTIONARY_WRITING) {
+    /* Another process is writing. It'll be loaded later. */
+    return;
+  }
+  if (dictionary_size > 0 &&
+      dictionary_size <= GRN_JA_ZSTD_DICTIONARY_MAX_SIZE) {
+    if (!ja->zstd.cdict) {
+      ja->zstd.cdict = ZSTD_createCDict(dictionary->data, dictionary_size,
+                                        GRN_JA_ZSTD_COMPRESSION_LEVEL);
+    }
+    if (!ja->zstd.ddict) {
+      ja->zstd.ddict = ZSTD_createDDict(dictionary->data, dictionary_size);
+    }
+  }
+  ja->zstd.loaded = (dictionary_size > 0);
+}
+
+static ZSTD_DDict *
+grn_ja_zstd_get_ddict(grn_ctx *ctx, grn_ja *ja)
+{
+  ZSTD_DDict *ddict;
+
+  if (ja->zstd.ddict) {
+    return ja->zstd.ddict;
+  }
+
+  CRITICAL_SECTION_ENTER(ja->zstd.lock);
+  if (!ja->zstd.ddict) {
+    /* The dictionary may be stored by another process. */
+    ja->zstd.loaded = GRN_FALSE;
+    grn_ja_zstd_load_dictionary(ctx, ja);
+  }
+  ddict = ja->zstd.ddict;
+  CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+  return ddict;
+}
+
+static grn_rc
+grn_ja_zstd_decompress(grn_ctx *ctx, grn_ja *ja, ZSTD_DCtx *dctx,
+                       void *value, size_t value_size,
+                       const void *zstd_value, size_t zstd_value_size)
+{
+  unsigned int dictionary_id;
+  size_t decompressed_size;
+
+  dictionary_id = ZSTD_getDictID_fromFrame(zstd_value, zstd_value_size);
+  if (dictionary_id == 0) {
+    decompressed_size = ZSTD_decompressDCtx(dctx,
+                                            value, value_size,
+                                            zstd_value, zstd_value_size);
+  } else {
+    ZSTD_DDict *ddict = grn_ja_zstd_get_ddict(ctx, ja);
+    if (!ddict || ZSTD_getDictID_fromDDict(ddict) != dictionary_id) {
+      ERR(GRN_ZSTD_ERROR,
+          "[ja][zstd] dictionary isn't found: <%u>", dictionary_id);
+      return ctx->rc;
+    }
+    decompressed_size = ZSTD_decompress_usingDDict(dctx,
+                                                   value, value_size,
+                                                   zstd_value,
+                                                   zstd_value_size,
+                                                   ddict);
+  }
+  if (ZSTD_isError(decompressed_size)) {
+    ERR(GRN_ZSTD_ERROR,
+        "[ja][zstd] failed to decompress: <%s>",
+        ZSTD_getErrorName(decompressed_size));
+    return ctx->rc;
+  }
+  if (decompressed_size != value_size) {
+    ERR(GRN_ZSTD_ERROR,
+        "[ja][zstd] decompressed size is different: <%" GRN_FMT_SIZE ">: "
+        "expected: <%" GRN_FMT_SIZE ">",
+        decompressed_size, value_size);
+    return ctx->rc;
+  }
+  return GRN_SUCCESS;
+}
+
+static void *
+grn_ja_ref_zstd(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *value_len)
+{
+  void *packed_value;
+  uint32_t packed_value_len;
+  void *zstd_value;
+  uint32_t zstd_value_len;
+  uint32_t original_value_len;
+  ZSTD_DCtx *dctx;
+  grn_rc rc;
+
+  if (!(packed_value = grn_ja_ref_raw(ctx, ja, id, iw, &packed_value_len))) {
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  original_value_len = *((uint64_t *)packed_value);
+  if (!(iw->uncompressed_value = GRN_MALLOC(original_value_len))) {
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  if (!(dctx = grn_ja_zstd_dctx_open(ctx, ja))) {
+    GRN_FREE(iw->uncompressed_value);
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  zstd_value = (void *)((uint64_t *)packed_value + 1);
+  zstd_value_len = packed_value_len - sizeof(uint64_t);
+  rc = grn_ja_zstd_decompress(ctx, ja, dctx,
+                              iw->uncompressed_value, original_value_len,
+                              zstd_value, zstd_value_len);
+  grn_ja_zstd_dctx_close(ctx, ja, dctx);
+  if (rc != GRN_SUCCESS) {
+    GRN_FREE(iw->uncompressed_value);
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  *value_len = original_value_len;
+  return iw->uncompressed_value;
+}
+#endif /* GRN_WITH_ZSTD */
+
+typedef struct {
+  uint32_t size;  /* Size of the decompressed block. */
+  uint32_t codec; /* GRN_OBJ_COMPRESS_* that compresses the block. */
+} grn_ja_block_header;
+
+/*
+ * grn_ja_block_compress() compresses a block to `packed`. A decompressed
+ * block is [number of records][offsets of values (n + 1)][values].
+ * The block is stored without compression if it isn't shrunk.
+ */
+static grn_rc
+grn_ja_block_compress(grn_ctx *ctx, grn_ja *ja,
+                      const char *block, uint32_t block_size,
+                      grn_obj *packed)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_ja_block_header header;
+  size_t body_size = 0;
+
+  header.size = block_size;
+  header.codec = ja->header->flags & GRN_OBJ_COMPRESS_MASK;
+  GRN_BULK_REWIND(packed);
+  switch (header.codec) {
+#ifdef GRN_WITH_ZLIB
+  case GRN_OBJ_COMPRESS_ZLIB :
+    {
+      uLongf zlib_size = compressBound(block_size);
+      rc = grn_bulk_reserve(ctx, packed, sizeof(header) + zlib_size);
+      if (rc != GRN_SUCCESS) {
+        return rc;
+      }
+      if (compress2((Bytef *)GRN_BULK_HEAD(packed) + sizeof(header),
+                    &zlib_size,
+                    (const Bytef *)block,
+                    block_size,
+                    Z_DEFAULT_COMPRESSION) != Z_OK) {
+        ERR(GRN_ZLIB_ERROR, "[ja][block] failed to compress a block");
+        return ctx->rc;
+      }
+      body_size = zlib_size;
+    }
+    break;
+#endif /* GRN_WITH_ZLIB */
+#ifdef GRN_WITH_LZ4
+  case GRN_OBJ_COMPRESS_LZ4 :
+    {
+      int lz4_size = LZ4_compressBound(block_size);
+      rc = grn_bulk_reserve(ctx, packed, sizeof(header) + lz4_size);
+      if (rc != GRN_SUCCESS) {
+        return rc;
+      }
+      lz4_size = LZ4_compress(block,
+                              GRN_BULK_HEAD(packed) + sizeof(header),
+                              block_size);
+      if (lz4_size <= 0) {
+        ERR(GRN_LZ4_ERROR, "[ja][block] failed to compress a block");
+        return ctx->rc;
+      }
+      body_size = lz4_size;
+    }
+    break;
+#endif /* GRN_WITH_LZ4 */
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    {
+      size_t zstd_size_max = ZSTD_compressBound(block_size);
+      size_t zstd_size;
+      rc = grn_bulk_reserve(ctx, packed, sizeof(header) + zstd_size_max);
+      if (rc != GRN_SUCCESS) {
+        return rc;
+      }
+      zstd_size = ZSTD_compress(GRN_BULK_HEAD(packed) + sizeof(header),
+                                zstd_size_max,
+                                block,
+                                block_size,
+                                GRN_JA_ZSTD_COMPRESSION_LEVEL);
+      if (ZSTD_isError(zstd_size)) {
+        ERR(GRN_ZSTD_ERROR,
+            "[ja][block] failed to compress a block: %s",
+            ZSTD_getErrorName(zstd_size));
+        return ctx->rc;
+      }
+      body_size = zstd_size;
+    }
+    break;
+#endif /* GRN_WITH_ZSTD */
+  default :
+    header.codec = GRN_OBJ_COMPRESS_NONE;
+    break;
+  }
+  if (header.codec == GRN_OBJ_COMPRESS_NONE || body_size >= block_size) {
+    header.codec = GRN_OBJ_COMPRESS_NONE;
+    rc = grn_bulk_reserve(ctx, packed, sizeof(header) + block_size);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+    grn_memcpy(GRN_BULK_HEAD(packed) + sizeof(header), block, block_size);
+    body_size = block_size;
+  }
+  grn_memcpy(GRN_BULK_HEAD(packed), &header, sizeof(header));
+  GRN_BULK_INCR_LEN(packed, sizeof(header) + body_size);
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+grn_ja_block_decompress(grn_ctx *ctx, uint32_t codec,
+                        const char *packed, uint32_t packed_size,
+                        char *block, uint32_t block_size)
+{
+  switch (codec) {
+#ifdef GRN_WITH_ZLIB
+  case GRN_OBJ_COMPRESS_ZLIB :
+    {
+      uLongf zlib_size = block_size;
+      if (uncompress((Bytef *)block, &zlib_size,
+                     (const Bytef *)packed, packed_size) != Z_OK ||
+          zlib_size != block_size) {
+        ERR(GRN_ZLIB_ERROR, "[ja][block] failed to decompress a block");
+        return ctx->rc;
+      }
+    }
+    break;
+#endif /* GRN_WITH_ZLIB */
+#ifdef GRN_WITH_LZ4
+  case GRN_OBJ_COMPRESS_LZ4 :
+    if (LZ4_decompress_safe(packed, block, packed_size, block_size) !=
+        (int)block_size) {
+      ERR(GRN_LZ4_ERROR, "[ja][block] failed to decompress a block");
+      return ctx->rc;
+    }
+    break;
+#endif /* GRN_WITH_LZ4 */
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    {
+      size_t zstd_size = ZSTD_decompress(block, block_size,
+                                         packed, packed_size);
+      if (ZSTD_isError(zstd_size) || zstd_size != block_size) {
+        ERR(GRN_ZSTD_ERROR, "[ja][block] failed to decompress a block");
+        return ctx->rc;
+      }
+    }
+    break;
+#endif /* GRN_WITH_ZSTD */
+  case GRN_OBJ_COMPRESS_NONE :
+    if (packed_size != block_size) {
+      ERR(GRN_FILE_CORRUPT,
+          "[ja][block] block size mismatch: <%u> != <%u>",
+          packed_size, block_size);
+      return ctx->rc;
+    }
+    grn_memcpy(block, packed, block_size);
+    break;
+  default :
+    ERR(GRN_FUNCTION_NOT_IMPLEMENTED,
+        "[ja][block] unsupported compression: <%#x>", codec);
+    return ctx->rc;
+  }
+  return GRN_SUCCESS;
+}
+
+static grn_bool
+grn_ja_block_validate(const char *block, uint32_t block_size)
+{
+  const uint32_t *offsets;
+  uint32_t i, n_records, body_size;
+
+  if (block_size < sizeof(uint32_t) * 2) {
+    return GRN_FALSE;
+  }
+  n_records = *((const uint32_t *)block);
+  if (n_records > GRN_JA_BLOCK_MAX_N_RECORDS) {
+    return GRN_FALSE;
+  }
+  if (block_size < sizeof(uint32_t) * (n_records + 2)) {
+    return GRN_FALSE;
+  }
+  body_size = block_size - sizeof(uint32_t) * (n_records + 2);
+  offsets = (const uint32_t *)block + 1;
+  for (i = 0; i < n_records; i++) {
+    if (offsets[i] > offsets[i + 1]) {
+      return GRN_FALSE;
+    }
+  }
+  return offsets[0] == 0 && offsets[n_records] == body_size;
+}
+
+/*
+ * grn_ja_block_fetch() returns a referenced block cache entry. The
+ * entry must be released by grn_block_cache_unref().
+ */
+static grn_block_cache_entry *
+grn_ja_block_fetch(grn_ctx *ctx, grn_ja *ja, grn_id block_id)
+{
+  grn_block_cache_entry *entry;
+  grn_ja_block_header header;
+  grn_io_win iw;
+  const char *packed;
+  uint32_t packed_size;
+  grn_rc rc;
+
+  entry = grn_block_cache_fetch(ctx, ja->block.cache_owner_id, block_id);
+  if (entry) {
+    return entry;
+  }
+
+  packed = grn_ja_ref_raw(ctx, ja->block.store, block_id, &iw, &packed_size);
+  if (!packed) {
+    ERR(GRN_FILE_CORRUPT, "[ja][block] block doesn't exist: <%u>", block_id);
+    return NULL;
+  }
+  if (packed_size < sizeof(header)) {
+    grn_ja_unref(ctx, &iw);
+    ERR(GRN_FILE_CORRUPT, "[ja][block] block is too small: <%u>", block_id);
+    return NULL;
+  }
+  grn_memcpy(&header, packed, sizeof(header));
+  entry = grn_block_cache_entry_open(ctx, header.size);
+  if (!entry) {
+    grn_ja_unref(ctx, &iw);
+    return NULL;
+  }
+  rc = grn_ja_block_decompress(ctx, header.codec,
+                               packed + sizeof(header),
+                               packed_size - sizeof(header),
+                               entry->data, header.size);
+  grn_ja_unref(ctx, &iw);
+  if (rc == GRN_SUCCESS && !grn_ja_block_validate(entry->data, header.size)) {
+    ERR(GRN_FILE_CORRUPT, "[ja][block] broken block: <%u>", block_id);
+    rc = ctx->rc;
+  }
+  if (rc != GRN_SUCCESS) {
+    grn_block_cache_entry_close(ctx, entry);
     return NULL;
   }
-  return iw->uncompressed_value;
+  return grn_block_cache_add(ctx, ja->block.cache_owner_id, block_id, entry);
 }
-#endif /* GRN_WITH_ZLIB */
 
-#ifdef GRN_WITH_LZ4
-#include <lz4.h>
+static grn_bool
+grn_ja_block_value(grn_block_cache_entry *entry, uint32_t index,
+                   const char **value, uint32_t *value_size)
+{
+  const uint32_t *offsets = (const uint32_t *)entry->data + 1;
+  uint32_t n_records = *((const uint32_t *)entry->data);
+  if (index >= n_records) {
+    return GRN_FALSE;
+  }
+  *value = (const char *)(offsets + n_records + 1) + offsets[index];
+  *value_size = offsets[index + 1] - offsets[index];
+  return GRN_TRUE;
+}
 
 static void *
-grn_ja_ref_lz4(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *value_len)
+grn_ja_ref_block(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *value_len)
 {
-  void *packed_value;
-  int packed_value_len;
-  void *lz4_value;
-  int lz4_value_len;
-  int original_value_len;
+  char *raw;
+  uint32_t raw_len;
+  grn_id block_id;
+  grn_block_cache_entry *entry;
+  const char *value;
+  uint32_t value_size;
 
-  if (!(packed_value = grn_ja_ref_raw(ctx, ja, id, iw, &packed_value_len))) {
-    iw->uncompressed_value = NULL;
-    *value_len = 0;
-    return NULL;
+  raw = grn_ja_ref_raw(ctx, ja, id, iw, &raw_len);
+  if (!raw || raw_len == 0) {
+    *value_len = raw_len;
+    return raw;
   }
-  original_value_len = *((uint64_t *)packed_value);
-  if (!(iw->uncompressed_value = GRN_MALLOC(original_value_len))) {
-    iw->uncompressed_value = NULL;
-    *value_len = 0;
-    return NULL;
+  if (raw[raw_len - 1] == GRN_JA_BLOCK_TAG_DIRECT) {
+    *value_len = raw_len - 1;
+    return raw;
   }
-  lz4_value = (void *)((uint64_t *)packed_value + 1);
-  lz4_value_len = packed_value_len - sizeof(uint64_t);
-  if (LZ4_decompress_safe((const char *)(lz4_value),
-                          (char *)(iw->uncompressed_value),
-                          lz4_value_len,
-                          original_value_len) < 0) {
-    GRN_FREE(iw->uncompressed_value);
-    iw->uncompressed_value = NULL;
-    *value_len = 0;
-    return NULL;
+  if (raw[raw_len - 1] != GRN_JA_BLOCK_TAG_PACKED ||
+      raw_len != GRN_JA_BLOCK_PACKED_SIZE) {
+    ERR(GRN_FILE_CORRUPT, "[ja][block] invalid value: <%u>", id);
+    goto exit;
   }
-  *value_len = original_value_len;
+  grn_memcpy(&block_id, raw, sizeof(grn_id));
+  entry = grn_ja_block_fetch(ctx, ja, block_id);
+  if (!entry) {
+    goto exit;
+  }
+  if (id < block_id ||
+      !grn_ja_block_value(entry, id - block_id, &value, &value_size)) {
+    grn_block_cache_unref(ctx, entry);
+    ERR(GRN_FILE_CORRUPT,
+        "[ja][block] value isn't found in block: <%u>: <%u>", id, block_id);
+    goto exit;
+  }
+  iw->uncompressed_value = GRN_MALLOC(value_size);
+  if (!iw->uncompressed_value) {
+    grn_block_cache_unref(ctx, entry);
+    goto exit;
+  }
+  grn_memcpy(iw->uncompressed_value, value, value_size);
+  grn_block_cache_unref(ctx, entry);
+  *value_len = value_size;
   return iw->uncompressed_value;
+
+exit :
+  grn_ja_unref(ctx, iw);
+  *value_len = 0;
+  return NULL;
 }
-#endif /* GRN_WITH_LZ4 */
 
 void *
 grn_ja_ref(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *value_len)
 {
+  if (ja->header->flags & GRN_OBJ_COMPRESS_BLOCK) {
+    return grn_ja_ref_block(ctx, ja, id, iw, value_len);
+  }
+  switch (ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
+  case GRN_OBJ_COMPRESS_ZLIB :
     return grn_ja_ref_zlib(ctx, ja, id, iw, value_len);
-  }
 #endif /* GRN_WITH_ZLIB */
 #ifdef GRN_WITH_LZ4
-  if (ja->header->flags & GRN_OBJ_COMPRESS_LZ4) {
+  case GRN_OBJ_COMPRESS_LZ4 :
     return grn_ja_ref_lz4(ctx, ja, id, iw, value_len);
-  }
 #endif /* GRN_WITH_LZ4 */
-  return grn_ja_ref_raw(ctx, ja, id, iw, value_len);
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return grn_ja_ref_zstd(ctx, ja, id, iw, value_len);
+#endif /* GRN_WITH_ZSTD */
+  default :
+    return grn_ja_ref_raw(ctx, ja, id, iw, value_len);
+  }
 }
 
 grn_obj *
@@ -1318,118 +3164,610 @@ grn_ja_get_value(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_obj *value)
     } else {
       grn_bulk_write(ctx, value, v, len);
     }
-    grn_ja_unref(ctx, &iw);
+    grn_ja_unref(ctx, &iw);
+  }
+exit :
+  return value;
+}
+
+#ifdef GRN_WITH_ZLIB
+inline static grn_rc
+grn_ja_put_zlib(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                void *value, uint32_t value_len, int flags, uint64_t *cas)
+{
+  grn_rc rc;
+  z_stream zstream;
+  void *zvalue;
+  int zvalue_len;
+
+  if (value_len == 0) {
+    return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+  }
+
+  zstream.next_in = value;
+  zstream.avail_in = value_len;
+  zstream.zalloc = Z_NULL;
+  zstream.zfree = Z_NULL;
+  if (deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   15 /* windowBits */,
+                   8 /* memLevel */,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    ERR(GRN_ZLIB_ERROR, "deflateInit2 failed");
+    return ctx->rc;
+  }
+  zvalue_len = deflateBound(&zstream, value_len);
+  if (!(zvalue = GRN_MALLOC(zvalue_len + sizeof(uint64_t)))) { deflateEnd(&zstream); return GRN_NO_MEMORY_AVAILABLE; }
+  zstream.next_out = (Bytef *)(((uint64_t *)zvalue) + 1);
+  zstream.avail_out = zvalue_len;
+  if (deflate(&zstream, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&zstream);
+    GRN_FREE(zvalue);
+    ERR(GRN_ZLIB_ERROR, "deflate failed");
+    return ctx->rc;
+  }
+  zvalue_len = zstream.total_out;
+  if (deflateEnd(&zstream) != Z_OK) {
+    GRN_FREE(zvalue);
+    ERR(GRN_ZLIB_ERROR, "deflateEnd failed");
+    return ctx->rc;
+  }
+  *(uint64_t *)zvalue = value_len;
+  rc = grn_ja_put_raw(ctx, ja, id, zvalue, zvalue_len + sizeof(uint64_t), flags, cas);
+  GRN_FREE(zvalue);
+  return rc;
+}
+#endif /* GRN_WITH_ZLIB */
+
+#ifdef GRN_WITH_LZ4
+inline static grn_rc
+grn_ja_put_lz4(grn_ctx *ctx, grn_ja *ja, grn_id id,
+               void *value, uint32_t value_len, int flags, uint64_t *cas)
+{
+  grn_rc rc;
+  void *packed_value;
+  int packed_value_len;
+  char *lz4_value;
+  int lz4_value_len;
+
+  if (value_len == 0) {
+    return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+  }
+
+  if (value_len > (uint32_t)LZ4_MAX_INPUT_SIZE) {
+    ERR(GRN_INVALID_ARGUMENT,
+        "[ja][lz4] too large value size: <%u>: max: <%d>",
+        value_len, LZ4_MAX_INPUT_SIZE);
+    return ctx->rc;
+  }
+
+  lz4_value_len = LZ4_compressBound(value_len);
+
+  if (!(packed_value = GRN_MALLOC(lz4_value_len + sizeof(uint64_t)))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  lz4_value = (char *)((uint64_t *)packed_value + 1);
+  lz4_value_len = LZ4_compress((const char*)value, lz4_value, value_len);
+
+  if (lz4_value_len <= 0) {
+    GRN_FREE(packed_value);
+    ERR(GRN_LZ4_ERROR, "LZ4_compress");
+    return ctx->rc;
+  }
+  *(uint64_t *)packed_value = value_len;
+  packed_value_len = lz4_value_len + sizeof(uint64_t);
+  rc = grn_ja_put_raw(ctx, ja, id, packed_value, packed_value_len, flags, cas);
+  GRN_FREE(packed_value);
+  return rc;
+}
+#endif /* GRN_WITH_LZ4 */
+
+#ifdef GRN_WITH_ZSTD
+/*
+ * It trains a dictionary from values of records before max_id and
+ * stores it. It must be called without ja->zstd.lock because training
+ * takes long. Only the caller that sets ja->zstd.trained calls it.
+ */
+static void
+grn_ja_zstd_train_dictionary(grn_ctx *ctx, grn_ja *ja, grn_id max_id)
+{
+  grn_obj samples;
+  size_t *sample_sizes;
+  unsigned int n_samples = 0;
+  grn_id id;
+  grn_ja_zstd_dictionary *stored_dictionary;
+  void *dictionary = NULL;
+  size_t dictionary_capacity;
+  size_t dictionary_size;
+  uint32_t stored_dictionary_size;
+  grn_bool stored = GRN_FALSE;
+  ZSTD_DCtx *dctx;
+  ZSTD_CDict *cdict = NULL;
+  ZSTD_DDict *ddict = NULL;
+
+  stored_dictionary = grn_ja_zstd_get_dictionary(ctx, ja);
+  if (!stored_dictionary) {
+    return;
+  }
+
+  sample_sizes = GRN_MALLOCN(size_t, GRN_JA_ZSTD_N_SAMPLES);
+  if (!sample_sizes) {
+    return;
+  }
+  dctx = grn_ja_zstd_dctx_open(ctx, ja);
+  if (!dctx) {
+    GRN_FREE(sample_sizes);
+    return;
+  }
+  GRN_TEXT_INIT(&samples, 0);
+
+  for (id = GRN_ID_NIL + 1;
+       id < max_id && n_samples < GRN_JA_ZSTD_N_SAMPLES;
+       id++) {
+    grn_io_win iw;
+    void *packed_value;
+    uint32_t packed_value_len;
+    uint64_t value_len;
+    const void *zstd_value;
+    size_t zstd_value_len;
+    size_t sample_size;
+
+    packed_value = grn_ja_ref_raw(ctx, ja, id, &iw, &packed_value_len);
+    if (!packed_value) {
+      continue;
+    }
+    if (packed_value_len <= sizeof(uint64_t)) {
+      grn_ja_unref(ctx, &iw);
+      continue;
+    }
+    value_len = *((uint64_t *)packed_value);
+    zstd_value = (const void *)((uint64_t *)packed_value + 1);
+    zstd_value_len = packed_value_len - sizeof(uint64_t);
+    if (value_len == 0 ||
+        GRN_TEXT_LEN(&samples) + value_len > GRN_JA_ZSTD_MAX_SAMPLES_SIZE ||
+        ZSTD_getDictID_fromFrame(zstd_value, zstd_value_len) != 0) {
+      grn_ja_unref(ctx, &iw);
+      continue;
+    }
+    if (grn_bulk_reserve(ctx, &samples, value_len) != GRN_SUCCESS) {
+      grn_ja_unref(ctx, &iw);
+      break;
+    }
+    sample_size = ZSTD_decompressDCtx(dctx,
+                                      GRN_BULK_CURR(&samples), value_len,
+                                      zstd_value, zstd_value_len);
+    grn_ja_unref(ctx, &iw);
+    if (sample_size != value_len) {
+      continue;
+    }
+    GRN_BULK_INCR_LEN(&samples, value_len);
+    sample_sizes[n_samples++] = value_len;
+  }
+
+  dictionary_capacity = GRN_TEXT_LEN(&samples) / 8;
+  if (dictionary_capacity > GRN_JA_ZSTD_DICTIONARY_MAX_SIZE) {
+    dictionary_capacity = GRN_JA_ZSTD_DICTIONARY_MAX_SIZE;
+  }
+  if (dictionary_capacity < GRN_JA_ZSTD_DICTIONARY_MIN_SIZE) {
+    goto exit;
+  }
+
+  dictionary = GRN_MALLOC(dictionary_capacity);
+  if (!dictionary) {
+    goto exit;
+  }
+  dictionary_size = ZDICT_trainFromBuffer(dictionary, dictionary_capacity,
+                                          GRN_TEXT_VALUE(&samples),
+                                          sample_sizes,
+                                          n_samples);
+  if (ZDICT_isError(dictionary_size)) {
+    GRN_LOG(ctx, GRN_LOG_DEBUG,
+            "[ja][zstd] failed to train dictionary: <%s>",
+            ZDICT_getErrorName(dictionary_size));
+    goto exit;
+  }
+
+  /* Don't overwrite a dictionary stored by another process. */
+  GRN_ATOMIC_CAS_EX(&(stored_dictionary->size),
+                    0, GRN_JA_ZSTD_DICTIONARY_WRITING,
+                    stored_dictionary_size);
+  if (stored_dictionary_size == 0) {
+    grn_memcpy(stored_dictionary->data, dictionary, dictionary_size);
+    GRN_ATOMIC_CAS_EX(&(stored_dictionary->size),
+                      GRN_JA_ZSTD_DICTIONARY_WRITING, dictionary_size,
+                      stored_dictionary_size);
+    stored = GRN_TRUE;
+    cdict = ZSTD_createCDict(dictionary, dictionary_size,
+                             GRN_JA_ZSTD_COMPRESSION_LEVEL);
+    ddict = ZSTD_createDDict(dictionary, dictionary_size);
+  }
+
+  CRITICAL_SECTION_ENTER(ja->zstd.lock);
+  if (stored) {
+    if (!ja->zstd.cdict) {
+      ja->zstd.cdict = cdict;
+      cdict = NULL;
+    }
+    if (!ja->zstd.ddict) {
+      ja->zstd.ddict = ddict;
+      ddict = NULL;
+    }
+    ja->zstd.loaded = GRN_TRUE;
+  } else {
+    ja->zstd.loaded = GRN_FALSE;
+    grn_ja_zstd_load_dictionary(ctx, ja);
+  }
+  CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+
+exit :
+  if (cdict) {
+    ZSTD_freeCDict(cdict);
+  }
+  if (ddict) {
+    ZSTD_freeDDict(ddict);
+  }
+  if (dictionary) {
+    GRN_FREE(dictionary);
+  }
+  grn_ja_zstd_dctx_close(ctx, ja, dctx);
+  GRN_OBJ_FIN(ctx, &samples);
+  GRN_FREE(sample_sizes);
+}
+
+inline static grn_rc
+grn_ja_put_zstd(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                void *value, uint32_t value_len, int flags, uint64_t *cas)
+{
+  grn_rc rc;
+  void *packed_value;
+  int packed_value_len;
+  void *zstd_value;
+  size_t zstd_value_len_max;
+  size_t zstd_value_len;
+  grn_bool need_training = GRN_FALSE;
+  ZSTD_CDict *cdict;
+  ZSTD_CCtx *cctx;
+
+  if (value_len == 0) {
+    return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+  }
+
+  zstd_value_len_max = ZSTD_compressBound(value_len);
+  if (!(packed_value = GRN_MALLOC(zstd_value_len_max + sizeof(uint64_t)))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  zstd_value = (void *)((uint64_t *)packed_value + 1);
+
+  CRITICAL_SECTION_ENTER(ja->zstd.lock);
+  grn_ja_zstd_load_dictionary(ctx, ja);
+  if (!ja->zstd.cdict && !ja->zstd.trained && id > GRN_JA_ZSTD_N_SAMPLES) {
+    ja->zstd.trained = GRN_TRUE;
+    need_training = GRN_TRUE;
+  }
+  cdict = ja->zstd.cdict;
+  CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+  if (need_training) {
+    grn_ja_zstd_train_dictionary(ctx, ja, id);
+    CRITICAL_SECTION_ENTER(ja->zstd.lock);
+    cdict = ja->zstd.cdict;
+    CRITICAL_SECTION_LEAVE(ja->zstd.lock);
+  }
+  /* cdict isn't freed until the column is closed or truncated. */
+
+  cctx = grn_ja_zstd_cctx_open(ctx, ja);
+  if (!cctx) {
+    GRN_FREE(packed_value);
+    ERR(GRN_ZSTD_ERROR, "[ja][zstd] failed to create compression context");
+    return ctx->rc;
+  }
+  if (cdict) {
+    zstd_value_len = ZSTD_compress_usingCDict(cctx,
+                                              zstd_value, zstd_value_len_max,
+                                              value, value_len,
+                                              cdict);
+  } else {
+    zstd_value_len = ZSTD_compressCCtx(cctx,
+                                       zstd_value, zstd_value_len_max,
+                                       value, value_len,
+                                       GRN_JA_ZSTD_COMPRESSION_LEVEL);
+  }
+  grn_ja_zstd_cctx_close(ctx, ja, cctx);
+
+  if (ZSTD_isError(zstd_value_len)) {
+    GRN_FREE(packed_value);
+    ERR(GRN_ZSTD_ERROR,
+        "[ja][zstd] failed to compress: <%s>",
+        ZSTD_getErrorName(zstd_value_len));
+    return ctx->rc;
+  }
+  *(uint64_t *)packed_value = value_len;
+  packed_value_len = zstd_value_len + sizeof(uint64_t);
+  rc = grn_ja_put_raw(ctx, ja, id, packed_value, packed_value_len, flags, cas);
+  GRN_FREE(packed_value);
+  return rc;
+}
+#endif /* GRN_WITH_ZSTD */
+
+static grn_id
+grn_ja_block_load_next_pack_id(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_id next_pack_id = GRN_ID_NIL + 1;
+  grn_io_win iw;
+  uint32_t size;
+  void *raw;
+
+  raw = grn_ja_ref_raw(ctx, ja->block.store, GRN_ID_NIL, &iw, &size);
+  if (raw) {
+    if (size == sizeof(grn_id)) {
+      grn_memcpy(&next_pack_id, raw, sizeof(grn_id));
+    }
+    grn_ja_unref(ctx, &iw);
+  }
+  return next_pack_id;
+}
+
+/*
+ * grn_ja_block_pack() packs direct values from the next pack ID to
+ * `max_id` into a block. It must be called with ja->block.lock.
+ */
+static grn_rc
+grn_ja_block_pack(grn_ctx *ctx, grn_ja *ja, grn_id max_id)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_id block_id, next_pack_id;
+  uint32_t i, n_records, n_packed_records = 0, header_size;
+  uint32_t *offsets;
+  grn_obj block, packed;
+
+  block_id = grn_ja_block_load_next_pack_id(ctx, ja);
+  if (max_id < block_id) {
+    ja->block.next_pack_id = block_id;
+    return GRN_SUCCESS;
+  }
+  if (max_id - block_id >= GRN_JA_BLOCK_MAX_N_RECORDS) {
+    max_id = block_id + GRN_JA_BLOCK_MAX_N_RECORDS - 1;
+  }
+  n_records = max_id - block_id + 1;
+  header_size = sizeof(uint32_t) * (n_records + 2);
+
+  offsets = GRN_MALLOCN(uint32_t, n_records + 1);
+  if (!offsets) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  GRN_TEXT_INIT(&block, 0);
+  GRN_TEXT_INIT(&packed, 0);
+  rc = grn_bulk_space(ctx, &block, header_size);
+  if (rc != GRN_SUCCESS) {
+    goto exit;
+  }
+  for (i = 0; i < n_records; i++) {
+    grn_io_win iw;
+    uint32_t raw_len;
+    char *raw;
+    offsets[i] = GRN_BULK_VSIZE(&block) - header_size;
+    raw = grn_ja_ref_raw(ctx, ja, block_id + i, &iw, &raw_len);
+    if (!raw) {
+      continue;
+    }
+    if (raw_len > 1 &&
+        raw_len - 1 <= GRN_JA_BLOCK_MAX_VALUE_SIZE &&
+        raw[raw_len - 1] == GRN_JA_BLOCK_TAG_DIRECT) {
+      rc = grn_bulk_write(ctx, &block, raw, raw_len - 1);
+      n_packed_records++;
+    }
+    grn_ja_unref(ctx, &iw);
+    if (rc != GRN_SUCCESS) {
+      goto exit;
+    }
+  }
+  offsets[n_records] = GRN_BULK_VSIZE(&block) - header_size;
+
+  if (n_packed_records > 0) {
+    char packed_value[GRN_JA_BLOCK_PACKED_SIZE];
+    *((uint32_t *)GRN_BULK_HEAD(&block)) = n_records;
+    grn_memcpy(GRN_BULK_HEAD(&block) + sizeof(uint32_t),
+               offsets, sizeof(uint32_t) * (n_records + 1));
+    rc = grn_ja_block_compress(ctx, ja,
+                               GRN_BULK_HEAD(&block), GRN_BULK_VSIZE(&block),
+                               &packed);
+    if (rc != GRN_SUCCESS) {
+      goto exit;
+    }
+    /* The block must be stored before values refer to it. */
+    rc = grn_ja_put_raw(ctx, ja->block.store, block_id,
+                        GRN_BULK_HEAD(&packed), GRN_BULK_VSIZE(&packed),
+                        GRN_OBJ_SET, NULL);
+    if (rc != GRN_SUCCESS) {
+      goto exit;
+    }
+    grn_memcpy(packed_value, &block_id, sizeof(grn_id));
+    packed_value[sizeof(grn_id)] = GRN_JA_BLOCK_TAG_PACKED;
+    for (i = 0; i < n_records; i++) {
+      if (offsets[i] == offsets[i + 1]) {
+        continue;
+      }
+      rc = grn_ja_put_raw(ctx, ja, block_id + i,
+                          packed_value, GRN_JA_BLOCK_PACKED_SIZE,
+                          GRN_OBJ_SET, NULL);
+      if (rc != GRN_SUCCESS) {
+        goto exit;
+      }
+    }
+  }
+
+  next_pack_id = max_id + 1;
+  rc = grn_ja_put_raw(ctx, ja->block.store, GRN_ID_NIL,
+                      &next_pack_id, sizeof(grn_id), GRN_OBJ_SET, NULL);
+  if (rc == GRN_SUCCESS) {
+    ja->block.next_pack_id = next_pack_id;
   }
+
 exit :
-  return value;
+  GRN_OBJ_FIN(ctx, &packed);
+  GRN_OBJ_FIN(ctx, &block);
+  GRN_FREE(offsets);
+  return rc;
 }
 
-#ifdef GRN_WITH_ZLIB
-inline static grn_rc
-grn_ja_put_zlib(grn_ctx *ctx, grn_ja *ja, grn_id id,
-                void *value, uint32_t value_len, int flags, uint64_t *cas)
+static grn_rc
+grn_ja_put_block_set(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                     void *value, uint32_t value_len, int flags, uint64_t *cas)
 {
   grn_rc rc;
-  z_stream zstream;
-  void *zvalue;
-  int zvalue_len;
+  char *tagged_value;
 
   if (value_len == 0) {
     return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
   }
 
-  zstream.next_in = value;
-  zstream.avail_in = value_len;
-  zstream.zalloc = Z_NULL;
-  zstream.zfree = Z_NULL;
-  if (deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-                   15 /* windowBits */,
-                   8 /* memLevel */,
-                   Z_DEFAULT_STRATEGY) != Z_OK) {
-    ERR(GRN_ZLIB_ERROR, "deflateInit2 failed");
-    return ctx->rc;
+  tagged_value = GRN_MALLOC(value_len + 1);
+  if (!tagged_value) {
+    return GRN_NO_MEMORY_AVAILABLE;
   }
-  zvalue_len = deflateBound(&zstream, value_len);
-  if (!(zvalue = GRN_MALLOC(zvalue_len + sizeof(uint64_t)))) { deflateEnd(&zstream); return GRN_NO_MEMORY_AVAILABLE; }
-  zstream.next_out = (Bytef *)(((uint64_t *)zvalue) + 1);
-  zstream.avail_out = zvalue_len;
-  if (deflate(&zstream, Z_FINISH) != Z_STREAM_END) {
-    deflateEnd(&zstream);
-    GRN_FREE(zvalue);
-    ERR(GRN_ZLIB_ERROR, "deflate failed");
-    return ctx->rc;
+  grn_memcpy(tagged_value, value, value_len);
+  tagged_value[value_len] = GRN_JA_BLOCK_TAG_DIRECT;
+  rc = grn_ja_put_raw(ctx, ja, id, tagged_value, value_len + 1, flags, cas);
+  GRN_FREE(tagged_value);
+  if (rc != GRN_SUCCESS) {
+    return rc;
   }
-  zvalue_len = zstream.total_out;
-  if (deflateEnd(&zstream) != Z_OK) {
-    GRN_FREE(zvalue);
-    ERR(GRN_ZLIB_ERROR, "deflateEnd failed");
-    return ctx->rc;
+
+  if (ja->block.next_pack_id == GRN_ID_NIL) {
+    ja->block.next_pack_id = grn_ja_block_load_next_pack_id(ctx, ja);
+  }
+  if (id < ja->block.next_pack_id || value_len > GRN_JA_BLOCK_MAX_VALUE_SIZE) {
+    return GRN_SUCCESS;
+  }
+  ja->block.n_pending_bytes += value_len;
+  if (ja->block.n_pending_bytes >= GRN_JA_BLOCK_SIZE ||
+      id - ja->block.next_pack_id + 1 >= GRN_JA_BLOCK_MAX_N_RECORDS) {
+    rc = grn_ja_block_pack(ctx, ja, id);
+    ja->block.n_pending_bytes = 0;
   }
-  *(uint64_t *)zvalue = value_len;
-  rc = grn_ja_put_raw(ctx, ja, id, zvalue, zvalue_len + sizeof(uint64_t), flags, cas);
-  GRN_FREE(zvalue);
   return rc;
 }
-#endif /* GRN_WITH_ZLIB */
 
-#ifdef GRN_WITH_LZ4
-inline static grn_rc
-grn_ja_put_lz4(grn_ctx *ctx, grn_ja *ja, grn_id id,
-               void *value, uint32_t value_len, int flags, uint64_t *cas)
+/*
+ * grn_ja_put_block_modify() computes the new value of APPEND, PREPEND,
+ * INCR and DECR from the current value and sets it. Packed values
+ * can't be modified in place.
+ */
+static grn_rc
+grn_ja_put_block_modify(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                        void *value, uint32_t value_len,
+                        int flags, uint64_t *cas)
 {
-  grn_rc rc;
-  void *packed_value;
-  int packed_value_len;
-  char *lz4_value;
-  int lz4_value_len;
-
-  if (value_len == 0) {
-    return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
-  }
-
-  if (value_len > (uint32_t)LZ4_MAX_INPUT_SIZE) {
-    ERR(GRN_INVALID_ARGUMENT,
-        "[ja][lz4] too large value size: <%u>: max: <%d>",
-        value_len, LZ4_MAX_INPUT_SIZE);
-    return ctx->rc;
-  }
-
-  lz4_value_len = LZ4_compressBound(value_len);
+  grn_rc rc = GRN_SUCCESS;
+  grn_obj old_value, new_value;
+  uint32_t old_len;
 
-  if (!(packed_value = GRN_MALLOC(lz4_value_len + sizeof(uint64_t)))) {
-    return GRN_NO_MEMORY_AVAILABLE;
+  GRN_TEXT_INIT(&old_value, 0);
+  GRN_TEXT_INIT(&new_value, 0);
+  grn_ja_get_value(ctx, ja, id, &old_value);
+  old_len = GRN_BULK_VSIZE(&old_value);
+  switch (flags & GRN_OBJ_SET_MASK) {
+  case GRN_OBJ_APPEND :
+    if (value_len == 0) {
+      goto exit;
+    }
+    GRN_TEXT_PUT(ctx, &new_value, GRN_BULK_HEAD(&old_value), old_len);
+    GRN_TEXT_PUT(ctx, &new_value, value, value_len);
+    break;
+  case GRN_OBJ_PREPEND :
+    if (value_len == 0) {
+      goto exit;
+    }
+    GRN_TEXT_PUT(ctx, &new_value, value, value_len);
+    GRN_TEXT_PUT(ctx, &new_value, GRN_BULK_HEAD(&old_value), old_len);
+    break;
+  case GRN_OBJ_INCR :
+  case GRN_OBJ_DECR :
+    if (value_len == sizeof(int64_t) &&
+        (old_len == 0 || old_len == sizeof(int64_t))) {
+      int64_t current = 0, delta;
+      grn_memcpy(&delta, value, sizeof(int64_t));
+      if (old_len > 0) {
+        grn_memcpy(&current, GRN_BULK_HEAD(&old_value), sizeof(int64_t));
+      }
+      if ((flags & GRN_OBJ_SET_MASK) == GRN_OBJ_DECR) {
+        current -= delta;
+      } else {
+        current += delta;
+      }
+      GRN_TEXT_PUT(ctx, &new_value, &current, sizeof(int64_t));
+    } else if (value_len == sizeof(int32_t) &&
+               (old_len == 0 || old_len == sizeof(int32_t))) {
+      int32_t current = 0, delta;
+      grn_memcpy(&delta, value, sizeof(int32_t));
+      if (old_len > 0) {
+        grn_memcpy(&current, GRN_BULK_HEAD(&old_value), sizeof(int32_t));
+      }
+      if ((flags & GRN_OBJ_SET_MASK) == GRN_OBJ_DECR) {
+        current -= delta;
+      } else {
+        current += delta;
+      }
+      GRN_TEXT_PUT(ctx, &new_value, &current, sizeof(int32_t));
+    } else if (old_len == 0 && (flags & GRN_OBJ_SET_MASK) == GRN_OBJ_INCR) {
+      GRN_TEXT_PUT(ctx, &new_value, value, value_len);
+    } else {
+      rc = GRN_INVALID_ARGUMENT;
+      goto exit;
+    }
+    break;
+  default :
+    ERR(GRN_INVALID_ARGUMENT, "grn_ja_put_block called with illegal flags value");
+    rc = ctx->rc;
+    goto exit;
   }
-  lz4_value = (char *)((uint64_t *)packed_value + 1);
-  lz4_value_len = LZ4_compress((const char*)value, lz4_value, value_len);
+  rc = grn_ja_put_block_set(ctx, ja, id,
+                            GRN_BULK_HEAD(&new_value),
+                            GRN_BULK_VSIZE(&new_value),
+                            (flags & ~GRN_OBJ_SET_MASK) | GRN_OBJ_SET,
+                            cas);
+exit :
+  GRN_OBJ_FIN(ctx, &new_value);
+  GRN_OBJ_FIN(ctx, &old_value);
+  return rc;
+}
 
-  if (lz4_value_len <= 0) {
-    GRN_FREE(packed_value);
-    ERR(GRN_LZ4_ERROR, "LZ4_compress");
-    return ctx->rc;
+static grn_rc
+grn_ja_put_block(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                 void *value, uint32_t value_len, int flags, uint64_t *cas)
+{
+  grn_rc rc;
+  CRITICAL_SECTION_ENTER(ja->block.lock);
+  if ((flags & GRN_OBJ_SET_MASK) == GRN_OBJ_SET) {
+    rc = grn_ja_put_block_set(ctx, ja, id, value, value_len, flags, cas);
+  } else {
+    rc = grn_ja_put_block_modify(ctx, ja, id, value, value_len, flags, cas);
   }
-  *(uint64_t *)packed_value = value_len;
-  packed_value_len = lz4_value_len + sizeof(uint64_t);
-  rc = grn_ja_put_raw(ctx, ja, id, packed_value, packed_value_len, flags, cas);
-  GRN_FREE(packed_value);
+  CRITICAL_SECTION_LEAVE(ja->block.lock);
   return rc;
 }
-#endif /* GRN_WITH_LZ4 */
 
 grn_rc
 grn_ja_put(grn_ctx *ctx, grn_ja *ja, grn_id id, void *value, uint32_t value_len,
            int flags, uint64_t *cas)
 {
+  if (ja->header->flags & GRN_OBJ_COMPRESS_BLOCK) {
+    return grn_ja_put_block(ctx, ja, id, value, value_len, flags, cas);
+  }
+  switch (ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
+  case GRN_OBJ_COMPRESS_ZLIB :
     return grn_ja_put_zlib(ctx, ja, id, value, value_len, flags, cas);
-  }
 #endif /* GRN_WITH_ZLIB */
 #ifdef GRN_WITH_LZ4
-  if (ja->header->flags & GRN_OBJ_COMPRESS_LZ4) {
+  case GRN_OBJ_COMPRESS_LZ4 :
     return grn_ja_put_lz4(ctx, ja, id, value, value_len, flags, cas);
-  }
 #endif /* GRN_WITH_LZ4 */
-  return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return grn_ja_put_zstd(ctx, ja, id, value, value_len, flags, cas);
+#endif /* GRN_WITH_ZSTD */
+  default :
+    return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+  }
 }
 
 static grn_rc
@@ -1456,7 +3794,7 @@ grn_ja_defrag_seg(grn_ctx *ctx, grn_ja *ja, uint32_t seg)
                 seg, pos, (long long int)(v + sizeof(uint32_t) + JA_SEGMENT_SIZE - ve));
         break;
       }
-      if (grn_ja_put(ctx, ja, id, v + sizeof(uint32_t), element_size, GRN_OBJ_SET, &cas)) {
+      if (grn_ja_put_raw(ctx, ja, id, v + sizeof(uint32_t), element_size, GRN_OBJ_SET, &cas)) {
         GRN_LOG(ctx, GRN_LOG_WARNING,
                 "dseges[%d] = put failed (%d)", seg, id);
         break;
@@ -1601,22 +3939,42 @@ grn_ja_reader_init(grn_ctx *ctx, grn_ja_reader *reader, grn_ja *ja)
   reader->body_seg_addr = NULL;
   reader->packed_buf = NULL;
   reader->packed_buf_size = 0;
+  reader->stream = NULL;
+  reader->block = NULL;
+  reader->block_value = NULL;
+  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_BLOCK) {
+    return GRN_SUCCESS;
+  }
+  switch (reader->ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
-    z_stream *new_stream = GRN_MALLOCN(z_stream, 1);
-    if (!new_stream) {
-      return GRN_NO_MEMORY_AVAILABLE;
+  case GRN_OBJ_COMPRESS_ZLIB :
+    {
+      z_stream *new_stream = GRN_MALLOCN(z_stream, 1);
+      if (!new_stream) {
+        return GRN_NO_MEMORY_AVAILABLE;
+      }
+      new_stream->zalloc = NULL;
+      new_stream->zfree = NULL;
+      new_stream->opaque = NULL;
+      if (inflateInit2(new_stream, 15) != Z_OK) {
+        GRN_FREE(new_stream);
+        return GRN_ZLIB_ERROR;
+      }
+      reader->stream = new_stream;
     }
-    new_stream->zalloc = NULL;
-    new_stream->zfree = NULL;
-    new_stream->opaque = NULL;
-    if (inflateInit2(new_stream, 15) != Z_OK) {
-      GRN_FREE(new_stream);
-      return GRN_ZLIB_ERROR;
+    break;
+#endif /* GRN_WITH_ZLIB */
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    reader->stream = ZSTD_createDCtx();
+    if (!reader->stream) {
+      return GRN_NO_MEMORY_AVAILABLE;
     }
-    reader->stream = new_stream;
+    break;
+#endif /* GRN_WITH_ZSTD */
+  default :
+    break;
   }
-#endif /* GRN_WITH_ZLIB */
   return GRN_SUCCESS;
 }
 
@@ -1637,16 +3995,30 @@ grn_ja_reader_fin(grn_ctx *ctx, grn_ja_reader *reader)
   if (reader->packed_buf) {
     GRN_FREE(reader->packed_buf);
   }
+  if (reader->block) {
+    grn_block_cache_unref(ctx, (grn_block_cache_entry *)reader->block);
+  }
+  switch (reader->ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
+  case GRN_OBJ_COMPRESS_ZLIB :
     if (reader->stream) {
       if (inflateEnd((z_stream *)reader->stream) != Z_OK) {
         rc = GRN_UNKNOWN_ERROR;
       }
       GRN_FREE(reader->stream);
     }
-  }
+    break;
 #endif /* GRN_WITH_ZLIB */
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    if (reader->stream) {
+      ZSTD_freeDCtx((ZSTD_DCtx *)reader->stream);
+    }
+    break;
+#endif /* GRN_WITH_ZSTD */
+  default :
+    break;
+  }
   return rc;
 }
 
@@ -1675,7 +4047,7 @@ grn_ja_reader_close(grn_ctx *ctx, grn_ja_reader *reader)
   return rc;
 }
 
-#if defined(GRN_WITH_ZLIB) || defined(GRN_WITH_LZ4)
+#if defined(GRN_WITH_ZLIB) || defined(GRN_WITH_LZ4) || defined(GRN_WITH_ZSTD)
 /* grn_ja_reader_seek_compressed() prepares to access a compressed value. */
 static grn_rc
 grn_ja_reader_seek_compressed(grn_ctx *ctx, grn_ja_reader *reader, grn_id id)
@@ -1722,7 +4094,7 @@ grn_ja_reader_seek_compressed(grn_ctx *ctx, grn_ja_reader *reader, grn_id id)
   reader->value_size = (uint32_t)*(uint64_t *)seg_addr;
   return GRN_SUCCESS;
 }
-#endif /* defined(GRN_WITH_ZLIB) || defined(GRN_WITH_LZ4) */
+#endif /* defined(GRN_WITH_ZLIB) || defined(GRN_WITH_LZ4) || defined(GRN_WITH_ZSTD) */
 
 /* grn_ja_reader_seek_raw() prepares to access a value. */
 static grn_rc
@@ -1770,20 +4142,80 @@ grn_ja_reader_seek_raw(grn_ctx *ctx, grn_ja_reader *reader, grn_id id)
   return GRN_SUCCESS;
 }
 
+/*
+ * grn_ja_reader_seek_block() prepares to access a value of a column with
+ * GRN_OBJ_COMPRESS_BLOCK. The block of a packed value is kept referenced
+ * while the following values are in the same block.
+ */
+static grn_rc
+grn_ja_reader_seek_block(grn_ctx *ctx, grn_ja_reader *reader, grn_id id)
+{
+  grn_rc rc;
+  grn_ja_einfo *einfo;
+  const char *tiny_value;
+  grn_id block_id;
+  grn_block_cache_entry *entry = (grn_block_cache_entry *)reader->block;
+  const char *value;
+  uint32_t value_size;
+
+  reader->block_value = NULL;
+  rc = grn_ja_reader_seek_raw(ctx, reader, id);
+  if (rc != GRN_SUCCESS || reader->value_size == 0) {
+    return rc;
+  }
+  einfo = (grn_ja_einfo *)reader->einfo;
+  tiny_value = (const char *)einfo;
+  if (!ETINY_P(einfo) ||
+      reader->value_size != GRN_JA_BLOCK_PACKED_SIZE ||
+      tiny_value[reader->value_size - 1] != GRN_JA_BLOCK_TAG_PACKED) {
+    /* A direct value. Only a packed value is a tiny value with the tag. */
+    reader->value_size--;
+    return GRN_SUCCESS;
+  }
+  grn_memcpy(&block_id, tiny_value, sizeof(grn_id));
+  if (!entry || entry->block_id != block_id) {
+    entry = grn_ja_block_fetch(ctx, reader->ja, block_id);
+    if (!entry) {
+      return ctx->rc == GRN_SUCCESS ? GRN_UNKNOWN_ERROR : ctx->rc;
+    }
+    if (reader->block) {
+      grn_block_cache_unref(ctx, (grn_block_cache_entry *)reader->block);
+    }
+    reader->block = entry;
+  }
+  if (id < block_id ||
+      !grn_ja_block_value(entry, id - block_id, &value, &value_size)) {
+    ERR(GRN_FILE_CORRUPT,
+        "[ja][block] value isn't found in block: <%u>: <%u>", id, block_id);
+    return ctx->rc;
+  }
+  reader->block_value = value;
+  reader->value_size = value_size;
+  return GRN_SUCCESS;
+}
+
 grn_rc
 grn_ja_reader_seek(grn_ctx *ctx, grn_ja_reader *reader, grn_id id)
 {
+  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_BLOCK) {
+    return grn_ja_reader_seek_block(ctx, reader, id);
+  }
+  switch (reader->ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
+  case GRN_OBJ_COMPRESS_ZLIB :
     return grn_ja_reader_seek_compressed(ctx, reader, id);
-  }
 #endif /* GRN_WITH_ZLIB */
 #ifdef GRN_WITH_LZ4
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_LZ4) {
+  case GRN_OBJ_COMPRESS_LZ4 :
     return grn_ja_reader_seek_compressed(ctx, reader, id);
-  }
 #endif /* GRN_WITH_LZ4 */
-  return grn_ja_reader_seek_raw(ctx, reader, id);
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return grn_ja_reader_seek_compressed(ctx, reader, id);
+#endif /* GRN_WITH_ZSTD */
+  default :
+    return grn_ja_reader_seek_raw(ctx, reader, id);
+  }
 }
 
 grn_rc
@@ -1966,6 +4398,62 @@ grn_ja_reader_read_lz4(grn_ctx *ctx, grn_ja_reader *reader, void *buf)
 }
 #endif /* GRN_WITH_LZ4 */
 
+#ifdef GRN_WITH_ZSTD
+/* grn_ja_reader_read_zstd() reads a value compressed with Zstandard. */
+static grn_rc
+grn_ja_reader_read_zstd(grn_ctx *ctx, grn_ja_reader *reader, void *buf)
+{
+  grn_ja_einfo *einfo = (grn_ja_einfo *)reader->einfo;
+  const char *packed_addr;
+  if (EHUGE_P(einfo)) {
+    grn_io *io = reader->ja->io;
+    void *seg_addr;
+    char *packed_ptr;
+    uint32_t size, seg_id;
+    if (reader->packed_size > reader->packed_buf_size) {
+      void *new_buf = GRN_REALLOC(reader->packed_buf, reader->packed_size);
+      if (!new_buf) {
+        return GRN_NO_MEMORY_AVAILABLE;
+      }
+      reader->packed_buf = new_buf;
+      reader->packed_buf_size = reader->packed_size;
+    }
+    packed_ptr = (char *)reader->packed_buf;
+    grn_memcpy(packed_ptr, (char *)reader->body_seg_addr + sizeof(uint64_t),
+               io->header->segment_size - sizeof(uint64_t));
+    packed_ptr += io->header->segment_size - sizeof(uint64_t);
+    size = reader->packed_size - (io->header->segment_size - sizeof(uint64_t));
+    seg_id = reader->body_seg_id + 1;
+    while (size > io->header->segment_size) {
+      GRN_IO_SEG_REF(io, seg_id, seg_addr);
+      if (!seg_addr) {
+        return GRN_UNKNOWN_ERROR;
+      }
+      grn_memcpy(packed_ptr, seg_addr, io->header->segment_size);
+      GRN_IO_SEG_UNREF(io, seg_id);
+      seg_id++;
+      size -= io->header->segment_size;
+      packed_ptr += io->header->segment_size;
+    }
+    GRN_IO_SEG_REF(io, seg_id, seg_addr);
+    if (!seg_addr) {
+      return GRN_UNKNOWN_ERROR;
+    }
+    grn_memcpy(packed_ptr, seg_addr, size);
+    GRN_IO_SEG_UNREF(io, seg_id);
+    packed_addr = (const char *)reader->packed_buf;
+  } else {
+    packed_addr = (const char *)reader->body_seg_addr;
+    packed_addr += reader->body_seg_offset + sizeof(uint64_t);
+  }
+  return grn_ja_zstd_decompress(ctx, reader->ja,
+                                (ZSTD_DCtx *)reader->stream,
+                                buf, reader->value_size,
+                                packed_addr,
+                                reader->packed_size - sizeof(uint64_t));
+}
+#endif /* GRN_WITH_ZSTD */
+
 /* grn_ja_reader_read_raw() reads a value. */
 static grn_rc
 grn_ja_reader_read_raw(grn_ctx *ctx, grn_ja_reader *reader, void *buf)
@@ -2010,20 +4498,39 @@ grn_ja_reader_read_raw(grn_ctx *ctx, grn_ja_reader *reader, void *buf)
   return GRN_SUCCESS;
 }
 
+/* grn_ja_reader_read_block() reads a value of GRN_OBJ_COMPRESS_BLOCK. */
+static grn_rc
+grn_ja_reader_read_block(grn_ctx *ctx, grn_ja_reader *reader, void *buf)
+{
+  if (!reader->block_value) {
+    return grn_ja_reader_read_raw(ctx, reader, buf);
+  }
+  grn_memcpy(buf, reader->block_value, reader->value_size);
+  return GRN_SUCCESS;
+}
+
 grn_rc
 grn_ja_reader_read(grn_ctx *ctx, grn_ja_reader *reader, void *buf)
 {
+  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_BLOCK) {
+    return grn_ja_reader_read_block(ctx, reader, buf);
+  }
+  switch (reader->ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
+  case GRN_OBJ_COMPRESS_ZLIB :
     return grn_ja_reader_read_zlib(ctx, reader, buf);
-  }
 #endif /* GRN_WITH_ZLIB */
 #ifdef GRN_WITH_LZ4
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_LZ4) {
+  case GRN_OBJ_COMPRESS_LZ4 :
     return grn_ja_reader_read_lz4(ctx, reader, buf);
-  }
 #endif /* GRN_WITH_LZ4 */
-  return grn_ja_reader_read_raw(ctx, reader, buf);
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return grn_ja_reader_read_zstd(ctx, reader, buf);
+#endif /* GRN_WITH_ZSTD */
+  default :
+    return grn_ja_reader_read_raw(ctx, reader, buf);
+  }
 }
 
 #ifdef GRN_WITH_ZLIB
@@ -2048,6 +4555,17 @@ grn_ja_reader_pread_lz4(grn_ctx *ctx, grn_ja_reader *reader,
 }
 #endif /* GRN_WITH_LZ4 */
 
+#ifdef GRN_WITH_ZSTD
+/* grn_ja_reader_pread_zstd() reads a part of a value compressed with Zstandard. */
+static grn_rc
+grn_ja_reader_pread_zstd(grn_ctx *ctx, grn_ja_reader *reader,
+                         size_t offset, size_t size, void *buf)
+{
+  /* TODO: To be supported? */
+  return GRN_FUNCTION_NOT_IMPLEMENTED;
+}
+#endif /* GRN_WITH_ZSTD */
+
 /* grn_ja_reader_pread_raw() reads a part of a value. */
 static grn_rc
 grn_ja_reader_pread_raw(grn_ctx *ctx, grn_ja_reader *reader,
@@ -2111,21 +4629,47 @@ grn_ja_reader_pread_raw(grn_ctx *ctx, grn_ja_reader *reader,
   return GRN_SUCCESS;
 }
 
+/* grn_ja_reader_pread_block() reads a part of a value of GRN_OBJ_COMPRESS_BLOCK. */
+static grn_rc
+grn_ja_reader_pread_block(grn_ctx *ctx, grn_ja_reader *reader,
+                          size_t offset, size_t size, void *buf)
+{
+  if (!reader->block_value) {
+    return grn_ja_reader_pread_raw(ctx, reader, offset, size, buf);
+  }
+  if ((offset >= reader->value_size) || !size) {
+    return GRN_SUCCESS;
+  }
+  if (size > (reader->value_size - offset)) {
+    size = reader->value_size - offset;
+  }
+  grn_memcpy(buf, (const char *)reader->block_value + offset, size);
+  return GRN_SUCCESS;
+}
+
 grn_rc
 grn_ja_reader_pread(grn_ctx *ctx, grn_ja_reader *reader,
                     size_t offset, size_t size, void *buf)
 {
+  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_BLOCK) {
+    return grn_ja_reader_pread_block(ctx, reader, offset, size, buf);
+  }
+  switch (reader->ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
+  case GRN_OBJ_COMPRESS_ZLIB :
     return grn_ja_reader_pread_zlib(ctx, reader, offset, size, buf);
-  }
 #endif /* GRN_WITH_ZLIB */
 #ifdef GRN_WITH_LZ4
-  if (reader->ja->header->flags & GRN_OBJ_COMPRESS_LZ4) {
+  case GRN_OBJ_COMPRESS_LZ4 :
     return grn_ja_reader_pread_lz4(ctx, reader, offset, size, buf);
-  }
 #endif /* GRN_WITH_LZ4 */
-  return grn_ja_reader_pread_raw(ctx, reader, offset, size, buf);
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return grn_ja_reader_pread_zstd(ctx, reader, offset, size, buf);
+#endif /* GRN_WITH_ZSTD */
+  default :
+    return grn_ja_reader_pread_raw(ctx, reader, offset, size, buf);
+  }
 }
 
 /**** vgram ****/
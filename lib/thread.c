@@ -22,6 +22,8 @@ static grn_thread_get_limit_func get_limit_func = NULL;
 static void *get_limit_func_data = NULL;
 static grn_thread_set_limit_func set_limit_func = NULL;
 static void *set_limit_func_data = NULL;
+static grn_thread_get_worker_statuses_func get_worker_statuses_func = NULL;
+static void *get_worker_statuses_func_data = NULL;
 
 uint32_t
 grn_thread_get_limit(void)
@@ -57,3 +59,24 @@ grn_thread_set_set_limit_func(grn_thread_set_limit_func func, void *data)
   set_limit_func = func;
   set_limit_func_data = data;
 }
+
+uint32_t
+grn_thread_get_worker_statuses(grn_thread_worker_status *statuses,
+                               uint32_t n_statuses)
+{
+  if (!get_worker_statuses_func) {
+    return 0;
+  }
+
+  return get_worker_statuses_func(statuses,
+                                  n_statuses,
+                                  get_worker_statuses_func_data);
+}
+
+void
+grn_thread_set_get_worker_statuses_func(grn_thread_get_worker_statuses_func func,
+                                        void *data)
+{
+  get_worker_statuses_func = func;
+  get_worker_statuses_func_data = data;
+}
@@ -540,10 +540,21 @@ grn_store_inspect_body(grn_ctx *ctx, grn_obj *buf, grn_obj *obj)
   case GRN_OBJ_COMPRESS_LZ4 :
     GRN_TEXT_PUTS(ctx, buf, "lz4");
     break;
+  case GRN_OBJ_COMPRESS_ZSTD :
+    GRN_TEXT_PUTS(ctx, buf, "zstd");
+    break;
   default:
     break;
   }
 
+  if (obj->header.flags & GRN_OBJ_COMPRESS_BLOCK) {
+    GRN_TEXT_PUTS(ctx, buf, " compress_block:true");
+  }
+
+  if (obj->header.flags & GRN_OBJ_WITH_ZONE_MAP) {
+    GRN_TEXT_PUTS(ctx, buf, " zone_map:true");
+  }
+
   if (obj->header.flags & GRN_OBJ_RING_BUFFER) {
     GRN_TEXT_PUTS(ctx, buf, " ring_buffer:true");
   }
@@ -614,6 +625,16 @@ grn_ii_inspect(grn_ctx *ctx, grn_obj *buf, grn_obj *obj)
     GRN_TEXT_PUTS(ctx, buf, "POSITION");
     have_flags = 1;
   }
+  if (obj->header.flags & GRN_OBJ_INDEX_SIMD_PACK) {
+    if (have_flags) { GRN_TEXT_PUTS(ctx, buf, "|"); }
+    GRN_TEXT_PUTS(ctx, buf, "SIMD_PACK");
+    have_flags = 1;
+  }
+  if (obj->header.flags & GRN_OBJ_INDEX_BLOCK_MAX) {
+    if (have_flags) { GRN_TEXT_PUTS(ctx, buf, "|"); }
+    GRN_TEXT_PUTS(ctx, buf, "BLOCK_MAX");
+    have_flags = 1;
+  }
   if (!have_flags) {
     GRN_TEXT_PUTS(ctx, buf, "NONE");
   }
@@ -494,54 +494,469 @@ exit :
 typedef void (*grn_edge_dispatcher_func)(grn_ctx *ctx, grn_edge *edge);
 typedef void (*grn_handler_func)(grn_ctx *ctx, grn_obj *msg);
 
-static grn_com_queue ctx_new;
+/*
+ * Requests are processed by a pool of worker threads. Each worker has
+ * its own job queue. A job is pushed to workers in round-robin order
+ * and a worker whose queue is empty steals a job from the other
+ * workers' queues. Workers aren't finished when thread_limit is
+ * reduced. They are parked until thread_limit is raised again. So
+ * threads are created only at start up and when thread_limit is
+ * raised.
+ */
+
+#define GROONGA_MAX_N_WORKERS 1024
+
+typedef struct _groonga_worker groonga_worker;
+typedef void (*groonga_worker_process_func)(groonga_worker *worker,
+                                            grn_com_queue_entry *job);
+
+struct _groonga_worker {
+  uint32_t id;
+  grn_thread thread;
+  grn_ctx ctx;
+  grn_com_queue jobs;
+  uint32_t n_queued_jobs;
+  grn_mutex mutex;
+  grn_cond cond;
+  grn_bool idle;
+  grn_bool parked;
+  uint64_t n_processed_jobs;
+  uint64_t busy_time_nsec;
+  grn_timeval start_time;
+};
+
+static struct {
+  grn_mutex mutex;
+  grn_obj *db;
+  groonga_worker_process_func process;
+  groonga_worker *workers[GROONGA_MAX_N_WORKERS];
+  uint32_t n_workers;
+  uint32_t n_running_workers;
+  uint32_t max_n_running_workers;
+  uint32_t n_idle_workers;
+  uint32_t n_queued_jobs;
+  uint32_t next_worker_id;
+  grn_bool started;
+  grn_bool stopping;
+} worker_pool;
+
+static groonga_worker_process_func worker_process = NULL;
 static grn_com_queue ctx_old;
+/* Protects edge states and ctx_old. */
 static grn_mutex q_mutex;
-static grn_cond q_cond;
-static uint32_t n_running_threads = 0;
-static uint32_t n_floating_threads = 0;
-static uint32_t max_n_floating_threads;
+
+static uint32_t
+worker_pool_atomic_get(uint32_t *value)
+{
+  uint32_t current_value;
+  GRN_ATOMIC_ADD_EX(value, 0, current_value);
+  return current_value;
+}
+
+static grn_bool
+worker_pool_is_stopping(void)
+{
+  return worker_pool.stopping || grn_gctx.stat == GRN_CTX_QUIT;
+}
+
+static grn_com_queue_entry *
+worker_pool_take_job(groonga_worker *worker)
+{
+  grn_ctx *ctx = &(worker->ctx);
+  uint32_t i, n_workers;
+  uint32_t n_queued_jobs;
+
+  n_workers = worker_pool_atomic_get(&(worker_pool.n_workers));
+  for (i = 0; i < n_workers; i++) {
+    groonga_worker *victim;
+    grn_com_queue_entry *job;
+
+    victim = worker_pool.workers[(worker->id + i) % n_workers];
+    if (worker_pool_atomic_get(&(victim->n_queued_jobs)) == 0) {
+      continue;
+    }
+    job = grn_com_queue_deque(ctx, &(victim->jobs));
+    if (job) {
+      GRN_ATOMIC_ADD_EX(&(victim->n_queued_jobs), -1, n_queued_jobs);
+      GRN_ATOMIC_ADD_EX(&(worker_pool.n_queued_jobs), -1, n_queued_jobs);
+      return job;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+worker_pool_wake_up_idle_workers(grn_ctx *ctx)
+{
+  uint32_t i, n_workers;
+
+  n_workers = worker_pool_atomic_get(&(worker_pool.n_workers));
+  for (i = 0; i < n_workers; i++) {
+    groonga_worker *worker = worker_pool.workers[i];
+    MUTEX_LOCK_ENSURE(ctx, worker->mutex);
+    if (worker->idle) {
+      worker->idle = GRN_FALSE;
+      COND_SIGNAL(worker->cond);
+    }
+    MUTEX_UNLOCK(worker->mutex);
+  }
+}
+
+/*
+ * It's checked before taking a job. Busy workers always find a job
+ * after they process a job, so checking it only when no job is found
+ * doesn't reduce the number of running workers under load.
+ */
+static grn_bool
+worker_pool_park(groonga_worker *worker)
+{
+  grn_ctx *ctx = &(worker->ctx);
+  grn_bool parked = GRN_FALSE;
+
+  if (worker_pool_atomic_get(&(worker_pool.n_running_workers)) <=
+      worker_pool_atomic_get(&(worker_pool.max_n_running_workers))) {
+    return GRN_FALSE;
+  }
+
+  MUTEX_LOCK_ENSURE(ctx, worker->mutex);
+  MUTEX_LOCK_ENSURE(ctx, worker_pool.mutex);
+  if (worker_pool.n_running_workers > worker_pool.max_n_running_workers) {
+    worker_pool.n_running_workers--;
+    worker->parked = GRN_TRUE;
+    parked = GRN_TRUE;
+  }
+  MUTEX_UNLOCK(worker_pool.mutex);
+  MUTEX_UNLOCK(worker->mutex);
+
+  if (!parked) {
+    return GRN_FALSE;
+  }
+
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread park (%u)", worker->id);
+  if (worker_pool_atomic_get(&(worker->n_queued_jobs)) > 0) {
+    /* Running workers steal jobs in the queue of the parked worker. */
+    worker_pool_wake_up_idle_workers(ctx);
+  }
+
+  MUTEX_LOCK_ENSURE(ctx, worker->mutex);
+  while (worker->parked && !worker_pool_is_stopping()) {
+    COND_WAIT(worker->cond, worker->mutex);
+  }
+  if (!worker->parked) {
+    GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread unpark (%u)", worker->id);
+  }
+  MUTEX_UNLOCK(worker->mutex);
+
+  return GRN_TRUE;
+}
+
+static void
+worker_pool_wait(groonga_worker *worker)
+{
+  uint32_t n_idle_workers;
+
+  MUTEX_LOCK_ENSURE(&(worker->ctx), worker->mutex);
+  if (worker_pool_atomic_get(&(worker->n_queued_jobs)) > 0) {
+    /* Pushed after worker_pool_take_job(). */
+  } else {
+    /* Publish idle state before checking jobs to not miss a wake up. */
+    worker->idle = GRN_TRUE;
+    GRN_ATOMIC_ADD_EX(&(worker_pool.n_idle_workers), 1, n_idle_workers);
+    if (worker_pool_atomic_get(&(worker_pool.n_queued_jobs)) > 0) {
+      worker->idle = GRN_FALSE;
+    }
+    while (worker->idle && !worker_pool_is_stopping()) {
+      COND_WAIT(worker->cond, worker->mutex);
+    }
+    worker->idle = GRN_FALSE;
+    GRN_ATOMIC_ADD_EX(&(worker_pool.n_idle_workers), -1, n_idle_workers);
+  }
+  MUTEX_UNLOCK(worker->mutex);
+}
+
+static grn_thread_func_result CALLBACK
+worker_pool_worker(void *arg)
+{
+  groonga_worker *worker = arg;
+  grn_ctx *ctx = &(worker->ctx);
+
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread start (%u)", worker->id);
+  while (!worker_pool_is_stopping()) {
+    grn_com_queue_entry *job;
+    grn_timeval start_time;
+    grn_timeval end_time;
+
+    if (worker_pool_park(worker)) {
+      continue;
+    }
+
+    job = worker_pool_take_job(worker);
+    if (!job) {
+      worker_pool_wait(worker);
+      continue;
+    }
+
+    grn_timeval_now(ctx, &start_time);
+    worker_pool.process(worker, job);
+    grn_timeval_now(ctx, &end_time);
+    worker->n_processed_jobs++;
+    worker->busy_time_nsec +=
+      (end_time.tv_sec - start_time.tv_sec) * GRN_TIME_NSEC_PER_SEC +
+      (end_time.tv_nsec - start_time.tv_nsec);
+  }
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread end (%u)", worker->id);
+  grn_ctx_fin(ctx);
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+/* Must be called with worker_pool.mutex locked. */
+static grn_bool
+worker_pool_add_worker(grn_ctx *ctx)
+{
+  groonga_worker *worker;
+  uint32_t n_workers;
+
+  if (worker_pool.n_workers == GROONGA_MAX_N_WORKERS) {
+    return GRN_FALSE;
+  }
+
+  worker = malloc(sizeof(groonga_worker));
+  if (!worker) {
+    SERR("malloc");
+    return GRN_FALSE;
+  }
+  worker->id = worker_pool.n_workers;
+  grn_ctx_init(&(worker->ctx), 0);
+  grn_ctx_use(&(worker->ctx), worker_pool.db);
+  GRN_COM_QUEUE_INIT(&(worker->jobs));
+  worker->n_queued_jobs = 0;
+  MUTEX_INIT(worker->mutex);
+  COND_INIT(worker->cond);
+  worker->idle = GRN_FALSE;
+  worker->parked = GRN_FALSE;
+  worker->n_processed_jobs = 0;
+  worker->busy_time_nsec = 0;
+  grn_timeval_now(ctx, &(worker->start_time));
+
+  worker_pool.workers[worker->id] = worker;
+  worker_pool.n_running_workers++;
+  if (THREAD_CREATE(worker->thread, worker_pool_worker, worker)) {
+    worker_pool.n_running_workers--;
+    worker_pool.workers[worker->id] = NULL;
+    COND_FIN(worker->cond);
+    MUTEX_FIN(worker->mutex);
+    grn_ctx_fin(&(worker->ctx));
+    free(worker);
+    SERR("pthread_create");
+    return GRN_FALSE;
+  }
+  GRN_ATOMIC_ADD_EX(&(worker_pool.n_workers), 1, n_workers);
+
+  return GRN_TRUE;
+}
+
+/* Runs workers until the number of running workers reaches the limit. */
+static void
+worker_pool_adjust(grn_ctx *ctx)
+{
+  uint32_t i, n_workers;
+
+  n_workers = worker_pool_atomic_get(&(worker_pool.n_workers));
+  for (i = 0; i < n_workers; i++) {
+    groonga_worker *worker = worker_pool.workers[i];
+    MUTEX_LOCK_ENSURE(ctx, worker->mutex);
+    if (worker->parked) {
+      MUTEX_LOCK_ENSURE(ctx, worker_pool.mutex);
+      if (worker_pool.n_running_workers < worker_pool.max_n_running_workers) {
+        worker_pool.n_running_workers++;
+        worker->parked = GRN_FALSE;
+        COND_SIGNAL(worker->cond);
+      }
+      MUTEX_UNLOCK(worker_pool.mutex);
+    }
+    MUTEX_UNLOCK(worker->mutex);
+  }
+
+  MUTEX_LOCK_ENSURE(ctx, worker_pool.mutex);
+  while (worker_pool.n_running_workers < worker_pool.max_n_running_workers) {
+    if (!worker_pool_add_worker(ctx)) {
+      break;
+    }
+  }
+  MUTEX_UNLOCK(worker_pool.mutex);
+}
+
+static void
+worker_pool_start(grn_ctx *ctx,
+                  grn_obj *db,
+                  groonga_worker_process_func process)
+{
+  worker_pool.db = db;
+  worker_pool.process = process;
+  worker_pool.n_workers = 0;
+  worker_pool.n_running_workers = 0;
+  worker_pool.n_idle_workers = 0;
+  worker_pool.n_queued_jobs = 0;
+  worker_pool.next_worker_id = 0;
+  worker_pool.stopping = GRN_FALSE;
+  worker_pool_adjust(ctx);
+  MUTEX_LOCK_ENSURE(ctx, worker_pool.mutex);
+  worker_pool.started = GRN_TRUE;
+  MUTEX_UNLOCK(worker_pool.mutex);
+}
+
+static void
+worker_pool_stop(grn_ctx *ctx)
+{
+  uint32_t i, n_workers;
+
+  MUTEX_LOCK_ENSURE(ctx, worker_pool.mutex);
+  worker_pool.started = GRN_FALSE;
+  worker_pool.stopping = GRN_TRUE;
+  MUTEX_UNLOCK(worker_pool.mutex);
+
+  n_workers = worker_pool_atomic_get(&(worker_pool.n_workers));
+  for (i = 0; i < n_workers; i++) {
+    groonga_worker *worker = worker_pool.workers[i];
+    MUTEX_LOCK_ENSURE(ctx, worker->mutex);
+    COND_SIGNAL(worker->cond);
+    MUTEX_UNLOCK(worker->mutex);
+  }
+
+  for (i = 0; i < n_workers; i++) {
+    groonga_worker *worker = worker_pool.workers[i];
+    THREAD_JOIN(worker->thread);
+    COND_FIN(worker->cond);
+    MUTEX_FIN(worker->mutex);
+    free(worker);
+    worker_pool.workers[i] = NULL;
+  }
+  worker_pool.n_workers = 0;
+  worker_pool.n_running_workers = 0;
+}
+
+static void
+worker_pool_push_job(grn_ctx *ctx, grn_com_queue_entry *job)
+{
+  uint32_t i, n_workers;
+  uint32_t offset;
+  uint32_t n_queued_jobs;
+  grn_bool woken_up = GRN_FALSE;
+
+  n_workers = worker_pool_atomic_get(&(worker_pool.n_workers));
+  GRN_ATOMIC_ADD_EX(&(worker_pool.next_worker_id), 1, offset);
+  for (i = 0; i < n_workers; i++) {
+    groonga_worker *worker = worker_pool.workers[(offset + i) % n_workers];
+    MUTEX_LOCK_ENSURE(ctx, worker->mutex);
+    if (worker->parked && i + 1 < n_workers) {
+      MUTEX_UNLOCK(worker->mutex);
+      continue;
+    }
+    grn_com_queue_enque(ctx, &(worker->jobs), job);
+    GRN_ATOMIC_ADD_EX(&(worker->n_queued_jobs), 1, n_queued_jobs);
+    GRN_ATOMIC_ADD_EX(&(worker_pool.n_queued_jobs), 1, n_queued_jobs);
+    if (worker->idle) {
+      worker->idle = GRN_FALSE;
+      COND_SIGNAL(worker->cond);
+      woken_up = GRN_TRUE;
+    }
+    MUTEX_UNLOCK(worker->mutex);
+    break;
+  }
+
+  if (!woken_up &&
+      worker_pool_atomic_get(&(worker_pool.n_idle_workers)) > 0) {
+    for (i = 0; i < n_workers; i++) {
+      groonga_worker *worker = worker_pool.workers[(offset + i) % n_workers];
+      MUTEX_LOCK_ENSURE(ctx, worker->mutex);
+      if (worker->idle) {
+        worker->idle = GRN_FALSE;
+        COND_SIGNAL(worker->cond);
+        woken_up = GRN_TRUE;
+      }
+      MUTEX_UNLOCK(worker->mutex);
+      if (woken_up) {
+        break;
+      }
+    }
+  }
+}
 
 static uint32_t
 groonga_get_thread_limit(void *data)
 {
-  return max_n_floating_threads;
+  return worker_pool.max_n_running_workers;
 }
 
 static void
 groonga_set_thread_limit(uint32_t new_limit, void *data)
 {
-  uint32_t i;
-  uint32_t current_n_floating_threads;
+  grn_bool started;
 
-  MUTEX_LOCK_ENSURE(&grn_gctx, q_mutex);
-  current_n_floating_threads = n_floating_threads;
-  max_n_floating_threads = new_limit;
-  MUTEX_UNLOCK(q_mutex);
+  if (new_limit > GROONGA_MAX_N_WORKERS) {
+    new_limit = GROONGA_MAX_N_WORKERS;
+  }
 
-  if (current_n_floating_threads > new_limit) {
-    for (i = 0; i < current_n_floating_threads; i++) {
-      MUTEX_LOCK_ENSURE(&grn_gctx, q_mutex);
-      COND_SIGNAL(q_cond);
-      MUTEX_UNLOCK(q_mutex);
-    }
+  MUTEX_LOCK_ENSURE(&grn_gctx, worker_pool.mutex);
+  worker_pool.max_n_running_workers = new_limit;
+  started = worker_pool.started;
+  MUTEX_UNLOCK(worker_pool.mutex);
+
+  if (!started) {
+    return;
   }
 
+  worker_pool_adjust(&grn_gctx);
+
   while (GRN_TRUE) {
     grn_bool is_reduced;
-    MUTEX_LOCK_ENSURE(&grn_gctx, q_mutex);
-    is_reduced = (n_running_threads <= max_n_floating_threads);
-    if (!is_reduced && n_floating_threads > 0) {
-      COND_SIGNAL(q_cond);
-    }
-    MUTEX_UNLOCK(q_mutex);
-    if (is_reduced) {
+    MUTEX_LOCK_ENSURE(&grn_gctx, worker_pool.mutex);
+    is_reduced =
+      (worker_pool.n_running_workers <= worker_pool.max_n_running_workers);
+    MUTEX_UNLOCK(worker_pool.mutex);
+    if (is_reduced || worker_pool_is_stopping()) {
       break;
     }
+    worker_pool_wake_up_idle_workers(&grn_gctx);
     grn_nanosleep(1000000);
   }
 }
 
+static uint32_t
+groonga_get_worker_statuses(grn_thread_worker_status *statuses,
+                            uint32_t n_statuses,
+                            void *data)
+{
+  uint32_t i, n_workers;
+  grn_timeval now;
+
+  n_workers = worker_pool_atomic_get(&(worker_pool.n_workers));
+  if (!statuses) {
+    return n_workers;
+  }
+
+  if (n_statuses > n_workers) {
+    n_statuses = n_workers;
+  }
+  grn_timeval_now(&grn_gctx, &now);
+  for (i = 0; i < n_statuses; i++) {
+    groonga_worker *worker = worker_pool.workers[i];
+    grn_thread_worker_status *status = &(statuses[i]);
+    status->n_queued_jobs = worker_pool_atomic_get(&(worker->n_queued_jobs));
+    status->n_processed_jobs = worker->n_processed_jobs;
+    status->busy_time =
+      (double)(worker->busy_time_nsec) / GRN_TIME_NSEC_PER_SEC;
+    status->elapsed_time =
+      (double)(now.tv_sec - worker->start_time.tv_sec) +
+      (double)(now.tv_nsec - worker->start_time.tv_nsec) /
+      GRN_TIME_NSEC_PER_SEC;
+    status->parked = worker->parked;
+  }
+
+  return n_statuses;
+}
+
 typedef struct {
   grn_mutex mutex;
   grn_ctx ctx;
@@ -899,6 +1314,7 @@ static void
 run_server_loop(grn_ctx *ctx, grn_com_event *ev)
 {
   request_timer_init();
+  worker_pool_start(ctx, (grn_obj *)(ev->opaque), worker_process);
   while (!grn_com_event_poll(ctx, ev, request_timer_get_poll_timeout()) &&
          grn_gctx.stat != GRN_CTX_QUIT) {
     grn_edge *edge;
@@ -919,12 +1335,7 @@ run_server_loop(grn_ctx *ctx, grn_com_event *ev)
     request_timer_process_timeout();
     /* todo : log stat */
   }
-  for (;;) {
-    MUTEX_LOCK_ENSURE(ctx, q_mutex);
-    if (n_running_threads == n_floating_threads) { break; }
-    MUTEX_UNLOCK(q_mutex);
-    grn_nanosleep(1000000);
-  }
+  worker_pool_stop(ctx);
   {
     grn_edge *edge;
     GRN_HASH_EACH(ctx, grn_edges, id, NULL, NULL, &edge, {
@@ -2369,53 +2780,22 @@ check_rlimit_nofile(grn_ctx *ctx)
 #endif /* WIN32 */
 }
 
-static grn_thread_func_result CALLBACK
-h_worker(void *arg)
+static void
+h_worker_process(groonga_worker *worker, grn_com_queue_entry *job)
 {
   ht_context hc;
-  grn_ctx ctx_, *ctx = &ctx_;
-  grn_ctx_init(ctx, 0);
-  grn_ctx_use(ctx, (grn_obj *)arg);
-  grn_ctx_recv_handler_set(ctx, h_output, &hc);
-  MUTEX_LOCK_ENSURE(ctx, q_mutex);
-  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread start (%d/%d)",
-          n_floating_threads, n_running_threads);
-  while (n_running_threads <= max_n_floating_threads &&
-         grn_gctx.stat != GRN_CTX_QUIT) {
-    grn_obj *msg;
-    if (ctx->rc == GRN_CANCEL) {
-      ctx->rc = GRN_SUCCESS;
-    }
-    n_floating_threads++;
-    while (!(msg = (grn_obj *)grn_com_queue_deque(&grn_gctx, &ctx_new))) {
-      COND_WAIT(q_cond, q_mutex);
-      if (grn_gctx.stat == GRN_CTX_QUIT) {
-        n_floating_threads--;
-        goto exit;
-      }
-      if (n_running_threads > max_n_floating_threads) {
-        n_floating_threads--;
-        goto exit;
-      }
-    }
-    n_floating_threads--;
-    MUTEX_UNLOCK(q_mutex);
-    hc.msg = (grn_msg *)msg;
-    hc.in_body = GRN_FALSE;
-    hc.is_chunked = GRN_FALSE;
-    do_htreq(ctx, &hc);
-    MUTEX_LOCK_ENSURE(ctx, q_mutex);
+  grn_ctx *ctx = &(worker->ctx);
+  if (ctx->rc == GRN_CANCEL) {
+    ctx->rc = GRN_SUCCESS;
   }
-exit :
-  n_running_threads--;
-  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread end (%d/%d)",
-          n_floating_threads, n_running_threads);
+  grn_ctx_recv_handler_set(ctx, h_output, &hc);
+  hc.msg = (grn_msg *)job;
+  hc.in_body = GRN_FALSE;
+  hc.is_chunked = GRN_FALSE;
+  do_htreq(ctx, &hc);
   if (grn_gctx.stat == GRN_CTX_QUIT) {
     break_accept_event_loop(ctx);
   }
-  grn_ctx_fin(ctx);
-  MUTEX_UNLOCK(q_mutex);
-  return GRN_THREAD_FUNC_RETURN_VALUE;
 }
 
 static void
@@ -2427,22 +2807,10 @@ h_handler(grn_ctx *ctx, grn_obj *msg)
     grn_msg_close(ctx, msg);
   } else {
     grn_sock fd = com->fd;
-    void *arg = com->ev->opaque;
     /* if not keep alive connection */
     grn_com_event_del(ctx, com->ev, fd);
     ((grn_msg *)msg)->u.fd = fd;
-    MUTEX_LOCK_ENSURE(ctx, q_mutex);
-    grn_com_queue_enque(ctx, &ctx_new, (grn_com_queue_entry *)msg);
-    if (n_floating_threads == 0 && n_running_threads < max_n_floating_threads) {
-      grn_thread thread;
-      n_running_threads++;
-      if (THREAD_CREATE(thread, h_worker, arg)) {
-        n_running_threads--;
-        SERR("pthread_create");
-      }
-    }
-    COND_SIGNAL(q_cond);
-    MUTEX_UNLOCK(q_mutex);
+    worker_pool_push_job(ctx, (grn_com_queue_entry *)msg);
   }
 }
 
@@ -2452,8 +2820,8 @@ h_server(char *path)
   int exit_code = EXIT_FAILURE;
   grn_ctx ctx_, *ctx = &ctx_;
   grn_ctx_init(ctx, 0);
-  GRN_COM_QUEUE_INIT(&ctx_new);
   GRN_COM_QUEUE_INIT(&ctx_old);
+  worker_process = h_worker_process;
   check_rlimit_nofile(ctx);
   GRN_TEXT_INIT(&http_response_server_line, 0);
   grn_text_printf(ctx,
@@ -2467,78 +2835,57 @@ h_server(char *path)
   return exit_code;
 }
 
-static grn_thread_func_result CALLBACK
-g_worker(void *arg)
+static void
+g_worker_process(groonga_worker *worker, grn_com_queue_entry *job)
 {
-  MUTEX_LOCK_ENSURE(NULL, q_mutex);
-  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread start (%d/%d)",
-          n_floating_threads, n_running_threads);
-  while (n_running_threads <= max_n_floating_threads &&
-         grn_gctx.stat != GRN_CTX_QUIT) {
-    grn_ctx *ctx;
-    grn_edge *edge;
-    n_floating_threads++;
-    while (!(edge = (grn_edge *)grn_com_queue_deque(&grn_gctx, &ctx_new))) {
-      COND_WAIT(q_cond, q_mutex);
-      if (grn_gctx.stat == GRN_CTX_QUIT) {
-        n_floating_threads--;
-        goto exit;
-      }
-      if (n_running_threads > max_n_floating_threads) {
-        n_floating_threads--;
-        goto exit;
-      }
-    }
-    ctx = &edge->ctx;
-    n_floating_threads--;
-    if (edge->stat == EDGE_DOING) { continue; }
-    if (edge->stat == EDGE_WAIT) {
-      edge->stat = EDGE_DOING;
-      while (!GRN_COM_QUEUE_EMPTYP(&edge->recv_new)) {
-        grn_obj *msg;
-        MUTEX_UNLOCK(q_mutex);
-        /* if (edge->flags == GRN_EDGE_WORKER) */
-        while (ctx->stat != GRN_CTX_QUIT &&
-               (edge->msg = (grn_msg *)grn_com_queue_deque(ctx, &edge->recv_new))) {
-          grn_com_header *header = &edge->msg->header;
-          msg = (grn_obj *)edge->msg;
-          switch (header->proto) {
-          case GRN_COM_PROTO_MBREQ :
-            do_mbreq(ctx, edge);
-            break;
-          case GRN_COM_PROTO_GQTP :
-            grn_ctx_send(ctx, GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), header->flags);
-            ERRCLR(ctx);
-            if (ctx->rc == GRN_CANCEL) {
-              ctx->rc = GRN_SUCCESS;
-            }
-            break;
-          default :
-            ctx->stat = GRN_CTX_QUIT;
-            break;
+  grn_edge *edge = (grn_edge *)job;
+  grn_ctx *ctx = &edge->ctx;
+  MUTEX_LOCK_ENSURE(ctx, q_mutex);
+  if (edge->stat == EDGE_DOING) {
+    MUTEX_UNLOCK(q_mutex);
+    return;
+  }
+  if (edge->stat == EDGE_WAIT) {
+    edge->stat = EDGE_DOING;
+    while (!GRN_COM_QUEUE_EMPTYP(&edge->recv_new)) {
+      grn_obj *msg;
+      MUTEX_UNLOCK(q_mutex);
+      /* if (edge->flags == GRN_EDGE_WORKER) */
+      while (ctx->stat != GRN_CTX_QUIT &&
+             (edge->msg = (grn_msg *)grn_com_queue_deque(ctx, &edge->recv_new))) {
+        grn_com_header *header = &edge->msg->header;
+        msg = (grn_obj *)edge->msg;
+        switch (header->proto) {
+        case GRN_COM_PROTO_MBREQ :
+          do_mbreq(ctx, edge);
+          break;
+        case GRN_COM_PROTO_GQTP :
+          grn_ctx_send(ctx, GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), header->flags);
+          ERRCLR(ctx);
+          if (ctx->rc == GRN_CANCEL) {
+            ctx->rc = GRN_SUCCESS;
           }
-          grn_msg_close(ctx, msg);
-        }
-        while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
-          grn_msg_close(ctx, msg);
+          break;
+        default :
+          ctx->stat = GRN_CTX_QUIT;
+          break;
         }
-        MUTEX_LOCK_ENSURE(ctx, q_mutex);
-        if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) { break; }
+        grn_msg_close(ctx, msg);
       }
+      while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
+        grn_msg_close(ctx, msg);
+      }
+      MUTEX_LOCK_ENSURE(ctx, q_mutex);
+      if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) { break; }
     }
-    if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) {
-      grn_com_queue_enque(&grn_gctx, &ctx_old, (grn_com_queue_entry *)edge);
-      edge->stat = EDGE_ABORT;
-    } else {
-      edge->stat = EDGE_IDLE;
-    }
-  };
-exit :
-  n_running_threads--;
-  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread end (%d/%d)",
-          n_floating_threads, n_running_threads);
+  }
+  if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) {
+    grn_com_queue_enque(&grn_gctx, &ctx_old, (grn_com_queue_entry *)edge);
+    edge->stat = EDGE_ABORT;
+  } else {
+    edge->stat = EDGE_IDLE;
+  }
   MUTEX_UNLOCK(q_mutex);
-  return GRN_THREAD_FUNC_RETURN_VALUE;
 }
 
 static void
@@ -2546,17 +2893,8 @@ g_dispatcher(grn_ctx *ctx, grn_edge *edge)
 {
   MUTEX_LOCK_ENSURE(ctx, q_mutex);
   if (edge->stat == EDGE_IDLE) {
-    grn_com_queue_enque(ctx, &ctx_new, (grn_com_queue_entry *)edge);
     edge->stat = EDGE_WAIT;
-    if (n_floating_threads == 0 && n_running_threads < max_n_floating_threads) {
-      grn_thread thread;
-      n_running_threads++;
-      if (THREAD_CREATE(thread, g_worker, NULL)) {
-        n_running_threads--;
-        SERR("pthread_create");
-      }
-    }
-    COND_SIGNAL(q_cond);
+    worker_pool_push_job(ctx, (grn_com_queue_entry *)edge);
   }
   MUTEX_UNLOCK(q_mutex);
 }
@@ -2631,8 +2969,8 @@ g_server(char *path)
   int exit_code = EXIT_FAILURE;
   grn_ctx ctx_, *ctx = &ctx_;
   grn_ctx_init(ctx, 0);
-  GRN_COM_QUEUE_INIT(&ctx_new);
   GRN_COM_QUEUE_INIT(&ctx_old);
+  worker_process = g_worker_process;
   check_rlimit_nofile(ctx);
   exit_code = start_service(ctx, path, g_dispatcher, g_handler);
   grn_ctx_fin(ctx);
@@ -3041,6 +3379,9 @@ show_version(void)
 #ifdef GRN_WITH_LZ4
   printf(",lz4");
 #endif
+#ifdef GRN_WITH_ZSTD
+  printf(",zstd");
+#endif
 #ifdef USE_KQUEUE
   printf(",kqueue");
 #endif
@@ -3493,17 +3834,18 @@ main(int argc, char **argv)
               max_n_threads_arg);
       return EXIT_FAILURE;
     }
-    max_n_floating_threads = value;
+    worker_pool.max_n_running_workers = value;
   } else {
     if (flags & FLAG_MODE_ALONE) {
-      max_n_floating_threads = 1;
+      worker_pool.max_n_running_workers = 1;
     } else {
-      max_n_floating_threads = default_max_n_threads;
+      worker_pool.max_n_running_workers = default_max_n_threads;
     }
   }
 
   grn_thread_set_get_limit_func(groonga_get_thread_limit, NULL);
   grn_thread_set_set_limit_func(groonga_set_thread_limit, NULL);
+  grn_thread_set_get_worker_statuses_func(groonga_get_worker_statuses, NULL);
 
   if (output_fd_arg) {
     const char * const end = output_fd_arg + strlen(output_fd_arg);
@@ -3652,7 +3994,7 @@ main(int argc, char **argv)
   }
 
   MUTEX_INIT(q_mutex);
-  COND_INIT(q_cond);
+  MUTEX_INIT(worker_pool.mutex);
 
   if (input_path) {
     input_reader = grn_file_reader_open(&grn_gctx, input_path);
@@ -3717,7 +4059,7 @@ main(int argc, char **argv)
     exit_code = do_alone(argc - i, argv + i);
   }
 
-  COND_FIN(q_cond);
+  MUTEX_FIN(worker_pool.mutex);
   MUTEX_FIN(q_mutex);
 
   if (input_reader) {
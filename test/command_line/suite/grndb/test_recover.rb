@@ -51,6 +51,18 @@ object corrupt: <[db][recover] column may be broken: <Users.age>: please truncat
     assert_equal("", result.error_output)
   end
 
+  def test_waiters_of_killed_processes
+    groonga("table_create", "Users", "TABLE_HASH_KEY", "ShortText")
+    _id, _name, path, *_ = JSON.parse(groonga("table_list").output)[1][1]
+    data = File.binread(path)
+    # The lock word that two killed waiters left.
+    data[44, 4] = [4].pack("L")
+    File.binwrite(path, data)
+    result = grndb("recover")
+    assert_equal(["", [0]],
+                 [result.error_output, File.binread(path)[44, 4].unpack("L")])
+  end
+
   def test_empty_file
     groonga("table_create", "Users", "TABLE_HASH_KEY", "ShortText")
     _id, _name, path, *_ = JSON.parse(groonga("table_list").output)[1][1]
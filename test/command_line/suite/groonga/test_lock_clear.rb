@@ -0,0 +1,12 @@
+class TestGroongaLockClear < GroongaTestCase
+  def test_waiters_of_killed_processes
+    groonga("table_create", "Users", "TABLE_HASH_KEY", "ShortText")
+    _id, _name, path, *_ = JSON.parse(groonga("table_list").output)[1][1]
+    data = File.binread(path)
+    # The lock word that a killed locker and two killed waiters left.
+    data[44, 4] = [1 + 4].pack("L")
+    File.binwrite(path, data)
+    groonga("lock_clear", "Users")
+    assert_equal([0], File.binread(path)[44, 4].unpack("L"))
+  end
+end
@@ -0,0 +1,104 @@
+require "net/http"
+require "socket"
+require "timeout"
+
+class TestGroongaThreadLimit < GroongaTestCase
+  def setup
+    groonga("table_create", "Entries", "TABLE_NO_KEY")
+    groonga("column_create", "Entries", "value", "COLUMN_SCALAR", "UInt32")
+    @port = find_available_port
+    @pid = spawn("groonga",
+                 "--log-path", @log_path.to_s,
+                 "--query-log-path", @query_log_path.to_s,
+                 "--protocol", "http",
+                 "--port", @port.to_s,
+                 "--max-threads", "4",
+                 "-s",
+                 @database_path.to_s,
+                 :out => @output_log_path.to_s,
+                 :err => @error_output_log_path.to_s)
+    wait_server
+    values = 20000.times.collect {|i| {"value" => i}}
+    http_post("load", JSON.generate(values), "table" => "Entries")
+  end
+
+  def teardown
+    http_get("shutdown") rescue nil
+    Process.waitpid(@pid)
+  end
+
+  def test_reduce_under_load
+    running = true
+    clients = 32.times.collect do
+      Thread.new do
+        while running
+          http_get("select",
+                   "table" => "Entries",
+                   "filter" => "value % 3 == 0",
+                   "sortby" => "-value",
+                   "limit" => "10",
+                   "cache" => "no")
+        end
+      end
+    end
+    begin
+      sleep(0.5)
+      response = Timeout.timeout(10) do
+        http_get("thread_limit", "max" => "1")
+      end
+      assert_equal(4, JSON.parse(response)[1])
+      workers = JSON.parse(http_get("status"))[1]["workers"]
+      n_running_workers = workers.count {|worker| not worker["parked"]}
+      assert_equal([1, 4],
+                   [n_running_workers, workers.size])
+    ensure
+      running = false
+      clients.each(&:join)
+    end
+  end
+
+  def test_raise_after_reduce
+    http_get("thread_limit", "max" => "1")
+    response = http_get("thread_limit", "max" => "3")
+    assert_equal(1, JSON.parse(response)[1])
+    workers = JSON.parse(http_get("status"))[1]["workers"]
+    n_running_workers = workers.count {|worker| not worker["parked"]}
+    assert_equal([3, 4],
+                 [n_running_workers, workers.size])
+  end
+
+  private
+  def find_available_port
+    server = TCPServer.new("127.0.0.1", 0)
+    port = server.addr[1]
+    server.close
+    port
+  end
+
+  def wait_server
+    Timeout.timeout(10) do
+      begin
+        TCPSocket.new("127.0.0.1", @port).close
+      rescue SystemCallError
+        sleep(0.1)
+        retry
+      end
+    end
+  end
+
+  def command_uri(command, parameters)
+    uri = URI("http://127.0.0.1:#{@port}/d/#{command}")
+    uri.query = URI.encode_www_form(parameters)
+    uri
+  end
+
+  def http_get(command, parameters={})
+    Net::HTTP.get(command_uri(command, parameters))
+  end
+
+  def http_post(command, body, parameters={})
+    Net::HTTP.post(command_uri(command, parameters),
+                   body,
+                   "Content-Type" => "application/json").body
+  end
+end